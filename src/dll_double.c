@@ -12,6 +12,7 @@ warranty is expressed for this program.
 
 #include <stdlib.h>
 #include "dll_double.h"
+#include "spade_features.h"
 
 /*! \file dll_double.c
  * \brief 
@@ -27,7 +28,7 @@ warranty is expressed for this program.
 */
 
 /// free list of dll_doubles
-dll_double *free_dlink_list= NULL;
+SPADE_THREAD_LOCAL dll_double *free_dlink_list= NULL;
 
 /* creation and recycling routines for dll_double's */
 
@@ -52,5 +53,14 @@ void free_dll_double_list(dll_double *start) {
     free_dlink_list= start;
 }
 
+/* return the links on this thread's free list to the system */
+void free_dll_double_freelist(void) {
+    dll_double *next;
+    for (; free_dlink_list != NULL; free_dlink_list= next) {
+        next= free_dlink_list->next;
+        free(free_dlink_list);
+    }
+}
+
 /*@}*/
 /* $Id: dll_double.c,v 1.5 2003/01/14 17:45:31 jim Exp $ */
\ No newline at end of file
@@ -32,6 +32,7 @@ typedef struct _dll_double {
 
 dll_double *new_dll_double(double val);
 void free_dll_double_list(dll_double *start);
+void free_dll_double_freelist(void);
 
 
 #endif  /* ! DLL_DOUBLE_H */
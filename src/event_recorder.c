@@ -37,20 +37,35 @@ warranty is expressed for this program.
 
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 
 static evfile *new_evfile(table_mgr *mgr,int feat_depth,feature_list *calc_feats);
 static table_mgr *new_table_mgr(feature_list *feats, const char **featurenames, event_condition_set conds, int scale_freq, double scale_factor, double prune_threshold, time_t curtime);
 static int table_mgr_recover(statefile_ref *ref, table_mgr **mgr);
 static int table_mgr_checkpoint(table_mgr *mgr, statefile_ref *ref);
 static int table_mgr_is_compatable(table_mgr *mgr, feature_list *feats, const char **featurenames, event_condition_set conds, int scale_freq, double scale_factor, double prune_threshold);
-static void table_mgr_new_time(table_mgr *mgr, time_t time);
+static void table_mgr_new_time(table_mgr *mgr, time_t time, double prune_boost);
+static void table_mgr_freeze(table_mgr *mgr, time_t time);
+static void table_mgr_drop_frozen(table_mgr *mgr);
+static double table_mgr_prune_threshold(table_mgr *mgr, double prune_boost);
+static void event_recorder_check_memory(event_recorder *self);
+static recorder_dispatch *recorder_dispatch_for(event_recorder *self, event_condition_set conds);
+static void forget_recorder_dispatch(event_recorder *self);
+static void table_mgr_new_event(table_mgr *mgr, spade_event *event);
+static void table_mgr_set_feature_domains(table_mgr *mgr, valtype feat_maxval[]);
 static void free_table_mgr(table_mgr *mgr);
+static void free_table_mgr_list(table_mgr *mgr);
 static void table_mgr_write_stats(table_mgr *mgr, FILE *file, u8 stats_to_print,condition_printer_t condprinter);
 static void table_mgr_print_config_details(table_mgr *mgr, FILE *f, char *indent);
 static void file_print_feature_list(feature_list *feats, FILE *f, const char **featurenames);
 
 #define feats_to_calc_with(evf) ( (evf->calc_feats.num > 0) ? (&(evf->calc_feats)) : (&(evf->mgr->feats)) )
 
+/// the table that queries about the events of evf are answered from
+#define query_table(evf) ( ((evf)->mgr->model != NULL) ? (evf)->mgr->model : &(evf)->mgr->table )
+/// the frozen copy an event file's queries are answered from, if not NULL
+#define query_frozen(evf) ( ((evf)->mgr->model != NULL) ? (evf)->mgr->frozen_model : (evf)->mgr->frozen )
+
 #define map_event_to_val_arr(featmap,size,event,val) { \
     int featidx; \
     for (featidx= 0; featidx < size; featidx++) { \
@@ -65,9 +80,22 @@ event_recorder *new_event_recorder() {
 }
 
 void init_event_recorder(event_recorder *self) {
+    int i;
     self->tables= NULL;
     self->files= NULL;
     self->curtime= (time_t)0;
+    for (i=0; i < MAX_NUM_FEATURES; i++) {
+        self->feat_maxval[i]= MAX_U32;
+    }
+    self->mem_budget= 0;
+    self->prune_boost= 1.0;
+    self->pressure_pruned= 0;
+    self->shed_count= 0;
+    for (i=0; i < RECORDER_DISPATCH_SLOTS; i++) {
+        self->dispatch[i].num= -1;
+        self->dispatch[i].size= 0;
+        self->dispatch[i].mgrs= NULL;
+    }
 }
 
 int event_recorder_recover(event_recorder **self,statefile_ref *ref) {
@@ -82,13 +110,51 @@ int event_recorder_merge_recover(event_recorder *self,statefile_ref *ref) {
     if (!spade_state_recover_u32(ref,&count)) return 0;
     for (i= 0; i < count; i++) {
         if (!table_mgr_recover(ref,&mgr)) return 0;
+        table_mgr_set_feature_domains(mgr,self->feat_maxval);
         /* add manager into list by prepending*/
         mgr->next= self->tables;
         self->tables= mgr;
     }
+    forget_recorder_dispatch(self);
     return 1;
 }
 
+/* bring the recorder, as recovered from a checkpoint (and any delta
+   checkpoints since), up to date with the delta checkpoint in ref, which
+   follows on from the last of those.  The tables in ref replace the ones we
+   have, taking over their arenas where they are the same table.  On failure,
+   we are left with no tables */
+int event_recorder_recover_delta(event_recorder *self,statefile_ref *ref) {
+    table_mgr *old= self->tables,*mgr;
+    spade_mem_arena **arenas;
+    int i,n,res;
+    
+    for (n= 0,mgr= old; mgr != NULL; mgr=mgr->next) n++;
+    arenas= (spade_mem_arena **)malloc(sizeof(spade_mem_arena *)*(n+1));
+    res= (arenas != NULL);
+    self->tables= NULL;
+    if (res) {
+        for (i= 0,mgr= old; mgr != NULL; mgr=mgr->next,i++) arenas[i]= mgr->table.arena;
+        ref->prior_arenas= arenas;
+        ref->num_prior_arenas= n;
+        res= event_recorder_merge_recover(self,ref);
+        ref->prior_arenas= NULL;
+        ref->num_prior_arenas= 0;
+        /* the arenas that were taken over belong to the new tables now */
+        for (i= 0,mgr= old; mgr != NULL; mgr=mgr->next,i++) {
+            if (arenas[i] == NULL) mgr->table.arena= NULL;
+        }
+        free(arenas);
+    }
+    free_table_mgr_list(old);
+    if (!res) {
+        free_table_mgr_list(self->tables);
+        self->tables= NULL;
+    }
+    forget_recorder_dispatch(self);
+    return res;
+}
+
 int event_recorder_checkpoint(event_recorder *self,statefile_ref *ref) {
     table_mgr *mgr;
     u32 count= 0;
@@ -126,9 +192,11 @@ evfile_ref event_recorder_new_event_file(event_recorder *self,feature_list *feat
         /* NOTE: we could go through tables again looking for compatable shared leading features to save on a table and save double-recording of leading features, but that seeking code is a little hairy and it would require recording "skip" information when getting an event */
         mgr= new_table_mgr(feats,featurenames,conds,scale_freq,scale_factor,prune_threshold,self->curtime);
         if (mgr == NULL) return NULL;
+        table_mgr_set_feature_domains(mgr,self->feat_maxval);
         /* add manager into list by prepending*/
         mgr->next= self->tables;
         self->tables= mgr;
+        forget_recorder_dispatch(self);
     }
     mgr->use_count++;
         
@@ -178,8 +246,39 @@ void event_recorder_new_time(event_recorder *self, time_t time) {
     self->curtime= time;
     /* check for scaling */
     for (mgr= self->tables; mgr != NULL; mgr=mgr->next) {
-        if (mgr->use_count) table_mgr_new_time(mgr,time);
+        if (mgr->use_count) table_mgr_new_time(mgr,time,self->prune_boost);
+    }
+    if (self->mem_budget > 0) event_recorder_check_memory(self);
+}
+
+/* see how close the tables are to the memory budget and prune them harder or ease off as needed */
+static void event_recorder_check_memory(event_recorder *self) {
+    table_mgr *mgr;
+    int passing= 0;
+    unsigned long used= event_recorder_mem_used(self);
+    
+    if (used < MEM_HIGH_WATER*self->mem_budget) {
+        self->pressure_pruned= 0;
+        if (used < MEM_LOW_WATER*self->mem_budget && self->prune_boost > 1.0) {
+            self->prune_boost*= MEM_BOOST_RELAX;
+            if (self->prune_boost < 1.0) self->prune_boost= 1.0;
+        }
+        return;
+    }
+    
+    /* short on memory; hurry along any pruning under way */
+    for (mgr= self->tables; mgr != NULL; mgr=mgr->next) {
+        if (mgr->use_count && spade_prob_table_pruning(&mgr->prune)) {
+            if (!spade_prob_table_prune_step(&mgr->table,&mgr->prune,MEM_PRESSURE_STEP)) passing= 1;
+        }
+    }
+    if (passing) return;
+    /* prune all the tables at raised thresholds, raising them further if that has already been done without enough effect */
+    if (self->pressure_pruned || self->prune_boost <= 1.0) self->prune_boost*= 2;
+    for (mgr= self->tables; mgr != NULL; mgr=mgr->next) {
+        if (mgr->use_count) spade_prob_table_start_prune(&mgr->table,&mgr->prune,table_mgr_prune_threshold(mgr,self->prune_boost));
     }
+    self->pressure_pruned= 1;
 }
 
 event_condition_set event_recorder_needed_conds(event_recorder *self) {
@@ -193,20 +292,82 @@ event_condition_set event_recorder_needed_conds(event_recorder *self) {
 
 int event_recorder_new_event(event_recorder *self, spade_event *event, event_condition_set matching_conds) {
     table_mgr *mgr;
-    int updates= 0;
+    recorder_dispatch *d;
+    int updates= 0,i;
+    if (self->mem_budget > 0 && event_recorder_mem_used(self) >= self->mem_budget) {
+        /* no room; let pruning catch up */
+        self->shed_count++;
+        return 0;
+    }
+    d= recorder_dispatch_for(self,matching_conds);
+    if (d != NULL) {
+        for (i= 0; i < d->num; i++) {
+            table_mgr_new_event(d->mgrs[i],event);
+        }
+        return d->num;
+    }
+    /* no memory to remember the matching tables; check them all */
     for (mgr= self->tables; mgr != NULL; mgr=mgr->next) {
         if (ALL_CONDS_MET(matching_conds,mgr->conds)) { /* all of mgr's conditions are met by event */
-            u32 val[MAX_NUM_FEATURES];
-            feature_list *l= &mgr->feats;
-            map_event_to_val_arr(l->feat,l->num,event,val);
-            increment_Njoint_count(&mgr->table,l->num,l->feat,val,0);
-            mgr->store_count++;
+            table_mgr_new_event(mgr,event);
             updates++;
         }
     }
     return updates;
 }
 
+/* return the dispatch slot listing the table managers whose conditions are
+   all met by conds, filling it in if conds is not the condition set it is
+   for; NULL is returned if memory runs out */
+static recorder_dispatch *recorder_dispatch_for(event_recorder *self,event_condition_set conds) {
+    recorder_dispatch *d= &self->dispatch[CONDS_HASH(conds) & (RECORDER_DISPATCH_SLOTS-1)];
+    table_mgr *mgr;
+    int count= 0;
+    
+    if (d->num >= 0 && d->conds == conds) return d;
+    
+    for (mgr= self->tables; mgr != NULL; mgr=mgr->next) count++;
+    if (count > d->size) {
+        table_mgr **mgrs= (table_mgr **)realloc(d->mgrs,sizeof(table_mgr *)*count);
+        if (mgrs == NULL) return NULL;
+        d->mgrs= mgrs;
+        d->size= count;
+    }
+    d->conds= conds;
+    d->num= 0;
+    for (mgr= self->tables; mgr != NULL; mgr=mgr->next) {
+        if (ALL_CONDS_MET(conds,mgr->conds)) d->mgrs[d->num++]= mgr;
+    }
+    return d;
+}
+
+/* forget which table managers go with which condition sets; this is called
+   whenever the list of table managers changes */
+static void forget_recorder_dispatch(event_recorder *self) {
+    int i;
+    for (i=0; i < RECORDER_DISPATCH_SLOTS; i++) {
+        self->dispatch[i].num= -1;
+    }
+}
+
+/* record event in the table of mgr */
+static void table_mgr_new_event(table_mgr *mgr,spade_event *event) {
+    u32 val[MAX_NUM_FEATURES];
+    feature_list *l= &mgr->feats;
+    map_event_to_val_arr(l->feat,l->num,event,val);
+    increment_Njoint_count(&mgr->table,l->num,l->feat,val,0);
+    mgr->store_count++;
+}
+
+/* note that the tables are as they are in a checkpoint just taken; a delta
+   checkpoint after this has only what changes from here on */
+void event_recorder_clear_dirty(event_recorder *self) {
+    table_mgr *mgr;
+    for (mgr= self->tables; mgr != NULL; mgr=mgr->next) {
+        spade_prob_table_clear_dirty(&mgr->table);
+    }
+}
+
 void event_recorder_prune_unused(event_recorder *self) {
     table_mgr *mgr,*prev=NULL;
     for (mgr= self->tables; mgr != NULL; mgr=mgr->next) {
@@ -220,42 +381,218 @@ void event_recorder_prune_unused(event_recorder *self) {
             prev= mgr;
         }
     }
+    forget_recorder_dispatch(self);
+}
+
+/* have each table of the n recorders answer queries from a model table
+   that adds up the counts of that table in all of them, replacing the model
+   from the last call.  The model is shared, so the recorders must have been
+   set up the same way, with corresponding lists of table managers, and
+   must not be in use (in other threads) during the call; they learn into
+   their own tables as before, which are only read here.  Where the tables
+   are to be frozen (see event_recorder_set_freeze_freq()), each model is
+   frozen here, once, and the frozen copy shared along with it.  Returns 0 if the
+   models could not be made (out of memory, or the tables do not
+   correspond, or there are none), in which case the recorders go back to
+   their own tables */
+int event_recorder_share_model(event_recorder *recs[],int n) {
+    table_mgr **mgrs;
+    spade_prob_table *model;
+    spade_frozen_table *frozen;
+    int i,ok= 1,freeze;
+
+    if (n < 1) return 0;
+    mgrs= (table_mgr **)malloc(n*sizeof(table_mgr *));
+    if (mgrs == NULL) {
+        event_recorder_drop_model(recs,n);
+        return 0;
+    }
+    for (i= 0; i < n; i++) mgrs[i]= recs[i]->tables;
+    while (ok && mgrs[0] != NULL) {
+        for (i= 1; i < n && ok; i++) {
+            if (mgrs[i] == NULL || mgrs[i]->conds != mgrs[0]->conds || mgrs[i]->feats.num != mgrs[0]->feats.num
+                    || memcmp(mgrs[i]->feats.feat,mgrs[0]->feats.feat,mgrs[0]->feats.num*sizeof(features))) {
+                ok= 0;
+            }
+        }
+        if (!ok) break;
+        model= new_spade_prob_table_like(&mgrs[0]->table);
+        if (model == NULL) {
+            ok= 0;
+            break;
+        }
+        for (i= 0; i < n && ok; i++) {
+            ok= spade_prob_table_merge(model,&mgrs[i]->table,1.0);
+        }
+        if (!ok) {
+            free_spade_prob_table(model);
+            break;
+        }
+        /* the model does not change until it is replaced, so it only needs freezing the once */
+        for (i= 0,freeze= 0; i < n; i++) freeze|= (mgrs[i]->freeze_freq > 0);
+        frozen= freeze ? spade_prob_table_freeze(model) : NULL; /* if this fails, the model is used as is */
+        if (mgrs[0]->model != NULL) free_spade_prob_table(mgrs[0]->model);
+        if (mgrs[0]->frozen_model != NULL) free_spade_frozen_table(mgrs[0]->frozen_model);
+        for (i= 0; i < n; i++) {
+            mgrs[i]->model= model;
+            mgrs[i]->frozen_model= frozen;
+            table_mgr_drop_frozen(mgrs[i]); /* a copy of the table would only go stale now */
+            mgrs[i]= mgrs[i]->next;
+        }
+    }
+    for (i= 1; i < n && ok; i++) {
+        if (mgrs[i] != NULL) ok= 0;
+    }
+    free(mgrs);
+    if (!ok) event_recorder_drop_model(recs,n);
+    return ok;
+}
+
+/* have the n recorders, which were given a shared model with
+   event_recorder_share_model(), answer queries from their own tables again,
+   freeing the model */
+void event_recorder_drop_model(event_recorder *recs[],int n) {
+    table_mgr *mgr,*other;
+    int i;
+    for (mgr= recs[0]->tables; mgr != NULL; mgr=mgr->next) {
+        if (mgr->model != NULL) free_spade_prob_table(mgr->model);
+        if (mgr->frozen_model != NULL) free_spade_frozen_table(mgr->frozen_model);
+    }
+    for (i= 0; i < n; i++) {
+        for (other= recs[i]->tables; other != NULL; other=other->next) {
+            other->model= NULL;
+            other->frozen_model= NULL;
+        }
+    }
 }
 
 double event_recorder_get_prob(event_recorder *self,evfile_ref eventfile,spade_event *event,int one_more) {
     u32 val[MAX_NUM_FEATURES];
     feature_list *l=  &eventfile->mgr->feats;
+    spade_frozen_table *frozen= query_frozen(eventfile);
     /* calculate the joint probability to the depth indicated in the evfile */
     map_event_to_val_arr(feats_to_calc_with(eventfile)->feat,eventfile->feat_depth,event,val);
+    if (frozen != NULL) return one_more ?
+        frozen_prob_Njoint_Ncond_plus_one(frozen,eventfile->feat_depth,l->feat,val,0) :
+        frozen_prob_Njoint_Ncond(frozen,eventfile->feat_depth,l->feat,val,0);
     return one_more ?
-        prob_Njoint_Ncond_plus_one(&eventfile->mgr->table,eventfile->feat_depth,l->feat,val,0) :
-        prob_Njoint_Ncond(&eventfile->mgr->table,eventfile->feat_depth,l->feat,val,0);
+        prob_Njoint_Ncond_plus_one(query_table(eventfile),eventfile->feat_depth,l->feat,val,0) :
+        prob_Njoint_Ncond(query_table(eventfile),eventfile->feat_depth,l->feat,val,0);
 }
 
 double event_recorder_get_condprob(event_recorder *self,evfile_ref eventfile,spade_event *event,int condcutoff,int one_more) {
     u32 val[MAX_NUM_FEATURES];
     feature_list *l= &eventfile->mgr->feats;
+    spade_frozen_table *frozen= query_frozen(eventfile);
     if (condcutoff < 0) condcutoff+= eventfile->feat_depth; /* condition cutoff specified from end */
     /* calculate the joint probability to the depth indicated in the evfile and conditioned to the indicated level */
     map_event_to_val_arr(feats_to_calc_with(eventfile)->feat,eventfile->feat_depth,event,val);
+    if (frozen != NULL) return one_more ?
+        frozen_prob_Njoint_Ncond_plus_one(frozen,eventfile->feat_depth,l->feat,val,condcutoff) :
+        frozen_prob_Njoint_Ncond(frozen,eventfile->feat_depth,l->feat,val,condcutoff);
     return one_more ?
-        prob_Njoint_Ncond_plus_one(&eventfile->mgr->table,eventfile->feat_depth,l->feat,val,condcutoff) :
-        prob_Njoint_Ncond(&eventfile->mgr->table,eventfile->feat_depth,l->feat,val,condcutoff);
+        prob_Njoint_Ncond_plus_one(query_table(eventfile),eventfile->feat_depth,l->feat,val,condcutoff) :
+        prob_Njoint_Ncond(query_table(eventfile),eventfile->feat_depth,l->feat,val,condcutoff);
 }
 
 double event_recorder_get_count(event_recorder *self,evfile_ref eventfile,spade_event *event,int featdepth) {
     u32 val[MAX_NUM_FEATURES];
     feature_list *l=  &eventfile->mgr->feats;
+    spade_frozen_table *frozen= query_frozen(eventfile);
     /* calculate the joint probability to the depth indicated in the evfile and conditioned to the indicated level */
     map_event_to_val_arr(feats_to_calc_with(eventfile)->feat,featdepth,event,val);
-    return jointN_count(&eventfile->mgr->table,featdepth,l->feat,val);
+    if (frozen != NULL) return frozen_jointN_count(frozen,featdepth,l->feat,val);
+    return jointN_count(query_table(eventfile),featdepth,l->feat,val);
 }
 
 double event_recorder_get_entropy(event_recorder *self,evfile_ref eventfile,spade_event *event,int entropy_prefix_len) {
     u32 val[MAX_NUM_FEATURES];
     feature_list *l=  &eventfile->mgr->feats;
+    spade_frozen_table *frozen= query_frozen(eventfile);
     map_event_to_val_arr(feats_to_calc_with(eventfile)->feat,entropy_prefix_len,event,val);
-    return spade_prob_table_entropy(&eventfile->mgr->table,entropy_prefix_len,l->feat,val);
+    if (frozen != NULL) return spade_frozen_table_entropy(frozen,entropy_prefix_len,l->feat,val);
+    return spade_prob_table_entropy(query_table(eventfile),entropy_prefix_len,l->feat,val);
+}
+
+void event_recorder_query(evfile_ref eventfile,spade_event *event,int condcutoff,int entropy_prefix_len,spade_prob_query *res) {
+    u32 val[MAX_NUM_FEATURES];
+    feature_list *l= &eventfile->mgr->feats;
+    spade_frozen_table *frozen= query_frozen(eventfile);
+    if (condcutoff < 0) condcutoff+= eventfile->feat_depth; /* condition cutoff specified from end */
+    map_event_to_val_arr(feats_to_calc_with(eventfile)->feat,eventfile->feat_depth,event,val);
+    if (frozen != NULL)
+        spade_frozen_table_query(frozen,eventfile->feat_depth,l->feat,val,condcutoff,entropy_prefix_len,res);
+    else
+        spade_prob_table_query(query_table(eventfile),eventfile->feat_depth,l->feat,val,condcutoff,entropy_prefix_len,res);
+}
+
+double event_recorder_query_entropy(evfile_ref eventfile,spade_prob_query *q) {
+    spade_frozen_table *frozen= query_frozen(eventfile);
+    if (frozen != NULL) return spade_frozen_table_query_entropy(frozen,q);
+    return spade_prob_table_query_entropy(query_table(eventfile),q);
+}
+
+void event_recorder_set_tree_kind(evfile_ref eventfile, u8 kind) {
+    spade_prob_table_set_tree_kind(&eventfile->mgr->table,kind);
+}
+
+/* answer all the queries about the table of the event file (probabilities,
+   counts and entropies alike) from a frozen copy of it, made afresh every
+   freeze_freq secs; the table goes on learning in between.  This suits
+   tables that change slowly compared to freeze_freq.  Where the table is
+   shared, it is frozen as often as its most frequent user asks.  The copy
+   is made a step at a time, as the table is pruned; where queries go to a
+   shared model instead (see event_recorder_share_model()), that is frozen
+   when it is made */
+void event_recorder_set_freeze_freq(evfile_ref eventfile, int freeze_freq) {
+    table_mgr *mgr= eventfile->mgr;
+    if (freeze_freq > 0 && (mgr->freeze_freq == 0 || freeze_freq < mgr->freeze_freq)) mgr->freeze_freq= freeze_freq;
+}
+
+void event_recorder_keep_entropy(evfile_ref eventfile) {
+    spade_prob_table_keep_entropy(&eventfile->mgr->table);
+}
+
+/* note that feature f never takes values above maxval; tables can use this to store it more compactly */
+void event_recorder_set_feature_domain(event_recorder *self, features f, valtype maxval) {
+    table_mgr *mgr;
+    self->feat_maxval[f]= maxval;
+    for (mgr= self->tables; mgr != NULL; mgr=mgr->next) {
+        spade_prob_table_set_feature_domain(&mgr->table,f,maxval);
+    }
+}
+
+/* have the tables be kept to within about bytes of memory by pruning them
+   harder as they approach it and by not recording events once they reach
+   it; 0 means there is no limit */
+void event_recorder_set_memory_budget(event_recorder *self, unsigned long bytes) {
+    self->mem_budget= bytes;
+}
+
+/* return the number of bytes the nodes of the tables take */
+unsigned long event_recorder_mem_used(event_recorder *self) {
+    table_mgr *mgr;
+    unsigned long used= 0;
+    for (mgr= self->tables; mgr != NULL; mgr=mgr->next) {
+        used+= spade_prob_table_mem_used(&mgr->table);
+        if (mgr->frozen != NULL) used+= spade_frozen_table_mem_used(mgr->frozen);
+    }
+    return used;
+}
+
+/* check that each of the tables is sound and survives a round trip through
+   merging and subtracting and through loading; returns the number of problems found, which
+   are described on stderr.  This takes time and memory in proportion to
+   the size of the tables, so it is for testing */
+int event_recorder_check_tables(event_recorder *self) {
+    table_mgr *mgr;
+    int numerrs= 0;
+    for (mgr= self->tables; mgr != NULL; mgr=mgr->next) {
+        numerrs+= sanity_check_spade_prob_table(&mgr->table);
+        numerrs+= spade_prob_table_check_merge(&mgr->table);
+        numerrs+= spade_prob_table_check_load(&mgr->table);
+    }
+    return numerrs;
 }
 
 int event_recorder_get_store_count(event_recorder *self, evfile_ref eventfile) {
@@ -266,6 +603,38 @@ double event_recorder_get_obs_count(event_recorder *self, evfile_ref eventfile)
     return jointN_count(&eventfile->mgr->table,0,eventfile->mgr->feats.feat,NULL);
 }
 
+void event_recorder_file_print_prune_status(event_recorder *self, evfile_ref eventfile, FILE *f) {
+    table_mgr *mgr= eventfile->mgr;
+    if (mgr->scale_freq <= 0) return;
+    fprintf(f,"%u pruning passes have been completed",mgr->prune.passes);
+    if (mgr->prune.passes > 0) fprintf(f," (the last visiting %u nodes)",mgr->prune.last_visited);
+    fprintf(f,"\n");
+    if (spade_prob_table_pruning(&mgr->prune)) {
+        if (mgr->prune.last_visited > 0) {
+            double done= mgr->prune.visited/(double)mgr->prune.last_visited;
+            fprintf(f,"  a pass is under way, about %.0f%% done",(done < 0.99 ? done : 0.99)*100);
+        } else {
+            fprintf(f,"  a pass is under way, %u nodes visited so far",mgr->prune.visited);
+        }
+        fprintf(f,"; %d more passes have come due since it started\n",mgr->prune_backlog);
+    }
+    if (self->prune_boost > 1.0)
+        fprintf(f,"  the pruning threshold is currently %.5f, raised from %.5f to save memory\n",table_mgr_prune_threshold(mgr,self->prune_boost),mgr->prune_threshold);
+}
+
+void event_recorder_file_print_memory(event_recorder *self, FILE *f) {
+    fprintf(f,"The probability tables take %.1f KB of memory",event_recorder_mem_used(self)/1024.0);
+    if (self->mem_budget > 0) {
+        fprintf(f," (of a %.1f KB budget)\n",self->mem_budget/1024.0);
+        if (self->prune_boost > 1.0)
+            fprintf(f,"  pruning thresholds are raised by a factor of %.2f to save memory\n",self->prune_boost);
+        if (self->shed_count > 0)
+            fprintf(f,"  %u events were not recorded since the tables were full\n",self->shed_count);
+    } else {
+        fprintf(f,"\n");
+    }
+}
+
 void event_recorder_write_stats(event_recorder *self,FILE *file,u8 stats_to_print,condition_printer_t condprinter) {
     table_mgr *mgr;
     for (mgr= self->tables; mgr != NULL; mgr=mgr->next) {
@@ -313,6 +682,15 @@ static table_mgr *new_table_mgr(feature_list *feats,const char **featurenames,ev
     new->prune_threshold= prune_threshold;
     new->use_count= 0;
     new->store_count= 0;
+    init_spade_prune_cursor(&new->prune);
+    new->unpruned_decay= 1.0;
+    new->prune_backlog= 0;
+    new->model= NULL;
+    new->freeze_freq= 0;
+    new->last_freeze= (time_t)0;
+    init_spade_freeze_cursor(&new->freezing);
+    new->frozen= NULL;
+    new->frozen_model= NULL;
     return new;
 }
 
@@ -400,24 +778,95 @@ static int table_mgr_is_compatable(table_mgr *mgr,feature_list *feats,const char
     return 1; /* found a compatable table manager */
 }
 
-static void table_mgr_new_time(table_mgr *mgr,time_t time) {
-    if (mgr->scale_freq > 0) {
-        while (time - mgr->last_scale > mgr->scale_freq) {
-            if (mgr->last_scale == (time_t)0) { /* never have scaled before */
-                mgr->last_scale= time;
-            } else {
-                //if (self->debug_level > 1) printf("scaling by %f at time %d; discarding at %f\n",mgr->scale_factor,(int)time,mgr->prune_threshold);
-                scale_and_prune_table(&mgr->table,mgr->scale_factor,mgr->prune_threshold);
-                mgr->last_scale+= mgr->scale_freq;  /* lets pretend we did this right on time */
-                //if (self->debug_level > 1) printf("done with scale/prune\n");
+static void table_mgr_set_feature_domains(table_mgr *mgr,valtype feat_maxval[]) {
+    int i;
+    for (i=0; i < MAX_NUM_FEATURES; i++) {
+        spade_prob_table_set_feature_domain(&mgr->table,i,feat_maxval[i]);
+    }
+}
+
+/* the threshold to prune mgr's table at when its thresholds are being raised by prune_boost */
+static double table_mgr_prune_threshold(table_mgr *mgr,double prune_boost) {
+    if (prune_boost > 1.0 && mgr->prune_threshold < MIN_PRESSURE_THRESHOLD) return MIN_PRESSURE_THRESHOLD*prune_boost;
+    return mgr->prune_threshold*prune_boost;
+}
+
+static void table_mgr_new_time(table_mgr *mgr,time_t time,double prune_boost) {
+    if (mgr->scale_freq > 0 && time - mgr->last_scale > mgr->scale_freq) {
+        if (mgr->last_scale == (time_t)0) { /* never have scaled before */
+            mgr->last_scale= time;
+        } else {
+            /* catch up on all the periods that have gone by at once */
+            int periods= (time - mgr->last_scale - 1) / mgr->scale_freq;
+            //if (self->debug_level > 1) printf("scaling by %f at time %d; discarding at %f\n",mgr->scale_factor,(int)time,mgr->prune_threshold);
+            spade_prob_table_decay(&mgr->table,pow(mgr->scale_factor,periods));
+            mgr->last_scale+= periods*mgr->scale_freq;  /* lets pretend we did this right on time */
+            mgr->unpruned_decay*= pow(mgr->scale_factor,periods);
+            if (mgr->unpruned_decay < PRUNE_AFTER_DECAY) { /* enough has decayed to be worth pruning */
+                mgr->unpruned_decay= 1.0;
+                if (spade_prob_table_pruning(&mgr->prune))
+                    mgr->prune_backlog++; /* still working on the last one */
+                else
+                    spade_prob_table_start_prune(&mgr->table,&mgr->prune,table_mgr_prune_threshold(mgr,prune_boost));
             }
         }
     }
+    
+    /* do the next slice of pruning, if a pass is under way */
+    if (spade_prob_table_pruning(&mgr->prune)) {
+        /* aim to finish a pass in half a scaling period, going faster if we are behind */
+        u32 budget= 2*mgr->prune.last_visited/(mgr->scale_freq > 0 ? mgr->scale_freq : 1);
+        if (budget < MIN_PRUNE_STEP) budget= MIN_PRUNE_STEP;
+        budget*= 1+mgr->prune_backlog;
+        if (spade_prob_table_prune_step(&mgr->table,&mgr->prune,budget) && mgr->prune_backlog > 0) {
+            /* passes came due while that one was going on; one more pass covers them all */
+            mgr->prune_backlog= 0;
+            spade_prob_table_start_prune(&mgr->table,&mgr->prune,table_mgr_prune_threshold(mgr,prune_boost));
+        }
+    }
+    
+    if (mgr->freeze_freq > 0) table_mgr_freeze(mgr,time);
+}
+
+/* start a frozen copy of the table if one is due, starting the clock the
+   first time, and do the next step of the copy under way, if any, putting
+   it in use once it is done; until the first copy is done, queries go to
+   the table.  A table answering from a shared model is not copied */
+static void table_mgr_freeze(table_mgr *mgr,time_t time) {
+    spade_frozen_table *frozen;
+    u32 budget;
+    if (mgr->model != NULL) return;
+    if (mgr->last_freeze == (time_t)0) {
+        mgr->last_freeze= time;
+        return;
+    }
+    if (time - mgr->last_freeze >= mgr->freeze_freq) {
+        /* a copy still under way is recent enough to stand for this one */
+        if (!spade_prob_table_freezing(&mgr->freezing)) spade_prob_table_start_freeze(&mgr->table,&mgr->freezing);
+        mgr->last_freeze+= ((time - mgr->last_freeze) / mgr->freeze_freq) * mgr->freeze_freq;
+    }
+    if (!spade_prob_table_freezing(&mgr->freezing)) return; /* none due, or out of memory; try again next time */
+    /* aim to have a copy done in a fraction of the time between them, going by the size of the last */
+    budget= (u32)(mgr->freezing.last_visited/(FREEZE_STEP_SPREAD*mgr->freeze_freq));
+    if (budget < MIN_FREEZE_STEP) budget= MIN_FREEZE_STEP;
+    frozen= spade_prob_table_freeze_step(&mgr->table,&mgr->freezing,budget);
+    if (frozen != NULL) {
+        if (mgr->frozen != NULL) free_spade_frozen_table(mgr->frozen);
+        mgr->frozen= frozen;
+    }
+}
+
+/* free the frozen copy of the table, and any copy under way */
+static void table_mgr_drop_frozen(table_mgr *mgr) {
+    spade_prob_table_abort_freeze(&mgr->freezing);
+    if (mgr->frozen != NULL) free_spade_frozen_table(mgr->frozen);
+    mgr->frozen= NULL;
 }
 
 static void free_table_mgr(table_mgr *mgr) {
     int i;
-    /* need to reset mgr->table */
+    free_spade_mem_arena(mgr->table.arena);
+    table_mgr_drop_frozen(mgr);
     for (i= 0; mgr->featurenames[i] != NULL; i++) {
         free((char *)mgr->featurenames[i]);
     }
@@ -425,6 +874,15 @@ static void free_table_mgr(table_mgr *mgr) {
     free(mgr);
 }
 
+/* free the list of table managers starting at mgr */
+static void free_table_mgr_list(table_mgr *mgr) {
+    table_mgr *next;
+    for (; mgr != NULL; mgr=next) {
+        next= mgr->next;
+        free_table_mgr(mgr);
+    }
+}
+
 static void table_mgr_write_stats(table_mgr *mgr,FILE *file,u8 stats_to_print,condition_printer_t condprinter) {
     fprintf(file,"** table for ");
     if (condprinter != NULL)
@@ -71,7 +71,29 @@ typedef u32 event_condition_set;
 #define CONDS_NOT_FALSE(conds) (((conds) & EVENT_CONDITION_FALSE) == 0)
 /// return the event_condition_set formed by restricting cond1 to only those conditions in cond2
 #define ONLY_CONDS(origconds,onlyconds) ((origconds) & onlyconds)
-
+/// a hash of an event_condition_set, for picking a slot in a table of them; take the low bits
+#define CONDS_HASH(conds) (((u32)(conds) * 2654435761U) >> 16)
+
+
+/// the least number of table nodes a table manager visits each second while a pruning pass is under way
+#define MIN_PRUNE_STEP 2000
+/// a new pruning pass is started once a table has been scaled down by this much since the last one started
+#define PRUNE_AFTER_DECAY 0.5
+/// the least number of table values a table manager copies each second while making a frozen copy of its table
+#define MIN_FREEZE_STEP 2000
+/// a frozen copy of a table is made over about this fraction of the time between copies
+#define FREEZE_STEP_SPREAD 0.1
+
+/// once the tables take this fraction of the memory budget, they are pruned harder to make room
+#define MEM_HIGH_WATER 0.9
+/// once the tables take less than this fraction of the memory budget, the extra pruning is eased off
+#define MEM_LOW_WATER 0.7
+/// each second the tables are below MEM_LOW_WATER, the factor the prune thresholds are raised by is multiplied by this (toward 1)
+#define MEM_BOOST_RELAX 0.98
+/// the prune threshold used to make room in a table that is otherwise not pruned, before it is raised
+#define MIN_PRESSURE_THRESHOLD 0.5
+/// the number of table nodes a pruning pass visits each second in a table when memory is short
+#define MEM_PRESSURE_STEP 50000
 
 /// structure containing the elements of a table manager
 typedef struct _table_mgr {
@@ -89,8 +111,28 @@ typedef struct _table_mgr {
     double scale_factor; ///< when we scale, how much do we do so?; this is the multiplier
     double prune_threshold;  ///< if an observation gets below this size, it gets discarded
     int use_count; ///< how many event files are using this table manager
+    spade_prune_cursor prune; ///< how far the incremental pruning of the table has gotten
+    double unpruned_decay; ///< how much the table has been scaled by since the last pruning pass started
+    int prune_backlog; ///< the number of times a pruning pass was due while the current one was under way
+    spade_prob_table *model; ///< if not NULL, the table queries are answered from instead of table; see event_recorder_share_model()
+    int freeze_freq; ///< how often (in secs) to freeze the table for queries to be answered from; 0 for never
+    time_t last_freeze; ///< the time the table was last frozen; 0 if it has not been yet
+    spade_freeze_cursor freezing; ///< how far making the next frozen copy of the table has gotten
+    spade_frozen_table *frozen; ///< if not NULL, the frozen table that (most) queries are answered from
+    spade_frozen_table *frozen_model; ///< if not NULL, a frozen copy of model, shared like it, that (most) queries are answered from instead
 } table_mgr;
 
+/// the number of event condition sets an event_recorder remembers the matching table managers for; a power of 2
+#define RECORDER_DISPATCH_SLOTS 16
+
+/// the table managers that store the events satisfying a set of event conditions
+typedef struct {
+    event_condition_set conds; ///< the event conditions
+    int num; ///< the number of table managers in mgrs; -1 if this slot is not in use
+    int size; ///< the number of table managers there is room for in mgrs
+    table_mgr **mgrs; ///< the table managers, in the order of the event_recorder's list of them
+} recorder_dispatch;
+
 /// structure containing the elements on an event file
 typedef struct _evfile {
     /// the table manager that does the storge for this event file
@@ -115,6 +157,18 @@ typedef struct {
     evfile *files;
     /// the current time
     time_t curtime;
+    /// the largest value each feature can take, as set with event_recorder_set_feature_domain()
+    valtype feat_maxval[MAX_NUM_FEATURES];
+    /// the most memory (in bytes) the tables should take; 0 if there is no limit
+    unsigned long mem_budget;
+    /// the factor the prune thresholds of the tables are currently raised by to stay within mem_budget
+    double prune_boost;
+    /// set if the tables have been pruned at the current prune_boost because of the memory budget
+    int pressure_pruned;
+    /// the number of events that were not recorded since the tables were at the memory budget
+    u32 shed_count;
+    /// the table managers to update for the event condition sets seen lately, hashed by the condition set
+    recorder_dispatch dispatch[RECORDER_DISPATCH_SLOTS];
 } event_recorder;
 
 /// function type that can be called to print the string version of a set of event conditions to a FILE *
@@ -126,7 +180,9 @@ void init_event_recorder(event_recorder *self);
 
 int event_recorder_recover(event_recorder **self, statefile_ref *ref);
 int event_recorder_merge_recover(event_recorder *self, statefile_ref *ref);
+int event_recorder_recover_delta(event_recorder *self, statefile_ref *ref);
 int event_recorder_checkpoint(event_recorder *self, statefile_ref *ref);
+void event_recorder_clear_dirty(event_recorder *self);
 
 evfile_ref event_recorder_new_event_file(event_recorder *self, feature_list *feats, const char **featurenames, event_condition_set conds, int scale_freq, double scale_factor, double prune_threshold, int fresh_only, feature_list *calc_feats);
 evfile_ref *event_recorder_new_event_files(event_recorder *self, int howmany, feature_list feats[], const char **featurenames, event_condition_set conds, int scale_freq, double scale_factor, double prune_threshold, int fresh_only);
@@ -135,14 +191,28 @@ void event_recorder_new_time(event_recorder *self, time_t time);
 event_condition_set event_recorder_needed_conds(event_recorder *self);
 int event_recorder_new_event(event_recorder *self, spade_event *event, event_condition_set matching_conds);
 void event_recorder_prune_unused(event_recorder *self);
+int event_recorder_share_model(event_recorder *recs[], int n);
+void event_recorder_drop_model(event_recorder *recs[], int n);
 
 double event_recorder_get_prob(event_recorder *self, evfile_ref eventfile, spade_event *event,int one_more);
 double event_recorder_get_condprob(event_recorder *self, evfile_ref eventfile, spade_event *event, int condcutoff,int one_more);
 double event_recorder_get_count(event_recorder *self, evfile_ref eventfile, spade_event *event, int featdepth);
 double event_recorder_get_entropy(event_recorder *self,evfile_ref eventfile,spade_event *event,int entropy_prefix_len);
+void event_recorder_query(evfile_ref eventfile, spade_event *event, int condcutoff, int entropy_prefix_len, spade_prob_query *res);
+double event_recorder_query_entropy(evfile_ref eventfile, spade_prob_query *q);
+
+void event_recorder_set_tree_kind(evfile_ref eventfile, u8 kind);
+void event_recorder_set_freeze_freq(evfile_ref eventfile, int freeze_freq);
+void event_recorder_keep_entropy(evfile_ref eventfile);
+void event_recorder_set_feature_domain(event_recorder *self, features f, valtype maxval);
+void event_recorder_set_memory_budget(event_recorder *self, unsigned long bytes);
+unsigned long event_recorder_mem_used(event_recorder *self);
+int event_recorder_check_tables(event_recorder *self);
 
 int event_recorder_get_store_count(event_recorder *self, evfile_ref eventfile);
 double event_recorder_get_obs_count(event_recorder *self, evfile_ref eventfile);
+void event_recorder_file_print_prune_status(event_recorder *self, evfile_ref eventfile, FILE *f);
+void event_recorder_file_print_memory(event_recorder *self, FILE *f);
 
 void event_recorder_write_stats(event_recorder *self, FILE *file, u8 stats_to_print,condition_printer_t condprinter);
 
@@ -23,9 +23,10 @@ warranty is expressed for this program.
 
 #include <stdlib.h>
 #include "ll_double.h"
+#include "spade_features.h"
 
 /// free list of allocated ll_doubles
-ll_double *free_link_list=NULL;
+SPADE_THREAD_LOCAL ll_double *free_link_list=NULL;
 
 /* creation and recycling routines for ll_double's */
 
@@ -49,6 +50,15 @@ void free_ll_double_list(ll_double *start) {
     free_link_list= start;
 }
 
+/* return the links on this thread's free list to the system */
+void free_ll_double_freelist(void) {
+    ll_double *next;
+    for (; free_link_list != NULL; free_link_list= next) {
+        next= free_link_list->next;
+        free(free_link_list);
+    }
+}
+
 /*@}*/
 
 /* $Id: ll_double.c,v 1.6 2003/01/14 17:45:31 jim Exp $ */
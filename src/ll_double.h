@@ -31,6 +31,7 @@ typedef struct _ll_double {
 
 ll_double *new_ll_double(double val);
 void free_ll_double_list(ll_double *start);
+void free_ll_double_freelist(void);
 
 /*@}*/
 #endif  /* ! LL_DOUBLE_H */
@@ -47,6 +47,16 @@ warranty is expressed for this program.
 #include <string.h>
 #include <stdlib.h>
 #include <math.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#ifdef SPADE_USE_THREADS
+#include <pthread.h>
+#include "spade_ring.h"
+#include "ll_double.h"
+#include "dll_double.h"
+#endif
 
 /// an array mapping a netspade feature number to its name
 const char *featurenames[NETSPADE_NUM_FEATURES+1]= {"sip","dip","sport","dport","proto","tcpflags","icmptype","icmptype+code",NULL};
@@ -90,35 +100,86 @@ const char *featurenames[NETSPADE_NUM_FEATURES+1]= {"sip","dip","sport","dport",
 #define ICMPRESP_CONDS (CONDS_PLUS_CONDS(ICMPNOTERR,IS_UNRCHICMP))
 
 
-#define PKT_IP_IN_HOMENET_LIST(pkt,fldname,list,res) {\
-    res= 0; \
-    if (list != NULL) { \
-        ll_net *home; \
-        for (home= list; home != NULL; home= home->next) { \
-            if ((pkt->fldval[fldname] & home->netmask) == home->netaddr) { \
-                res= 1; \
-                break; \
-            } \
-        } \
+/* the entries of a netspade's pkt_conds_table; the first 64 are for
+   top-level TCP packets, indexed by their TCP flags */
+#define PKT_CONDS_TCP_LAST      0x3F ///< the pkt_conds_table entry for top-level TCP packets with all 6 flags set
+#define PKT_CONDS_UDP           0x40 ///< the pkt_conds_table entry for top-level UDP packets
+#define PKT_CONDS_ICMPNOTERR    0x41 ///< the pkt_conds_table entry for top-level ICMP packets not indicating an error
+#define PKT_CONDS_ICMPERR       0x42 ///< the pkt_conds_table entry for top-level ICMP packets indicating an error
+#define PKT_CONDS_OTHER         0x43 ///< the pkt_conds_table entry for top-level packets of other protocols
+#define PKT_CONDS_UNRCH_TCP     0x44 ///< the pkt_conds_table entry for TCP headers from inside an unreachable
+#define PKT_CONDS_UNRCH_UDP     0x45 ///< the pkt_conds_table entry for UDP headers from inside an unreachable
+#define PKT_CONDS_UNRCH_ICMP    0x46 ///< the pkt_conds_table entry for ICMP headers from inside an unreachable
+#define PKT_CONDS_UNRCH_OTHER   0x47 ///< the pkt_conds_table entry for other headers from inside an unreachable
+
+/// is this ICMP type an error (unreachable, source quench, redirect, time exceeded, or parameter problem)?
+#define ICMPTYPE_IS_ERR(type) ((type) < 13 && ((0x1838 >> (type)) & 1))
+
+/// set res to whether ip is in one of the num sorted, disjoint net_ranges at ranges
+#define IP_IN_NET_RANGES(ranges,num,ip,res) {\
+    const net_range *base= (ranges); \
+    int n= (num); \
+    /* find the last range starting at or before ip */ \
+    while (n > 1) { \
+        int half= n >> 1; \
+        if (base[half].lo <= (ip)) base+= half; \
+        n-= half; \
+    } \
+    res= (n == 1) && (base->lo <= (ip)) && ((ip) <= base->hi); \
+}
+
+/// set res to whether the IP address in the given field of pkt is in the homenet of self
+#define PKT_IP_IN_HOMENET(self,pkt,fldname,res) {\
+    if (self->homelist_head != NULL) { \
+        u32 ip= pkt->fldval[fldname]; \
+        IP_IN_NET_RANGES(self->home_ranges,self->num_home_ranges,ip,res); \
     } else { \
         res= 1; \
     } \
 }
 
+/// the number of bytes in a bitmap over the port numbers
+#define PORT_MAP_BYTES (65536/8)
+/// is port set in the port bitmap map?
+#define PORT_IN_MAP(map,port) ((port) <= 0xFFFF && ((map)[(port) >> 3] & (1 << ((port) & 7))))
+
 static void init_netspade_empty(netspade *self,spade_msg_fn msg_callback, int debug_level);
 static netspade_detector *acquire_detector_for_id(netspade *self, char *id);
 static netspade_detector *detector_for_id(netspade *self, char *id);
 static void netspade_detector_dump(netspade_detector *detector);
 static void netspade_detector_cleanup(netspade_detector *detector);
+static void netspade_first_pkt(netspade *self);
+static void netspade_new_classified_pkt(netspade *self, spade_event *pkt, event_condition_set pkt_conds);
+static int netspade_new_time(netspade *self, time_t now);
+static event_condition_set netspade_pkt_conds(netspade *self, spade_event *pkt);
+static void netspade_process_pkt(netspade *self, spade_event *pkt, event_condition_set pkt_conds);
+static void netspade_check_checkpoint(netspade *self);
+static detector_dispatch *detector_dispatch_for(netspade *self, event_condition_set pkt_conds);
+static void forget_detector_dispatch(netspade *self);
+static int pkt_conds_index(spade_event *pkt);
+static void build_pkt_conds_table(netspade *self);
+static event_condition_set classify_pkt(netspade *self, spade_event *pkt);
 static void netspade_update_conds_to_calc(netspade *self);
 static event_condition_set netspade_nonstore_conds(netspade *self);
 static event_condition_set flipped_homenet_conds(event_condition_set orig);
 static int do_checkpointing(netspade *self);
+static int write_checkpoint(netspade *self, u32 prev_stamp);
+static void start_background_checkpoint(netspade *self);
+static int reap_background_checkpoint(netspade *self, int wait);
+static void note_checkpoint_done(netspade *self, int background);
+static u32 plan_checkpoint(netspade *self);
+static void remove_delta_files(netspade *self);
 static int do_recovery(netspade *self, char *statefile);
+static int recover_chain(netspade *self, char *statefile, int max_deltas, int *deltas);
 static void threshold_was_exceeded(void *context, void *mgrref, spade_event *pkt, score_info *score);
 static void canceller_status_report(void *context, spade_report *rpt, port_status_t status);
 static void threshold_was_adjusted(void *context, void *mgrref);
+static void netspade_deliver_report(netspade *self, spade_report *rpt);
+static void netspade_deliver_adjustment(netspade *self, char *id, char *message, int using_corrscore);
 static void netspade_add_net_to_homenet(netspade *self, char *net_str);
+static void build_home_ranges(netspade *self);
+static int merge_net_ranges(net_range *ranges, int count);
+static int compare_net_ranges(const void *a, const void *b);
 static char *scope_str_for_cond(event_condition_set cond);
 static void process_netspade_xarg(netspade *self, char *str, features feat, xarg_type_t type);
 static void process_detector_xargs(netspade_detector *d, char *xsips, char *xdips, char *xsports, char *xdports);
@@ -126,28 +187,62 @@ static void process_detector_xarg(netspade_detector *d, char *str, features feat
 static void process_detector_xarg(netspade_detector *d,char *str,features feat,xarg_type_t type);
 static xfeatval_link *process_xarg(char *str,features feat,xarg_type_t type,spade_msg_fn msg_callback,xfeatval_link **tail);
 static xfeatval_link *new_xfeatval_link(features feat, xarg_type_t type, char *val);
-static int pkt_is_excluded(xfeatval_link *list,spade_event *pkt);
+static void init_xfeatval_index(xfeatval_index *idx);
+static void build_xfeatval_index(xfeatval_index *idx, xfeatval_link *list, spade_msg_fn msg_callback);
+static int add_excluded_ranges(net_range **ranges, xfeatval_link *list, features feat);
+static int pkt_is_excluded(xfeatval_index *idx, spade_event *pkt);
 static int cidr_to_netmask(char *str, u32 *netip, u32 *netmask);
 static void file_print_conds(FILE *file,event_condition_set conds);
+#ifdef SPADE_USE_THREADS
+static void free_netspade_pipeline(netspade_pipeline *p);
+static void pipeline_put_pkt(netspade *self, spade_event *pkt);
+static void pipeline_put_report(netspade *self, spade_report *rpt);
+static void pipeline_put_adjustment(netspade *self, char *id, char *message, int using_corrscore);
+static void *pipeline_classify_stage(void *arg);
+static void *pipeline_process_stage(void *arg);
+static void *pipeline_report_stage(void *arg);
+static void pipeline_free_thread_freelists(void);
+#endif
 
 void init_netspade(netspade *self,spade_msg_fn msg_callback, int debug_level) {
     init_netspade_empty(self,msg_callback,debug_level);
 }
 
 static void init_netspade_empty(netspade *self,spade_msg_fn msg_callback, int debug_level) {
+    int i;
     self->msg_callback= (msg_callback == NULL) ? default_spade_msg_fn : msg_callback;
     self->debug_level= debug_level;
 
     self->detectors= NULL;
     self->detectors_tail= NULL;
+    self->pipeline= NULL;
+    for (i=0; i < NETSPADE_DISPATCH_SLOTS; i++) {
+        self->dispatch[i].num= -1;
+        self->dispatch[i].size= 0;
+        self->dispatch[i].steps= NULL;
+    }
     
     self->homelist_head= NULL;
     self->homelist_tail= NULL;
+    self->home_ranges= NULL;
+    self->num_home_ranges= 0;
     
     self->checkpoint_file= NULL;
     self->checkpoint_freq= -1;
 
     self->records_since_checkpoint=0;
+    self->checkpoint_in_background= 0;
+    self->checkpoint_pid= 0;
+    self->last_checkpoint_secs= -1;
+    self->last_checkpoint_bytes= 0;
+    self->last_checkpoint_background= 0;
+    self->last_checkpoint_delta= 0;
+    self->checkpoint_deltas= 0;
+    self->delta_seq= 0;
+    self->checkpoint_stamp= 0;
+    self->delta_file= NULL;
+    self->chain_file= NULL;
+    self->checkpoint_compress= 0;
     self->last_time_forwarded= (time_t)0;
     
     self->callback_context= NULL;
@@ -157,8 +252,16 @@ static void init_netspade_empty(netspade *self,spade_msg_fn msg_callback, int de
     self->pkt_native_freer_callback= NULL;
 
     self->rpt_exclude_list= NULL;
+    init_xfeatval_index(&self->rpt_exclude_index);
     
     init_event_recorder(&self->recorder);
+    /* these features have small domains, which lets their trees be dense */
+    event_recorder_set_feature_domain(&self->recorder,SPORT,MAX_U16);
+    event_recorder_set_feature_domain(&self->recorder,DPORT,MAX_U16);
+    event_recorder_set_feature_domain(&self->recorder,IPPROTO,MAX_U8);
+    event_recorder_set_feature_domain(&self->recorder,TCPFLAGS,MAX_U8);
+    event_recorder_set_feature_domain(&self->recorder,ICMPTYPE,MAX_U8);
+    event_recorder_set_feature_domain(&self->recorder,ICMPTYPECODE,MAX_U16);
     self->recorder_needed_conds= 0;
     self->nonstore_conds= 0;
     self->conds_to_calc= 0;
@@ -198,6 +301,42 @@ void netspade_set_callbacks(netspade *self,void *context,netspade_exc_callback_t
 void netspade_set_checkpointing(netspade *self,char *checkpoint_file,int checkpoint_freq) {
     self->checkpoint_file= (checkpoint_file == NULL) ? NULL : strdup(checkpoint_file);
     self->checkpoint_freq= checkpoint_freq;
+    free(self->delta_file);
+    self->delta_file= (self->checkpoint_file == NULL) ? NULL : (char *)malloc(strlen(self->checkpoint_file)+12);
+    /* the deltas we recovered from can only be carried on from if they are where we will checkpoint to */
+    if (self->chain_file == NULL || self->checkpoint_file == NULL || strcmp(self->chain_file,self->checkpoint_file)) {
+        self->checkpoint_stamp= 0;
+    }
+    free(self->chain_file);
+    self->chain_file= NULL;
+}
+
+/* if on is set, write periodic checkpoints from a forked child process,
+   which has a copy-on-write snapshot of our state, rather than stopping
+   packet processing to write them */
+void netspade_set_background_checkpointing(netspade *self,int on) {
+    self->checkpoint_in_background= on;
+}
+
+/* between full checkpoints, write up to this many delta checkpoints, which
+   have only the parts of the tables that changed since the checkpoint
+   before; these go in the checkpoint file name followed by .1, .2, and so
+   on.  0 means to always write full checkpoints */
+void netspade_set_delta_checkpointing(netspade *self,int deltas) {
+    self->checkpoint_deltas= deltas < 0 ? 0 : deltas;
+}
+
+/* if on is set, write checkpoints with the probability tables compressed
+   (with zlib if built with SPADE_USE_ZLIB, and otherwise with a built-in
+   codec); the files are then smaller, but are read in rather than mapped
+   when recovering */
+void netspade_set_checkpoint_compression(netspade *self,int on) {
+    self->checkpoint_compress= on;
+}
+
+/* keep the probability tables within about this many bytes; 0 for no limit */
+void netspade_set_memory_limit(netspade *self,unsigned long bytes) {
+    event_recorder_set_memory_budget(&self->recorder,bytes);
 }
 
 void netspade_set_homenet_from_str(netspade *self,char *homenet_str) {
@@ -223,6 +362,7 @@ void netspade_set_homenet_from_str(netspade *self,char *homenet_str) {
     }
 
     free(strcopy);
+    build_home_ranges(self);
 
     if (self->debug_level) {
         ll_net *n;
@@ -281,6 +421,7 @@ void netspade_add_rpt_excludes(netspade *self,char *xsips,char *xdips,char *xspo
     process_netspade_xarg(self,xdips,DIP,XARG_TYPE_CIDR);
     process_netspade_xarg(self,xsips,SIP,XARG_TYPE_CIDR);
     process_netspade_xarg(self,xdports,DPORT,XARG_TYPE_UINT);
+    build_xfeatval_index(&self->rpt_exclude_index,self->rpt_exclude_list,self->msg_callback);
 }
 
 char *netspade_new_detector(netspade *self,char *str) {
@@ -301,13 +442,15 @@ char *netspade_new_detector(netspade *self,char *str) {
     int scalefreqmins=240;
     double scalefactor= 0.98363,scalecutoff= 0.18,scalehalflifehrs=-1;
     int reverse_reporting=0;
+    int widenodes=0;
+    int freezemins=0;
     double maxentropy= -1;
     void *args[30];
     char formatstr[500]="$i:wait;s50:id;i:minobs;"
                 "i:scalefreq;d:scalefactor;d:scalecutoff;d:scalehalflife;"
                 "s400:Xsips,Xsip,xsips;s400:Xdips,Xdip,xdips;"
                 "s400:Xsports,Xsport,xsports;s400:Xdports,Xdport,xdports;"
-                "b:revwaitrpt";
+                "b:revwaitrpt;b:widenodes;i:freeze";
     char id[51]="\0";
     char defaultid[31];
     sprintf(defaultid,"%d",++self->detector_id_nonce);
@@ -324,6 +467,8 @@ char *netspade_new_detector(netspade *self,char *str) {
     args[9]= &xsports;
     args[10]= &xdports;
     args[11]= &reverse_reporting;
+    args[12]= &widenodes;
+    args[13]= &freezemins;
     
     new= (netspade_detector *)malloc(sizeof(netspade_detector));
     new->parent= self;
@@ -353,13 +498,13 @@ char *netspade_new_detector(netspade *self,char *str) {
         new->thresh_exc_port_impl= PORT_PROBCLOSED;
         PS_INIT_SET_WITH_STRONGER(new->port_report_criterea,PORT_PROBCLOSED); /* override default default; this will be overriden if wait is set */
         
-        args[12]= &protocol;
-        args[13]= &to;
-        args[14]= &tcpflags;
-        args[15]= &thresh;
-        args[16]= &relscore;
-        args[17]= &probmode;
-        args[18]= &corrscore;
+        args[14]= &protocol;
+        args[15]= &to;
+        args[16]= &tcpflags;
+        args[17]= &thresh;
+        args[18]= &relscore;
+        args[19]= &probmode;
+        args[20]= &corrscore;
         strcat(formatstr,";s4:protocol,proto;s7:to;s20:tcpflags;d:thresh;b:relscore;"
                           "i:probmode;b:-corrscore,corrscore");
         fill_args_space_sep(strcopy,formatstr,args,self->msg_callback);
@@ -461,9 +606,9 @@ char *netspade_new_detector(netspade *self,char *str) {
         
         minobs_prefix_len= 0;
 
-        args[12]= &to;
-        args[13]= &thresh;
-        args[14]= &icmptype;        
+        args[14]= &to;
+        args[15]= &thresh;
+        args[16]= &icmptype;        
         strcat(formatstr,";s7:to;d:thresh;s6:icmptype");
         fill_args_space_sep(strcopy,formatstr,args,self->msg_callback);
             
@@ -509,9 +654,9 @@ char *netspade_new_detector(netspade *self,char *str) {
         thresh=0.8;
         minobs=600; /* this detection type uses a different that normal default minobs */
         
-        args[12]= &protocol;
-        args[13]= &from;
-        args[14]= &thresh;
+        args[14]= &protocol;
+        args[15]= &from;
+        args[16]= &thresh;
         strcat(formatstr,";s4:protocol,proto;s7:from;d:thresh");
         fill_args_space_sep(strcopy,formatstr,args,self->msg_callback);
             
@@ -557,10 +702,10 @@ char *netspade_new_detector(netspade *self,char *str) {
         scalefactor= 0.97957;
         scalecutoff= 0.25;
         
-        args[12]= &protocol;
-        args[13]= &from;
-        args[14]= &thresh;
-        args[15]= &maxentropy;
+        args[14]= &protocol;
+        args[15]= &from;
+        args[16]= &thresh;
+        args[17]= &maxentropy;
         strcat(formatstr,";s4:protocol,proto;s7:from;d:thresh;d:maxentropy");
         fill_args_space_sep(strcopy,formatstr,args,self->msg_callback);
 
@@ -624,9 +769,9 @@ char *netspade_new_detector(netspade *self,char *str) {
         score_calculator_set_features(&new->calculator,1,fla,&cfl,featurenames);
         score_calculator_set_corrscore(&new->calculator,1);
         
-        args[12]= &protocol;
-        args[13]= &tcpflags;        
-        args[14]= &icmptype;        
+        args[14]= &protocol;
+        args[15]= &tcpflags;        
+        args[16]= &icmptype;        
         strcat(formatstr,";s4:protocol,proto;s20:tcpflags;s6:icmptype");
         fill_args_space_sep(strcopy,formatstr,args,self->msg_callback);
 
@@ -725,6 +870,8 @@ char *netspade_new_detector(netspade *self,char *str) {
     if (scalehalflifehrs >= 0) // set factor based on halflife and frequency
         scalefactor= exp((scalefreqmins/(scalehalflifehrs*60))*log(0.5));
     score_calculator_set_scaling(&new->calculator,scalefreqmins*60,scalefactor,scalecutoff);
+    if (widenodes) score_calculator_set_tree_kind(&new->calculator,TREE_KIND_WIDE);
+    if (freezemins > 0) score_calculator_set_freeze_freq(&new->calculator,freezemins*60);
     if (minobs > 0) {
         if (minobs_prefix_len < 0) minobs_prefix_len+= fla[0].num;
         score_calculator_set_min_obs(&new->calculator,minobs_prefix_len,minobs);
@@ -756,6 +903,7 @@ char *netspade_new_detector(netspade *self,char *str) {
         self->detectors_tail->next= new;
     }
     self->detectors_tail= new;
+    forget_detector_dispatch(self);
     
     netspade_detector_scope_str(self,new->id);
                 
@@ -834,44 +982,489 @@ char *netspade_setup_detector_survey_from_str(netspade *self,char *str) {
 
 /* called frequently, should be efficient esp for packets we don't care about */
 void netspade_new_pkt(netspade *self,spade_event *pkt) {
-    event_condition_set pkt_conds=0;
-    int write_log= 0;
-    int ip_in_homenet;
-    features orig_sip,orig_dip,orig_sport,orig_dport;
-    netspade_detector *detector;
-    int new_sec= (self->last_time_forwarded < (time_t)pkt->time);
+    event_condition_set pkt_conds;
 
+#ifdef SPADE_USE_THREADS
+    if (self->pipeline != NULL) { /* the pipeline stages take it from here */
+        pipeline_put_pkt(self,pkt);
+        return;
+    }
+#endif
     if (self->last_time_forwarded == 0) { /* first packet */
-        if (self->detectors == NULL)
-            netspade_new_detector(self,"relscore=0 corrscore=0");
-        for (detector= self->detectors; detector != NULL; detector=detector->next) {
-            score_calculator_init_complete(&detector->calculator); /* make sure calculator is all set up */
-        }
+        netspade_first_pkt(self);
     }
 
 //printf("packet time is %.4f\n",pkt->time);
 
-    /* update packet counts and tell detector of new time */
+    /* calculate the conditions that this packet satisfies; no need to calculate any conditions we don't care about (i.e., not on recorder_needed_conds or nonstore_conds) */
+    if (!self->nonstore_conds || !self->recorder_needed_conds)
+        netspade_update_conds_to_calc(self);
+    pkt_conds= netspade_pkt_conds(self,pkt);
+
+    netspade_new_classified_pkt(self,pkt,pkt_conds);
+}
+
+/* go on with pkt, given the conditions it satisfies: update the packet
+   counts, tell the detectors of a new time, then score, cancel and record */
+static void netspade_new_classified_pkt(netspade *self,spade_event *pkt,event_condition_set pkt_conds) {
+    int write_log= 0;
+
     self->total_pkts++;
-    if (new_sec) {
-        for (detector= self->detectors; detector != NULL; detector=detector->next) {
-            if (score_mgr_new_time(&detector->mgr,pkt->time)) write_log=1; /* advising completed */
-            if (detector->canceller != NULL)
-                packet_resp_canceller_new_time(detector->canceller,pkt->time);
-            detector->enviro.now= (time_t)pkt->time;
-        }
-        event_recorder_new_time(&self->recorder,(time_t)pkt->time);
-        self->last_time_forwarded= (time_t)pkt->time;
+    if (self->last_time_forwarded < (time_t)pkt->time) {
+        write_log= netspade_new_time(self,(time_t)pkt->time);
     }
+
+    netspade_process_pkt(self,pkt,pkt_conds);
     
-    /* calculate the conditions that this packet satisfies; no need to calculate any conditions we don't care about (i.e., not on recorder_needed_conds or nonstore_conds) */
+    if (write_log) { /* time to write the log */
+        netspade_write_log(self);
+    }
+    netspade_check_checkpoint(self);
+}
+
+/* hand netspade a batch of n packets; this has the same effect as passing
+   them to netspade_new_pkt() in turn, except that a checkpoint that comes
+   due is written at the end of the second (or of the batch) it came due
+   in.  The conditions of up to NETSPADE_BATCH_SIZE packets are calculated
+   before any of them is scored and recorded, and the checks for a new
+   second are only made where the batch crosses into one.  The scoring and
+   recording itself stays in packet order, since the score of each packet
+   depends on what was recorded for the ones before it. */
+void netspade_new_pkts(netspade *self,spade_event pkts[],int n) {
+    event_condition_set pkt_conds[NETSPADE_BATCH_SIZE];
+    int first,last,i;
+
+    if (n <= 0) return;
+#ifdef SPADE_USE_THREADS
+    if (self->pipeline != NULL) { /* the pipeline stages take it from here */
+        for (i= 0; i < n; i++) pipeline_put_pkt(self,&pkts[i]);
+        return;
+    }
+#endif
+    if (self->last_time_forwarded == 0) { /* first packet */
+        netspade_first_pkt(self);
+    }
+
+    for (first= 0; first < n; first= last) {
+        last= (n - first > NETSPADE_BATCH_SIZE) ? first + NETSPADE_BATCH_SIZE : n;
+
+        if (!self->nonstore_conds || !self->recorder_needed_conds)
+            netspade_update_conds_to_calc(self);
+        for (i= first; i < last; i++) {
+            pkt_conds[i-first]= netspade_pkt_conds(self,&pkts[i]);
+        }
+
+        i= first;
+        while (i < last) {
+            int write_log= 0;
+            self->total_pkts++;
+            if (self->last_time_forwarded < (time_t)pkts[i].time) {
+                write_log= netspade_new_time(self,(time_t)pkts[i].time);
+            }
+            /* the packet that started the second is processed before the log is written, as in netspade_new_pkt() */
+            netspade_process_pkt(self,&pkts[i],pkt_conds[i-first]);
+            if (write_log) netspade_write_log(self);
+            /* the rest of the packets up to the next second */
+            for (i++; i < last && (time_t)pkts[i].time <= self->last_time_forwarded; i++) {
+                self->total_pkts++;
+                netspade_process_pkt(self,&pkts[i],pkt_conds[i-first]);
+            }
+            netspade_check_checkpoint(self);
+        }
+    }
+}
+
+/* finish setting up netspade, as is otherwise done when the first packet
+   comes; after this, its detectors and tables are all in place */
+void netspade_setup_complete(netspade *self) {
+    if (self->last_time_forwarded == 0) netspade_first_pkt(self);
+}
+
+/* set up the detectors before the first packet */
+static void netspade_first_pkt(netspade *self) {
+    netspade_detector *detector;
+    if (self->detectors == NULL)
+        netspade_new_detector(self,"relscore=0 corrscore=0");
+    for (detector= self->detectors; detector != NULL; detector=detector->next) {
+        score_calculator_init_complete(&detector->calculator); /* make sure calculator is all set up */
+    }
+}
+
+#ifdef SPADE_USE_THREADS
+
+/// the number of items each ring between the stages of the pipeline holds
+#define PIPELINE_RING_SLOTS 4096
+
+/// a pipeline_note kind: a report for the exc_callback
+#define PIPELINE_NOTE_REPORT 1
+/// a pipeline_note kind: a threshold adjustment for the adj_callback
+#define PIPELINE_NOTE_ADJUSTMENT 2
+/// a pipeline_note kind: the signal for the report stage to finish
+#define PIPELINE_NOTE_STOP 3
+
+/// a packet on its way through the pipeline
+typedef struct {
+    spade_event pkt; ///< the packet, with our own copy of its native form if there is a pkt_native_copier_callback
+    event_condition_set conds; ///< the conditions the packet satisfies, once it has been classified
+    int stop; ///< set if this is no packet, but the signal for the stages to finish
+} pipeline_pkt;
+
+/// a report or a threshold adjustment on its way to the user's callback
+typedef struct {
+    int kind; ///< what this is; a PIPELINE_NOTE_* value
+    spade_report rpt; ///< the report, pointing at the copies below
+    spade_event pkt; ///< a copy of the packet reported on
+    score_info score; ///< a copy of its score
+    spade_pkt_stats stats; ///< a copy of the detector statistics as they were when the report was made
+    char *id; ///< for an adjustment, the id of its detector
+    char message[85]; ///< for an adjustment, the message about it
+    int using_corrscore; ///< for an adjustment, whether its detector uses the corrected score
+} pipeline_note;
+
+/// the threads and queues of a netspade running pipelined
+/** Packets go from the user's thread to a classify stage, which works out
+    the conditions each packet satisfies, then to a process stage, which
+    does all the rest in packet order (the score of a packet depends on
+    what was recorded for the ones before it, so scoring and recording
+    stay together), and the reports and threshold adjustments that result
+    go to a report stage, which passes them on to the user's callbacks. */
+struct _netspade_pipeline {
+    spade_ring to_classify; ///< packets from the user, for the classify stage
+    spade_ring to_process; ///< classified packets, for the process stage
+    spade_ring to_report; ///< pipeline_notes, for the report stage
+    pthread_t classify_thread; ///< the thread running the classify stage
+    pthread_t process_thread; ///< the thread running the process stage
+    pthread_t report_thread; ///< the thread running the report stage
+};
+
+/* have the packets handed to netspade_new_pkt() and netspade_new_pkts()
+   from now on be processed by a pipeline of threads, with each call just
+   queueing the packets for it.  The reports and threshold adjustments are
+   passed to the callbacks from a thread of the pipeline, which must
+   therefore be safe to call from there, as must the native packet copier
+   and freer (which are used for every packet).  Other than to hand it
+   packets, netspade must not be used until netspade_stop_pipeline() is
+   called.  Returns 1 if the pipeline was started and 0 otherwise */
+int netspade_start_pipeline(netspade *self) {
+    netspade_pipeline *p;
+    pipeline_pkt *stop;
+
+    if (self->pipeline != NULL) return 1;
+    p= (netspade_pipeline *)malloc(sizeof(netspade_pipeline));
+    if (p != NULL) {
+        p->to_classify.slots= NULL;
+        p->to_process.slots= NULL;
+        p->to_report.slots= NULL;
+    }
+    if (p == NULL || !init_spade_ring(&p->to_classify,PIPELINE_RING_SLOTS,sizeof(pipeline_pkt))
+            || !init_spade_ring(&p->to_process,PIPELINE_RING_SLOTS,sizeof(pipeline_pkt))
+            || !init_spade_ring(&p->to_report,PIPELINE_RING_SLOTS,sizeof(pipeline_note))) {
+        if (p != NULL) free_netspade_pipeline(p);
+        (*self->msg_callback)(SPADE_MSG_TYPE_WARNING,"Out of memory starting the Spade pipeline; not running pipelined\n");
+        return 0;
+    }
+
+    /* the classify stage needs everything it reads to be set up already */
+    if (self->last_time_forwarded == 0) netspade_first_pkt(self);
     if (!self->nonstore_conds || !self->recorder_needed_conds)
         netspade_update_conds_to_calc(self);
+
+    self->pipeline= p;
+    if (pthread_create(&p->report_thread,NULL,pipeline_report_stage,self) != 0) {
+        self->pipeline= NULL;
+        free_netspade_pipeline(p);
+        (*self->msg_callback)(SPADE_MSG_TYPE_WARNING,"Could not start the threads of the Spade pipeline; not running pipelined\n");
+        return 0;
+    }
+    if (pthread_create(&p->process_thread,NULL,pipeline_process_stage,self) != 0) {
+        pipeline_note *note= (pipeline_note *)spade_ring_claim(&p->to_report);
+        note->kind= PIPELINE_NOTE_STOP;
+        spade_ring_publish(&p->to_report);
+        pthread_join(p->report_thread,NULL);
+        self->pipeline= NULL;
+        free_netspade_pipeline(p);
+        (*self->msg_callback)(SPADE_MSG_TYPE_WARNING,"Could not start the threads of the Spade pipeline; not running pipelined\n");
+        return 0;
+    }
+    if (pthread_create(&p->classify_thread,NULL,pipeline_classify_stage,self) != 0) {
+        /* no classify stage, so have the process stage stop (and pass that on) */
+        stop= (pipeline_pkt *)spade_ring_claim(&p->to_process);
+        stop->stop= 1;
+        spade_ring_publish(&p->to_process);
+        pthread_join(p->process_thread,NULL);
+        pthread_join(p->report_thread,NULL);
+        self->pipeline= NULL;
+        free_netspade_pipeline(p);
+        (*self->msg_callback)(SPADE_MSG_TYPE_WARNING,"Could not start the threads of the Spade pipeline; not running pipelined\n");
+        return 0;
+    }
+    return 1;
+}
+
+/* finish processing the packets queued for the pipeline, then stop its
+   threads; netspade processes packets in the calling thread again after
+   this */
+void netspade_stop_pipeline(netspade *self) {
+    netspade_pipeline *p= self->pipeline;
+    pipeline_pkt *stop;
+
+    if (p == NULL) return;
+    /* the stop signal follows the packets through each stage in turn */
+    stop= (pipeline_pkt *)spade_ring_claim(&p->to_classify);
+    stop->stop= 1;
+    spade_ring_publish(&p->to_classify);
+    pthread_join(p->classify_thread,NULL);
+    pthread_join(p->process_thread,NULL);
+    pthread_join(p->report_thread,NULL);
+
+    self->pipeline= NULL;
+    free_netspade_pipeline(p);
+}
+
+static void free_netspade_pipeline(netspade_pipeline *p) {
+    spade_ring_cleanup(&p->to_classify);
+    spade_ring_cleanup(&p->to_process);
+    spade_ring_cleanup(&p->to_report);
+    free(p);
+}
+
+/* (user's thread) queue pkt for the classify stage; the user's copy of it
+   and its native form need not outlive the call */
+static void pipeline_put_pkt(netspade *self,spade_event *pkt) {
+    pipeline_pkt *item= (pipeline_pkt *)spade_ring_claim(&self->pipeline->to_classify);
+
+    item->pkt= *pkt;
+    if (self->pkt_native_copier_callback != NULL) {
+        item->pkt.native= (*self->pkt_native_copier_callback)(pkt->native);
+        item->pkt.native_freer= self->pkt_native_freer_callback;
+    } else {
+        item->pkt.native_freer= NULL;
+    }
+    item->stop= 0;
+    spade_ring_publish(&self->pipeline->to_classify);
+}
+
+/* (process stage) queue a copy of rpt for the report stage */
+static void pipeline_put_report(netspade *self,spade_report *rpt) {
+    pipeline_note *note= (pipeline_note *)spade_ring_claim(&self->pipeline->to_report);
+
+    note->kind= PIPELINE_NOTE_REPORT;
+    note->rpt= *rpt;
+    note->pkt= *rpt->pkt;
+    if (self->pkt_native_copier_callback != NULL) {
+        note->pkt.native= (*self->pkt_native_copier_callback)(rpt->pkt->native);
+        note->pkt.native_freer= self->pkt_native_freer_callback;
+    } else {
+        note->pkt.native_freer= NULL;
+    }
+    note->score= *rpt->score;
+    note->rpt.pkt= &note->pkt;
+    note->rpt.score= &note->score;
+    if (rpt->stream_stats != NULL) {
+        /* the detector goes on counting; the report should have its counts as they are now */
+        note->stats= *rpt->stream_stats;
+        note->rpt.stream_stats= &note->stats;
+    }
+    note->rpt.next= NULL;
+    spade_ring_publish(&self->pipeline->to_report);
+}
+
+/* (process stage) queue a threshold adjustment for the report stage */
+static void pipeline_put_adjustment(netspade *self,char *id,char *message,int using_corrscore) {
+    pipeline_note *note= (pipeline_note *)spade_ring_claim(&self->pipeline->to_report);
+
+    note->kind= PIPELINE_NOTE_ADJUSTMENT;
+    note->id= id;
+    strncpy(note->message,message,sizeof(note->message)-1);
+    note->message[sizeof(note->message)-1]= '\0';
+    note->using_corrscore= using_corrscore;
+    spade_ring_publish(&self->pipeline->to_report);
+}
+
+/* the classify stage: work out the conditions each packet satisfies */
+static void *pipeline_classify_stage(void *arg) {
+    netspade *self= (netspade *)arg;
+    netspade_pipeline *p= self->pipeline;
+
+    for (;;) {
+        pipeline_pkt *in= (pipeline_pkt *)spade_ring_next(&p->to_classify);
+        pipeline_pkt *out= (pipeline_pkt *)spade_ring_claim(&p->to_process);
+        int stop= in->stop;
+
+        *out= *in;
+        spade_ring_consume(&p->to_classify);
+        if (!stop) out->conds= netspade_pkt_conds(self,&out->pkt);
+        spade_ring_publish(&p->to_process);
+        if (stop) return NULL;
+    }
+}
+
+/* the process stage: everything else netspade_new_pkt() does, in packet order */
+static void *pipeline_process_stage(void *arg) {
+    netspade *self= (netspade *)arg;
+    netspade_pipeline *p= self->pipeline;
+
+    for (;;) {
+        pipeline_pkt *item= (pipeline_pkt *)spade_ring_next(&p->to_process);
+        if (item->stop) {
+            pipeline_note *note= (pipeline_note *)spade_ring_claim(&p->to_report);
+            note->kind= PIPELINE_NOTE_STOP;
+            spade_ring_publish(&p->to_report);
+            spade_ring_consume(&p->to_process);
+            pipeline_free_thread_freelists();
+            return NULL;
+        }
+        netspade_new_classified_pkt(self,&item->pkt,item->conds);
+        if (item->pkt.native_freer != NULL) (*item->pkt.native_freer)(item->pkt.native);
+        spade_ring_consume(&p->to_process);
+    }
+}
+
+/* the report stage: pass on the reports and threshold adjustments to the user */
+static void *pipeline_report_stage(void *arg) {
+    netspade *self= (netspade *)arg;
+    netspade_pipeline *p= self->pipeline;
+
+    for (;;) {
+        pipeline_note *note= (pipeline_note *)spade_ring_next(&p->to_report);
+        if (note->kind == PIPELINE_NOTE_STOP) {
+            spade_ring_consume(&p->to_report);
+            pipeline_free_thread_freelists();
+            return NULL;
+        }
+        if (note->kind == PIPELINE_NOTE_REPORT) {
+            (*(self->exc_callback))(self->callback_context,&note->rpt);
+            if (note->pkt.native_freer != NULL) (*note->pkt.native_freer)(note->pkt.native);
+        } else {
+            (*(self->adj_callback))(self->callback_context,note->id,note->message,note->using_corrscore);
+        }
+        spade_ring_consume(&p->to_report);
+    }
+}
+
+/* the free lists of the objects Spade recycles are per thread, so a stage
+   returns what is on its own to the system before the thread exits; the
+   pipeline is stopped and restarted (e.g., around each merge of shards), so
+   these would otherwise be lost each time */
+static void pipeline_free_thread_freelists(void) {
+    free_score_info_freelist();
+    free_spade_event_freelist();
+    free_spade_report_freelist();
+    free_ll_double_freelist();
+    free_dll_double_freelist();
+    packet_resp_canceller_free_freelists();
+}
+
+#else /* ! SPADE_USE_THREADS */
+
+int netspade_start_pipeline(netspade *self) {
+    (*self->msg_callback)(SPADE_MSG_TYPE_WARNING,"Spade was built without SPADE_USE_THREADS, so it cannot run pipelined\n");
+    return 0;
+}
+
+void netspade_stop_pipeline(netspade *self) {
+    self->pipeline= NULL; /* there is never one to stop */
+}
+
+#endif /* SPADE_USE_THREADS */
+
+/* tell the detectors and recorder it is now a new second; returns 1 if the
+   log should be written since threshold advising has completed */
+static int netspade_new_time(netspade *self,time_t now) {
+    netspade_detector *detector;
+    int write_log= 0;
+    for (detector= self->detectors; detector != NULL; detector=detector->next) {
+        if (score_mgr_new_time(&detector->mgr,now)) write_log=1; /* advising completed */
+        if (detector->canceller != NULL)
+            packet_resp_canceller_new_time(detector->canceller,now);
+        detector->enviro.now= now;
+    }
+    event_recorder_new_time(&self->recorder,now);
+    self->last_time_forwarded= now;
+    if (self->checkpoint_pid != 0) reap_background_checkpoint(self,0);
+    return write_log;
+}
+
+/* calculate the conditions that this packet satisfies, among those in conds_to_calc */
+static event_condition_set netspade_pkt_conds(netspade *self,spade_event *pkt) {
+    event_condition_set pkt_conds;
+    int ip_in_homenet;
+    features orig_sip,orig_dip;
+
     if (pkt->origin == PKTORIG_UNRCH) {
         orig_sip= DIP;
         orig_dip= SIP;
-        orig_sport= DPORT;
-        orig_dport= SPORT;
+    } else {
+        orig_sip= SIP;
+        orig_dip= DIP;
+    }
+    pkt_conds= self->pkt_conds_table[pkt_conds_index(pkt)];
+
+    if (SOME_CONDS_MET(self->conds_to_calc,CONDS_PLUS_CONDS(DIP_IN_HOMENET,DIP_NOT_IN_HOMENET))) {
+        PKT_IP_IN_HOMENET(self,pkt,orig_dip,ip_in_homenet);
+        ADD_TO_CONDS(pkt_conds,(ip_in_homenet ? DIP_IN_HOMENET : DIP_NOT_IN_HOMENET));
+    }
+    if (SOME_CONDS_MET(self->conds_to_calc,CONDS_PLUS_CONDS(SIP_IN_HOMENET,SIP_NOT_IN_HOMENET))) {
+        PKT_IP_IN_HOMENET(self,pkt,orig_sip,ip_in_homenet);
+        ADD_TO_CONDS(pkt_conds,(ip_in_homenet ? SIP_IN_HOMENET : SIP_NOT_IN_HOMENET));
+    }
+
+    return pkt_conds;
+}
+
+/* the entry in pkt_conds_table for a packet; the conditions other than the
+   homenet ones only depend on the origin, the protocol, the TCP flags (but
+   for the reserved bits) of top-level TCP packets, and whether top-level
+   ICMP packets are errors */
+static int pkt_conds_index(spade_event *pkt) {
+    int unrch= (pkt->origin == PKTORIG_UNRCH);
+    switch (pkt->fldval[IPPROTO]) {
+    case IPPROTO_TCP:
+        return unrch ? PKT_CONDS_UNRCH_TCP : (int)(pkt->fldval[TCPFLAGS] & 0x3F);
+    case IPPROTO_UDP:
+        return unrch ? PKT_CONDS_UNRCH_UDP : PKT_CONDS_UDP;
+    case IPPROTO_ICMP:
+        if (unrch) return PKT_CONDS_UNRCH_ICMP;
+        return ICMPTYPE_IS_ERR(pkt->fldval[ICMPTYPE]) ? PKT_CONDS_ICMPERR : PKT_CONDS_ICMPNOTERR;
+    default:
+        return unrch ? PKT_CONDS_UNRCH_OTHER : PKT_CONDS_OTHER;
+    }
+}
+
+/* fill in pkt_conds_table, by classifying a packet standing in for each entry */
+static void build_pkt_conds_table(netspade *self) {
+    spade_event pkt;
+    int i;
+
+    memset(&pkt,0,sizeof(pkt));
+    for (i= 0; i < PKT_CONDS_TABLE_SIZE; i++) {
+        pkt.origin= PKTORIG_TOP;
+        pkt.fldval[TCPFLAGS]= 0;
+        pkt.fldval[ICMPTYPE]= 0;
+        if (i <= PKT_CONDS_TCP_LAST) {
+            pkt.fldval[IPPROTO]= IPPROTO_TCP;
+            pkt.fldval[TCPFLAGS]= i;
+        } else {
+            switch (i) {
+            case PKT_CONDS_UDP: pkt.fldval[IPPROTO]= IPPROTO_UDP; break;
+            case PKT_CONDS_ICMPNOTERR: pkt.fldval[IPPROTO]= IPPROTO_ICMP; pkt.fldval[ICMPTYPE]= 8; break;
+            case PKT_CONDS_ICMPERR: pkt.fldval[IPPROTO]= IPPROTO_ICMP; pkt.fldval[ICMPTYPE]= 3; break;
+            case PKT_CONDS_OTHER: pkt.fldval[IPPROTO]= IPPROTO_RAW; break;
+            case PKT_CONDS_UNRCH_TCP: pkt.origin= PKTORIG_UNRCH; pkt.fldval[IPPROTO]= IPPROTO_TCP; break;
+            case PKT_CONDS_UNRCH_UDP: pkt.origin= PKTORIG_UNRCH; pkt.fldval[IPPROTO]= IPPROTO_UDP; break;
+            case PKT_CONDS_UNRCH_ICMP: pkt.origin= PKTORIG_UNRCH; pkt.fldval[IPPROTO]= IPPROTO_ICMP; break;
+            case PKT_CONDS_UNRCH_OTHER: pkt.origin= PKTORIG_UNRCH; pkt.fldval[IPPROTO]= IPPROTO_RAW; break;
+            }
+        }
+        self->pkt_conds_table[i]= classify_pkt(self,&pkt);
+    }
+}
+
+/* calculate the conditions that a packet satisfies, other than the homenet ones */
+static event_condition_set classify_pkt(netspade *self,spade_event *pkt) {
+    event_condition_set pkt_conds=0;
+
+    if (pkt->origin == PKTORIG_UNRCH) {
         if (pkt->fldval[IPPROTO] == IPPROTO_TCP) 
              ADD_TO_CONDS(pkt_conds,IS_UNRCHTCP);
         else if (pkt->fldval[IPPROTO] == IPPROTO_UDP) 
@@ -879,10 +1472,6 @@ void netspade_new_pkt(netspade *self,spade_event *pkt) {
         else if (pkt->fldval[IPPROTO] == IPPROTO_ICMP) 
             ADD_TO_CONDS(pkt_conds,IS_UNRCHICMP);
     } else {
-        orig_sip= SIP;
-        orig_dip= DIP;
-        orig_sport= SPORT;
-        orig_dport= DPORT;
         if (pkt->fldval[IPPROTO] == IPPROTO_TCP) {
             u8 tcpflags= pkt->fldval[TCPFLAGS] & 0x3F; /* strip off reserved bits */
             ADD_TO_CONDS(pkt_conds,IS_TCP);
@@ -941,21 +1530,38 @@ void netspade_new_pkt(netspade *self,spade_event *pkt) {
             ADD_TO_CONDS(pkt_conds,SETUPRESP);
     }
 
-    
-    if (SOME_CONDS_MET(self->conds_to_calc,CONDS_PLUS_CONDS(DIP_IN_HOMENET,DIP_NOT_IN_HOMENET))) {
-        PKT_IP_IN_HOMENET_LIST(pkt,orig_dip,self->homelist_head,ip_in_homenet);
-        ADD_TO_CONDS(pkt_conds,(ip_in_homenet ? DIP_IN_HOMENET : DIP_NOT_IN_HOMENET));
-    }
-    if (SOME_CONDS_MET(self->conds_to_calc,CONDS_PLUS_CONDS(SIP_IN_HOMENET,SIP_NOT_IN_HOMENET))) {
-        PKT_IP_IN_HOMENET_LIST(pkt,orig_sip,self->homelist_head,ip_in_homenet);
-        ADD_TO_CONDS(pkt_conds,(ip_in_homenet ? SIP_IN_HOMENET : SIP_NOT_IN_HOMENET));
+    return pkt_conds;
+}
+
+/* score, check for responses with, and record a packet that satisfies pkt_conds */
+static void netspade_process_pkt(netspade *self,spade_event *pkt,event_condition_set pkt_conds) {
+    netspade_detector *detector;
+    features orig_sip,orig_dip,orig_sport,orig_dport;
+
+    if (pkt->origin == PKTORIG_UNRCH) {
+        orig_sip= DIP;
+        orig_dip= SIP;
+        orig_sport= DPORT;
+        orig_dport= SPORT;
+    } else {
+        orig_sip= SIP;
+        orig_dip= DIP;
+        orig_sport= SPORT;
+        orig_dport= DPORT;
     }
-    
+
     if (SOME_CONDS_MET(pkt_conds,self->nonstore_conds)) { /* might match something to calculate or cancel */
-        /* check for scoring and cancelling in each detector */
+        /* score and cancel in each detector that does so for these conditions */
         int portless= (pkt->fldval[IPPROTO] != IPPROTO_TCP) && (pkt->fldval[IPPROTO] != IPPROTO_UDP);
-        for (detector= self->detectors; detector != NULL; detector=detector->next) {
-            if (ALL_CONDS_MET(pkt_conds,detector->scorecalc_conds) && (!detector->exclude_broadcast_dip || ((pkt->fldval[DIP] & 0xFF) != 0xFF))) {
+        detector_dispatch *dispatch= detector_dispatch_for(self,pkt_conds);
+        detector_step *step= NULL,*end= NULL;
+        if (dispatch != NULL) {
+            step= dispatch->steps;
+            end= step + dispatch->num;
+        }
+        for (; step < end; step++) {
+            detector= step->detector;
+            if ((step->actions & DISPATCH_SCORE) && (!detector->exclude_broadcast_dip || ((pkt->fldval[DIP] & 0xFF) != 0xFF))) {
                 score_info score;
                 int enoughobs;
                 score_info *res= score_calculator_calc_event_score(&detector->calculator,pkt,&score,&enoughobs);
@@ -968,13 +1574,13 @@ void netspade_new_pkt(netspade *self,spade_event *pkt) {
                     }
                 }
             }
-            if (ALL_CONDS_MET(pkt_conds,detector->cancel_open_conds)) {
+            if (step->actions & DISPATCH_CANCEL_OPEN) {
                 detector->enviro.pkt_stats.respchecked++;
                 packet_resp_canceller_note_response(detector->canceller,PORT_OPEN,
                     pkt->fldval[orig_dip],pkt->fldval[orig_dport],
                     pkt->fldval[orig_sip],pkt->fldval[orig_sport],portless);
             }
-            if (ALL_CONDS_MET(pkt_conds,detector->cancel_closed_conds)) {
+            if (step->actions & DISPATCH_CANCEL_CLOSED) {
                 detector->enviro.pkt_stats.respchecked++;
                 packet_resp_canceller_note_response(detector->canceller,PORT_CLOSED,
                     pkt->fldval[orig_dip],pkt->fldval[orig_dport],
@@ -986,16 +1592,66 @@ void netspade_new_pkt(netspade *self,spade_event *pkt) {
         self->records_since_checkpoint+=
             event_recorder_new_event(&self->recorder,pkt,pkt_conds);
     }
-    
-    if (write_log) { /* time to write the log */
-        netspade_write_log(self);
+}
+
+/* return the dispatch slot listing what each detector does with packets
+   satisfying pkt_conds, filling it in if pkt_conds is not the condition set
+   it is for; this way each packet only visits the detectors with something
+   to do, rather than all of them */
+static detector_dispatch *detector_dispatch_for(netspade *self,event_condition_set pkt_conds) {
+    detector_dispatch *d= &self->dispatch[CONDS_HASH(pkt_conds) & (NETSPADE_DISPATCH_SLOTS-1)];
+    netspade_detector *detector;
+    int count= 0;
+
+    if (d->num >= 0 && d->conds == pkt_conds) return d;
+
+    for (detector= self->detectors; detector != NULL; detector=detector->next) count++;
+    if (count > d->size) {
+        detector_step *steps= (detector_step *)realloc(d->steps,sizeof(detector_step)*count);
+        if (steps == NULL) {
+            (*self->msg_callback)(SPADE_MSG_TYPE_FATAL,"Out of memory dispatching a packet to the detectors\n");
+            return NULL;
+        }
+        d->steps= steps;
+        d->size= count;
     }
-    if ((self->checkpoint_freq > 0) && (self->records_since_checkpoint >= self->checkpoint_freq)) { // see if its time to checkpoint
-        do_checkpointing(self); // should report err if returns 0
-        self->records_since_checkpoint= 0;
+    d->conds= pkt_conds;
+    d->num= 0;
+    for (detector= self->detectors; detector != NULL; detector=detector->next) {
+        int actions= 0;
+        if (ALL_CONDS_MET(pkt_conds,detector->scorecalc_conds)) actions|= DISPATCH_SCORE;
+        if (ALL_CONDS_MET(pkt_conds,detector->cancel_open_conds)) actions|= DISPATCH_CANCEL_OPEN;
+        if (ALL_CONDS_MET(pkt_conds,detector->cancel_closed_conds)) actions|= DISPATCH_CANCEL_CLOSED;
+        if (actions) {
+            d->steps[d->num].detector= detector;
+            d->steps[d->num].actions= actions;
+            d->num++;
+        }
+    }
+    return d;
+}
+
+/* forget what the detectors do for which packet condition sets; this is
+   called whenever the detectors or the conditions we calculate change */
+static void forget_detector_dispatch(netspade *self) {
+    int i;
+    for (i=0; i < NETSPADE_DISPATCH_SLOTS; i++) {
+        self->dispatch[i].num= -1;
     }
 }
 
+/* write a checkpoint if enough has been recorded since the last one */
+static void netspade_check_checkpoint(netspade *self) {
+    if ((self->checkpoint_freq > 0) && (self->records_since_checkpoint >= self->checkpoint_freq)) { // see if its time to checkpoint
+        if (!self->checkpoint_in_background) {
+            do_checkpointing(self); // should report err if returns 0
+            self->records_since_checkpoint= 0;
+        } else if (self->checkpoint_pid == 0) { /* otherwise wait for the one under way to finish */
+            start_background_checkpoint(self);
+            self->records_since_checkpoint= 0;
+        }
+    }
+}
 
 void netspade_dump(netspade *self) 
 {
@@ -1007,9 +1663,17 @@ void netspade_dump(netspade *self)
     if (self->checkpoint_file != NULL) do_checkpointing(self);
 }
 
+/* check the probability tables, as event_recorder_check_tables() does;
+   returns the number of problems found */
+int netspade_check_tables(netspade *self) 
+{
+    return event_recorder_check_tables(&self->recorder);
+}
+
 void netspade_cleanup(netspade *self) 
 {
     netspade_detector *detector;
+    netspade_stop_pipeline(self);
     netspade_write_log(self);
     for (detector= self->detectors; detector != NULL; detector=detector->next) {
         netspade_detector_cleanup(detector);
@@ -1134,6 +1798,8 @@ static void netspade_update_conds_to_calc(netspade *self) {
         self->nonstore_conds= netspade_nonstore_conds(self);
         
     self->conds_to_calc= CONDS_PLUS_CONDS(self->recorder_needed_conds,self->nonstore_conds);
+    build_pkt_conds_table(self); /* some conditions are only calculated if they are in conds_to_calc */
+    forget_detector_dispatch(self);
 }
 
 static event_condition_set netspade_nonstore_conds(netspade *self) {
@@ -1163,26 +1829,185 @@ static event_condition_set flipped_homenet_conds(event_condition_set orig) {
 }
 
 
+/* checkpoint now, waiting for any checkpoint being written in the background to finish first */
 static int do_checkpointing(netspade *self) {
-    statefile_ref *ref= spade_state_begin_checkpointing(self->checkpoint_file,"netspade",2);
+    int res;
+    u32 prev_stamp;
+    if (self->checkpoint_pid != 0) reap_background_checkpoint(self,1);
+    gettimeofday(&self->checkpoint_started,NULL);
+    prev_stamp= plan_checkpoint(self);
+    res= write_checkpoint(self,prev_stamp);
+    event_recorder_clear_dirty(&self->recorder);
+    if (res) {
+        note_checkpoint_done(self,0);
+    } else {
+        self->checkpoint_stamp= 0; /* start over with a full checkpoint */
+    }
+    return res;
+}
+
+/* write the checkpoint planned by plan_checkpoint(), which returned prev_stamp */
+static int write_checkpoint(netspade *self,u32 prev_stamp) {
+    char *file= (self->delta_seq > 0) ? self->delta_file : self->checkpoint_file;
+    statefile_ref *ref= spade_state_begin_stamped_checkpointing(file,"netspade",2,self->checkpoint_stamp,prev_stamp);
     if (ref == NULL) return 0;
+    if (self->checkpoint_compress) spade_state_set_encoding(ref,SPADE_STATE_ENC_COMPRESSED);
     
-    return event_recorder_checkpoint(&self->recorder,ref)
-        /* could checkpoint detectors in here */
-        && spade_state_end_checkpointing(ref);
+    if (!event_recorder_checkpoint(&self->recorder,ref)) {
+        /* leave the last good checkpoint in place */
+        spade_state_abort_checkpointing(ref);
+        return 0;
+    }
+    /* could checkpoint detectors in here */
+    if (!spade_state_end_checkpointing(ref)) return 0;
+    /* the delta checkpoints from before a full checkpoint are no longer needed */
+    if (self->delta_seq == 0) remove_delta_files(self);
+    return 1;
 }
 
+/* set up the next checkpoint to be a full one or a delta, as is due, and
+   give it a new stamp; returns the stamp of the checkpoint a delta follows
+   on from, 0 if it is to be a full checkpoint */
+static u32 plan_checkpoint(netspade *self) {
+    u32 prev_stamp= self->checkpoint_stamp;
+    if (prev_stamp == 0 || self->delta_seq >= self->checkpoint_deltas || self->delta_file == NULL) {
+        self->delta_seq= 0;
+        prev_stamp= 0;
+    } else {
+        self->delta_seq++;
+        sprintf(self->delta_file,"%s.%d",self->checkpoint_file,self->delta_seq);
+    }
+    self->checkpoint_stamp= spade_state_new_stamp();
+    return prev_stamp;
+}
+
+/* remove the delta checkpoint files next to the checkpoint file */
+static void remove_delta_files(netspade *self) {
+    int i;
+    char *name= (char *)malloc(strlen(self->checkpoint_file)+12);
+    if (name == NULL) return;
+    for (i= 1; ; i++) {
+        sprintf(name,"%s.%d",self->checkpoint_file,i);
+        if (remove(name) != 0) break;
+    }
+    free(name);
+}
+
+/* fork a child process to write a checkpoint from its copy of our state */
+static void start_background_checkpoint(netspade *self) {
+    pid_t pid;
+    u32 prev_stamp;
+    gettimeofday(&self->checkpoint_started,NULL);
+    prev_stamp= plan_checkpoint(self);
+    pid= fork();
+    if (pid < 0) {
+        formatted_spade_msg_send(SPADE_MSG_TYPE_WARNING,self->msg_callback,"netspade: could not start a process to checkpoint in; checkpointing in the foreground\n");
+        if (write_checkpoint(self,prev_stamp)) {
+            note_checkpoint_done(self,0);
+        } else {
+            self->checkpoint_stamp= 0;
+        }
+        event_recorder_clear_dirty(&self->recorder);
+        return;
+    }
+    if (pid == 0) { /* the child; leave the signals meant for the parent to it */
+        signal(SIGHUP,SIG_IGN);
+        signal(SIGINT,SIG_IGN);
+        signal(SIGQUIT,SIG_IGN);
+        signal(SIGUSR1,SIG_IGN);
+        signal(SIGUSR2,SIG_IGN);
+        _exit(write_checkpoint(self,prev_stamp) ? 0 : 1);
+    }
+    self->checkpoint_pid= pid;
+    /* the child has the changes so far; the next delta needs only those from here on */
+    event_recorder_clear_dirty(&self->recorder);
+}
+
+/* see if the checkpoint being written in the background is done, waiting
+   for it to be if wait is set; returns 1 if it is done */
+static int reap_background_checkpoint(netspade *self,int wait) {
+    int status;
+    pid_t pid= waitpid(self->checkpoint_pid,&status,wait ? 0 : WNOHANG);
+    if (pid == 0) return 0; /* still going */
+    self->checkpoint_pid= 0;
+    if (pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        formatted_spade_msg_send(SPADE_MSG_TYPE_WARNING,self->msg_callback,"netspade: writing a checkpoint to %s in the background failed\n",self->delta_seq > 0 ? self->delta_file : self->checkpoint_file);
+        self->checkpoint_stamp= 0; /* the next one cannot follow on from it */
+    } else {
+        note_checkpoint_done(self,1);
+    }
+    return 1;
+}
+
+/* record how long the checkpoint that was just completed took and how big it is */
+static void note_checkpoint_done(netspade *self,int background) {
+    struct timeval now;
+    struct stat st;
+    gettimeofday(&now,NULL);
+    self->last_checkpoint_secs= (now.tv_sec - self->checkpoint_started.tv_sec) + (now.tv_usec - self->checkpoint_started.tv_usec)/1000000.0;
+    self->last_checkpoint_delta= (self->delta_seq > 0);
+    self->last_checkpoint_bytes= (stat(self->last_checkpoint_delta ? self->delta_file : self->checkpoint_file,&st) == 0) ? (long)st.st_size : 0;
+    self->last_checkpoint_background= background;
+}
+
+/* recover from the checkpoint in statefile and the delta checkpoints that follow on from it */
 static int do_recovery(netspade *self,char *statefile) {
-    char *appname;
+    int deltas;
+    if (!recover_chain(self,statefile,-1,&deltas)) {
+        if (deltas < 0) return 0;
+        /* a delta was bad; go with what we had before it */
+        formatted_spade_msg_send(SPADE_MSG_TYPE_WARNING,self->msg_callback,"netspade: could not recover from %s.%d; using the state from before it\n",statefile,deltas+1);
+        if (!recover_chain(self,statefile,deltas,&deltas)) return 0;
+    }
+    self->delta_seq= deltas;
+    self->chain_file= strdup(statefile);
+    return 1;
+}
+
+/* recover from the checkpoint in statefile and then from the delta
+   checkpoints in statefile.1, statefile.2, and so on, for as long as each
+   follows on from the one before it, but no more than max_deltas of them if
+   that is not negative.  On success, sets *deltas to the number of deltas
+   used; on failure, sets it to that number if a delta could not be used,
+   leaving the recorder empty, or to -1 if the full checkpoint could not be */
+static int recover_chain(netspade *self,char *statefile,int max_deltas,int *deltas) {
+    char *appname,*name;
     u8 file_app_fvers;
+    statefile_ref *ref;
+    int n;
     
-    statefile_ref *ref= spade_state_begin_recovery(statefile,2,&appname,&file_app_fvers);
+    *deltas= -1;
+    ref= spade_state_begin_recovery(statefile,2,&appname,&file_app_fvers);
     if (ref == NULL) return 0;
     if (strcmp(appname,"netspade")) return 0;
     
-    return event_recorder_merge_recover(&self->recorder,ref)
+    self->checkpoint_stamp= ref->stamp;
+    if (!(event_recorder_merge_recover(&self->recorder,ref)
         /* would checkpoint detectors in here; if we checkpointed that */
-        && spade_state_end_recovery(ref);
+        && spade_state_end_recovery(ref))) return 0;
+    
+    name= (char *)malloc(strlen(statefile)+12);
+    if (name == NULL) return 0;
+    for (n= 0; max_deltas < 0 || n < max_deltas; n++) {
+        sprintf(name,"%s.%d",statefile,n+1);
+        ref= spade_state_begin_recovery(name,2,&appname,&file_app_fvers);
+        if (ref == NULL) break;
+        if (strcmp(appname,"netspade") || ref->prev_stamp == 0 || ref->prev_stamp != self->checkpoint_stamp) { /* not the next delta */
+            spade_state_end_recovery(ref);
+            break;
+        }
+        if (!event_recorder_recover_delta(&self->recorder,ref)) {
+            spade_state_end_recovery(ref);
+            *deltas= n;
+            free(name);
+            return 0;
+        }
+        self->checkpoint_stamp= ref->stamp;
+        spade_state_end_recovery(ref);
+    }
+    free(name);
+    *deltas= n;
+    return 1;
 }
 
 static void threshold_was_exceeded(void *context,void *mgrref,spade_event *pkt,score_info *score) {
@@ -1192,8 +2017,8 @@ static void threshold_was_exceeded(void *context,void *mgrref,spade_event *pkt,s
     port_status_t port_status= detector->thresh_exc_port_impl;
     
     /* first check if this report should be excluded */
-    if (pkt_is_excluded(self->rpt_exclude_list,pkt) ||
-            pkt_is_excluded(detector->rpt_exclude_list,pkt)) {
+    if (pkt_is_excluded(&self->rpt_exclude_index,pkt) ||
+            pkt_is_excluded(&detector->rpt_exclude_index,pkt)) {
         detector->enviro.pkt_stats.excluded++;
         return;
     } else {
@@ -1202,7 +2027,7 @@ static void threshold_was_exceeded(void *context,void *mgrref,spade_event *pkt,s
     
     if (PS_IN_SET(detector->port_report_criterea,port_status)) {
         spade_report *rpt= new_spade_report(pkt,score,detector->detect_type,id,SPADE_DN_TYPE_MEDDESCR4NUM(detector->report_detection_type),netspade_detector_scope_str(self,id),&detector->enviro.pkt_stats,port_status);
-        (*(self->exc_callback))(self->callback_context,rpt);
+        netspade_deliver_report(self,rpt);
         free_spade_report(rpt);
         detector->enviro.pkt_stats.reported++;
     } else if (detector->canceller != NULL) {
@@ -1224,7 +2049,7 @@ static void canceller_status_report(void *context,spade_report *rpt,port_status_
     if (PS_IN_SET(d->port_report_criterea,status)) {
         /* met one of the critea so report it */
         rpt->port_status= status;
-        (*(self->exc_callback))(self->callback_context,rpt);
+        netspade_deliver_report(self,rpt);
         if (rpt->stream_stats) {
             rpt->stream_stats->reported++;
         }
@@ -1249,7 +2074,31 @@ static void threshold_was_adjusted(void *context,void *mgrref) {
     sprintf(message,"Threshold adjusted to %.4f after %d alerts (of %d)",detector->enviro.thresh,adj_period_stats.reported,adj_period_stats.scored);
 
     using_corrscore= score_calculator_using_corrscore(&detector->calculator);
-    (*(self->adj_callback))(self->callback_context,detector->id,message,using_corrscore);
+    netspade_deliver_adjustment(self,detector->id,message,using_corrscore);
+}
+
+/* pass rpt on to the user's report callback; when running pipelined, a copy
+   is queued for the report stage to pass on instead */
+static void netspade_deliver_report(netspade *self,spade_report *rpt) {
+#ifdef SPADE_USE_THREADS
+    if (self->pipeline != NULL) {
+        pipeline_put_report(self,rpt);
+        return;
+    }
+#endif
+    (*(self->exc_callback))(self->callback_context,rpt);
+}
+
+/* pass a threshold adjustment on to the user's callback, or queue it for
+   the report stage when running pipelined */
+static void netspade_deliver_adjustment(netspade *self,char *id,char *message,int using_corrscore) {
+#ifdef SPADE_USE_THREADS
+    if (self->pipeline != NULL) {
+        pipeline_put_adjustment(self,id,message,using_corrscore);
+        return;
+    }
+#endif
+    (*(self->adj_callback))(self->callback_context,id,message,using_corrscore);
 }
 
 
@@ -1270,6 +2119,54 @@ static void netspade_add_net_to_homenet(netspade *self,char *net_str) {
     }
 }
 
+/* turn the homenet list into sorted, disjoint address ranges, so testing
+   whether an address is in the homenet is a binary search rather than a
+   walk over every network */
+static void build_home_ranges(netspade *self) {
+    ll_net *n;
+    int count= 0;
+
+    for (n= self->homelist_head; n != NULL; n= n->next) count++;
+    free(self->home_ranges);
+    self->home_ranges= (net_range *)malloc(sizeof(net_range)*(count+1));
+    if (self->home_ranges == NULL) {
+        self->num_home_ranges= 0;
+        (*self->msg_callback)(SPADE_MSG_TYPE_FATAL,"Out of memory setting up the homenet\n");
+        return;
+    }
+
+    count= 0;
+    for (n= self->homelist_head; n != NULL; n= n->next) {
+        if (n->netaddr & ~n->netmask) continue; /* host bits set; no address can match */
+        self->home_ranges[count].lo= n->netaddr;
+        self->home_ranges[count].hi= n->netaddr | ~n->netmask;
+        count++;
+    }
+    self->num_home_ranges= merge_net_ranges(self->home_ranges,count);
+}
+
+/* sort the count ranges given and merge those that overlap or abut; returns
+   the number of ranges left */
+static int merge_net_ranges(net_range *ranges,int count) {
+    int i,merged= 0;
+
+    qsort(ranges,count,sizeof(net_range),compare_net_ranges);
+    for (i= 0; i < count; i++) {
+        if (merged > 0 && (ranges[merged-1].hi == (u32)~0
+                           || ranges[i].lo <= ranges[merged-1].hi + 1)) {
+            if (ranges[i].hi > ranges[merged-1].hi)
+                ranges[merged-1].hi= ranges[i].hi;
+        } else {
+            ranges[merged++]= ranges[i];
+        }
+    }
+    return merged;
+}
+
+static int compare_net_ranges(const void *a,const void *b) {
+    u32 alo= ((const net_range *)a)->lo,blo= ((const net_range *)b)->lo;
+    return (alo < blo) ? -1 : (alo > blo);
+}
 
 
 void netspade_write_log(netspade *self) {
@@ -1283,7 +2180,12 @@ void netspade_write_log(netspade *self) {
         if (!file) formatted_spade_msg_send(SPADE_MSG_TYPE_FATAL,self->msg_callback,"netspade: unable to open %s",self->outfile);
     }
 
-    fprintf(file,"%ld total packets were processed by spade in this run\n\n",self->total_pkts);
+    fprintf(file,"%ld total packets were processed by spade in this run\n",self->total_pkts);
+    event_recorder_file_print_memory(&self->recorder,file);
+    if (self->last_checkpoint_secs >= 0) {
+        fprintf(file,"The last checkpoint%s%s took %.2f seconds and wrote %ld bytes\n",self->last_checkpoint_delta ? " (a delta)" : "",self->last_checkpoint_background ? ", written in the background," : "",self->last_checkpoint_secs,self->last_checkpoint_bytes);
+    }
+    fprintf(file,"\n");
     for (detector= self->detectors; detector != NULL; detector=detector->next) {
         spade_pkt_stats *stats= &detector->enviro.pkt_stats;
         int scored= stats->scored;
@@ -1302,6 +2204,7 @@ void netspade_write_log(netspade *self) {
             fprintf(file,"  %d packets were checked against the wait queue\n",stats->respchecked);
         fprintf(file,"%d observations were stored\n",score_calculator_get_store_count(&detector->calculator));
         fprintf(file,"%.4f observations are remembered\n",score_calculator_get_obs_count(&detector->calculator));
+        score_calculator_file_print_prune_status(&detector->calculator,file);
         score_mgr_file_print_log(&detector->mgr,file);
         fprintf(file,"\n");
     }
@@ -1480,10 +2383,12 @@ static void process_netspade_xarg(netspade *self,char *str,features feat,xarg_ty
 
 static void process_detector_xargs(netspade_detector *d,char *xsips,char *xdips,char *xsports,char *xdports) {
     d->rpt_exclude_list= NULL;
+    init_xfeatval_index(&d->rpt_exclude_index);
     process_detector_xarg(d,xsports,SPORT,XARG_TYPE_UINT);
     process_detector_xarg(d,xdips,DIP,XARG_TYPE_CIDR);
     process_detector_xarg(d,xsips,SIP,XARG_TYPE_CIDR);
     process_detector_xarg(d,xdports,DPORT,XARG_TYPE_UINT);
+    build_xfeatval_index(&d->rpt_exclude_index,d->rpt_exclude_list,d->parent->msg_callback);
 }
 
 static void process_detector_xarg(netspade_detector *d,char *str,features feat,xarg_type_t type) {
@@ -1551,15 +2456,92 @@ static xfeatval_link *new_xfeatval_link(features feat,xarg_type_t type,char *val
     return new;
 }
 
-static int pkt_is_excluded(xfeatval_link *list,spade_event *pkt) {
+static void init_xfeatval_index(xfeatval_index *idx) {
+    idx->empty= 1;
+    idx->sport_map= NULL;
+    idx->dport_map= NULL;
+    idx->sip_ranges= NULL;
+    idx->num_sip_ranges= 0;
+    idx->dip_ranges= NULL;
+    idx->num_dip_ranges= 0;
+}
+
+/* (re)build idx from the exclusions in list: the ports go into a bitmap and
+   the networks into sorted, disjoint ranges, so checking a packet takes the
+   same few steps however long the list is */
+static void build_xfeatval_index(xfeatval_index *idx,xfeatval_link *list,spade_msg_fn msg_callback) {
     xfeatval_link *x;
+
+    free(idx->sport_map);
+    free(idx->dport_map);
+    free(idx->sip_ranges);
+    free(idx->dip_ranges);
+    init_xfeatval_index(idx);
+    
     for (x= list; x != NULL; x= x->next) {
-        u32 pktval= pkt->fldval[x->feat];
-        if ((x->type == XARG_TYPE_UINT)
-            ? (x->val.i == pktval)
-            : ((pktval & x->val.cidr.netmask) == x->val.cidr.netip)) { /* found one to exclude */
-            return 1; 
+        u8 **map;
+        if (x->type != XARG_TYPE_UINT) continue;
+        map= (x->feat == SPORT) ? &idx->sport_map : &idx->dport_map;
+        if (*map == NULL) {
+            *map= (u8 *)calloc(PORT_MAP_BYTES,1);
+            if (*map == NULL) {
+                (*msg_callback)(SPADE_MSG_TYPE_FATAL,"Out of memory setting up report exclusions\n");
+                return;
+            }
         }
+        /* a larger value can never match a port, so it has no bit */
+        if ((unsigned int)x->val.i <= 0xFFFF)
+            (*map)[x->val.i >> 3]|= 1 << (x->val.i & 7);
+    }
+    
+    idx->num_sip_ranges= add_excluded_ranges(&idx->sip_ranges,list,SIP);
+    idx->num_dip_ranges= add_excluded_ranges(&idx->dip_ranges,list,DIP);
+    if (idx->num_sip_ranges < 0 || idx->num_dip_ranges < 0) {
+        (*msg_callback)(SPADE_MSG_TYPE_FATAL,"Out of memory setting up report exclusions\n");
+        return;
+    }
+    
+    idx->empty= (idx->sport_map == NULL && idx->dport_map == NULL
+                 && idx->num_sip_ranges == 0 && idx->num_dip_ranges == 0);
+}
+
+/* set *ranges to the sorted, disjoint ranges of the networks in list to
+   exclude on feat, returning how many there are (or -1 if out of memory) */
+static int add_excluded_ranges(net_range **ranges,xfeatval_link *list,features feat) {
+    xfeatval_link *x;
+    int count= 0;
+    
+    for (x= list; x != NULL; x= x->next) {
+        if (x->type == XARG_TYPE_CIDR && x->feat == feat) count++;
+    }
+    if (count == 0) return 0;
+    *ranges= (net_range *)malloc(sizeof(net_range)*count);
+    if (*ranges == NULL) return -1;
+
+    count= 0;
+    for (x= list; x != NULL; x= x->next) {
+        if (x->type != XARG_TYPE_CIDR || x->feat != feat) continue;
+        if (x->val.cidr.netip & ~x->val.cidr.netmask) continue; /* host bits set; no address can match */
+        (*ranges)[count].lo= x->val.cidr.netip;
+        (*ranges)[count].hi= x->val.cidr.netip | ~x->val.cidr.netmask;
+        count++;
+    }
+    return merge_net_ranges(*ranges,count);
+}
+
+static int pkt_is_excluded(xfeatval_index *idx,spade_event *pkt) {
+    int res;
+    
+    if (idx->empty) return 0;
+    if (idx->sport_map != NULL && PORT_IN_MAP(idx->sport_map,pkt->fldval[SPORT])) return 1;
+    if (idx->dport_map != NULL && PORT_IN_MAP(idx->dport_map,pkt->fldval[DPORT])) return 1;
+    if (idx->num_sip_ranges > 0) {
+        IP_IN_NET_RANGES(idx->sip_ranges,idx->num_sip_ranges,pkt->fldval[SIP],res);
+        if (res) return 1;
+    }
+    if (idx->num_dip_ranges > 0) {
+        IP_IN_NET_RANGES(idx->dip_ranges,idx->num_dip_ranges,pkt->fldval[DIP],res);
+        if (res) return 1;
     }
     return 0;
 }
@@ -35,6 +35,13 @@ warranty is expressed for this program.
 #include "event_recorder.h"
 #include "spade_output.h"
 
+#include <sys/types.h>
+#include <sys/time.h>
+
+/// the most packets whose conditions netspade_new_pkts() calculates at once
+#define NETSPADE_BATCH_SIZE 256
+/// the number of entries in the table of the conditions that each kind of packet satisfies
+#define PKT_CONDS_TABLE_SIZE 0x48
 
 typedef void (*netspade_exc_callback_t)(void *context,spade_report *rpt);
 typedef void (*netspade_adj_callback_t)(void *context,char *id,char *mess,int using_corrrscore);
@@ -56,7 +63,25 @@ typedef struct _xfeatval_link {
     struct _xfeatval_link *next; /// the next element in a linked list of this type
 } xfeatval_link;
 
+/// a range of addresses, from lo to hi inclusive
+typedef struct {
+    u32 lo; ///< the first address in the range
+    u32 hi; ///< the last address in the range
+} net_range;
+
+/// the reports to exclude, as compiled from a list of xfeatval_link, so checking a packet does not mean walking the list
+typedef struct {
+    int empty; ///< set if nothing is excluded
+    u8 *sport_map; ///< a bitmap over the source ports, with those to exclude set; NULL if none are excluded
+    u8 *dport_map; ///< a bitmap over the destination ports, with those to exclude set; NULL if none are excluded
+    net_range *sip_ranges; ///< the source addresses to exclude, as sorted, disjoint ranges
+    int num_sip_ranges; ///< the number of entries in sip_ranges
+    net_range *dip_ranges; ///< the destination addresses to exclude, as sorted, disjoint ranges
+    int num_dip_ranges; ///< the number of entries in dip_ranges
+} xfeatval_index;
+
 struct _netspade;
+struct _netspade_pipeline;
 
 /// encapsulates the state specific to a netspade detector
 typedef struct _netspade_detector {
@@ -98,6 +123,8 @@ typedef struct _netspade_detector {
     
     /// a linked list of reports to exclude in this detector; suppliments netspade's global list
     xfeatval_link *rpt_exclude_list;
+    /// rpt_exclude_list, indexed by the field each exclusion is on
+    xfeatval_index rpt_exclude_index;
 
     /// \brief the detection type we report for this detector
     /// \note eventually, there may be more than one detection type possible from a given detector, so this will need to be generalized
@@ -113,27 +140,75 @@ typedef struct _ll_net {
     struct _ll_net *next;  ///< the next link in a linked list of networks
 } ll_net;
 
+/// the number of packet condition sets a netspade remembers the detector work for; a power of 2
+#define NETSPADE_DISPATCH_SLOTS 32
+
+/// a detector_step action: the detector scores the packet
+#define DISPATCH_SCORE 0x1
+/// a detector_step action: the packet is a response that might cancel a report as open
+#define DISPATCH_CANCEL_OPEN 0x2
+/// a detector_step action: the packet is a response that might cancel a report as closed
+#define DISPATCH_CANCEL_CLOSED 0x4
+
+/// something to be done by a detector with a packet
+typedef struct {
+    netspade_detector *detector; ///< the detector
+    int actions; ///< what the detector does with the packet; a bitmask of DISPATCH_* values
+} detector_step;
+
+/// the detector work to do for packets satisfying a set of packet conditions
+typedef struct {
+    event_condition_set conds; ///< the packet conditions
+    int num; ///< the number of entries in steps; -1 if this slot is not in use
+    int size; ///< the number of entries there is room for in steps
+    detector_step *steps; ///< the work, in the order of the detector list
+} detector_dispatch;
+
+/// the threads and queues of a netspade running pipelined; this is private to netspade.c
+typedef struct _netspade_pipeline netspade_pipeline;
+
 /// a instance of netspade
 typedef struct _netspade {
     /// the head of a linked list of detectors contained in this netspade
     netspade_detector *detectors;
     /// the tail of the linked list of detectors
     netspade_detector *detectors_tail;
+    /// the threads packets are handed to when running pipelined (see netspade_start_pipeline()); NULL otherwise
+    netspade_pipeline *pipeline;
     /// the packet conditions under which we need to pass an event to our event_recorder
     event_condition_set recorder_needed_conds;
     /// the packet conditions under which we need to do something besides storing a packet
     event_condition_set nonstore_conds;
     /// the the packet conditions that we actually need to calculate for any given packet
     event_condition_set conds_to_calc;
+    /// the conditions (among conds_to_calc, and other than the homenet ones) that each kind of packet satisfies
+    event_condition_set pkt_conds_table[PKT_CONDS_TABLE_SIZE];
+    /// the detector work for the packet condition sets seen lately, hashed by the condition set
+    detector_dispatch dispatch[NETSPADE_DISPATCH_SLOTS];
 
     ll_net *homelist_head; ///< the head a linked list of home networks
     ll_net *homelist_tail; ///< the tail in a linked list of home networks 
+    net_range *home_ranges; ///< the addresses in the home networks, as sorted, disjoint ranges to search
+    int num_home_ranges; ///< the number of entries in home_ranges
 
     char *checkpoint_file; ///< the name of the file to checkpoint to
     int checkpoint_freq; ///< the frequency (in recorded packet counts) with which to checkpoint
 
     /// records how many things have been recorded since the last checkpoint
     int records_since_checkpoint;
+    int checkpoint_in_background; ///< if set, periodic checkpoints are written by a child process while we go on with packets
+    pid_t checkpoint_pid; ///< the child process writing a checkpoint; 0 if there is none
+    struct timeval checkpoint_started; ///< when the checkpoint being written was started
+    double last_checkpoint_secs; ///< how long the last completed checkpoint took to write, in seconds; < 0 if there has been none
+    long last_checkpoint_bytes; ///< the size of the file the last completed checkpoint wrote
+    int last_checkpoint_background; ///< whether the last completed checkpoint was written in the background
+    int last_checkpoint_delta; ///< whether the last completed checkpoint was a delta checkpoint
+    int checkpoint_deltas; ///< the number of delta checkpoints, with only what changed since the one before, to write between full checkpoints
+    int delta_seq; ///< the number of delta checkpoints since the last full one, including the one being written
+    u32 checkpoint_stamp; ///< the stamp of the last checkpoint (or the one being written), which the next delta follows on from; 0 if the next must be a full checkpoint
+    char *delta_file; ///< the name of the file of the latest delta checkpoint
+    char *chain_file; ///< after recovery, the file of the full checkpoint that checkpoint_stamp follows on from
+    int checkpoint_compress; ///< whether checkpoints are written with their probability tables compressed
     /// the last packet time that we passed along to the enties that need it
     time_t last_time_forwarded;
     
@@ -152,6 +227,7 @@ typedef struct _netspade {
     event_native_freer_t pkt_native_freer_callback;
     
     xfeatval_link *rpt_exclude_list; ///< a linked list of reports to exclude globally
+    xfeatval_index rpt_exclude_index; ///< rpt_exclude_list, indexed by the field each exclusion is on
 
     event_recorder recorder; ///< our event recorder
 
@@ -173,6 +249,10 @@ netspade *new_netspade_from_statefile(char *statefile, spade_msg_fn msg_callback
 
 void netspade_set_callbacks(netspade *self, void *context, netspade_exc_callback_t exc_callback, netspade_adj_callback_t adj_callback, event_native_copier_t pkt_native_copier_callback, event_native_freer_t pkt_native_freer_callback);
 void netspade_set_checkpointing(netspade *self, char *checkpoint_file, int checkpoint_freq);
+void netspade_set_background_checkpointing(netspade *self, int on);
+void netspade_set_delta_checkpointing(netspade *self, int deltas);
+void netspade_set_checkpoint_compression(netspade *self, int on);
+void netspade_set_memory_limit(netspade *self, unsigned long bytes);
 void netspade_set_homenet_from_str(netspade *self, char *homenet_str);
 void netspade_set_output_stats(netspade *self, int stats_to_print);
 void netspade_set_output_stats_from_str(netspade *self, char *str);
@@ -192,9 +272,14 @@ char *netspade_setup_detector_advise_from_str(netspade *self, char *str);
 int netspade_setup_detector_survey(netspade *self, char *detectorid, char *filename, float interval);
 char *netspade_setup_detector_survey_from_str(netspade *self, char *str);
 
+void netspade_setup_complete(netspade *self);
 void netspade_new_pkt(netspade *self, spade_event *pkt);
+void netspade_new_pkts(netspade *self, spade_event pkts[], int n);
+int netspade_start_pipeline(netspade *self);
+void netspade_stop_pipeline(netspade *self);
 
 void netspade_dump(netspade *self);
+int netspade_check_tables(netspade *self);
 void netspade_cleanup(netspade *self);
 void netspade_write_log(netspade *self);
 
@@ -0,0 +1,190 @@
+/*********************************************************************
+netspade_shards.c, distributed as part of Spade v030125.1
+Author: James Hoagland, Silicon Defense (hoagland@SiliconDefense.com)
+copyright (c) 2002 by Silicon Defense (http://www.silicondefense.com/)
+Released under GNU General Public License, see the COPYING file included
+with the distribution or http://www.silicondefense.com/spice/ for details.
+
+Please send complaints, kudos, and especially improvements and bugfixes to
+hoagland@SiliconDefense.com.  As described in GNU General Public License, no
+warranty is expressed for this program.
+*********************************************************************/
+
+/*! \file netspade_shards.c
+ * \brief
+ *  contains the routines for netspade_shards, which runs several netspades
+ *  side by side on shares of the packets
+ * \ingroup netspade_layer
+ */
+
+/*! \addtogroup netspade_layer
+    @{
+*/
+
+#include <stdlib.h>
+#include "netspade_shards.h"
+#include "event_recorder.h"
+#include "spade_output.h"
+
+static void shards_report_anom(void *context, spade_report *rpt);
+static void shards_report_thresh_changed(void *context, char *id, char *mess, int using_corrscore);
+
+/* set up a set of num netspades, each set up by the user in the same way,
+   to share out the packets; every merge_freq secs (of packet time) their
+   tables are merged into the model they all score against.  From here on
+   the shards are only used through self.  Returns 0 if out of memory */
+int init_netspade_shards(netspade_shards *self,netspade *shards[],int num,int merge_freq) {
+    int i;
+    self->num= num;
+    self->merge_freq= merge_freq;
+    self->next_merge= 0;
+    self->running= 0;
+    self->merges= 0;
+    self->exc_callback= NULL;
+    self->adj_callback= NULL;
+    self->callback_context= NULL;
+    self->shards= (netspade **)malloc(num*sizeof(netspade *));
+    self->recorders= (event_recorder **)malloc(num*sizeof(event_recorder *));
+    if (self->shards == NULL || self->recorders == NULL) {
+        if (self->shards != NULL) free(self->shards);
+        if (self->recorders != NULL) free(self->recorders);
+        return 0;
+    }
+    for (i= 0; i < num; i++) {
+        self->shards[i]= shards[i];
+        self->recorders[i]= &shards[i]->recorder;
+    }
+#ifdef SPADE_USE_THREADS
+    pthread_mutex_init(&self->callback_lock,NULL);
+#endif
+    return 1;
+}
+
+/* set the callbacks for the shards, as with netspade_set_callbacks(); the
+   report callbacks are called one at a time, but (when the shards are
+   running pipelined) from the threads of the shards */
+void netspade_shards_set_callbacks(netspade_shards *self,void *context,netspade_exc_callback_t exc_callback,netspade_adj_callback_t adj_callback,event_native_copier_t pkt_native_copier_callback,event_native_freer_t pkt_native_freer_callback) {
+    int i;
+    self->exc_callback= exc_callback;
+    self->adj_callback= adj_callback;
+    self->callback_context= context;
+    for (i= 0; i < self->num; i++) {
+        netspade_set_callbacks(self->shards[i],self,shards_report_anom,(adj_callback == NULL) ? NULL : shards_report_thresh_changed,pkt_native_copier_callback,pkt_native_freer_callback);
+    }
+}
+
+/* have each shard process its packets in threads of its own, from here
+   on; see netspade_start_pipeline().  Returns 1 if they all are and 0
+   otherwise; shards that are not take their packets in the calling thread */
+int netspade_shards_start(netspade_shards *self) {
+    int i,all= 1;
+#ifdef SPADE_USE_THREADS
+    for (i= 0; i < self->num; i++) {
+        if (netspade_start_pipeline(self->shards[i]))
+            self->running= 1;
+        else
+            all= 0;
+    }
+#else
+    (*self->shards[0]->msg_callback)(SPADE_MSG_TYPE_WARNING,"Spade was built without SPADE_USE_THREADS, so its shards take turns in one thread\n");
+    for (i= 0; i < self->num; i++) netspade_setup_complete(self->shards[i]);
+    all= 0;
+#endif
+    return all;
+}
+
+/* wait for the shards to get through the packets they have been given and
+   have them process packets in the calling thread again */
+void netspade_shards_stop(netspade_shards *self) {
+    int i;
+    if (!self->running) return;
+    for (i= 0; i < self->num; i++) netspade_stop_pipeline(self->shards[i]);
+    self->running= 0;
+}
+
+/* pass pkt on to the shard for its flow, first merging the shards' tables
+   if that has come due */
+void netspade_shards_new_pkt(netspade_shards *self,spade_event *pkt) {
+    if (self->merge_freq > 0) {
+        if (self->next_merge == 0) {
+            self->next_merge= (time_t)pkt->time + self->merge_freq;
+        } else if ((time_t)pkt->time >= self->next_merge) {
+            netspade_shards_merge(self);
+            while (self->next_merge <= (time_t)pkt->time) self->next_merge+= self->merge_freq;
+        }
+    }
+    netspade_new_pkt(self->shards[(NETSPADE_FLOW_HASH(pkt) >> 16) % self->num],pkt);
+}
+
+/* pass n packets on to the shards, as with netspade_shards_new_pkt() */
+void netspade_shards_new_pkts(netspade_shards *self,spade_event pkts[],int n) {
+    int i;
+    for (i= 0; i < n; i++) netspade_shards_new_pkt(self,&pkts[i]);
+}
+
+/* merge the shards' tables into a model that they all score against from
+   now on, in place of the model from the last merge.  The shards are
+   paused for this while they are running pipelined, since their tables are
+   read.  With one shard there is nothing to merge, as it is already
+   scoring against all the packets.  Returns 0 if the merge could not be
+   done, in which case each shard scores against its own tables until the
+   next one */
+int netspade_shards_merge(netspade_shards *self) {
+    int i,ok,running= self->running;
+
+    if (self->num < 2) return 1;
+    netspade_shards_stop(self);
+    for (i= 0; i < self->num; i++) netspade_setup_complete(self->shards[i]);
+    ok= event_recorder_share_model(self->recorders,self->num);
+    if (ok) {
+        self->merges++;
+    } else {
+        (*self->shards[0]->msg_callback)(SPADE_MSG_TYPE_WARNING,"Could not merge the tables of the Spade shards; each is scoring against its own\n");
+    }
+    if (running) netspade_shards_start(self);
+    return ok;
+}
+
+/* finish with the shards: let them get through their packets, then clean
+   each up as with netspade_cleanup(), which writes its log and state */
+void netspade_shards_cleanup(netspade_shards *self) {
+    int i;
+    netspade_shards_stop(self);
+    event_recorder_drop_model(self->recorders,self->num);
+    for (i= 0; i < self->num; i++) netspade_cleanup(self->shards[i]);
+#ifdef SPADE_USE_THREADS
+    pthread_mutex_destroy(&self->callback_lock);
+#endif
+    free(self->recorders);
+    free(self->shards);
+    self->recorders= NULL;
+    self->shards= NULL;
+}
+
+/* the exc_callback of each shard: pass the report on to the user */
+static void shards_report_anom(void *context,spade_report *rpt) {
+    netspade_shards *self= (netspade_shards *)context;
+#ifdef SPADE_USE_THREADS
+    pthread_mutex_lock(&self->callback_lock);
+#endif
+    (*self->exc_callback)(self->callback_context,rpt);
+#ifdef SPADE_USE_THREADS
+    pthread_mutex_unlock(&self->callback_lock);
+#endif
+}
+
+/* the adj_callback of each shard: pass the adjustment on to the user */
+static void shards_report_thresh_changed(void *context,char *id,char *mess,int using_corrscore) {
+    netspade_shards *self= (netspade_shards *)context;
+#ifdef SPADE_USE_THREADS
+    pthread_mutex_lock(&self->callback_lock);
+#endif
+    (*self->adj_callback)(self->callback_context,id,mess,using_corrscore);
+#ifdef SPADE_USE_THREADS
+    pthread_mutex_unlock(&self->callback_lock);
+#endif
+}
+
+/*@}*/
+
+/* $Id$ */
@@ -0,0 +1,81 @@
+/*********************************************************************
+netspade_shards.h, distributed as part of Spade v030125.1
+Author: James Hoagland, Silicon Defense (hoagland@SiliconDefense.com)
+copyright (c) 2002 by Silicon Defense (http://www.silicondefense.com/)
+Released under GNU General Public License, see the COPYING file included
+with the distribution or http://www.silicondefense.com/spice/ for details.
+
+Please send complaints, kudos, and especially improvements and bugfixes to
+hoagland@SiliconDefense.com.  As described in GNU General Public License, no
+warranty is expressed for this program.
+*********************************************************************/
+
+/*! \file netspade_shards.h
+ * \brief
+ *  netspade_shards.h is the header file for netspade_shards.c
+ * \ingroup netspade_layer
+ */
+
+/*! \addtogroup netspade_layer
+    @{
+*/
+
+#ifndef NETSPADE_SHARDS_H
+#define NETSPADE_SHARDS_H
+
+#include "netspade.h"
+#include "netspade_features.h"
+#include "spade_event.h"
+
+#ifdef SPADE_USE_THREADS
+#include <pthread.h>
+#endif
+
+/// the default number of seconds (of packet time) between merges of the shards' tables
+#define NETSPADE_SHARDS_MERGE_FREQ 60
+
+/// a hash of the flow of a netspade packet; it is the same for the packets going each way
+#define NETSPADE_FLOW_HASH(pkt) ( (((u32)((pkt)->fldval[SIP] ^ (pkt)->fldval[DIP])) * 2654435761U) \
+                                ^ (((u32)((pkt)->fldval[SPORT] ^ (pkt)->fldval[DPORT])) * 2246822519U) )
+
+/// a set of netspades that share out the packets between them and score against what they have all seen
+/** Each shard is a netspade of its own, set up by the user the same way
+    as the others, and gets the packets of a share of the flows (both
+    directions of a flow go to the same shard, so the responses to a
+    packet can cancel its report).  Each shard learns into its own tables;
+    every merge_freq seconds their counts are added up into a model that
+    all the shards score against until the next merge.  Where threads are
+    available, each shard runs pipelined (see netspade_start_pipeline())
+    in threads of its own. */
+typedef struct {
+    netspade **shards; ///< the shards
+    event_recorder **recorders; ///< the event recorder of each shard
+    int num; ///< the number of shards
+    int merge_freq; ///< how often (in secs of packet time) the shards' tables are merged into the model they score against; 0 for never
+    time_t next_merge; ///< the packet time the next merge is due at; 0 before the first packet
+    int running; ///< set if the shards are running pipelined
+    unsigned long merges; ///< the number of merges done
+
+    netspade_exc_callback_t exc_callback; ///< the user's callback for an anomalous event
+    netspade_adj_callback_t adj_callback; ///< the user's callback for a threshold adjustment, or NULL if none
+    void *callback_context; ///< the user's context for the callbacks
+#ifdef SPADE_USE_THREADS
+    pthread_mutex_t callback_lock; ///< held while calling one of the user's callbacks, so they are called one at a time
+#endif
+} netspade_shards;
+
+int init_netspade_shards(netspade_shards *self, netspade *shards[], int num, int merge_freq);
+void netspade_shards_set_callbacks(netspade_shards *self, void *context, netspade_exc_callback_t exc_callback, netspade_adj_callback_t adj_callback, event_native_copier_t pkt_native_copier_callback, event_native_freer_t pkt_native_freer_callback);
+int netspade_shards_start(netspade_shards *self);
+void netspade_shards_stop(netspade_shards *self);
+
+void netspade_shards_new_pkt(netspade_shards *self, spade_event *pkt);
+void netspade_shards_new_pkts(netspade_shards *self, spade_event pkts[], int n);
+int netspade_shards_merge(netspade_shards *self);
+
+void netspade_shards_cleanup(netspade_shards *self);
+
+/*@}*/
+#endif // NETSPADE_SHARDS_H
+
+/* $Id$ */
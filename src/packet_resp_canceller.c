@@ -60,9 +60,9 @@ static void free_prc_lookup_table2_clean(prc_lookup_table2 *t);
 }
 
 /// free list of allocated prc_lookup_table2s
-prc_lookup_table2 *prc_lookup_table2_freelist= NULL;
+SPADE_THREAD_LOCAL prc_lookup_table2 *prc_lookup_table2_freelist= NULL;
 /// free list of allocated prc_links
-prc_link *prc_link_freelist= NULL;
+SPADE_THREAD_LOCAL prc_link *prc_link_freelist= NULL;
 
 //int disp_hashinfo= 0;
 
@@ -109,6 +109,21 @@ void free_packet_resp_canceller(packet_resp_canceller *self) {
     free(self);
 }
 
+/* return the prc_links and prc_lookup_table2s on this thread's free lists
+   to the system */
+void packet_resp_canceller_free_freelists(void) {
+    prc_link *next;
+    prc_lookup_table2 *next2;
+    for (; prc_link_freelist != NULL; prc_link_freelist= next) {
+        next= prc_link_freelist->ttl_next;
+        free(prc_link_freelist);
+    }
+    for (; prc_lookup_table2_freelist != NULL; prc_lookup_table2_freelist= next2) {
+        next2= (prc_lookup_table2 *)prc_lookup_table2_freelist->arr[0];
+        free(prc_lookup_table2_freelist);
+    }
+}
+
 void packet_resp_canceller_new_time(packet_resp_canceller *self,time_t now) {
     int i;
     prc_link *l;
@@ -82,6 +82,7 @@ typedef struct {
 void init_packet_resp_canceller(packet_resp_canceller *self,int wait_secs,prc_report_status_fn status_callback,void *callback_context,port_status_t timeout_implication);
 packet_resp_canceller *new_packet_resp_canceller(int wait_secs,prc_report_status_fn status_callback,void *callback_context,port_status_t timeout_implication);
 void free_packet_resp_canceller(packet_resp_canceller *self);
+void packet_resp_canceller_free_freelists(void);
 
 void packet_resp_canceller_new_time(packet_resp_canceller *self,time_t time);
 
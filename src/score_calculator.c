@@ -98,8 +98,19 @@ void score_calculator_set_scaling(score_calculator *self,int scale_freq,double s
     self->evfiles_data->prune_threshold= prune_threshold;
 }
 
+void score_calculator_set_tree_kind(score_calculator *self,u8 tree_kind) {
+    if (self->evfiles_data == NULL) self->evfiles_data= new_evfiles_specs();
+    self->evfiles_data->tree_kind= tree_kind;
+}
+
+void score_calculator_set_freeze_freq(score_calculator *self,int freeze_freq) {
+    if (self->evfiles_data == NULL) self->evfiles_data= new_evfiles_specs();
+    self->evfiles_data->freeze_freq= freeze_freq;
+}
+
 void score_calculator_init_complete(score_calculator *self) {
     table_use_specs *d;
+    int i;
     
     if (self->evfiles_data == NULL) return; /* nothing to do */
     d= self->evfiles_data;
@@ -116,6 +127,23 @@ void score_calculator_init_complete(score_calculator *self) {
     } else {
         self->evfiles= event_recorder_new_event_files(self->recorder,d->prodcount,d->feats,d->featurenames,d->conds,d->scale_freq,d->scale_factor,d->prune_threshold,0);
     }
+    if (d->tree_kind != TREE_KIND_BINARY) {
+        if (d->prodcount == 1) {
+            event_recorder_set_tree_kind(self->evfile,d->tree_kind);
+        } else {
+            for (i=0; i < d->prodcount; i++) event_recorder_set_tree_kind(self->evfiles[i],d->tree_kind);
+        }
+    }
+    if (d->freeze_freq > 0) {
+        if (d->prodcount == 1) {
+            event_recorder_set_freeze_freq(self->evfile,d->freeze_freq);
+        } else {
+            for (i=0; i < d->prodcount; i++) event_recorder_set_freeze_freq(self->evfiles[i],d->freeze_freq);
+        }
+    }
+    if (self->max_entropy > 0 && d->prodcount == 1) { /* we will be asking for entropies all the time */
+        event_recorder_keep_entropy(self->evfile);
+    }
     free(self->evfiles_data->feats);
     free(self->evfiles_data);
     self->evfiles_data= NULL;
@@ -174,19 +202,20 @@ score_info *score_calculator_calc_event_score(score_calculator *self,spade_event
             prob*= event_recorder_get_condprob(self->recorder,self->evfiles[prodidx],event,-1,1);
         rawscore= -1*(log(prob)/LOG2);
     } else {
+        spade_prob_query q; /* everything we need from the table in one lookup */
+        event_recorder_query(self->evfile,event,self->cond_prefix_len,(self->max_entropy > 0) ? self->entropy_prefix_len : -1,&q);
         if (self->min_obs_count > 0) {
-            double count= event_recorder_get_count(self->recorder,self->evfile,event,self->min_obs_prefix_len);
-            if ((count+1) < self->min_obs_count) {
+            if ((q.count[self->min_obs_prefix_len]+1) < self->min_obs_count) {
                 *enoughobs= 0;
                 return NULL;
             }
         }
         if (self->max_entropy > 0) {
             double entropy;
-            entropy= event_recorder_get_entropy(self->recorder,self->evfile,event,self->entropy_prefix_len);
+            entropy= event_recorder_query_entropy(self->evfile,&q);
             if (entropy > self->max_entropy) return NULL;
         }
-        prob= event_recorder_get_condprob(self->recorder,self->evfile,event,self->cond_prefix_len,1);
+        prob= q.condprob_plus_one;
         if (self->calc_rawscore) { // calculate raw anomaly score
             if (self->use_corrscore) { // use the scores that are computed as adverstised
                 rawscore= -1.0*(log(prob)/LOG2);
@@ -195,7 +224,7 @@ score_info *score_calculator_calc_event_score(score_calculator *self,spade_event
             }
         }
         if (self->calc_relscore) { // calculate relative anomaly score
-            double basecount= event_recorder_get_count(self->recorder,self->evfile,event,self->cond_prefix_len)+1;
+            double basecount= q.count[q.condbase]+1;
             double ratio= log(prob)/log(1/basecount);
             relscore= ratio; /* *ratio; */
         }
@@ -219,6 +248,11 @@ double score_calculator_get_obs_count(score_calculator *self) {
     return event_recorder_get_obs_count(self->recorder,f);
 }
 
+void score_calculator_file_print_prune_status(score_calculator *self, FILE *f) {
+    evfile_ref ef= (self->prodcount > 1) ? self->evfiles[0] : self->evfile;
+    event_recorder_file_print_prune_status(self->recorder,ef,f);
+}
+
 static table_use_specs *new_evfiles_specs() {
     table_use_specs *new= (table_use_specs *)malloc(sizeof(table_use_specs));
     new->prodcount= 1;
@@ -229,6 +263,8 @@ static table_use_specs *new_evfiles_specs() {
     new->scale_freq= -1;
     new->scale_factor= 1;
     new->prune_threshold= 0;
+    new->tree_kind= TREE_KIND_BINARY;
+    new->freeze_freq= 0;
     return new;
 }
 
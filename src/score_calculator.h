@@ -40,6 +40,8 @@ typedef struct {
     int scale_freq; ///< how often the table will be scaled/pruned, in secs
     double scale_factor; ///< when we scale, how much do we do so by
     double prune_threshold; ///< if an observation gets below this size, it will be discarded
+    u8 tree_kind; ///< the representation (TREE_KIND_*) to use for the trees in the table
+    int freeze_freq; ///< how often (in secs) to freeze the table for scoring against; 0 for never
 } table_use_specs;
 
 /// an instance of a score calculator
@@ -68,6 +70,8 @@ void init_score_calculator_clear(score_calculator *self, event_recorder *recorde
 void score_calculator_set_features(score_calculator *self, int prodcount, feature_list prod_cond[], feature_list *calc_feats, const char **featurenames);
 void score_calculator_set_storage_conditions(score_calculator *self, event_condition_set conds);
 void score_calculator_set_scaling(score_calculator *self, int scale_freq, double scale_factor, double prune_threshold);
+void score_calculator_set_tree_kind(score_calculator *self, u8 tree_kind);
+void score_calculator_set_freeze_freq(score_calculator *self, int freeze_freq);
 void score_calculator_init_complete(score_calculator *self);
 
 void score_calculator_set_condcutoff(score_calculator *self, int cond_prefix_len);
@@ -85,6 +89,7 @@ score_info *score_calculator_calc_event_score(score_calculator *self, spade_even
 
 int score_calculator_get_store_count(score_calculator *self);
 double score_calculator_get_obs_count(score_calculator *self);
+void score_calculator_file_print_prune_status(score_calculator *self, FILE *f);
 
 void score_calculator_print_config_details(score_calculator *self,FILE *f,char *indent);
 
@@ -12,6 +12,7 @@ warranty is expressed for this program.
 
 #include <stdlib.h>
 #include "score_info.h"
+#include "spade_features.h"
 
 /*! \file score_info.c
  * \brief 
@@ -27,7 +28,7 @@ warranty is expressed for this program.
 
 
 /// free list of allocated score_infos
-score_info *score_info_freelist=NULL;
+SPADE_THREAD_LOCAL score_info *score_info_freelist=NULL;
 
 /* creation and recycling routines for score_info's */
 
@@ -66,6 +67,15 @@ void free_score_infos(score_info *start) {
     score_info_freelist= start;
 }
 
+/* return the score_infos on this thread's free list to the system */
+void free_score_info_freelist(void) {
+    score_info *next;
+    for (; score_info_freelist != NULL; score_info_freelist= next) {
+        next= score_info_freelist->next;
+        free(score_info_freelist);
+    }
+}
+
 double score_info_mainscore(score_info *i) {
     return i->main == PREF_RAWSCORE ? i->rawscore : i->relscore;
 }
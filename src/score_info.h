@@ -49,6 +49,7 @@ void init_score_info(score_info *i, scorepref main, double relscore, double raws
 score_info *score_info_clone(score_info *i);
 void free_score_info(score_info *i);
 void free_score_infos(score_info *start);
+void free_score_info_freelist(void);
 
 double score_info_mainscore(score_info *i);
 double score_info_relscore(score_info *i);
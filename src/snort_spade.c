@@ -141,15 +141,15 @@ void SetupSpade()
      register the preprocessor function */
 void SpadeInit(u_char *argsstr)
 {
-    int prob_mode=3,checkpoint_freq=50000,recover;
-    double init_thresh= -1;
+    int prob_mode=3,checkpoint_freq=50000,recover,checkpoint_background= 0,checkpoint_deltas= 0,checkpoint_compress= 0;
+    double init_thresh= -1,memlimit_mb= 0;
     char statefile[401]= "spade.rcv";
     char outfile[401]= "-";
     int use_corrscore= 0;
     char dest[11]= "alert";
     char adjdest[11]= "\0";
     char xsips[401]="",xdips[401]="",xsports[401]="",xdports[401]="";
-    void *args[12];
+    void *args[16];
 
     args[0]= &init_thresh;
     args[1]= &statefile;
@@ -163,10 +163,15 @@ void SpadeInit(u_char *argsstr)
     args[9]= &xdips;
     args[10]= &xsports;
     args[11]= &xdports;
+    args[12]= &memlimit_mb;
+    args[13]= &checkpoint_background;
+    args[14]= &checkpoint_deltas;
+    args[15]= &checkpoint_compress;
     fill_args_space_sep(argsstr,"d:thresh;s400:statefile;s400:logfile;"
             "i:probmode;i:cpfreq;b:-corrscore,corrscore;s10:dest;s10:adjdest;"
             "s400:Xsips,Xsip,xsips;s400:Xdips,Xdip,xdips;"
-            "s400:Xsports,Xsport,xsports;s400:Xdports,Xdport,xdports",args,SnortSpadeMsgFn);
+            "s400:Xsports,Xsport,xsports;s400:Xdports,Xdport,xdports;d:memlimit;"
+            "b:cpbackground;i:cpdeltas;b:cpcompress",args,SnortSpadeMsgFn);
 
     if (as_debug) printf("statefile=%s; logfile=%s; cpfreq=%d\n",statefile,outfile,checkpoint_freq);
 
@@ -191,8 +196,24 @@ void SpadeInit(u_char *argsstr)
 
     netspade_set_checkpointing(spade,statefile,checkpoint_freq);
     LogMessage("    Spade will record its state to %s after every %d updates\n",statefile,checkpoint_freq);
+    if (checkpoint_background) {
+        netspade_set_background_checkpointing(spade,1);
+        LogMessage("    Spade's periodic state records will be written in the background\n");
+    }
+    if (checkpoint_deltas > 0) {
+        netspade_set_delta_checkpointing(spade,checkpoint_deltas);
+        LogMessage("    Spade will write %d state records of only what changed (to %s.N) between full ones\n",checkpoint_deltas,statefile);
+    }
+    if (checkpoint_compress) {
+        netspade_set_checkpoint_compression(spade,1);
+        LogMessage("    Spade's state records will be compressed\n");
+    }
     netspade_set_output_file(spade,outfile);
     LogMessage("    Spade's log is %s\n",outfile);
+    if (memlimit_mb > 0) {
+        netspade_set_memory_limit(spade,(unsigned long)(memlimit_mb*1024*1024));
+        LogMessage("    Spade's probability tables will be kept to about %.1f MB\n",memlimit_mb);
+    }
 
     if (!strcmp(dest,"log")) {
         LogMessage("    Spade reports will go to the log facility\n");
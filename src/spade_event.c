@@ -32,7 +32,7 @@ warranty is expressed for this program.
 */
 
 /// free list of allocated spade_events
-spade_event *spade_event_freelist=NULL;
+SPADE_THREAD_LOCAL spade_event *spade_event_freelist=NULL;
 
 /* creation and recycling routines for spade_event's */
 
@@ -64,6 +64,15 @@ void free_spade_event(spade_event *e) {
     spade_event_freelist= e;
 }
 
+/* return the spade_events on this thread's free list to the system */
+void free_spade_event_freelist(void) {
+    spade_event *next;
+    for (; spade_event_freelist != NULL; spade_event_freelist= next) {
+        next= (spade_event *)spade_event_freelist->native;
+        free(spade_event_freelist);
+    }
+}
+
 /*@}*/
 
 /* $Id: spade_event.c,v 1.6 2003/01/14 17:45:31 jim Exp $ */
@@ -51,6 +51,7 @@ typedef struct {
 spade_event *new_spade_event(void);
 spade_event *spade_event_clone(spade_event *e, event_native_copier_t native_copier, event_native_freer_t native_freer);
 void free_spade_event(spade_event *e);
+void free_spade_event_freelist(void);
 
 /*@}*/
 
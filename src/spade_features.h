@@ -79,4 +79,13 @@ typedef struct {
     features feat[MAX_NUM_FEATURES]; ///< 0-based array storing the features
 } feature_list;
 
+/* define SPADE_THREADED to give each thread its own current arena and free
+   lists; several netspades can then process packets at once in different
+   threads.  SPADE_USE_THREADS implies it */
+#if defined(SPADE_THREADED) || defined(SPADE_USE_THREADS)
+#define SPADE_THREAD_LOCAL __thread
+#else
+#define SPADE_THREAD_LOCAL
+#endif
+
 #endif // SPADE_FEATURES_H
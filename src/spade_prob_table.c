@@ -14,6 +14,7 @@ warranty is expressed for this program.
 #include "spade_features.h"
 #include <limits.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 /*! \file spade_prob_table.c,
@@ -48,6 +49,7 @@ warranty is expressed for this program.
 //static mindex find_leaf_in_subtree(dmindex encchild,valtype val) {
 #define find_leaf_in_subtree_macro(_encchild,_val,_res) { \
     mindex _child; \
+    int _slot; \
     \
     _res= TNULL; \
     while (_encchild != TNULL) { \
@@ -59,6 +61,15 @@ warranty is expressed for this program.
             } else { /* leaf not present */ \
                 break; \
             } \
+        } else if (isbnode(_encchild)) { /* scan the keys for the first slot that could hold _val */ \
+            _child= encbnode2mindex(_encchild); \
+            for (_slot= 0; _slot < bnused(_child)-1 && _val > bnkey(_child,_slot); _slot++) {} \
+            _encchild= bnchild(_child,_slot); \
+            continue; \
+        } else if (isdnode(_encchild)) { /* index straight to the slot; the leaf check catches values out of range */ \
+            _child= encdnode2mindex(_encchild); \
+            _encchild= dnchild(_child,dnslot(_child,_val)); \
+            continue; \
         } else { \
             _child= _encchild; \
         } \
@@ -82,6 +93,28 @@ warranty is expressed for this program.
     } \
 }
 
+/* the number of nodes visited by scale_and_prune_subtree(), for limiting the steps of an incremental pruning pass */
+static SPADE_THREAD_LOCAL u32 prune_visits= 0;
+/* how much scale_and_prune_subtree() has changed the count*ln(count) sum of the tree being done */
+static SPADE_THREAD_LOCAL double prune_clogc_change= 0.0;
+
+/* how much scale_and_prune_subtree() has changed the number of values in the tree being done */
+static SPADE_THREAD_LOCAL int prune_nvals_change= 0;
+
+/* the count on the leaf that incr_tree_value_count() last added to, from before it was added to; 0 for a new leaf */
+static SPADE_THREAD_LOCAL double incr_prior_count= 0.0;
+/* add an observation to an existing leaf, noting what it had */
+#define bump_leafcount(leaf) (incr_prior_count= leafcount(leaf), dirty_leaf(leaf), leafcount(leaf)+= OBS_INCR)
+
+/* a leaf's contribution to its tree's clogc */
+#define clogc_term(c) ((c) > 0.0 ? (c)*log(c) : 0.0)
+
+/// a tree that can be dense is considered for it when its number of values reaches this or a power of 2 above it
+#define DENSE_MIN_VALUES 32
+/// a tree is only made dense if its dnodes would take no more than this many times the space of the intnodes it replaces
+#define DENSE_MAX_GROWTH 4
+/// a dense tree is changed back once pruning leaves it with fewer values than this
+#define DENSE_DROP_VALUES (DENSE_MIN_VALUES/2)
 
 static int min_int(int a, int b);
 static int max_int(int a, int b);
@@ -94,11 +127,29 @@ static mindex add_node_above_to_right(mindex node, valtype val);
 static mindex add_node_above_to_left(mindex node, valtype val);
 static mindex add_node_between(mindex node, valtype val);
 static void rebalance_subtree(mindex encnode);
+static mindex new_wide_root(dmindex child, valtype largest);
+static mindex increment_wide_value_count(mindex tree, valtype val);
+static void insert_into_wide_path(mindex tree, mindex path[], int slot[], int level, int pos, valtype key, dmindex child);
+static dmindex scale_and_prune_wide_subtree(mindex node, double factor, double threshold, double *change, valtype *newrightmost, spade_prune_cursor *c);
+static void merge_wide_children(mindex node);
+static mindex increment_dense_value_count(mindex tree, valtype val);
+static void densify_tree(mindex tree);
+static void undensify_tree(mindex tree);
+static mindex *tree_leaves_in_order(mindex tree);
+static void collect_subtree_leaves(dmindex encnode, mindex *leaves, u32 *n);
+static void free_interior_in_subtree(dmindex encnode);
+static dmindex build_balanced_subtree(mindex leaves[], u32 n);
+static dmindex build_wide_subtree(mindex leaves[], u32 n);
+static dmindex build_weighted_subtree(mindex leaves[], double sums[], u32 n, double before);
+static dmindex scale_and_prune_dense_subtree(mindex node, double factor, double threshold, double *change, valtype *newrightmost, spade_prune_cursor *c);
 static int out_of_balance(mindex node);
 static void free_all_in_tree(mindex tree);
 static void free_all_in_subtree(dmindex encnode);
-static void scale_and_prune_tree(mindex tree, double factor, double threshold);
-static dmindex scale_and_prune_subtree(dmindex encnode, double factor, double threshold, double *change, valtype *newrightmost);
+static mindex add_to_tree_value_count(mindex tree, valtype newval);
+static void scale_and_prune_tree(mindex tree, double factor, double threshold, spade_prune_cursor *c);
+static dmindex scale_and_prune_subtree(dmindex encnode, double factor, double threshold, double *change, valtype *newrightmost, spade_prune_cursor *c);
+static int prune_step_skips(spade_prune_cursor *c, dmindex encnode, double *change, valtype *newrightmost);
+static void prune_step_did(spade_prune_cursor *c, valtype largest);
 static valtype largest_val(mindex node);
 static mindex dup_intnode(mindex node);
 static mindex find_leaf(mindex tree, valtype val);
@@ -130,10 +181,34 @@ static void printtree2(spade_prob_table *self,dmindex encnode, char *ind);
 static void printtree2_shallow(dmindex encnode);
 static int sanity_check_tree(mindex tree);
 static int sanity_check_subtree(dmindex encnode);
+static int compare_spade_prob_tables(spade_prob_table *self, spade_prob_table *other, const char *what);
+static int compare_frozen_trees(spade_frozen_table *a, mindex ta, spade_frozen_table *b, mindex tb, const char *what);
+static int frozen_counts_differ(double a, double b);
+static int load_frozen_values(spade_prob_table_loader *loader, spade_frozen_table *frozen, mindex tree, u32 k, int depth);
 static mindex find_leaf2(spade_prob_table *self, features type1, valtype val1, features type2, valtype val2);
 static mindex find_leaf3(spade_prob_table *self, features type1, valtype val1, features type2, valtype val2, features type3, valtype val3);
-static double calc_tree_entropy(mindex tree);
-static double calc_subtree_entropy(mindex node,double prob_base);
+static double tree_entropy(mindex tree);
+static double subtree_clogc(dmindex encnode);
+static void init_tree_clogc(mindex tree);
+static double init_subtree_clogc(dmindex encnode);
+static void init_all_clogc(spade_prob_table *self);
+static int load_tree_list(spade_prob_table_loader *loader, spade_mem_arena *from, mindex tree, int depth);
+static int load_subtree(spade_prob_table_loader *loader, spade_mem_arena *from, features type, dmindex encnode, int depth);
+static int merge_table(spade_prob_table *self, spade_prob_table *other, double weight);
+static int merge_tree(spade_mem_arena *from, mindex srctree, mindex tree, double weight);
+static void set_tree_leaves(mindex tree, mindex leaves[], u32 n);
+static void finish_load_level(spade_prob_table_loader *self);
+static int frozen_room(spade_freeze_cursor *c, u32 ntrees, u32 nvals);
+static void fit_frozen_copy(spade_freeze_cursor *c);
+static int start_frozen_top(spade_prob_table *self, spade_freeze_cursor *c);
+static int freeze_top_value(spade_prob_table *self, spade_freeze_cursor *c);
+static int finish_frozen_top(spade_freeze_cursor *c);
+static void place_frozen_top(spade_freeze_cursor *c, u32 first, u32 k, u32 *i);
+static int freeze_tree(spade_freeze_cursor *c, mindex tree, u32 slot);
+static int freeze_values(spade_freeze_cursor *c, mindex leaves[], u32 n, u32 first, u32 k, u32 *i);
+static int freeze_nested(spade_freeze_cursor *c, mindex leaf, u32 *sub, u8 *nsub);
+static u32 frozen_find(spade_frozen_table *self, mindex tree, valtype val);
+static mindex frozen_nexttree(spade_frozen_table *self, u32 v, features type);
 
 
 #ifndef LOG2
@@ -144,7 +219,7 @@ static double calc_subtree_entropy(mindex node,double prob_base);
 void init_spade_prob_table(spade_prob_table *self,const char **featurenames,int recovering) {
     int i;
     if (!recovering) {
-        init_mem();
+        self->arena= new_spade_mem_arena();
     
         for (i=0; i < MAX_NUM_FEATURES; i++) {
             self->root[i]= TNULL;
@@ -159,6 +234,73 @@ spade_prob_table *new_spade_prob_table(const char **featurenames) {
     return new;
 }
 
+/* return a new, empty table with the same feature names and representation
+   settings as other; NULL if out of memory */
+spade_prob_table *new_spade_prob_table_like(spade_prob_table *other) {
+    spade_prob_table *new= (spade_prob_table *)malloc(sizeof(spade_prob_table));
+    if (new == NULL) return NULL;
+    init_spade_prob_table(new,other->featurenames,0);
+    new->arena->tree_kind= other->arena->tree_kind;
+    new->arena->keep_clogc= other->arena->keep_clogc;
+    memcpy(new->arena->dense_levels,other->arena->dense_levels,sizeof(new->arena->dense_levels));
+    return new;
+}
+
+/* free a table made with new_spade_prob_table() or new_spade_prob_table_like() */
+void free_spade_prob_table(spade_prob_table *self) {
+    free_spade_mem_arena(self->arena);
+    free(self);
+}
+
+/* release all the memory used by the table for its observations, leaving it empty */
+void free_spade_prob_table_mem(spade_prob_table *self) {
+    int i;
+    u8 kind= self->arena->tree_kind;
+    u8 keep_clogc= self->arena->keep_clogc;
+    u8 dense_levels[MAX_NUM_FEATURES];
+    memcpy(dense_levels,self->arena->dense_levels,sizeof(dense_levels));
+    free_spade_mem_arena(self->arena);
+    self->arena= new_spade_mem_arena();
+    self->arena->tree_kind= kind;
+    self->arena->keep_clogc= keep_clogc;
+    memcpy(self->arena->dense_levels,dense_levels,sizeof(dense_levels));
+    for (i=0; i < MAX_NUM_FEATURES; i++) {
+        self->root[i]= TNULL;
+    }
+}
+
+/* set the representation (TREE_KIND_*) used for trees started in this table from now on; existing trees keep theirs */
+void spade_prob_table_set_tree_kind(spade_prob_table *self,u8 kind) {
+    self->arena->tree_kind= kind;
+}
+
+/* note that feature f never takes values above maxval, so its trees can be
+   made dense (direct-indexed by value) once they have enough values in them;
+   only small domains (up to 2 bytes) are worth this */
+void spade_prob_table_set_feature_domain(spade_prob_table *self,features f,valtype maxval) {
+    self->arena->dense_levels[f]= (maxval <= MAX_U8) ? 1 : ((maxval <= MAX_U16) ? 2 : 0);
+}
+
+/* return the number of bytes taken by the nodes in use in the table */
+unsigned long spade_prob_table_mem_used(spade_prob_table *self) {
+    return self->arena->mem_used;
+}
+
+/* note that the table is as it is in a checkpoint just taken, so that a
+   delta checkpoint after this need only have what changes from here on */
+void spade_prob_table_clear_dirty(spade_prob_table *self) {
+    spade_mem_arena_clear_dirty(self->arena);
+}
+
+/* have the trees in this table keep their count*ln(count) sums up to date
+   from now on, so their entropy can be had without walking them; this costs
+   a couple of log() calls per increment */
+void spade_prob_table_keep_entropy(spade_prob_table *self) {
+    if (self->arena->keep_clogc) return;
+    self->arena->keep_clogc= 1;
+    init_all_clogc(self);
+}
+
 int spade_prob_table_is_empty(spade_prob_table *self) {
     int i;
     for (i=0; i < MAX_NUM_FEATURES; i++) {
@@ -176,6 +318,7 @@ static int max_int(int a,int b) {
 }
 
 void increment_simple_count(spade_prob_table *self,features type1,valtype val1) {
+    use_arena(self->arena);
     if (self->root[type1] == TNULL) {
         self->root[type1]= new_treeinfo(type1);
     }
@@ -185,6 +328,7 @@ void increment_simple_count(spade_prob_table *self,features type1,valtype val1)
 /* assumes type1 and type2 are in a consistant order */
 void increment_2joint_count(spade_prob_table *self,features type1,valtype val1,features type2,valtype val2,int skip) {
     mindex leaf1,tree2;
+    use_arena(self->arena);
     
     if (skip >= 1) {
         /* this should always find something and self->root[type1] should be non-NULL since has been marked before */
@@ -201,6 +345,7 @@ void increment_2joint_count(spade_prob_table *self,features type1,valtype val1,f
 
 void increment_3joint_count(spade_prob_table *self,features type1,valtype val1,features type2,valtype val2,features type3,valtype val3,int skip) {
     mindex leaf1,leaf2,tree2,tree3;
+    use_arena(self->arena);
     
     if (skip >= 1) {
         /* this should always find something and self->root[type1] should be non-NULL since has been marked before */
@@ -220,6 +365,7 @@ void increment_3joint_count(spade_prob_table *self,features type1,valtype val1,f
 
 void increment_4joint_count(spade_prob_table *self,features type1,valtype val1,features type2,valtype val2,features type3,valtype val3,features type4,valtype val4,int skip) {
     mindex leaf1,leaf2,leaf3,tree2,tree3,tree4;
+    use_arena(self->arena);
     
     if (skip >= 1) {
         /* this should always find something and self->root[type1] should be non-NULL since has been marked before */
@@ -243,6 +389,7 @@ void increment_4joint_count(spade_prob_table *self,features type1,valtype val1,f
 void increment_Njoint_count(spade_prob_table *self,int size,features type[],valtype val[],int skip) {
     mindex leaf,tree;
     int i;
+    use_arena(self->arena);
     
     if (self->root[type[0]] == TNULL) {
         self->root[type[0]]= new_treeinfo(type[0]);
@@ -259,9 +406,92 @@ void increment_Njoint_count(spade_prob_table *self,int size,features type[],valt
     incr_tree_value_count(tree,val[size-1]);
 }
 
+/* add the counts in other, times weight (> 0), to the counts of the same
+   feature value paths in this table, as if the observations in other had
+   been made here.  Each tree is merged with its counterpart in one pass
+   over the two in order of value, recursing into the trees nested under
+   the values, and is then rebuilt balanced; this takes time linear in the
+   size of the two tables.  Returns 0 if out of memory, in which case only
+   some of the counts have been added */
+int spade_prob_table_merge(spade_prob_table *self,spade_prob_table *other,double weight) {
+    return merge_table(self,other,weight);
+}
+
+/* take the counts in other, times weight (> 0), away from the counts of the
+   same feature value paths in this table, undoing a spade_prob_table_merge()
+   of other.  Values left with no count are removed along with the trees
+   nested under them; paths in other that are not here are passed over.
+   This also takes linear time.  Returns 0 if out of memory, in which case
+   only some of the counts have been taken away */
+int spade_prob_table_subtract(spade_prob_table *self,spade_prob_table *other,double weight) {
+    return merge_table(self,other,-weight);
+}
+
+/* get ready to load the (empty) table from a stream of values with
+   spade_prob_table_load_value().  Returns 0 if the table is not empty */
+int spade_prob_table_begin_load(spade_prob_table_loader *self,spade_prob_table *table) {
+    if (!spade_prob_table_is_empty(table)) return 0;
+    self->table= table;
+    self->depth= 0;
+    return 1;
+}
+
+/* load the value val of feature type, with the given (actual) count, into
+   the table.  At depth 0 it goes in the top level tree for type; otherwise
+   it is nested under the value last loaded at depth-1.  Within a tree,
+   values must be given in increasing order, and once another tree is
+   started at the same depth (or a shallower value is given), a tree is
+   complete and is built.  Returns 0 if the value is out of order or we are
+   out of memory, in which case it is not loaded; the load should still be
+   ended with spade_prob_table_end_load() */
+int spade_prob_table_load_value(spade_prob_table_loader *self,int depth,features type,valtype val,double count) {
+    spade_load_level *lev;
+    mindex tree,leaf;
+
+    if (depth < 0 || depth > self->depth || depth >= MAX_NUM_FEATURES || count <= 0.0) return 0;
+    if (depth > 0 && self->level[depth-1].n == 0) return 0; /* nothing to nest it under */
+    use_arena(self->table->arena);
+    while (self->depth > depth+1) finish_load_level(self);
+    if (self->depth == depth+1 && treetype(self->level[depth].tree) != type) finish_load_level(self);
+    lev= &self->level[depth];
+    if (self->depth == depth) { /* start a tree */
+        if (depth == 0) {
+            if (self->table->root[type] == TNULL) self->table->root[type]= new_treeinfo(type);
+            tree= self->table->root[type];
+        } else {
+            tree= get_nexttree_of_type(self->level[depth-1].leaves[self->level[depth-1].n-1],type);
+        }
+        if (treeroot(tree) != TNULL) return 0; /* this tree was loaded before */
+        lev->tree= tree;
+        lev->leaves= NULL;
+        lev->n= lev->size= 0;
+        self->depth++;
+    } else if (val <= leafvalue(lev->leaves[lev->n-1])) {
+        return 0;
+    }
+    if (lev->n == lev->size) {
+        u32 size= lev->size ? 2*lev->size : 16;
+        mindex *leaves= (mindex *)realloc(lev->leaves,sizeof(mindex)*size);
+        if (leaves == NULL) return 0;
+        lev->leaves= leaves;
+        lev->size= size;
+    }
+    leaf= new_leaf(val);
+    leafcount(leaf)= count/cur_arena->decay;
+    lev->leaves[lev->n++]= leaf;
+    return 1;
+}
+
+/* finish loading the table, building the trees still being filled in */
+void spade_prob_table_end_load(spade_prob_table_loader *self) {
+    use_arena(self->table->arena);
+    while (self->depth > 0) finish_load_level(self);
+}
+
 /*****************************************************/
 
 double prob_simple(spade_prob_table *self,features type1,valtype val1) {
+    use_arena(self->arena);
     if (self->root[type1] == TNULL) return PROBRESULT_NO_RECORD; /* this feature was not counted */
     return tree_value_prob(self->root[type1],val1);
 }
@@ -277,6 +507,7 @@ static double tree_value_prob(mindex tree,valtype val) {
 
 double prob_cond1(spade_prob_table *self,features type,valtype val,features ctype,valtype cval) {
     mindex condleaf,tree,leaf;
+    use_arena(self->arena);
     if (self->root[ctype] == TNULL) {
         return PROBRESULT_NO_RECORD; /* denominator would be 0 */
     }
@@ -293,6 +524,7 @@ double prob_cond1(spade_prob_table *self,features type,valtype val,features ctyp
 
 double prob_cond2(spade_prob_table *self,features type,valtype val,features ctype1,valtype cval1,features ctype2,valtype cval2) {
     mindex condleaf,leaf,tree;
+    use_arena(self->arena);
     condleaf= find_leaf2(self,ctype1,cval1,ctype2,cval2);
     if (condleaf == TNULL) return PROBRESULT_NO_RECORD; /* denominator would be 0 */
     find_nexttree_of_type_macro(condleaf,type,tree);
@@ -306,6 +538,7 @@ double prob_cond2(spade_prob_table *self,features type,valtype val,features ctyp
 
 double prob_cond3(spade_prob_table *self,features type,valtype val,features ctype1,valtype cval1,features ctype2,valtype cval2,features ctype3,valtype cval3) {
     mindex condleaf,leaf,tree;
+    use_arena(self->arena);
     condleaf= find_leaf3(self,ctype1,cval1,ctype2,cval2,ctype3,cval3);
     if (condleaf == TNULL) return PROBRESULT_NO_RECORD; /* denominator would be 0 */
     find_nexttree_of_type_macro(condleaf,type,tree);
@@ -321,6 +554,7 @@ double prob_cond3(spade_prob_table *self,features type,valtype val,features ctyp
 double prob_2joint(spade_prob_table *self,features type1,valtype val1,features type2,valtype val2) {
     mindex tree,leaf;
     double totcount;
+    use_arena(self->arena);
     if (self->root[type1] == TNULL) {
         return PROBRESULT_NO_RECORD; /* denominator would be 0 */
     }
@@ -340,6 +574,7 @@ double prob_Njoint(spade_prob_table *self,int size,features type[],valtype val[]
     mindex tree=self->root[type[0]],leaf;
     double totcount;
     int i;
+    use_arena(self->arena);
     if (tree == TNULL) return PROBRESULT_NO_RECORD; /* denominator would be 0 */
     totcount= tree_count(tree);
     for (i=1;i < size; i++) {
@@ -357,15 +592,16 @@ double prob_Njoint_Ncond(spade_prob_table *self,int size,features type[],valtype
     mindex tree=self->root[type[0]],leaf;
     double basecount=1; /* initialized to keep compiler happy */
     int i;
+    use_arena(self->arena);
     if (tree == TNULL) return PROBRESULT_NO_RECORD; /* denominator would be 0 */
     if (condbase == 0) basecount= tree_count(tree);
     for (i=1;i < size; i++) {
         find_leaf_macro(tree,val[i-1],leaf);
-        if (condbase == i) basecount= leafcount(leaf);
         if (leaf == TNULL) {
-            if (condbase < i) return PROBRESULT_NO_RECORD; /* denominator would be 0 */
+            if (condbase <= i) return PROBRESULT_NO_RECORD; /* denominator would be 0 */
             else return 0.0; /* numerator would be 0 */
         }
+        if (condbase == i) basecount= leafcount(leaf);
         tree= find_nexttree_of_type(leaf,type[i]);
         if (tree == TNULL) {
             if (condbase < i) return PROBRESULT_NO_RECORD; /* denominator would be 0 */
@@ -381,16 +617,17 @@ double prob_Njoint_Ncond_plus_one(spade_prob_table *self,int size,features type[
     mindex tree=self->root[type[0]],leaf;
     double basecount=-1;
     int i;
+    use_arena(self->arena);
     /* pretend the table has one more observation for numerator and numerator */
     if (tree == TNULL) return 1; /* natural denominator is 0 */
-    if (condbase == 0) basecount= tree_count(tree)+1;
+    if (condbase == 0) basecount= actual_count(tree_count(tree))+1;
     for (i=1;i < size; i++) {
         find_leaf_macro(tree,val[i-1],leaf);
-        if (condbase == i) basecount= leafcount(leaf)+1;
         if (leaf == TNULL) {
-            if (condbase < i) return 1; /* natural denominator is 0  */
+            if (condbase <= i) return 1; /* natural denominator is 0  */
             else return 1/basecount; /* natural numerator is 0 */
         }
+        if (condbase == i) basecount= actual_count(leafcount(leaf))+1;
         tree= find_nexttree_of_type(leaf,type[i]);
         if (tree == TNULL) {
             if (condbase < i) return 1; /* natural denominator is 0  */
@@ -399,15 +636,526 @@ double prob_Njoint_Ncond_plus_one(spade_prob_table *self,int size,features type[
     }
     find_leaf_macro(tree,val[size-1],leaf);
     if (leaf == TNULL) return 1/basecount; /* natural numerator is 0 */
-    return (leafcount(leaf)+1)/basecount;
+    return (actual_count(leafcount(leaf))+1)/basecount;
+}
+
+/* look up the values in a single walk down the trees, filling in res with the
+   count at each depth, the conditional probability as from
+   prob_Njoint_Ncond_plus_one(), and the tree at entropy_depth (< size) for
+   spade_prob_table_query_entropy(); entropy_depth is -1 if not needed */
+void spade_prob_table_query(spade_prob_table *self,int size,features type[],valtype val[],int condbase,int entropy_depth,spade_prob_query *res) {
+    mindex tree=self->root[type[0]],leaf;
+    double basecount=-1;
+    int i;
+    use_arena(self->arena);
+    
+    res->condbase= condbase;
+    res->depth_found= 0;
+    res->entropy_tree= TNULL;
+    for (i=0; i <= size; i++) res->count[i]= 0.0;
+    
+    /* pretend the table has one more observation for numerator and denominator, as in prob_Njoint_Ncond_plus_one() */
+    if (tree == TNULL) {
+        res->condprob_plus_one= 1; /* natural denominator is 0 */
+        return;
+    }
+    res->count[0]= actual_count(tree_count(tree));
+    if (condbase == 0) basecount= res->count[0]+1;
+    if (entropy_depth == 0) res->entropy_tree= tree;
+    for (i=1; i <= size; i++) {
+        find_leaf_macro(tree,val[i-1],leaf);
+        if (leaf == TNULL) {
+            if (i < size && condbase <= i) res->condprob_plus_one= 1; /* natural denominator is 0  */
+            else res->condprob_plus_one= 1/basecount; /* natural numerator is 0 */
+            return;
+        }
+        res->count[i]= actual_count(leafcount(leaf));
+        res->depth_found= i;
+        if (condbase == i) basecount= res->count[i]+1;
+        if (i == size) break;
+        tree= find_nexttree_of_type(leaf,type[i]);
+        if (tree == TNULL) {
+            if (condbase < i) res->condprob_plus_one= 1; /* natural denominator is 0  */
+            else res->condprob_plus_one= 1/basecount; /* natural numerator is 0 */
+            return;
+        }
+        if (entropy_depth == i) res->entropy_tree= tree;
+    }
+    res->condprob_plus_one= (res->count[size]+1)/basecount;
+}
+
+/* return the entropy of the tree found by spade_prob_table_query(), or 0 if it was not present */
+double spade_prob_table_query_entropy(spade_prob_table *self,spade_prob_query *q) {
+    use_arena(self->arena);
+    if (q->entropy_tree == TNULL) return 0.0;
+    return tree_entropy(q->entropy_tree);
+}
+
+/*****************************************************/
+/* frozen tables */
+
+/// the alignment of each array in the block of a spade_frozen_table
+/// the number of trees or values a frozen copy being made first has room for
+#define MIN_FROZEN_ROOM 64
+
+/* return a frozen copy of the table, which queries can be answered from as
+   the table was now while the table itself goes on learning, or NULL if
+   out of memory.  This takes time linear in the size of the table; see
+   spade_prob_table_freeze_step() for making one a step at a time */
+spade_frozen_table *spade_prob_table_freeze(spade_prob_table *self) {
+    spade_freeze_cursor c;
+    init_spade_freeze_cursor(&c);
+    if (!spade_prob_table_start_freeze(self,&c)) return NULL;
+    return spade_prob_table_freeze_step(self,&c,~(u32)0);
+}
+
+void free_spade_frozen_table(spade_frozen_table *self) {
+    free(self->trees);
+    free(self->count);
+    free(self->key);
+    free(self->sub);
+    free(self->nsub);
+    free(self);
+}
+
+void init_spade_freeze_cursor(spade_freeze_cursor *c) {
+    c->feature= MAX_NUM_FEATURES;
+    c->copy= NULL;
+    c->top= NULL;
+    c->visited= 0;
+    c->last_visited= 0;
+}
+
+/* start making a frozen copy of the table with c, to be carried on with
+   spade_prob_table_freeze_step(); a copy already under way with c is given
+   up.  Returns 0 if out of memory */
+int spade_prob_table_start_freeze(spade_prob_table *self,spade_freeze_cursor *c) {
+    spade_frozen_table *new;
+    int i;
+    spade_prob_table_abort_freeze(c);
+    new= (spade_frozen_table *)malloc(sizeof(spade_frozen_table));
+    if (new == NULL) return 0;
+    new->trees= NULL;
+    new->count= NULL;
+    new->key= NULL;
+    new->sub= NULL;
+    new->nsub= NULL;
+    new->ntrees= 0;
+    new->nvals= 0;
+    c->copy= new;
+    c->trees_room= 0;
+    c->vals_room= 0;
+    /* the top level trees come first, then each tree is followed by the trees nested in it */
+    for (i=0; i < MAX_NUM_FEATURES; i++) new->root[i]= (self->root[i] == TNULL) ? TNULL : new->ntrees++;
+    if (!frozen_room(c,new->ntrees,0)) {
+        spade_prob_table_abort_freeze(c);
+        return 0;
+    }
+    c->feature= 0;
+    c->visited= 0;
+    return 1;
+}
+
+/* carry on making the frozen copy with c, copying about budget values;
+   returns the copy if this completes it (it is then the caller's to free),
+   otherwise NULL.  A copy that runs out of memory is given up, which
+   spade_prob_table_freezing() tells.  The top level trees are done in turn,
+   each in order of value; the trees nested under a top level value are
+   done along with it */
+spade_frozen_table *spade_prob_table_freeze_step(spade_prob_table *self,spade_freeze_cursor *c,u32 budget) {
+    spade_frozen_table *done;
+    u32 start= c->visited;
+    int ok= 1;
+    if (!spade_prob_table_freezing(c)) return NULL;
+    use_arena(self->arena);
+    for (; c->feature < MAX_NUM_FEATURES && ok; c->feature++) {
+        if (c->copy->root[c->feature] == TNULL) continue;
+        if (c->top == NULL) ok= start_frozen_top(self,c);
+        while (ok && c->top_next < c->top_n) {
+            if (c->visited - start >= budget) return NULL; /* the rest will wait until the next step */
+            ok= freeze_top_value(self,c);
+        }
+        if (ok) ok= finish_frozen_top(c);
+    }
+    if (!ok) {
+        spade_prob_table_abort_freeze(c);
+        return NULL;
+    }
+    fit_frozen_copy(c);
+    c->last_visited= c->visited;
+    done= c->copy;
+    c->copy= NULL;
+    return done;
+}
+
+/* is there a copy under way with c? */
+int spade_prob_table_freezing(spade_freeze_cursor *c) {
+    return c->feature < MAX_NUM_FEATURES;
+}
+
+/* give up the copy under way with c, if any */
+void spade_prob_table_abort_freeze(spade_freeze_cursor *c) {
+    if (c->copy != NULL) free_spade_frozen_table(c->copy);
+    if (c->top != NULL) free(c->top);
+    c->copy= NULL;
+    c->top= NULL;
+    c->feature= MAX_NUM_FEATURES;
+}
+
+unsigned long spade_frozen_table_mem_used(spade_frozen_table *self) {
+    return self->mem_used;
+}
+
+/* as jointN_count(), for the table as frozen */
+double frozen_jointN_count(spade_frozen_table *self,int size,features type[],valtype val[]) {
+    mindex tree=self->root[type[0]];
+    u32 v;
+    int i;
+    if (tree == TNULL || self->trees[tree].n == 0) {
+        return 0.0;
+    }
+    if (size == 0) {
+        return self->trees[tree].total;
+    }
+    for (i=1;i < size; i++) {
+        v= frozen_find(self,tree,val[i-1]);
+        if (v == TNULL) return 0.0;
+        tree= frozen_nexttree(self,v,type[i]);
+        if (tree == TNULL) {
+            return 0.0;
+        }
+    }
+    v= frozen_find(self,tree,val[size-1]);
+    if (v == TNULL) return 0.0;
+    return self->count[v];
+}
+
+/* as prob_Njoint_Ncond(), for the table as frozen */
+double frozen_prob_Njoint_Ncond(spade_frozen_table *self,int size,features type[],valtype val[],int condbase) {
+    mindex tree=self->root[type[0]];
+    double basecount=1; /* initialized to keep compiler happy */
+    u32 v;
+    int i;
+    if (tree == TNULL) return PROBRESULT_NO_RECORD; /* denominator would be 0 */
+    if (condbase == 0) basecount= self->trees[tree].total;
+    for (i=1;i < size; i++) {
+        v= frozen_find(self,tree,val[i-1]);
+        if (v == TNULL) {
+            if (condbase <= i) return PROBRESULT_NO_RECORD; /* denominator would be 0 */
+            else return 0.0; /* numerator would be 0 */
+        }
+        if (condbase == i) basecount= self->count[v];
+        tree= frozen_nexttree(self,v,type[i]);
+        if (tree == TNULL) {
+            if (condbase < i) return PROBRESULT_NO_RECORD; /* denominator would be 0 */
+            else return 0.0; /* numerator would be 0 */
+        }
+    }
+    v= frozen_find(self,tree,val[size-1]);
+    if (v == TNULL) return 0.0; /* numerator would be 0 */
+    return self->count[v]/basecount;
+}
+
+/* as prob_Njoint_Ncond_plus_one(), for the table as frozen */
+double frozen_prob_Njoint_Ncond_plus_one(spade_frozen_table *self,int size,features type[],valtype val[],int condbase) {
+    mindex tree=self->root[type[0]];
+    double basecount=-1;
+    u32 v;
+    int i;
+    /* pretend the table has one more observation for numerator and numerator */
+    if (tree == TNULL) return 1; /* natural denominator is 0 */
+    if (condbase == 0) basecount= self->trees[tree].total+1;
+    for (i=1;i < size; i++) {
+        v= frozen_find(self,tree,val[i-1]);
+        if (v == TNULL) {
+            if (condbase <= i) return 1; /* natural denominator is 0  */
+            else return 1/basecount; /* natural numerator is 0 */
+        }
+        if (condbase == i) basecount= self->count[v]+1;
+        tree= frozen_nexttree(self,v,type[i]);
+        if (tree == TNULL) {
+            if (condbase < i) return 1; /* natural denominator is 0  */
+            else return 1/basecount; /* natural numerator is 0 */
+        }
+    }
+    v= frozen_find(self,tree,val[size-1]);
+    if (v == TNULL) return 1/basecount; /* natural numerator is 0 */
+    return (self->count[v]+1)/basecount;
+}
+
+/* as spade_prob_table_query(), for the table as frozen; res->entropy_tree
+   is the index of the frozen tree */
+void spade_frozen_table_query(spade_frozen_table *self,int size,features type[],valtype val[],int condbase,int entropy_depth,spade_prob_query *res) {
+    mindex tree=self->root[type[0]];
+    double basecount=-1;
+    u32 v;
+    int i;
+
+    res->condbase= condbase;
+    res->depth_found= 0;
+    res->entropy_tree= TNULL;
+    for (i=0; i <= size; i++) res->count[i]= 0.0;
+
+    if (tree == TNULL) {
+        res->condprob_plus_one= 1; /* natural denominator is 0 */
+        return;
+    }
+    res->count[0]= self->trees[tree].total;
+    if (condbase == 0) basecount= res->count[0]+1;
+    if (entropy_depth == 0) res->entropy_tree= tree;
+    for (i=1; i <= size; i++) {
+        v= frozen_find(self,tree,val[i-1]);
+        if (v == TNULL) {
+            if (i < size && condbase <= i) res->condprob_plus_one= 1; /* natural denominator is 0  */
+            else res->condprob_plus_one= 1/basecount; /* natural numerator is 0 */
+            return;
+        }
+        res->count[i]= self->count[v];
+        res->depth_found= i;
+        if (condbase == i) basecount= res->count[i]+1;
+        if (i == size) break;
+        tree= frozen_nexttree(self,v,type[i]);
+        if (tree == TNULL) {
+            if (condbase < i) res->condprob_plus_one= 1; /* natural denominator is 0  */
+            else res->condprob_plus_one= 1/basecount; /* natural numerator is 0 */
+            return;
+        }
+        if (entropy_depth == i) res->entropy_tree= tree;
+    }
+    res->condprob_plus_one= (res->count[size]+1)/basecount;
+}
+
+/* as spade_prob_table_entropy(), for the table as frozen */
+double spade_frozen_table_entropy(spade_frozen_table *self,int depth,features type[],valtype val[]) {
+    mindex tree=self->root[type[0]];
+    u32 v;
+    int i;
+    if (tree == TNULL) return 0.0;
+    for (i=1;i <= depth; i++) {
+        v= frozen_find(self,tree,val[i-1]);
+        if (v == TNULL) return 0.0;
+        tree= frozen_nexttree(self,v,type[i]);
+        if (tree == TNULL) return 0.0;
+    }
+    return self->trees[tree].entropy;
+}
+
+/* return the entropy of the tree found by spade_frozen_table_query(), or 0 if it was not present */
+double spade_frozen_table_query_entropy(spade_frozen_table *self,spade_prob_query *q) {
+    if (q->entropy_tree == TNULL) return 0.0;
+    return self->trees[q->entropy_tree].entropy;
+}
+
+/* make room in the copy being made with c for the given numbers of trees
+   and values, at least doubling what has run out; returns 0 if out of memory */
+static int frozen_room(spade_freeze_cursor *c,u32 ntrees,u32 nvals) {
+    spade_frozen_table *f= c->copy;
+    u32 room;
+    void *p;
+    if (ntrees > c->trees_room) {
+        room= max_int(max_int(2*c->trees_room,ntrees),MIN_FROZEN_ROOM);
+        p= realloc(f->trees,room*sizeof(spade_frozen_tree));
+        if (p == NULL) return 0;
+        f->trees= (spade_frozen_tree *)p;
+        c->trees_room= room;
+    }
+    if (nvals > c->vals_room) {
+        room= max_int(max_int(2*c->vals_room,nvals),MIN_FROZEN_ROOM);
+        /* the arrays that have grown are kept if a later one cannot */
+        if ((p= realloc(f->count,room*sizeof(double))) == NULL) return 0;
+        f->count= (double *)p;
+        if ((p= realloc(f->key,room*sizeof(valtype))) == NULL) return 0;
+        f->key= (valtype *)p;
+        if ((p= realloc(f->sub,room*sizeof(u32))) == NULL) return 0;
+        f->sub= (u32 *)p;
+        if ((p= realloc(f->nsub,room*sizeof(u8))) == NULL) return 0;
+        f->nsub= (u8 *)p;
+        c->vals_room= room;
+    }
+    return 1;
+}
+
+/* give back the room the completed copy with c has no use for, and note how much it takes */
+static void fit_frozen_copy(spade_freeze_cursor *c) {
+    spade_frozen_table *f= c->copy;
+    void *p;
+    /* a failure to shrink an array just leaves it as it was */
+    if (f->ntrees > 0 && (p= realloc(f->trees,f->ntrees*sizeof(spade_frozen_tree))) != NULL) f->trees= (spade_frozen_tree *)p;
+    if (f->nvals > 0) {
+        if ((p= realloc(f->count,f->nvals*sizeof(double))) != NULL) f->count= (double *)p;
+        if ((p= realloc(f->key,f->nvals*sizeof(valtype))) != NULL) f->key= (valtype *)p;
+        if ((p= realloc(f->sub,f->nvals*sizeof(u32))) != NULL) f->sub= (u32 *)p;
+        if ((p= realloc(f->nsub,f->nvals*sizeof(u8))) != NULL) f->nsub= (u8 *)p;
+    }
+    f->mem_used= sizeof(spade_frozen_table) + f->ntrees*sizeof(spade_frozen_tree)
+        + f->nvals*(sizeof(double)+sizeof(valtype)+sizeof(u32)+sizeof(u8));
+}
+
+/* list the values of the top level tree that c is on, to be copied in turn; returns 0 if out of memory */
+static int start_frozen_top(spade_prob_table *self,spade_freeze_cursor *c) {
+    mindex tree= self->root[c->feature];
+    mindex *leaves= NULL;
+    u32 n= (tree == TNULL) ? 0 : treenvals(tree),i;
+    if (n > 0 && (leaves= tree_leaves_in_order(tree)) == NULL) return 0;
+    c->top= (spade_frozen_value *)malloc(sizeof(spade_frozen_value)*(n > 0 ? n : 1));
+    if (c->top == NULL) {
+        if (leaves != NULL) free(leaves);
+        return 0;
+    }
+    for (i=0; i < n; i++) c->top[i].key= leafvalue(leaves[i]);
+    if (leaves != NULL) free(leaves);
+    c->top_n= n;
+    c->top_next= 0;
+    c->top_done= 0;
+    return 1;
+}
+
+/* copy the next value listed for the top level tree that c is on, with the
+   trees nested under it, unless it has been pruned from the table since;
+   returns 0 if out of memory */
+static int freeze_top_value(spade_prob_table *self,spade_freeze_cursor *c) {
+    mindex tree= self->root[c->feature];
+    mindex leaf= (tree == TNULL) ? TNULL : find_leaf(tree,c->top[c->top_next].key);
+    spade_frozen_value *v;
+    c->top_next++;
+    if (leaf == TNULL) return 1;
+    /* top_done never passes top_next, so this only overwrites a value already looked at */
+    v= &c->top[c->top_done++];
+    v->key= leafvalue(leaf);
+    v->count= actual_count(leafcount(leaf));
+    c->visited++;
+    return freeze_nested(c,leaf,&v->sub,&v->nsub);
+}
+
+/* put the values copied for the top level tree that c is on into the copy,
+   in Eytzinger order, and fill in the tree; returns 0 if out of memory */
+static int finish_frozen_top(spade_freeze_cursor *c) {
+    spade_frozen_table *f= c->copy;
+    spade_frozen_tree *ft;
+    u32 first= f->nvals,i= 0;
+    double N= 0.0,clogc= 0.0,H;
+    if (!frozen_room(c,f->ntrees,first+c->top_done)) return 0;
+    f->nvals+= c->top_done;
+    place_frozen_top(c,first,1,&i);
+    /* the total and entropy go by the counts as they were copied, as for the values */
+    for (i=0; i < c->top_done; i++) {
+        N+= c->top[i].count;
+        clogc+= clogc_term(c->top[i].count);
+    }
+    H= (N > 0.0) ? (log(N) - clogc/N)/LOG2 : 0.0;
+    ft= &f->trees[f->root[c->feature]];
+    ft->type= c->feature;
+    ft->n= c->top_done;
+    ft->first= first;
+    ft->total= N;
+    ft->entropy= H > 0.0 ? H : 0.0; /* rounding can put a single valued tree a hair below 0 */
+    free(c->top);
+    c->top= NULL;
+    return 1;
+}
+
+/* put the values copied for the top level tree that c is on, from *i on,
+   into the positions of the subtree at Eytzinger position k of those
+   starting at first, going through the positions in order of value */
+static void place_frozen_top(spade_freeze_cursor *c,u32 first,u32 k,u32 *i) {
+    spade_frozen_table *f= c->copy;
+    spade_frozen_value *v;
+    if (k > c->top_done) return;
+    place_frozen_top(c,first,2*k,i);
+    v= &c->top[(*i)++];
+    f->key[first+k-1]= v->key;
+    f->count[first+k-1]= v->count;
+    f->sub[first+k-1]= v->sub;
+    f->nsub[first+k-1]= v->nsub;
+    place_frozen_top(c,first,2*k+1,i);
+}
+
+/* freeze the tree into the given slot of the copy being made with c,
+   taking the next values and, for the trees nested in it, the next slots
+   after it; returns 0 if out of memory */
+static int freeze_tree(spade_freeze_cursor *c,mindex tree,u32 slot) {
+    spade_frozen_table *f= c->copy;
+    mindex *leaves;
+    u32 n= treenvals(tree),first= f->nvals,i= 0;
+    int ok;
+    f->trees[slot].type= treetype(tree);
+    f->trees[slot].n= n;
+    f->trees[slot].first= first;
+    f->trees[slot].total= actual_count(tree_count(tree));
+    f->trees[slot].entropy= tree_entropy(tree);
+    if (n == 0) return 1;
+    if (!frozen_room(c,f->ntrees,first+n)) return 0;
+    f->nvals+= n;
+    c->visited+= n;
+    leaves= tree_leaves_in_order(tree);
+    if (leaves == NULL) return 0;
+    ok= freeze_values(c,leaves,n,first,1,&i);
+    free(leaves);
+    return ok;
+}
+
+/* put the leaves, from *i on, in order into the positions of the subtree
+   at Eytzinger position k (of n) of the values starting at first, going
+   through the positions in order of value */
+static int freeze_values(spade_freeze_cursor *c,mindex leaves[],u32 n,u32 first,u32 k,u32 *i) {
+    mindex leaf;
+    u32 v= first+k-1;
+    if (k > n) return 1;
+    if (!freeze_values(c,leaves,n,first,2*k,i)) return 0;
+    leaf= leaves[(*i)++];
+    c->copy->key[v]= leafvalue(leaf);
+    c->copy->count[v]= actual_count(leafcount(leaf));
+    /* (these are set before adding the nested trees, which can move the arrays) */
+    if (!freeze_nested(c,leaf,&c->copy->sub[v],&c->copy->nsub[v])) return 0;
+    return freeze_values(c,leaves,n,first,2*k+1,i);
+}
+
+/* freeze the trees nested under the leaf into the next slots of the copy
+   being made with c, setting *sub and *nsub to where they are; returns 0
+   if out of memory */
+static int freeze_nested(spade_freeze_cursor *c,mindex leaf,u32 *sub,u8 *nsub) {
+    mindex t;
+    u32 first= c->copy->ntrees,j;
+    u8 n= 0;
+    for (t=leafnexttree(leaf); t != TNULL; t=treenext(t)) n++;
+    *sub= first;
+    *nsub= n;
+    if (!frozen_room(c,first+n,c->copy->nvals)) return 0;
+    c->copy->ntrees+= n;
+    for (t=leafnexttree(leaf),j=0; t != TNULL; t=treenext(t),j++) {
+        if (!freeze_tree(c,t,first+j)) return 0;
+    }
+    return 1;
+}
+
+/* return the index of val in the frozen tree, or TNULL if it is not there */
+static u32 frozen_find(spade_frozen_table *self,mindex tree,valtype val) {
+    const valtype *key= self->key + self->trees[tree].first;
+    u32 n= self->trees[tree].n,k= 1;
+    /* go down the implicit tree, the comparison picking the child; there is no other branch to mispredict */
+    while (k <= n) k= 2*k + (key[k-1] < val);
+    /* the low bits of k are the steps right taken after the last step left, which was from the first value >= val */
+    k>>= __builtin_ffs(~k);
+    if (k == 0 || key[k-1] != val) return TNULL;
+    return self->trees[tree].first + k-1;
+}
+
+/* return the index of the frozen tree of the given type nested under the value at index v, or TNULL if none */
+static mindex frozen_nexttree(spade_frozen_table *self,u32 v,features type) {
+    mindex t,end= self->sub[v]+self->nsub[v];
+    for (t= self->sub[v]; t < end; t++) {
+        if (self->trees[t].type == type) return t;
+    }
+    return TNULL;
 }
 
 /* return what the probability would be if some instance of the indicated feature had a count of 1 */
 double one_prob_simple(spade_prob_table *self,features type1) {
     mindex root;
+    use_arena(self->arena);
     if (self->root[type1] == TNULL) return PROBRESULT_NO_RECORD; /* denominator would be 0 */
     root= treeroot(self->root[type1]);
-    return 1/count_or_sum(root);
+    return 1/actual_count(count_or_sum(root));
 }
 
 /*****************************************************/
@@ -415,11 +1163,12 @@ double one_prob_simple(spade_prob_table *self,features type1) {
 double jointN_count(spade_prob_table *self,int size,features type[], valtype val[]) {
     mindex tree=self->root[type[0]],leaf;
     int i;
+    use_arena(self->arena);
     if (tree == TNULL || treeroot(tree) == TNULL) {
         return 0.0;
     }
     if (size == 0) {
-        return count_or_sum(treeroot(tree));
+        return actual_count(count_or_sum(treeroot(tree)));
     }
     for (i=1;i < size; i++) {
         find_leaf_macro(tree,val[i-1],leaf);
@@ -431,7 +1180,7 @@ double jointN_count(spade_prob_table *self,int size,features type[], valtype val
     }
     find_leaf_macro(tree,val[size-1],leaf);
     if (leaf == TNULL) return 0.0;
-    return leafcount(leaf);
+    return actual_count(leafcount(leaf));
 }
 
 /*****************************************************/
@@ -439,6 +1188,7 @@ double jointN_count(spade_prob_table *self,int size,features type[], valtype val
 double spade_prob_table_entropy(spade_prob_table *self,int depth,features type[], valtype val[]) {
     mindex tree=self->root[type[0]],leaf;
     int i;
+    use_arena(self->arena);
     //printf("H(%s",self->featurenames[type[0]]);
     if (tree == TNULL) {
         return 0.0;
@@ -453,30 +1203,77 @@ double spade_prob_table_entropy(spade_prob_table *self,int depth,features type[]
         //printf("=%d,%s",val[i-1],self->featurenames[type[i]]);
     }
     //printf(")= ");
-    if (treeH(tree) < 0 || treeH_wait(tree) == 0) {
-        /* need to recalculate entropy */
-        int wait= count_or_sum(treeroot(tree)) * 0.1;
-        treeH_wait(tree)= wait > 10000 ? 10000 : (wait < 100 ? 100 : wait);
-        treeH(tree)= calc_tree_entropy(tree);
-        //printf("*");
+    return tree_entropy(tree);
+}
+
+/* return the entropy of the tree; with N the total count, this is
+   -sum (c/N)*log2(c/N) over the leaf counts c, which is (ln N - clogc/N)/ln 2.
+   This is the same whatever decay has yet to be applied to the counts */
+static double tree_entropy(mindex tree) {
+    double N,clogc,H;
+    if (treeroot(tree) == TNULL) return 0.0;
+    N= count_or_sum(treeroot(tree));
+    clogc= cur_arena->keep_clogc ? treeclogc(tree) : subtree_clogc(treeroot(tree));
+    H= (log(N) - clogc/N)/LOG2;
+    return H > 0.0 ? H : 0.0; /* rounding can put a single valued tree a hair below 0 */
+}
+
+/* return the sum of count*ln(count) over the leaves in the subtree, as kept in treeclogc() */
+static double subtree_clogc(dmindex encnode) {
+    if (isleaf(encnode)) {
+        return clogc_term(leafcount(encleaf2mindex(encnode)));
+    } else if (isbnode(encnode)) { /* recurse on each slot */
+        mindex b= encbnode2mindex(encnode);
+        double sum= 0.0;
+        int i;
+        for (i=0; i < bnused(b); i++) sum+= subtree_clogc(bnchild(b,i));
+        return sum;
+    } else if (isdnode(encnode)) { /* recurse on each slot in use */
+        mindex d= encdnode2mindex(encnode);
+        double sum= 0.0;
+        int i;
+        for (i=0; i < DNODE_SLOTS; i++) if (dnchild(d,i) != TNULL) sum+= subtree_clogc(dnchild(d,i));
+        return sum;
+    } else { /* recurse */
+        return subtree_clogc(intleft(encnode)) + subtree_clogc(intright(encnode));
+    }
+}
+
+static void init_all_clogc(spade_prob_table *self) {
+    mindex t;
+    int i;
+    use_arena(self->arena);
+    for (i=0; i < MAX_NUM_FEATURES; i++) {
+        for (t=self->root[i]; t != TNULL; t=treenext(t)) init_tree_clogc(t);
     }
-    //printf("%.4f\n",treeH(tree));
-    return treeH(tree);
 }
 
-static double calc_tree_entropy(mindex tree) {
-    mindex root= treeroot(tree);
-    return calc_subtree_entropy(root,count_or_sum(root));
+/* set treeclogc() on the tree and on all the trees nested in it */
+static void init_tree_clogc(mindex tree) {
+    dirty_tree(tree);
+    treeclogc(tree)= (treeroot(tree) == TNULL) ? 0.0 : init_subtree_clogc(treeroot(tree));
 }
 
-static double calc_subtree_entropy(mindex node,double prob_base) {
-    double prob;
-    if (isleaf(node)) {
-        prob= leafcount(encleaf2mindex(node))/prob_base;
-        return -1*prob*(log(prob)/LOG2);
+/* return subtree_clogc(encnode), setting up the trees nested below it along the way */
+static double init_subtree_clogc(dmindex encnode) {
+    if (isleaf(encnode)) {
+        mindex leaf= encleaf2mindex(encnode),t;
+        for (t=leafnexttree(leaf); t != TNULL; t=treenext(t)) init_tree_clogc(t);
+        return clogc_term(leafcount(leaf));
+    } else if (isbnode(encnode)) { /* recurse on each slot */
+        mindex b= encbnode2mindex(encnode);
+        double sum= 0.0;
+        int i;
+        for (i=0; i < bnused(b); i++) sum+= init_subtree_clogc(bnchild(b,i));
+        return sum;
+    } else if (isdnode(encnode)) { /* recurse on each slot in use */
+        mindex d= encdnode2mindex(encnode);
+        double sum= 0.0;
+        int i;
+        for (i=0; i < DNODE_SLOTS; i++) if (dnchild(d,i) != TNULL) sum+= init_subtree_clogc(dnchild(d,i));
+        return sum;
     } else { /* recurse */
-        return calc_subtree_entropy(intleft(node),prob_base) +
-               calc_subtree_entropy(intright(node),prob_base);
+        return init_subtree_clogc(intleft(encnode)) + init_subtree_clogc(intright(encnode));
     }
 }
 
@@ -500,11 +1297,13 @@ static mindex get_nexttree_of_type(mindex leaf,features type) {
     }
     t= leafnexttree(leaf);
     if (t == TNULL) {
+        dirty_leaf(leaf);
         leafnexttree(leaf)= new_treeinfo(type);
         return leafnexttree(leaf);
     }
     for (; t != TNULL; t=treenext(t)) {
         if (treenext(t) == TNULL) { /* we are at end */
+            dirty_tree(t);
             treenext(t)= new_treeinfo(type);
             return treenext(t);
         }
@@ -514,24 +1313,53 @@ static mindex get_nexttree_of_type(mindex leaf,features type) {
 
 /* increment the count of instance of val in the tree and return the leaf updated */
 static mindex incr_tree_value_count(mindex tree,valtype newval) {
+    mindex leaf;
+    incr_prior_count= 0.0;
+    dirty_tree(tree); /* its root, nvals or clogc may change */
+    leaf= add_to_tree_value_count(tree,newval);
+    if (cur_arena->keep_clogc) {
+        treeclogc(tree)+= clogc_term(leafcount(leaf)) - clogc_term(incr_prior_count);
+    }
+    if (incr_prior_count == 0.0) { /* the leaf is new */
+        u32 n= ++treenvals(tree);
+        if (n >= DENSE_MIN_VALUES && (n & (n-1)) == 0 && cur_arena->dense_levels[treetype(tree)] && !isdnode(treeroot(tree)))
+            densify_tree(tree);
+    }
+    return leaf;
+}
+
+/* the tree structure part of incr_tree_value_count() */
+static mindex add_to_tree_value_count(mindex tree,valtype newval) {
     mindex root=treeroot(tree);
-    if (treeH_wait(tree)) treeH_wait(tree)--;
     if (root == TNULL) {
         mindex newleaf=new_leaf(newval);
         treeroot(tree)= asleaf(newleaf);
         return newleaf;
     }
+    if (isdnode(root)) {
+        mindex d= encdnode2mindex(root);
+        if ((newval >> dnshift(d)) < DNODE_SLOTS) return increment_dense_value_count(tree,newval);
+        undensify_tree(tree); /* a value too big for it; should not happen, but go back to a sorted tree if it does */
+        root= treeroot(tree);
+    }
+    if (isbnode(root)) {
+        return increment_wide_value_count(tree,newval);
+    }
     if (isleaf(root)) {
         mindex leaf= encleaf2mindex(root);
         valtype curval= leafvalue(leaf);
         
         if (curval == newval) {
-            leafcount(leaf)++;
+            bump_leafcount(leaf);
             return leaf;
+        } else if (cur_arena->tree_kind == TREE_KIND_WIDE) {
+            /* most trees only ever see one value, so wide trees start out as a bare leaf too */
+            treeroot(tree)= asbnode(new_wide_root(root,curval));
+            return increment_wide_value_count(tree,newval);
         } else {
             mindex newleaf= new_leaf(newval); /* count is 1 */
             mindex node= new_int();
-            intsum(node)= leafcount(leaf)+1;
+            intsum(node)= leafcount(leaf)+OBS_INCR;
             
             if (curval < newval) {
                 intleft(node)= asleaf(leaf);
@@ -543,7 +1371,7 @@ static mindex incr_tree_value_count(mindex tree,valtype newval) {
                 intsortpt(node)= newval;
             }
             /* no rebalancing possible now, so just set wait time to standard */
-            intwait(node)= wait_time(1,leafcount(leaf));
+            intwait(node)= wait_time(1,actual_count(leafcount(leaf)));
             treeroot(tree)= node;
             return newleaf;
         }
@@ -552,23 +1380,213 @@ static mindex incr_tree_value_count(mindex tree,valtype newval) {
     }
 }
 
+/* increment the count of val in the dense tree, which it is in the range of, and return its leaf */
+static mindex increment_dense_value_count(mindex tree,valtype val) {
+    mindex node= encdnode2mindex(treeroot(tree)),leaf;
+    dmindex child;
+    int slot;
+    
+    dirty_dnode(node);
+    dnsum(node)+= OBS_INCR;
+    if (dnshift(node)) { /* go down to the page */
+        slot= dnslot(node,val);
+        child= dnchild(node,slot);
+        if (child == TNULL) {
+            child= asdnode(new_dnode(0,val & ~(valtype)(DNODE_SLOTS-1)));
+            dnchild(node,slot)= child;
+            dnused(node)++;
+        }
+        node= encdnode2mindex(child);
+        dirty_dnode(node);
+        dnsum(node)+= OBS_INCR;
+    }
+    slot= dnslot(node,val);
+    child= dnchild(node,slot);
+    if (child == TNULL) {
+        leaf= new_leaf(val); /* count is 1 */
+        dnchild(node,slot)= asleaf(leaf);
+        dnused(node)++;
+    } else {
+        leaf= encleaf2mindex(child);
+        bump_leafcount(leaf);
+    }
+    return leaf;
+}
+
+/* make the tree into a dense tree with the same leaves, if its values are all
+   in range and the dnodes needed are not too big compared to what they replace */
+static void densify_tree(mindex tree) {
+    int levels= cur_arena->dense_levels[treetype(tree)];
+    mindex *leaves,top,page=TNULL;
+    u32 n= treenvals(tree),i,dnodes;
+    
+    leaves= tree_leaves_in_order(tree);
+    if (leaves == NULL) return;
+    if ((leafvalue(leaves[n-1]) >> (8*levels)) != 0) { /* out of range */
+        free(leaves);
+        return;
+    }
+    dnodes= 1;
+    if (levels == 2) {
+        for (i=0; i < n; i++) if (i == 0 || (leafvalue(leaves[i]) >> 8) != (leafvalue(leaves[i-1]) >> 8)) dnodes++;
+    }
+    if (dnodes*sizeof(dnode) > DENSE_MAX_GROWTH*n*INTNODE_BYTES) {
+        free(leaves);
+        return;
+    }
+    
+    free_interior_in_subtree(treeroot(tree));
+    top= new_dnode(levels == 2 ? 8 : 0,0);
+    for (i=0; i < n; i++) {
+        valtype val= leafvalue(leaves[i]);
+        mindex node= top;
+        dnsum(top)+= leafcount(leaves[i]);
+        if (levels == 2) {
+            if (i == 0 || (val >> 8) != (leafvalue(leaves[i-1]) >> 8)) {
+                page= new_dnode(0,val & ~(valtype)(DNODE_SLOTS-1));
+                dnchild(top,dnslot(top,val))= asdnode(page);
+                dnused(top)++;
+            }
+            node= page;
+            dnsum(page)+= leafcount(leaves[i]);
+        }
+        dnchild(node,dnslot(node,val))= asleaf(leaves[i]);
+        dnused(node)++;
+    }
+    dirty_tree(tree);
+    treeroot(tree)= asdnode(top);
+    free(leaves);
+}
+
+/* make the dense tree back into a balanced binary tree with the same leaves */
+static void undensify_tree(mindex tree) {
+    mindex *leaves= tree_leaves_in_order(tree);
+    if (leaves == NULL) return; /* stay dense */
+    free_interior_in_subtree(treeroot(tree));
+    dirty_tree(tree);
+    treeroot(tree)= build_balanced_subtree(leaves,treenvals(tree));
+    free(leaves);
+}
+
+/* return a malloc'd array of the treenvals(tree) leaves in the tree, in order of value, or NULL if out of memory */
+static mindex *tree_leaves_in_order(mindex tree) {
+    mindex *leaves= (mindex *)malloc(sizeof(mindex)*treenvals(tree));
+    u32 n= 0;
+    if (leaves == NULL) return NULL;
+    collect_subtree_leaves(treeroot(tree),leaves,&n);
+    return leaves;
+}
+
+static void collect_subtree_leaves(dmindex encnode,mindex *leaves,u32 *n) {
+    int i;
+    if (isleaf(encnode)) {
+        leaves[(*n)++]= encleaf2mindex(encnode);
+    } else if (isbnode(encnode)) {
+        for (i=0; i < bnused(encbnode2mindex(encnode)); i++) collect_subtree_leaves(bnchild(encbnode2mindex(encnode),i),leaves,n);
+    } else if (isdnode(encnode)) {
+        for (i=0; i < DNODE_SLOTS; i++) {
+            if (dnchild(encdnode2mindex(encnode),i) != TNULL) collect_subtree_leaves(dnchild(encdnode2mindex(encnode),i),leaves,n);
+        }
+    } else {
+        collect_subtree_leaves(intleft(encnode),leaves,n);
+        collect_subtree_leaves(intright(encnode),leaves,n);
+    }
+}
+
+/* free the interior nodes of the subtree, leaving its leaves (and what is nested under them) alone */
+static void free_interior_in_subtree(dmindex encnode) {
+    int i;
+    if (isleaf(encnode)) {
+        return;
+    } else if (isbnode(encnode)) {
+        for (i=0; i < bnused(encbnode2mindex(encnode)); i++) free_interior_in_subtree(bnchild(encbnode2mindex(encnode),i));
+        free_bnode(encbnode2mindex(encnode));
+    } else if (isdnode(encnode)) {
+        for (i=0; i < DNODE_SLOTS; i++) {
+            if (dnchild(encdnode2mindex(encnode),i) != TNULL) free_interior_in_subtree(dnchild(encdnode2mindex(encnode),i));
+        }
+        free_dnode(encdnode2mindex(encnode));
+    } else {
+        free_interior_in_subtree(intleft(encnode));
+        free_interior_in_subtree(intright(encnode));
+        free_int(encnode);
+    }
+}
+
+/* return a balanced binary subtree over the n (> 0) leaves given, which are in order of value */
+static dmindex build_balanced_subtree(mindex leaves[],u32 n) {
+    mindex node;
+    u32 half= n/2;
+    if (n == 1) return asleaf(leaves[0]);
+    node= new_int();
+    intleft(node)= build_balanced_subtree(leaves,half);
+    intright(node)= build_balanced_subtree(leaves+half,n-half);
+    intsortpt(node)= leafvalue(leaves[half-1]);
+    intsum(node)= count_or_sum(intleft(node)) + count_or_sum(intright(node));
+    intwait(node)= wait_time(actual_count(count_or_sum(intleft(node))),actual_count(count_or_sum(intright(node))));
+    return node;
+}
+
+/* return a binary subtree over the n (> 0) leaves given, which are in
+   order of value, splitting each node where the counts on its two sides
+   come nearest to even, as rebalancing aims for; sums[i] is the total count
+   of the leaves before leaves[i+1] in the whole tree and before is the
+   total before leaves[0].  Interior nodes are allocated parent first, so
+   the way down a path runs through memory in order */
+static dmindex build_weighted_subtree(mindex leaves[],double sums[],u32 n,double before) {
+    mindex node;
+    double half;
+    u32 lo=1,hi=n-1,mid;
+    if (n == 1) return asleaf(leaves[0]);
+    half= before + (sums[n-1]-before)/2;
+    /* find the first split with at least half the count on the left, then see if the one before is nearer */
+    while (lo < hi) {
+        mid= (lo+hi)/2;
+        if (sums[mid-1] >= half) hi= mid;
+        else lo= mid+1;
+    }
+    if (lo > 1 && half - sums[lo-2] < sums[lo-1] - half) lo--;
+    node= new_int();
+    intleft(node)= build_weighted_subtree(leaves,sums,lo,before);
+    intright(node)= build_weighted_subtree(leaves+lo,sums+lo,n-lo,sums[lo-1]);
+    intsortpt(node)= leafvalue(leaves[lo-1]);
+    intsum(node)= count_or_sum(intleft(node)) + count_or_sum(intright(node));
+    intwait(node)= wait_time(actual_count(count_or_sum(intleft(node))),actual_count(count_or_sum(intright(node))));
+    return node;
+}
+
+/// the number of levels increment_value_count keeps track of in one call; deeper trees continue in a nested call
+#define INCR_PATH_DEPTH 64
+
 /* increment the sum for this interior node and the counts and sums for subtrees containing the given value and return the leaf node for the value */
 static mindex increment_value_count(mindex node,valtype val) {
+    mindex path[INCR_PATH_DEPTH];
     mindex child,res;
     dmindex encchild;
-
-    /* TODO: optimize by making non-recursive (note: not tail-recursive) */
-    if (val <= intsortpt(node)) { /* going left */
-        encchild= intleft(node);
-    } else { /* going right */
-        encchild= intright(node);
+    int depth= 0;
+
+    /* go down to the interior node right above where val's leaf is or belongs, adding to the sums on the way */
+    for (;;) {
+        path[depth++]= node;
+        dirty_int(node); /* its sum and wait change */
+        if (val <= intsortpt(node)) { /* going left */
+            encchild= intleft(node);
+        } else { /* going right */
+            encchild= intright(node);
+        }
+        if (isleaf(encchild) || depth == INCR_PATH_DEPTH) break;
+        intsum(node)+= OBS_INCR;
+        node= encchild;
     }
     
-    if (isleaf(encchild)) {
+    if (!isleaf(encchild)) { /* an unusually deep tree; carry on in a new frame */
+        intsum(node)+= OBS_INCR;
+        res= increment_value_count(encchild,val);
+    } else {
         child= encleaf2mindex(encchild);
         if (val == leafvalue(child)) { /* found the leaf */
-            intsum(node)++;
-            leafcount(child)++; 
+            intsum(node)+= OBS_INCR;
+            bump_leafcount(child);
             res= child;
         } else { /* need to add the leaf */
             if (val > leafvalue(child)) { /* higher than right node */
@@ -580,14 +1598,14 @@ static mindex increment_value_count(mindex node,valtype val) {
             }
             /* note: "node" may have different children now */
         }
-    } else { /* recurse */
-        child= encchild;
-        intsum(node)++;
-        res= increment_value_count(child,val);
     }
     
-    intwait(node)--;
-    if (intwait(node) == 0) {/*printf("** rebalancing %X since got to 0 **\n",node);*/rebalance_subtree(node);}
+    /* count down the wait on the nodes passed through, deepest first, rebalancing those that get to 0 */
+    while (depth > 0) {
+        node= path[--depth];
+        intwait(node)--;
+        if (intwait(node) == 0) {/*printf("** rebalancing %X since got to 0 **\n",node);*/rebalance_subtree(node);}
+    }
     
     return res;
 }
@@ -599,9 +1617,10 @@ static mindex add_node_above_to_right(mindex node,valtype val) {
     mindex newint= dup_intnode(node);
     
     /* now reshape 'node' to have newint on left and leaf on right */
+    dirty_int(node);
     intleft(node)= newint;
     intright(node)= asleaf(leaf);
-    intsum(node)++; /* sum on newint + count on leaf */
+    intsum(node)+= OBS_INCR; /* sum on newint + count on leaf */
     intsortpt(node)= largest_val(newint);
 
     rebalance_subtree(node);
@@ -616,9 +1635,10 @@ static mindex add_node_above_to_left(mindex node,valtype val) {
     mindex newint= dup_intnode(node);
     
     /* now reshape 'node' to have newint on right and leaf on left */
+    dirty_int(node);
     intright(node)= newint;
     intleft(node)= asleaf(leaf);
-    intsum(node)++; /* sum on newint + count on leaf */
+    intsum(node)+= OBS_INCR; /* sum on newint + count on leaf */
     intsortpt(node)= val; /* val is largest value on left side */
 
     rebalance_subtree(node);
@@ -634,15 +1654,289 @@ static mindex add_node_between(mindex node,valtype val) {
     intsortpt(newint)= val; /* val is largest value on left side */
     intleft(newint)= asleaf(leaf);
     intright(newint)= intright(node);
-    intsum(newint)= count_or_sum(intright(node))+1;
+    intsum(newint)= count_or_sum(intright(node))+OBS_INCR;
+    dirty_int(node);
     intright(node)= newint;
-    intsum(node)++; /* counts stayed the same except adding 1 */
+    intsum(node)+= OBS_INCR; /* counts stayed the same except adding 1 */
     
     rebalance_subtree(newint);
     
     return leaf;
 }
 
+/*****************************************************/
+/* wide trees: B-trees of bnodes, with all leaves at the same depth */
+
+/// the deepest a wide tree can get; nodes other than the root are kept at least half full, so this is never approached
+#define MAX_WIDE_DEPTH 32
+
+/* return a wide subtree over the n (> 0) leaves given, which are in order
+   of value; it is built a level at a time from the bottom up, spreading the
+   nodes on each level evenly over the level below.  The leaves array is
+   overwritten with the nodes of each level as it goes */
+static dmindex build_wide_subtree(mindex leaves[],u32 n) {
+    dmindex *level= (dmindex *)leaves;
+    u32 count,nodes,i,j,k,end;
+    mindex node;
+
+    for (i=0; i < n; i++) level[i]= asleaf(leaves[i]);
+    for (count= n; count > 1; count= nodes) {
+        nodes= (count + BNODE_FANOUT-1)/BNODE_FANOUT;
+        for (j=0,k=0; j < nodes; j++) {
+            end= (u32)(((unsigned long long)count*(j+1))/nodes);
+            node= new_bnode();
+            for (; k < end; k++) {
+                bnkey(node,bnused(node))= largestval(level[k]);
+                bnchild(node,bnused(node))= level[k];
+                bnused(node)++;
+                bnsum(node)+= count_or_sum(level[k]);
+            }
+            level[j]= asbnode(node);
+        }
+    }
+    return level[0];
+}
+
+/* make a new wide tree root with the given (encoded) node in its only slot */
+static mindex new_wide_root(dmindex child,valtype largest) {
+    mindex node= new_bnode();
+    bnkey(node,0)= largest;
+    bnchild(node,0)= child;
+    bnused(node)= 1;
+    bnsum(node)= count_or_sum(child);
+    return node;
+}
+
+/* increment the count of instance of val in the wide tree and return the leaf updated */
+static mindex increment_wide_value_count(mindex tree,valtype val) {
+    mindex path[MAX_WIDE_DEPTH];
+    int slot[MAX_WIDE_DEPTH];
+    int depth=0,i,last;
+    mindex node= encbnode2mindex(treeroot(tree)),leaf;
+
+    /* descend to the bnode above the leaves, adding one to the sums on the way */
+    for (;;) {
+        dirty_bnode(node);
+        bnsum(node)+= OBS_INCR;
+        if (isleaf(bnchild(node,0))) break;
+        last= bnused(node)-1;
+        for (i=0; i < last && val > bnkey(node,i); i++) {}
+        if (val > bnkey(node,i)) bnkey(node,i)= val; /* val will be the new largest value in the last slot */
+        path[depth]= node;
+        slot[depth]= i;
+        depth++;
+        node= encbnode2mindex(bnchild(node,i));
+    }
+    
+    for (i=0; i < bnused(node) && val > bnkey(node,i); i++) {}
+    if (i < bnused(node) && val == bnkey(node,i)) { /* found the leaf */
+        leaf= encleaf2mindex(bnchild(node,i));
+        bump_leafcount(leaf);
+        return leaf;
+    }
+    
+    /* need to add the leaf before slot i */
+    leaf= new_leaf(val); /* count is 1 */
+    path[depth]= node;
+    insert_into_wide_path(tree,path,slot,depth,i,val,asleaf(leaf));
+    return leaf;
+}
+
+/* put child (whose largest value is key) in slot pos of the bnode at
+   path[level], moving later slots over; if that bnode is full, split it in
+   two and add the new right half to its parent (path[level-1], where it was
+   in slot[level-1]) and so on up; path[0] is the root of the tree */
+static void insert_into_wide_path(mindex tree,mindex path[],int slot[],int level,int pos,valtype key,dmindex child) {
+    valtype keys[BNODE_FANOUT+1];
+    dmindex children[BNODE_FANOUT+1];
+    mindex node,right,newroot;
+    int i,n,half;
+    
+    for (;;) {
+        node= path[level];
+        dirty_bnode(node);
+        n= bnused(node);
+        if (n < BNODE_FANOUT) {
+            for (i=n; i > pos; i--) {
+                bnkey(node,i)= bnkey(node,i-1);
+                bnchild(node,i)= bnchild(node,i-1);
+            }
+            bnkey(node,pos)= key;
+            bnchild(node,pos)= child;
+            bnused(node)++;
+            return;
+        }
+        
+        /* node is full; lay out its slots with the new one and deal half of them to a new right sibling */
+        for (i=0; i < pos; i++) {
+            keys[i]= bnkey(node,i);
+            children[i]= bnchild(node,i);
+        }
+        keys[pos]= key;
+        children[pos]= child;
+        for (i=pos; i < n; i++) {
+            keys[i+1]= bnkey(node,i);
+            children[i+1]= bnchild(node,i);
+        }
+        half= (n+1)/2;
+        right= new_bnode();
+        bnsum(node)= 0;
+        for (i=0; i < half; i++) {
+            bnkey(node,i)= keys[i];
+            bnchild(node,i)= children[i];
+            bnsum(node)+= count_or_sum(children[i]);
+        }
+        bnused(node)= half;
+        for (i=half; i <= n; i++) {
+            bnkey(right,i-half)= keys[i];
+            bnchild(right,i-half)= children[i];
+            bnsum(right)+= count_or_sum(children[i]);
+        }
+        bnused(right)= n+1-half;
+        
+        if (level == 0) { /* split the root, so the tree gets a level deeper */
+            newroot= new_wide_root(asbnode(node),bnlargest(node));
+            bnkey(newroot,1)= bnlargest(right);
+            bnchild(newroot,1)= asbnode(right);
+            bnused(newroot)= 2;
+            bnsum(newroot)+= bnsum(right);
+            dirty_tree(tree);
+            treeroot(tree)= asbnode(newroot);
+            return;
+        }
+        
+        /* node's slot in the parent now has only the left half; right goes after it */
+        level--;
+        pos= slot[level];
+        dirty_bnode(path[level]);
+        bnkey(path[level],pos)= bnlargest(node);
+        key= bnlargest(right);
+        child= asbnode(right);
+        pos++;
+    }
+}
+
+/* the wide tree part of scale_and_prune_subtree; node is a (non-encoded) bnode */
+static dmindex scale_and_prune_wide_subtree(mindex node,double factor,double threshold,double *change,valtype *newrightmost,spade_prune_cursor *c) {
+    double childchange,reduced=0.0;
+    valtype childrightmost;
+    dmindex child;
+    valtype key;
+    int i,n,changed= (factor != 1.0);
+    
+    bnsum(node)*= factor; /* should really get this by adding otherwise there is some drift */
+    if (bnsum(node) < threshold) {
+        if (c != NULL) prune_step_did(c,bnlargest(node));
+        if (cur_arena->keep_clogc) prune_clogc_change-= subtree_clogc(asbnode(node));
+        prune_nvals_change-= num_subtree_leaves(asbnode(node));
+        *change= bnsum(node);
+        *newrightmost= NOT_A_SORTPT; /* we don't have the info */
+        free_all_in_subtree(asbnode(node));
+        return TNULL;
+    }
+    
+    /* scale below us, closing up the slots of anything deleted */
+    for (i=0,n=0; i < bnused(node); i++) {
+        if (c != NULL && c->started && bnkey(node,i) <= c->after) { /* done earlier in this pass */
+            child= bnchild(node,i);
+            childchange= 0.0;
+        } else {
+            child= scale_and_prune_subtree(bnchild(node,i),factor,threshold,&childchange,&childrightmost,c);
+        }
+        reduced+= childchange;
+        if (child == TNULL) continue;
+        key= isbnode(child) ? bnlargest(encbnode2mindex(child)) : bnkey(node,i);
+        if (n != i || child != bnchild(node,i) || key != bnkey(node,i)) changed= 1;
+        bnchild(node,n)= child;
+        bnkey(node,n)= key;
+        n++;
+    }
+    if (changed || n != bnused(node) || reduced != 0.0) dirty_bnode(node);
+    bnused(node)= n;
+    *change= reduced;
+    if (n == 0) { /* all that was below us is gone */
+        *newrightmost= NOT_A_SORTPT;
+        free_bnode(node);
+        return TNULL;
+    }
+    
+    if (isbnode(bnchild(node,0))) merge_wide_children(node);
+    bnsum(node)-= reduced;
+    *newrightmost= bnlargest(node);
+    return asbnode(node);
+}
+
+/* scale_and_prune_subtree() for a dnode */
+static dmindex scale_and_prune_dense_subtree(mindex node,double factor,double threshold,double *change,valtype *newrightmost,spade_prune_cursor *c) {
+    double childchange,reduced=0.0;
+    valtype childrightmost;
+    dmindex child;
+    int i;
+    
+    *newrightmost= NOT_A_SORTPT; /* dnodes are never under a node that needs this */
+    if (factor != 1.0) dirty_dnode(node);
+    dnsum(node)*= factor; /* should really get this by adding otherwise there is some drift */
+    if (dnsum(node) < threshold) {
+        if (c != NULL) prune_step_did(c,dnslottop(node,DNODE_SLOTS-1));
+        if (cur_arena->keep_clogc) prune_clogc_change-= subtree_clogc(asdnode(node));
+        prune_nvals_change-= num_subtree_leaves(asdnode(node));
+        *change= dnsum(node);
+        free_all_in_subtree(asdnode(node));
+        return TNULL;
+    }
+    
+    /* scale below us, emptying the slots of anything deleted */
+    for (i=0; i < DNODE_SLOTS; i++) {
+        if (dnchild(node,i) == TNULL) continue;
+        if (c != NULL && c->started && dnslottop(node,i) <= c->after) continue; /* done earlier in this pass */
+        child= scale_and_prune_subtree(dnchild(node,i),factor,threshold,&childchange,&childrightmost,c);
+        reduced+= childchange;
+        if (child != dnchild(node,i) || childchange != 0.0) dirty_dnode(node);
+        dnchild(node,i)= child;
+        if (child == TNULL) dnused(node)--;
+    }
+    *change= reduced;
+    if (dnused(node) == 0) { /* all that was below us is gone */
+        free_dnode(node);
+        return TNULL;
+    }
+    dnsum(node)-= reduced;
+    return asdnode(node);
+}
+
+/* combine neighboring bnode children of the given bnode when they fit in one, to keep the tree from getting sparse as it is pruned */
+static void merge_wide_children(mindex node) {
+    mindex left,right;
+    int i,j,n;
+    
+    for (i=0; i+1 < bnused(node); ) {
+        left= encbnode2mindex(bnchild(node,i));
+        right= encbnode2mindex(bnchild(node,i+1));
+        n= bnused(left);
+        if (n+bnused(right) > BNODE_FANOUT) {
+            i++;
+            continue;
+        }
+        dirty_bnode(node);
+        dirty_bnode(left);
+        for (j=0; j < bnused(right); j++) {
+            bnkey(left,n+j)= bnkey(right,j);
+            bnchild(left,n+j)= bnchild(right,j);
+        }
+        bnused(left)+= bnused(right);
+        bnsum(left)+= bnsum(right);
+        free_bnode(right);
+        bnkey(node,i)= bnkey(node,i+1);
+        for (j=i+1; j+1 < bnused(node); j++) {
+            bnkey(node,j)= bnkey(node,j+1);
+            bnchild(node,j)= bnchild(node,j+1);
+        }
+        bnused(node)--;
+    }
+}
+
+/*****************************************************/
+
 #if 0 /* not currently needed, prob not tested */
 /* regardless of wait counts, start rebalancing this tree from the root */
 static void rebalance_tree(mindex tree) {
@@ -659,6 +1953,7 @@ static void rebalance_subtree(mindex encnode) {
 
     if (isleaf(encnode)) return;
     node= encnode;
+    dirty_int(node); /* its wait gets reset, if nothing else */
 
     do {
 #ifdef NO_REBALANCE
@@ -690,6 +1985,7 @@ printf(" < (%f,%f)*0.999 [%f]\n",lct,rct,unbalanced_amount*0.999);*/
                         /* rotate right */
                         /* recycle "left" interior node into one for right */ 
                         newright= left;
+                        dirty_int(newright);
                         intsortpt(newright)= largestval(right2);
                         intleft(newright)= right2;
                         intright(newright)= right;
@@ -716,10 +2012,12 @@ printf(" < (%f,%f)*0.999 [%f]\n",lct,rct,unbalanced_amount*0.999);*/
                             lrl= intleft(prl);
                             
                             /* intsortpt(pprl) remains same */
+                            dirty_int(pprl);
                             intright(pprl)= lrl;
                             /* rl is now out of right of tree and prl can be recycled */
                             /* use prl for node on right of "node", containing rl and "right" */
                             newright= prl;
+                            dirty_int(newright);
                             intsortpt(newright)= largestval(rl);
                             intleft(newright)= rl;
                             intright(newright)= right;
@@ -728,6 +2026,7 @@ printf(" < (%f,%f)*0.999 [%f]\n",lct,rct,unbalanced_amount*0.999);*/
                             intsortpt(node)= prl_largest;
                             /* update sums from left to pprl (inclusive) to reflect loss (rlct) of the node rl */
                             for (n=left; 1; n=intright(n)) {
+                                dirty_int(n);
                                 intsum(n)-= rlct;
                                 if (n == pprl) break;
                             }
@@ -750,6 +2049,7 @@ printf(" < (%f,%f)*0.999 [%f]]\n",rct,lct,unbalanced_amount*0.999);*/
                         /* rotate left */
                         /* transform "right" interior node into one for left */
                         newleft= right;
+                        dirty_int(newleft);
                         intsortpt(newleft)= largestval(left);
                         intleft(newleft)= left;
                         intright(newleft)= left2;
@@ -775,11 +2075,13 @@ printf(" < (%f,%f)*0.999 [%f]]\n",rct,lct,unbalanced_amount*0.999);*/
                             lrct= count_or_sum(lr);
                             rlr= intright(plr);
                             
+                            dirty_int(pplr);
                             intsortpt(pplr)= largestval(rlr);
                             intleft(pplr)= rlr;
                             /* lr is now out of right of tree and plr can be recycled */
                             /* use plr for node on left of node, containing left and lr */
                             newleft= plr;
+                            dirty_int(newleft);
                             intsortpt(newleft)= largestval(left);
                             intleft(newleft)= left;
                             intright(newleft)= lr;
@@ -788,6 +2090,7 @@ printf(" < (%f,%f)*0.999 [%f]]\n",rct,lct,unbalanced_amount*0.999);*/
                             intsortpt(node)= lr_largest;
                             /* update sums from right to pplr (inclusive) to reflect loss (lrct) of the node lr */
                             for (n=right; 1; n=intleft(n)) {
+                                dirty_int(n);
                                 intsum(n)-= lrct;
                                 if (n == pplr) break;
                             }
@@ -803,7 +2106,7 @@ printf(" < (%f,%f)*0.999 [%f]]\n",rct,lct,unbalanced_amount*0.999);*/
     /* note: right and left of node may have changed */
 
     /* reset the wait count */
-    intwait(node)= wait_time(count_or_sum(intleft(node)),count_or_sum(intright(node)));
+    intwait(node)= wait_time(actual_count(count_or_sum(intleft(node))),actual_count(count_or_sum(intright(node))));
 }
 
 static int out_of_balance(mindex node) {
@@ -822,6 +2125,7 @@ static void free_all_in_tree(mindex tree) {
 
 static void free_all_in_subtree(dmindex encnode) {
     mindex node,t,next;
+    int i;
 /*printf("free_all_in_subtree(%X)\n",encnode);*/
     if (isleaf(encnode)) {
         node= encleaf2mindex(encnode);
@@ -830,6 +2134,14 @@ static void free_all_in_subtree(dmindex encnode) {
             free_all_in_tree(t);
         }
         free_leaf(node);
+    } else if (isbnode(encnode)) {
+        node= encbnode2mindex(encnode);
+        for (i=0; i < bnused(node); i++) free_all_in_subtree(bnchild(node,i));
+        free_bnode(node);
+    } else if (isdnode(encnode)) {
+        node= encdnode2mindex(encnode);
+        for (i=0; i < DNODE_SLOTS; i++) if (dnchild(node,i) != TNULL) free_all_in_subtree(dnchild(node,i));
+        free_dnode(node);
     } else {
         node= encnode;
         if (intleft(node) != TNULL) free_all_in_subtree(intleft(node));
@@ -838,35 +2150,150 @@ static void free_all_in_subtree(dmindex encnode) {
     }   
 }
 
+/* scale the table's counts down by factor in constant time by adding it to
+   the decay not yet applied to the stored counts; once that gets below
+   MIN_LAZY_DECAY, bring the stored counts up to date so they stay in range.
+   Pruning is left to spade_prob_table_prune_step() */
+void spade_prob_table_decay(spade_prob_table *self,double factor) {
+    self->arena->decay*= factor;
+    self->arena->incr= 1/self->arena->decay;
+    if (self->arena->decay < MIN_LAZY_DECAY) scale_and_prune_table(self,1.0,0.0);
+}
+
+/* scale the table's counts by factor and prune away the observations that end up below threshold; this visits every node */
 void scale_and_prune_table(spade_prob_table *self,double factor,double threshold) {
     int i;
+    use_arena(self->arena);
+    factor*= cur_arena->decay; /* apply any pending decay too */
     for (i=0; i < MAX_NUM_FEATURES; i++) {
-        if (self->root[i] != TNULL) scale_and_prune_tree(self->root[i],factor,threshold);
+        if (self->root[i] != TNULL) scale_and_prune_tree(self->root[i],factor,threshold,NULL);
+    }
+    cur_arena->decay= cur_arena->incr= 1.0;
+}
+
+void init_spade_prune_cursor(spade_prune_cursor *c) {
+    c->feature= MAX_NUM_FEATURES;
+    c->started= 0;
+    c->threshold= 0.0;
+    c->budget= 0;
+    c->stopped= 0;
+    c->visited= c->last_visited= 0;
+    c->passes= 0;
+}
+
+/* set up c for a new pass pruning away the observations in the table below
+   threshold; there is nothing for a pass to do in an empty table, so none is
+   started then */
+void spade_prob_table_start_prune(spade_prob_table *self,spade_prune_cursor *c,double threshold) {
+    for (c->feature= 0; c->feature < MAX_NUM_FEATURES && self->root[c->feature] == TNULL; c->feature++) {}
+    c->started= 0;
+    c->threshold= threshold;
+    c->visited= 0;
+}
+
+/* is there a pass under way with c? */
+int spade_prob_table_pruning(spade_prune_cursor *c) {
+    return c->feature < MAX_NUM_FEATURES;
+}
+
+/* continue the pruning pass with c, visiting about budget nodes; returns
+   1 if this completes the pass.  The top level trees are done in turn, each in
+   order of value; the nested trees under a top level leaf are done along with it */
+int spade_prob_table_prune_step(spade_prob_table *self,spade_prune_cursor *c,u32 budget) {
+    if (!spade_prob_table_pruning(c)) return 0;
+    use_arena(self->arena);
+    prune_visits= 0;
+    c->budget= budget;
+    c->stopped= 0;
+    for (; c->feature < MAX_NUM_FEATURES; c->feature++,c->started=0) {
+        if (self->root[c->feature] != TNULL) {
+            /* the threshold is converted into the units the counts are currently stored in */
+            scale_and_prune_tree(self->root[c->feature],1.0,c->threshold*cur_arena->incr,c);
+            if (c->stopped) break;
+        }
     }
+    c->visited+= prune_visits;
+    if (c->stopped) return 0;
+    c->last_visited= c->visited;
+    c->passes++;
+    return 1;
 }
 
-static void scale_and_prune_tree(mindex tree,double factor,double threshold) {
-    double change;
-    valtype newrightmost;
-    if (treeroot(tree) != TNULL) treeroot(tree)= scale_and_prune_subtree(treeroot(tree),factor,threshold,&change,&newrightmost);
+/* in a step of an incremental pass, if the subtree at encnode needs no more done to it now, set the results of scale_and_prune_subtree to leave it alone and return 1 */
+static int prune_step_skips(spade_prune_cursor *c,dmindex encnode,double *change,valtype *newrightmost) {
+    if (prune_visits > c->budget) {
+        c->stopped= 1; /* the rest will wait until the next step */
+    } else if (!(c->started && isleaf(encnode) && leafvalue(encleaf2mindex(encnode)) <= c->after)) {
+        return 0;
+    }
+    *change= 0.0;
+    *newrightmost= NOT_A_SORTPT;
+    return 1;
+}
+
+/* note that an incremental pass has done everything in the current top level tree up to and including largest */
+static void prune_step_did(spade_prune_cursor *c,valtype largest) {
+    c->after= largest;
+    c->started= 1;
 }
 
-static dmindex scale_and_prune_subtree(dmindex encnode,double factor,double threshold,double *change,valtype *newrightmost) {
+/* scale and prune the tree; c is NULL unless this is a step in an incremental pass over a top level tree */
+static void scale_and_prune_tree(mindex tree,double factor,double threshold,spade_prune_cursor *c) {
+    double change;
+    double outer_clogc_change= prune_clogc_change; /* we may be a tree nested in one being done */
+    int outer_nvals_change= prune_nvals_change;
+    valtype newrightmost;
+    dmindex root= treeroot(tree);
+    prune_clogc_change= 0.0;
+    prune_nvals_change= 0;
+    if (root != TNULL) treeroot(tree)= scale_and_prune_subtree(root,factor,threshold,&change,&newrightmost,c);
+    if (treeroot(tree) != root || prune_clogc_change != 0.0 || prune_nvals_change != 0) dirty_tree(tree);
+    treeclogc(tree)= (treeroot(tree) == TNULL) ? 0.0 : treeclogc(tree)+prune_clogc_change;
+    treenvals(tree)+= prune_nvals_change;
+    prune_clogc_change= outer_clogc_change;
+    prune_nvals_change= outer_nvals_change;
+    /* a dense tree that has gotten small is better off sorted */
+    if (isdnode(treeroot(tree)) && treenvals(tree) < DENSE_DROP_VALUES) undensify_tree(tree);
+    /* a wide root left with a single slot is not needed */
+    for (root= treeroot(tree); isbnode(root) && bnused(encbnode2mindex(root)) == 1; root= treeroot(tree)) {
+        dirty_tree(tree);
+        treeroot(tree)= bnchild(encbnode2mindex(root),0);
+        free_bnode(encbnode2mindex(root));
+    }
+}
+
+static dmindex scale_and_prune_subtree(dmindex encnode,double factor,double threshold,double *change,valtype *newrightmost,spade_prune_cursor *c) {
     mindex node,t;
     int a_leaf= isleaf(encnode);
 
+    prune_visits++;
+    if (c != NULL && prune_step_skips(c,encnode,change,newrightmost)) return encnode;
+    if (isbnode(encnode)) return scale_and_prune_wide_subtree(encbnode2mindex(encnode),factor,threshold,change,newrightmost,c);
+    if (isdnode(encnode)) return scale_and_prune_dense_subtree(encdnode2mindex(encnode),factor,threshold,change,newrightmost,c);
+
     /* scale ourselves */
     if (a_leaf) {
         node= encleaf2mindex(encnode);
-        leafcount(node)*= factor;
+        if (factor != 1.0) dirty_leaf(node);
+        if (cur_arena->keep_clogc && factor != 1.0) {
+            prune_clogc_change-= clogc_term(leafcount(node));
+            leafcount(node)*= factor;
+            prune_clogc_change+= clogc_term(leafcount(node));
+        } else {
+            leafcount(node)*= factor;
+        }
     } else {
         node= encnode;
+        if (factor != 1.0) dirty_int(node);
         intsum(node)*= factor; /* should really get this by adding otherwise there is some drift */
     }
     
     /* if we get too small, delete us and return TNULL and how much weight we had */
     if (count_or_sum(encnode) < threshold) {
 /*printf("Deleting %X:\n",encnode);printtree2(encnode,"");printf("\n");*/
+        if (c != NULL) prune_step_did(c,largestval(encnode));
+        if (cur_arena->keep_clogc) prune_clogc_change-= subtree_clogc(encnode);
+        prune_nvals_change-= a_leaf ? 1 : num_subtree_leaves(encnode);
         *change= count_or_sum(encnode);
         *newrightmost= NOT_A_SORTPT; /* we don't have the info */
         free_all_in_subtree(encnode);
@@ -879,24 +2306,25 @@ static dmindex scale_and_prune_subtree(dmindex encnode,double factor,double thre
         *newrightmost= NOT_A_SORTPT;
                 
         for (t=leafnexttree(node); t != TNULL; t=treenext(t)) {
-            scale_and_prune_tree(t,factor,threshold);
+            scale_and_prune_tree(t,factor,threshold,NULL);
         }
+        if (c != NULL) prune_step_did(c,leafvalue(node));
     } else {
         dmindex left,right;
         double mychange,reduced=0.0;
         left= intleft(node);
         right= intright(node);
         
-        if (left != TNULL) {
+        if (left != TNULL && !(c != NULL && c->started && intsortpt(node) <= c->after)) { /* (unless done earlier in this pass) */
             valtype leftnewrightmost; /* we want this to update our sortpt, if there is a change, and the rightmost has changed */
-            intleft(node)= scale_and_prune_subtree(left,factor,threshold,change,&leftnewrightmost);
+            intleft(node)= scale_and_prune_subtree(left,factor,threshold,change,&leftnewrightmost,c);
             if (*change > 0.0) {
                 reduced+= *change;
                 if (leftnewrightmost != NOT_A_SORTPT) intsortpt(node)= leftnewrightmost; /* there is a new rightmost on left side */
             }
         }
         if (right != TNULL) {
-            intright(node)= scale_and_prune_subtree(right,factor,threshold,&mychange,newrightmost);
+            intright(node)= scale_and_prune_subtree(right,factor,threshold,&mychange,newrightmost,c);
             if (mychange > 0.0) {
                 reduced+= mychange;
             }
@@ -904,6 +2332,7 @@ static dmindex scale_and_prune_subtree(dmindex encnode,double factor,double thre
             *newrightmost= NOT_A_SORTPT;
         }
         *change= reduced;
+        if (intleft(node) != left || intright(node) != right || reduced != 0.0) dirty_int(node);
         
         left= intleft(node);
         right= intright(node);
@@ -997,6 +2426,7 @@ float feature_trees_stats(spade_prob_table *self,features f,float *amind,float *
     unsigned int sum_num_leaves,sum_mind,sum_maxd;
     float sum_aved,sum_waved;
     int i;
+    use_arena(self->arena);
     for (i=0; i < MAX_NUM_FEATURES; i++) {
         if (self->root[i] != TNULL) {
             tree_count+= feature_tree_stats(self->root[i],f,&sum_mind,&sum_maxd,&sum_aved,&sum_waved,&sum_num_leaves);
@@ -1055,6 +2485,29 @@ static unsigned int feature_subtree_stats(mindex encnode,features f,unsigned int
             *swaved+= new_swaved;
             *snum_leaves+= new_snum_leaves;
         }
+    } else if (isbnode(encnode)) {
+        int i;
+        node= encbnode2mindex(encnode);
+        for (i=0; i < bnused(node); i++) {
+            tree_count+= feature_subtree_stats(bnchild(node,i),f,&new_smind,&new_smaxd,&new_saved,&new_swaved,&new_snum_leaves);
+            *smind+= new_smind;
+            *smaxd+= new_smaxd;
+            *saved+= new_saved;
+            *swaved+= new_swaved;
+            *snum_leaves+= new_snum_leaves;
+        }
+    } else if (isdnode(encnode)) {
+        int i;
+        node= encdnode2mindex(encnode);
+        for (i=0; i < DNODE_SLOTS; i++) {
+            if (dnchild(node,i) == TNULL) continue;
+            tree_count+= feature_subtree_stats(dnchild(node,i),f,&new_smind,&new_smaxd,&new_saved,&new_swaved,&new_snum_leaves);
+            *smind+= new_smind;
+            *smaxd+= new_smaxd;
+            *saved+= new_saved;
+            *swaved+= new_swaved;
+            *snum_leaves+= new_snum_leaves;
+        }
     } else {
         node= encnode;
         if (intleft(node) != TNULL) {
@@ -1107,6 +2560,14 @@ static unsigned int num_leaves(mindex tree) {
 static unsigned int num_subtree_leaves(mindex encnode) {
     if (isleaf(encnode)) {
         return 1;
+    } else if (isbnode(encnode)) {
+        int i,count= 0;
+        for (i=0; i < bnused(encbnode2mindex(encnode)); i++) count+=num_subtree_leaves(bnchild(encbnode2mindex(encnode),i));
+        return count;
+    } else if (isdnode(encnode)) {
+        int i,count= 0;
+        for (i=0; i < DNODE_SLOTS; i++) if (dnchild(encdnode2mindex(encnode),i) != TNULL) count+=num_subtree_leaves(dnchild(encdnode2mindex(encnode),i));
+        return count;
     } else {
         int count= 0;
         if (intleft(encnode) != TNULL) count+=num_subtree_leaves(intleft(encnode));
@@ -1127,6 +2588,14 @@ static unsigned int subtree_depth_total(mindex encnode,unsigned int depth) {
     depth++;
     if (isleaf(encnode)) {
         return depth;
+    } else if (isbnode(encnode)) {
+        int i,count= 0;
+        for (i=0; i < bnused(encbnode2mindex(encnode)); i++) count+=subtree_depth_total(bnchild(encbnode2mindex(encnode),i),depth);
+        return count;
+    } else if (isdnode(encnode)) {
+        int i,count= 0;
+        for (i=0; i < DNODE_SLOTS; i++) if (dnchild(encdnode2mindex(encnode),i) != TNULL) count+=subtree_depth_total(dnchild(encdnode2mindex(encnode),i),depth);
+        return count;
     } else {
         int count= 0;
         if (intleft(encnode) != TNULL) count+=subtree_depth_total(intleft(encnode),depth);
@@ -1147,6 +2616,16 @@ static double weighted_subtree_depth_total(mindex encnode,unsigned int depth) {
     depth++;
     if (isleaf(encnode)) {
         return depth*leafnode(encleaf2mindex(encnode)).count;
+    } else if (isbnode(encnode)) {
+        int i;
+        double count= 0;
+        for (i=0; i < bnused(encbnode2mindex(encnode)); i++) count+=weighted_subtree_depth_total(bnchild(encbnode2mindex(encnode),i),depth);
+        return count;
+    } else if (isdnode(encnode)) {
+        int i;
+        double count= 0;
+        for (i=0; i < DNODE_SLOTS; i++) if (dnchild(encdnode2mindex(encnode),i) != TNULL) count+=weighted_subtree_depth_total(dnchild(encdnode2mindex(encnode),i),depth);
+        return count;
     } else {
         double count= 0;
         if (intleft(encnode) != TNULL) count+=weighted_subtree_depth_total(intleft(encnode),depth);
@@ -1177,6 +2656,12 @@ static void subtree_min_max_depth(mindex encnode,unsigned int *mind,unsigned int
         if (*maxd < depth) {
             *maxd= depth;
         }
+    } else if (isbnode(encnode)) {
+        int i;
+        for (i=0; i < bnused(encbnode2mindex(encnode)); i++) subtree_min_max_depth(bnchild(encbnode2mindex(encnode),i),mind,maxd,depth);
+    } else if (isdnode(encnode)) {
+        int i;
+        for (i=0; i < DNODE_SLOTS; i++) if (dnchild(encdnode2mindex(encnode),i) != TNULL) subtree_min_max_depth(dnchild(encdnode2mindex(encnode),i),mind,maxd,depth);
     } else {
         if (intleft(encnode) != TNULL) subtree_min_max_depth(intleft(encnode),mind,maxd,depth);
         if (intright(encnode) != TNULL) subtree_min_max_depth(intright(encnode),mind,maxd,depth);
@@ -1187,6 +2672,7 @@ static void subtree_min_max_depth(mindex encnode,unsigned int *mind,unsigned int
 /*****************************************************/
 void spade_prob_table_write_stats(spade_prob_table *self,FILE *file,u8 stats_to_print) {
     featcomb H;
+    use_arena(self->arena);
 
     if (stats_to_print & STATS_ENTROPY) {
         H= calc_all_entropies(self);
@@ -1211,6 +2697,7 @@ void write_all_uncond_probs(spade_prob_table *self,FILE *f) {
     int i;
     features feats[MAX_NUM_FEATURES];
     valtype vals[MAX_NUM_FEATURES];
+    use_arena(self->arena);
     for (i=0; i < MAX_NUM_FEATURES; i++) {
         if (self->root[i] != TNULL) write_all_tree_uncond_probs(self,f,self->root[i],0,feats,vals,count_or_sum(tree(self->root[i]).root));
     }
@@ -1239,6 +2726,14 @@ static void write_all_subtree_uncond_probs(spade_prob_table *self,FILE *f,dminde
         for (t=leafnexttree(node); t != TNULL; t=treenext(t)) {
             write_all_tree_uncond_probs(self,f,t,depth,feats,vals,treesum);
         }
+    } else if (isbnode(encnode)) {
+        int i;
+        node= encbnode2mindex(encnode);
+        for (i=0; i < bnused(node); i++) write_all_subtree_uncond_probs(self,f,bnchild(node,i),depth,feats,vals,treesum);
+    } else if (isdnode(encnode)) {
+        int i;
+        node= encdnode2mindex(encnode);
+        for (i=0; i < DNODE_SLOTS; i++) if (dnchild(node,i) != TNULL) write_all_subtree_uncond_probs(self,f,dnchild(node,i),depth,feats,vals,treesum);
     } else {
         node= encnode;
         if (intleft(node) != TNULL) write_all_subtree_uncond_probs(self,f,intleft(node),depth,feats,vals,treesum);
@@ -1253,6 +2748,7 @@ void write_all_cond_probs(spade_prob_table *self,FILE *f) {
     int i;
     features feats[MAX_NUM_FEATURES];
     valtype vals[MAX_NUM_FEATURES];
+    use_arena(self->arena);
     for (i=0; i < MAX_NUM_FEATURES; i++) {
         if (self->root[i] != TNULL) write_all_tree_cond_probs(self,f,self->root[i],0,feats,vals);
     }
@@ -1283,6 +2779,14 @@ static void write_all_subtree_cond_probs(spade_prob_table *self,FILE *f,dmindex
         for (t=leafnexttree(node); t != TNULL; t=treenext(t)) {
             write_all_tree_cond_probs(self,f,t,depth,feats,vals);
         }
+    } else if (isbnode(encnode)) {
+        int i;
+        node= encbnode2mindex(encnode);
+        for (i=0; i < bnused(node); i++) write_all_subtree_cond_probs(self,f,bnchild(node,i),depth,feats,vals,treesum);
+    } else if (isdnode(encnode)) {
+        int i;
+        node= encdnode2mindex(encnode);
+        for (i=0; i < DNODE_SLOTS; i++) if (dnchild(node,i) != TNULL) write_all_subtree_cond_probs(self,f,dnchild(node,i),depth,feats,vals,treesum);
     } else {
         node= encnode;
         if (intleft(node) != TNULL) write_all_subtree_cond_probs(self,f,intleft(node),depth,feats,vals,treesum);
@@ -1339,6 +2843,7 @@ featcomb calc_all_entropies(spade_prob_table *self) {
     features feats[MAX_NUM_FEATURES];
     featcomb H= create_featurecomb(MAX_NUM_FEATURES,0.0);
     int i;
+    use_arena(self->arena);
     for (i=0; i < MAX_NUM_FEATURES; i++) {
         if (self->root[i] != TNULL) {
             add_all_tree_entrsum(H,self->root[i],0,feats,tree_count(self->root[i]));
@@ -1376,6 +2881,14 @@ static void add_all_subtree_entrsum(featcomb c,dmindex encnode,int depth,feature
         for (t=leafnexttree(node); t != TNULL; t=treenext(t)) {
             add_all_tree_entrsum(c,t,depth,feats,totsum);
         }
+    } else if (isbnode(encnode)) {
+        int i;
+        node= encbnode2mindex(encnode);
+        for (i=0; i < bnused(node); i++) add_all_subtree_entrsum(c,bnchild(node,i),depth,feats,treesum,totsum);
+    } else if (isdnode(encnode)) {
+        int i;
+        node= encdnode2mindex(encnode);
+        for (i=0; i < DNODE_SLOTS; i++) if (dnchild(node,i) != TNULL) add_all_subtree_entrsum(c,dnchild(node,i),depth,feats,treesum,totsum);
     } else {
         node= encnode;
         if (intleft(node) != TNULL) add_all_subtree_entrsum(c,intleft(node),depth,feats,treesum,totsum);
@@ -1386,6 +2899,7 @@ static void add_all_subtree_entrsum(featcomb c,dmindex encnode,int depth,feature
 void write_all_entropies(spade_prob_table *self,FILE *f,featcomb c) {
     int i;
     features feats[MAX_NUM_FEATURES];
+    use_arena(self->arena);
     for (i=0; i < MAX_NUM_FEATURES; i++) {
         if (c->val[i] > 0) {
             fprintf(f,"H(%s)=%.8f\n",self->featurenames[i],c->val[i]);
@@ -1430,6 +2944,7 @@ static void write_feature_names(spade_prob_table *self,FILE *f,int depth,feature
 
 void print_spade_prob_table(spade_prob_table *self) {
     int i;
+    use_arena(self->arena);
     for (i=0; i < MAX_NUM_FEATURES; i++) {
         if (self->root[i] != TNULL) {
             printtree(self,self->root[i],"");
@@ -1461,6 +2976,25 @@ static void printtree2(spade_prob_table *self,dmindex encnode,char *ind) {
             printf("%s}}",ind);
         }
         printf("}");
+    } else if (isbnode(encnode)) {
+        int i;
+        node= encbnode2mindex(encnode);
+        printf("[[%X: (%.2f)",node,bnsum(node));
+        for (i=0; i < bnused(node); i++) {
+            printf(" <=%d ",bnkey(node,i));
+            printtree2(self,bnchild(node,i),ind);
+        }
+        printf("]]");
+    } else if (isdnode(encnode)) {
+        int i;
+        node= encdnode2mindex(encnode);
+        printf("[#%X: %d+ (%.2f)",node,dnbase(node),dnsum(node));
+        for (i=0; i < DNODE_SLOTS; i++) {
+            if (dnchild(node,i) == TNULL) continue;
+            printf(" @%d ",i);
+            printtree2(self,dnchild(node,i),ind);
+        }
+        printf("#]");
     } else {
         node= encnode;
         printf("[%X: <=%d (%.2f) W=%d ",node,intsortpt(node),intsum(node),intwait(node));
@@ -1487,6 +3021,25 @@ static void printtree2_shallow(dmindex encnode) {
         node=encleaf2mindex(encnode);
         printf("{%X: %dx%.2f",node,leafvalue(node),leafcount(node));
         printf("}");
+    } else if (isbnode(encnode)) {
+        int i;
+        node= encbnode2mindex(encnode);
+        printf("[[%X: (%.2f)",node,bnsum(node));
+        for (i=0; i < bnused(node); i++) {
+            printf(" <=%d ",bnkey(node,i));
+            printtree2_shallow(bnchild(node,i));
+        }
+        printf("]]");
+    } else if (isdnode(encnode)) {
+        int i;
+        node= encdnode2mindex(encnode);
+        printf("[#%X: %d+ (%.2f)",node,dnbase(node),dnsum(node));
+        for (i=0; i < DNODE_SLOTS; i++) {
+            if (dnchild(node,i) == TNULL) continue;
+            printf(" @%d ",i);
+            printtree2_shallow(dnchild(node,i));
+        }
+        printf("#]");
     } else {
         node= encnode;
         printf("[%X: <=%d (%.2f) ",node,intsortpt(node),intsum(node));
@@ -1501,6 +3054,7 @@ static void printtree2_shallow(dmindex encnode) {
 
 int sanity_check_spade_prob_table(spade_prob_table *self) {
     int i,numerrs=0;
+    use_arena(self->arena);
     for (i=0; i < MAX_NUM_FEATURES; i++) {
         if (self->root[i] != TNULL) {
             numerrs+= sanity_check_tree(self->root[i]);
@@ -1517,7 +3071,16 @@ static int sanity_check_tree(mindex tree) {
         numerrs++;
     }
     if (treeroot(tree) != TNULL) {
+        double clogc= cur_arena->keep_clogc ? subtree_clogc(root) : 0.0;
         numerrs+= sanity_check_subtree(root);
+        if (treenvals(tree) != num_subtree_leaves(root)) {
+            fprintf(stderr,"*** integrity check failure: value count kept on tree %X is %d, but it has %d leaves\n",tree,treenvals(tree),num_subtree_leaves(root));
+            numerrs++;
+        }
+        if (cur_arena->keep_clogc && fabs(treeclogc(tree)-clogc) > 1e-6*(fabs(clogc)+count_or_sum(root))) {
+            fprintf(stderr,"*** integrity check failure: count*ln(count) sum kept on tree %X is %f, but the leaves give %f\n",tree,treeclogc(tree),clogc);
+            numerrs++;
+        }
     }
     return numerrs;
 }
@@ -1538,7 +3101,68 @@ static int sanity_check_subtree(dmindex encnode) {
             /* can check if our count is approx that of the root's child */
             numerrs+= sanity_check_tree(t);
         }
-    }  else {
+    } else if (isbnode(encnode)) {
+        int i;
+        double ratio;
+        dmindex child;
+        node= encbnode2mindex(encnode);
+        if (bnused(node) < 1 || bnused(node) > BNODE_FANOUT) {
+            fprintf(stderr,"*** integrity check failure: wide node %X has %d slots in use\n",node,bnused(node));
+            return numerrs+1;
+        }
+        sum= 0.0;
+        for (i=0; i < bnused(node); i++) {
+            child= bnchild(node,i);
+            if (child == TNULL) {
+                fprintf(stderr,"*** integrity check failure: slot %d of wide node %X is TNULL\n",i,node);
+                numerrs++;
+                continue;
+            }
+            sum+= count_or_sum(child);
+            if (largestval(child) != bnkey(node,i)) {
+                fprintf(stderr,"*** integrity check failure: key %d on wide node %X (%d) does not match largest value below it (%d)\n",i,node,bnkey(node,i),largestval(child));
+                numerrs++;
+            }
+            if (i > 0 && bnkey(node,i) <= bnkey(node,i-1)) {
+                fprintf(stderr,"*** integrity check failure: keys on wide node %X are out of order at slot %d\n",node,i);
+                numerrs++;
+            }
+            numerrs+= sanity_check_subtree(child);
+        }
+        ratio= sum/bnsum(node);
+        if (ratio < 0.999 || ratio > 1.001) {
+            fprintf(stderr,"*** integrity check failure: sum on wide node %X (%f) does not match sum/counts below it (%f)\n",node,bnsum(node),sum);
+            numerrs++;
+        }
+    } else if (isdnode(encnode)) {
+        int i,used= 0;
+        double ratio;
+        dmindex child;
+        node= encdnode2mindex(encnode);
+        sum= 0.0;
+        for (i=0; i < DNODE_SLOTS; i++) {
+            child= dnchild(node,i);
+            if (child == TNULL) continue;
+            used++;
+            sum+= count_or_sum(child);
+            if (isleaf(child) ? (dnshift(node) != 0 || leafvalue(encleaf2mindex(child)) != dnslottop(node,i))
+                              : (!isdnode(child) || dnshift(node) == 0 || dnbase(encdnode2mindex(child)) != dnslottop(node,i)-(DNODE_SLOTS-1))) {
+                fprintf(stderr,"*** integrity check failure: slot %d of dense node %X holds something that does not belong there\n",i,node);
+                numerrs++;
+                continue;
+            }
+            numerrs+= sanity_check_subtree(child);
+        }
+        if (used != dnused(node) || used == 0) {
+            fprintf(stderr,"*** integrity check failure: dense node %X says %d slots are in use, but %d are\n",node,dnused(node),used);
+            numerrs++;
+        }
+        ratio= sum/dnsum(node);
+        if (ratio < 0.999 || ratio > 1.001) {
+            fprintf(stderr,"*** integrity check failure: sum on dense node %X (%f) does not match sum/counts below it (%f)\n",node,dnsum(node),sum);
+            numerrs++;
+        }
+    } else {
         dmindex left,right;
         node= encnode;
         sum= intsum(node);
@@ -1575,13 +3199,332 @@ static int sanity_check_subtree(dmindex encnode) {
     return numerrs;
 }
 
+/* check that merging the table twice into an empty table and subtracting
+   it again gives back the table's values and counts, in a sound table;
+   returns the number of problems found, which are described on stderr */
+int spade_prob_table_check_merge(spade_prob_table *self) {
+    spade_prob_table *copy= new_spade_prob_table_like(self);
+    int numerrs;
+    if (copy == NULL || !spade_prob_table_merge(copy,self,1.0) || !spade_prob_table_merge(copy,self,1.0)
+            || !spade_prob_table_subtract(copy,self,1.0)) {
+        fprintf(stderr,"*** merge check failure: out of memory merging the table\n");
+        if (copy != NULL) free_spade_prob_table(copy);
+        return 1;
+    }
+    numerrs= sanity_check_spade_prob_table(copy) + compare_spade_prob_tables(self,copy,"merge");
+    free_spade_prob_table(copy);
+    return numerrs;
+}
+
+/* check that loading the table's values, in order, into an empty table
+   gives back the table's values and counts, in a sound table; returns the
+   number of problems found, which are described on stderr */
+int spade_prob_table_check_load(spade_prob_table *self) {
+    spade_frozen_table *frozen= spade_prob_table_freeze(self);
+    spade_prob_table *copy= new_spade_prob_table_like(self);
+    spade_prob_table_loader loader;
+    int i,ok,numerrs;
+    if (frozen == NULL || copy == NULL) {
+        fprintf(stderr,"*** load check failure: out of memory copying the table\n");
+        if (frozen != NULL) free_spade_frozen_table(frozen);
+        if (copy != NULL) free_spade_prob_table(copy);
+        return 1;
+    }
+    /* the frozen copy has the values of each tree in a flat array, which
+       is easy to go through in order */
+    ok= spade_prob_table_begin_load(&loader,copy);
+    for (i=0; i < MAX_NUM_FEATURES && ok; i++) {
+        if (frozen->root[i] != TNULL) ok= load_frozen_values(&loader,frozen,frozen->root[i],1,0);
+    }
+    spade_prob_table_end_load(&loader);
+    free_spade_frozen_table(frozen);
+    if (!ok) {
+        fprintf(stderr,"*** load check failure: a value was refused by spade_prob_table_load_value()\n");
+        free_spade_prob_table(copy);
+        return 1;
+    }
+    numerrs= sanity_check_spade_prob_table(copy) + compare_spade_prob_tables(self,copy,"load");
+    free_spade_prob_table(copy);
+    return numerrs;
+}
+
+/* load the values of the subtree at Eytzinger position k of the frozen
+   tree, and the trees nested under them, in order of value */
+static int load_frozen_values(spade_prob_table_loader *loader,spade_frozen_table *frozen,mindex tree,u32 k,int depth) {
+    spade_frozen_tree *ft= &frozen->trees[tree];
+    u32 v= ft->first+k-1;
+    mindex t,end;
+    if (k > ft->n) return 1;
+    if (!load_frozen_values(loader,frozen,tree,2*k,depth)) return 0;
+    if (!spade_prob_table_load_value(loader,depth,ft->type,frozen->key[v],frozen->count[v])) return 0;
+    end= frozen->sub[v]+frozen->nsub[v];
+    for (t= frozen->sub[v]; t < end; t++) {
+        if (!load_frozen_values(loader,frozen,t,1,depth+1)) return 0;
+    }
+    return load_frozen_values(loader,frozen,tree,2*k+1,depth);
+}
+
+/* compare the values and counts of other, made from self in the way
+   described by what, with those of self, going by frozen copies of them;
+   an empty tree is taken to be the same as a missing one */
+static int compare_spade_prob_tables(spade_prob_table *self,spade_prob_table *other,const char *what) {
+    spade_frozen_table *a= spade_prob_table_freeze(self);
+    spade_frozen_table *b= spade_prob_table_freeze(other);
+    int i,numerrs= 0;
+    if (a == NULL || b == NULL) {
+        fprintf(stderr,"*** %s check failure: out of memory freezing the tables to compare\n",what);
+        numerrs++;
+    } else {
+        for (i=0; i < MAX_NUM_FEATURES; i++) {
+            numerrs+= compare_frozen_trees(a,a->root[i],b,b->root[i],what);
+        }
+    }
+    if (a != NULL) free_spade_frozen_table(a);
+    if (b != NULL) free_spade_frozen_table(b);
+    return numerrs;
+}
+
+/* compare the frozen tree tb of b with the tree ta of a, and the trees
+   nested in them; either may be TNULL */
+static int compare_frozen_trees(spade_frozen_table *a,mindex ta,spade_frozen_table *b,mindex tb,const char *what) {
+    u32 na= (ta == TNULL) ? 0 : a->trees[ta].n;
+    u32 nb= (tb == TNULL) ? 0 : b->trees[tb].n;
+    u32 i,va,vb;
+    mindex t,end;
+    int numerrs= 0;
+    if (na != nb) {
+        fprintf(stderr,"*** %s check failure: a tree has %u values, but %u after the %s\n",what,na,nb,what);
+        return 1;
+    }
+    if (na == 0) return 0;
+    if (frozen_counts_differ(a->trees[ta].total,b->trees[tb].total)) {
+        fprintf(stderr,"*** %s check failure: a tree of feature %d has a total count of %f, but %f after the %s\n",what,a->trees[ta].type,a->trees[ta].total,b->trees[tb].total,what);
+        numerrs++;
+    }
+    /* the same values in the same number give the same Eytzinger order */
+    for (i=0; i < na; i++) {
+        va= a->trees[ta].first+i;
+        vb= b->trees[tb].first+i;
+        if (a->key[va] != b->key[vb]) {
+            fprintf(stderr,"*** %s check failure: value %d of feature %d is %d after the %s\n",what,a->key[va],a->trees[ta].type,b->key[vb],what);
+            return numerrs+1;
+        }
+        if (frozen_counts_differ(a->count[va],b->count[vb])) {
+            fprintf(stderr,"*** %s check failure: the count of value %d of feature %d is %f, but %f after the %s\n",what,a->key[va],a->trees[ta].type,a->count[va],b->count[vb],what);
+            numerrs++;
+        }
+        end= a->sub[va]+a->nsub[va];
+        for (t= a->sub[va]; t < end; t++) {
+            numerrs+= compare_frozen_trees(a,t,b,frozen_nexttree(b,vb,a->trees[t].type),what);
+        }
+        end= b->sub[vb]+b->nsub[vb];
+        for (t= b->sub[vb]; t < end; t++) {
+            if (b->trees[t].n > 0 && frozen_nexttree(a,va,b->trees[t].type) == TNULL) {
+                fprintf(stderr,"*** %s check failure: value %d of feature %d has a tree of feature %d nested under it only after the %s\n",what,a->key[va],a->trees[ta].type,b->trees[t].type,what);
+                numerrs++;
+            }
+        }
+    }
+    return numerrs;
+}
+
+static int frozen_counts_differ(double a,double b) {
+    return fabs(a-b) > 1e-6*(fabs(a)+fabs(b));
+}
+
 
 int spade_prob_table_checkpoint(statefile_ref *s,spade_prob_table *self) {
-    return spade_state_checkpoint_arr(s,self->root,MAX_NUM_FEATURES,sizeof(mindex));
+    return spade_state_checkpoint_mem_arena(s,self->arena)
+        && spade_state_checkpoint_arr(s,self->root,MAX_NUM_FEATURES,sizeof(mindex));
 }
 
 int spade_prob_table_recover(statefile_ref *s,spade_prob_table *self) {
-    return spade_state_recover_arr(s,&self->root,MAX_NUM_FEATURES,sizeof(mindex));
+    mindex legacy_root[MAX_NUM_FEATURES];
+    spade_mem_arena *arena;
+    spade_prob_table_loader loader;
+    int i,clogc_kept,ok= 1;
+
+    if (s->legacy_arena == NULL) { /* the file has an arena for this table */
+        u8 want_clogc= self->arena->keep_clogc;
+        arena= spade_state_recover_mem_arena(s);
+        if (arena == NULL) return 0;
+        /* the recovered arena has keep_clogc set if the file kept the clogc of its trees current */
+        clogc_kept= arena->keep_clogc;
+        arena->tree_kind= self->arena->tree_kind;
+        arena->keep_clogc= want_clogc || clogc_kept;
+        memcpy(arena->dense_levels,self->arena->dense_levels,sizeof(arena->dense_levels));
+        free_spade_mem_arena(self->arena);
+        self->arena= arena;
+        if (!spade_state_recover_arr(s,&self->root,MAX_NUM_FEATURES,sizeof(mindex))) return 0;
+        if (want_clogc && !clogc_kept) init_all_clogc(self);
+        return 1;
+    }
+    
+    /* older files have a single arena for all tables; load our trees out of
+       it, which builds them afresh the way this table builds its trees */
+    if (!spade_state_recover_arr(s,legacy_root,MAX_NUM_FEATURES,sizeof(mindex))) return 0;
+    free_spade_prob_table_mem(self);
+    spade_prob_table_begin_load(&loader,self);
+    for (i=0; i < MAX_NUM_FEATURES && ok; i++) {
+        ok= load_tree_list(&loader,s->legacy_arena,legacy_root[i],0);
+    }
+    spade_prob_table_end_load(&loader);
+    return ok;
+}
+
+/* load the list of trees starting at tree in arena from, and the trees
+   nested in them, into the table being loaded at the given depth; returns
+   0 if a value is refused (out of memory, or out of order in a corrupt file) */
+static int load_tree_list(spade_prob_table_loader *loader,spade_mem_arena *from,mindex tree,int depth) {
+    mindex t;
+    for (t=tree; t != TNULL; t=arena_tree(from,t).next) {
+        if (!load_subtree(loader,from,arena_tree(from,t).type,arena_tree(from,t).root,depth)) return 0;
+    }
+    return 1;
+}
+
+/* load the values in the (binary) subtree rooted at encnode in arena from,
+   a tree of the given type, in order, each followed by the trees nested
+   under it; values with no count are left out */
+static int load_subtree(spade_prob_table_loader *loader,spade_mem_arena *from,features type,dmindex encnode,int depth) {
+    mindex leaf;
+    if (encnode == TNULL) return 1;
+    if (isleaf(encnode)) {
+        leaf= encleaf2mindex(encnode);
+        if (arena_leafnode(from,leaf).count <= 0.0) return 1;
+        return spade_prob_table_load_value(loader,depth,type,arena_leafnode(from,leaf).value,arena_leafnode(from,leaf).count*from->decay)
+            && load_tree_list(loader,from,arena_leafnode(from,leaf).nexttree,depth+1);
+    }
+    return load_subtree(loader,from,type,arena_intnode(from,encnode).left,depth)
+        && load_subtree(loader,from,type,arena_intnode(from,encnode).right,depth);
+}
+
+/// after a subtraction, a value whose (actual) count is no more than this is taken to have none left and is removed
+#define MERGE_MIN_COUNT 1e-6
+
+/* merge the counts in other, times weight, into self; a negative weight subtracts */
+static int merge_table(spade_prob_table *self,spade_prob_table *other,double weight) {
+    int i;
+    for (i=0; i < MAX_NUM_FEATURES; i++) {
+        if (other->root[i] == TNULL) continue;
+        use_arena(self->arena);
+        if (self->root[i] == TNULL) {
+            if (weight < 0) continue;
+            self->root[i]= new_treeinfo(i);
+        }
+        if (!merge_tree(other->arena,other->root[i],self->root[i],weight)) return 0;
+    }
+    return 1;
+}
+
+/* merge the counts in the tree srctree in arena from, and in the trees
+   nested under its leaves, times weight, into tree (and the trees nested in
+   it) in the current arena.  The leaves of the two trees are walked
+   together in order of value, giving the leaves of the merged tree in
+   order, which it is then rebuilt over */
+static int merge_tree(spade_mem_arena *from,mindex srctree,mindex tree,double weight) {
+    spade_mem_arena *to= cur_arena;
+    mindex *src,*dst=NULL,*out,leaf,t,sub;
+    u32 ns,nd,n=0,i=0,j=0;
+    double scale;
+    valtype val;
+    int ok= 1;
+
+    use_arena(from);
+    ns= treenvals(srctree);
+    src= ns ? tree_leaves_in_order(srctree) : NULL;
+    use_arena(to);
+    if (ns == 0) return 1;
+    nd= treenvals(tree);
+    if (nd) dst= tree_leaves_in_order(tree);
+    out= (mindex *)malloc(sizeof(mindex)*(ns+nd));
+    if (src == NULL || (nd && dst == NULL) || out == NULL) {
+        if (src != NULL) free(src);
+        if (dst != NULL) free(dst);
+        if (out != NULL) free(out);
+        return 0;
+    }
+    scale= weight*from->decay/to->decay; /* from stored counts there to stored counts here */
+
+    while (i < ns || j < nd) {
+        if (j < nd && (i == ns || leafvalue(dst[j]) < arena_leafnode(from,src[i]).value)) {
+            out[n++]= dst[j++]; /* only here; left as is */
+            continue;
+        }
+        val= arena_leafnode(from,src[i]).value;
+        if (j < nd && leafvalue(dst[j]) == val) { /* in both */
+            leaf= dst[j++];
+            dirty_leaf(leaf);
+            leafcount(leaf)+= arena_leafnode(from,src[i]).count*scale;
+        } else if (weight > 0) { /* only in other */
+            leaf= new_leaf(val);
+            leafcount(leaf)= arena_leafnode(from,src[i]).count*scale;
+        } else { /* nothing here to take away from */
+            i++;
+            continue;
+        }
+        for (t=arena_leafnode(from,src[i]).nexttree; t != TNULL && ok; t=arena_tree(from,t).next) {
+            if (weight > 0)
+                sub= get_nexttree_of_type(leaf,arena_tree(from,t).type);
+            else
+                sub= find_nexttree_of_type(leaf,arena_tree(from,t).type);
+            if (sub != TNULL) ok= merge_tree(from,t,sub,weight);
+        }
+        i++;
+        if (weight < 0 && actual_count(leafcount(leaf)) <= MERGE_MIN_COUNT) {
+            free_all_in_subtree(asleaf(leaf));
+        } else {
+            out[n++]= leaf;
+        }
+    }
+    free(src);
+    if (dst != NULL) free(dst);
+    /* the leaves have changed even if we ran out of memory on the way, so always rebuild */
+    set_tree_leaves(tree,out,n);
+    free(out);
+    return ok;
+}
+
+/* replace the interior of the tree with a balanced one over the n leaves
+   given, which are in order of value, keeping to the kind of tree it was;
+   the leaves array may be overwritten */
+static void set_tree_leaves(mindex tree,mindex leaves[],u32 n) {
+    dmindex root= treeroot(tree);
+    int wide;
+    double clogc= 0.0,*sums;
+    u32 i;
+
+    /* a bare leaf could start either kind, so it goes by what new trees here use */
+    if (root == TNULL || isleaf(root))
+        wide= (cur_arena->tree_kind == TREE_KIND_WIDE);
+    else
+        wide= isbnode(root);
+    if (root != TNULL) free_interior_in_subtree(root);
+    dirty_tree(tree);
+    treenvals(tree)= n;
+    if (cur_arena->keep_clogc) {
+        for (i=0; i < n; i++) clogc+= clogc_term(leafcount(leaves[i]));
+        treeclogc(tree)= clogc;
+    }
+    if (n == 0)
+        treeroot(tree)= TNULL;
+    else if (wide)
+        treeroot(tree)= build_wide_subtree(leaves,n);
+    else if ((sums= (double *)malloc(sizeof(double)*n)) == NULL)
+        treeroot(tree)= build_balanced_subtree(leaves,n); /* balanced by number of values instead */
+    else {
+        for (i=0; i < n; i++) sums[i]= (i ? sums[i-1] : 0.0) + leafcount(leaves[i]);
+        treeroot(tree)= build_weighted_subtree(leaves,sums,n,0.0);
+        free(sums);
+    }
+    if (n >= DENSE_MIN_VALUES && cur_arena->dense_levels[treetype(tree)]) densify_tree(tree);
+}
+
+/* build the deepest tree being loaded over its leaves and stop filling it in */
+static void finish_load_level(spade_prob_table_loader *self) {
+    spade_load_level *lev= &self->level[--self->depth];
+    if (lev->n) set_tree_leaves(lev->tree,lev->leaves,lev->n);
+    if (lev->leaves != NULL) free(lev->leaves);
 }
 
 /* $Id: spade_prob_table.c,v 1.10 2002/12/19 22:37:10 jim Exp $ */
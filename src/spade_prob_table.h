@@ -33,6 +33,7 @@ warranty is expressed for this program.
 typedef struct {
     mindex root[MAX_NUM_FEATURES]; ///< top level tree roots in an array indexed by the feature type of the top level tree
     const char **featurenames;     ///< user provided pointer to array of the string names of the features, used for output
+    spade_mem_arena *arena;        ///< the arena owned by this table that all its nodes are allocated from
 } spade_prob_table;
 
 /// an element in a data structure representing a set of doubles indexed by a list of features
@@ -41,6 +42,15 @@ typedef struct _featcomb {
     double val[MAX_NUM_FEATURES];  ///< the values stored; indexed by the final feature in the list
 } *featcomb;
 
+/// the results of looking up a list of feature values in a table with spade_prob_table_query()
+typedef struct {
+    int condbase;                     ///< the number of leading features the probability is conditioned on
+    int depth_found;                  ///< the number of leading values that are present in the table
+    double count[MAX_NUM_FEATURES+1]; ///< count[i] is the count for the first i values, count[0] being the total for the first feature; 0 beyond depth_found
+    double condprob_plus_one;         ///< the conditional probability of the values given the first condbase of them, pretending there is one more of them in the table
+    mindex entropy_tree;              ///< the tree whose entropy was asked for, or TNULL if none
+} spade_prob_query;
+
 #define STATS_NONE          0x00  ///< no statistics
 #define STATS_ENTROPY       0x01  ///< entropy statistics
 #define STATS_UNCONDPROB    0x02  ///< unconditional probabilities
@@ -48,9 +58,106 @@ typedef struct _featcomb {
 
 #define PROBRESULT_NO_RECORD (double)-1.0 ///< a special probability value denoting the probability denominator was 0
 
+/// where an incremental pruning pass over a table made with spade_prob_table_prune_step() has gotten to
+typedef struct {
+    int feature;       ///< the feature of the top level tree being pruned; MAX_NUM_FEATURES if no pass is under way
+    valtype after;     ///< the values in that tree up to this one have been done (if started)
+    int started;       ///< whether any of that tree has been done
+    double threshold;  ///< observation count below which to prune in this pass
+    u32 budget;        ///< the number of nodes the current step may visit
+    int stopped;       ///< set when the current step ran out of budget
+    u32 visited;       ///< the number of nodes visited so far in this pass
+    u32 last_visited;  ///< the number of nodes visited in the last complete pass
+    u32 passes;        ///< the number of passes completed
+} spade_prune_cursor;
+
+/// one tree being filled in by a spade_prob_table_loader
+typedef struct {
+    mindex tree;      ///< the tree
+    mindex *leaves;   ///< the leaves loaded into it so far, in order of value
+    u32 n;            ///< the number of leaves loaded
+    u32 size;         ///< the room in leaves
+} spade_load_level;
+
+/// the state of loading a table from a stream of values in sorted order, with spade_prob_table_load_value()
+/** The values are given depth first, as they would be met walking the
+    table in order: each value is followed by the values nested under it.
+    Each tree is only built once all its values are in, in one go: its
+    nodes come from the arena's free lists like any others, parents before
+    children, and binary trees are balanced by count. */
+typedef struct {
+    spade_prob_table *table;  ///< the table being loaded
+    int depth;                ///< the number of trees being filled in; level[depth-1] is the deepest
+    spade_load_level level[MAX_NUM_FEATURES]; ///< the trees being filled in at each depth
+} spade_prob_table_loader;
+
+/// a tree of a spade_frozen_table
+typedef struct {
+    u32 first;         ///< the index in the value arrays of the tree's first value
+    u32 n;             ///< the number of values in the tree
+    features type;     ///< the feature the tree is of
+    double total;      ///< the total count of the values in the tree
+    double entropy;    ///< the entropy of the tree's values, as from spade_prob_table_entropy()
+} spade_frozen_tree;
+
+/// a read-only copy of a spade_prob_table, laid out for quick lookups; made with spade_prob_table_freeze()
+/** The values of each tree are stored in Eytzinger order: a balanced
+    binary search tree laid out breadth first, with the children of the
+    value at position k (counting from 1) at 2k and 2k+1.  A lookup is
+    then a run of comparisons that each only decide the next position, and
+    the first few levels of every lookup share the same cache lines.  The
+    trees nested under a value are stored next to each other.  Counts are
+    the actual counts at the time of freezing. */
+typedef struct {
+    mindex root[MAX_NUM_FEATURES]; ///< the index of the top level tree for each feature, or TNULL if none
+    spade_frozen_tree *trees;      ///< the trees
+    double *count;                 ///< the count of each value
+    valtype *key;                  ///< the values of the trees, each tree's in Eytzinger order
+    u32 *sub;                      ///< for each value, the index of the first tree nested under it
+    u8 *nsub;                      ///< for each value, the number of trees nested under it
+    u32 ntrees;                    ///< the number of trees
+    u32 nvals;                     ///< the number of values
+    unsigned long mem_used;        ///< the number of bytes the table and its arrays take
+} spade_frozen_table;
+
+/// a value of a top level tree being frozen by spade_prob_table_freeze_step(), waiting for the rest of the tree
+typedef struct {
+    valtype key;       ///< the value
+    double count;      ///< its count
+    u32 sub;           ///< the index of the first tree nested under it
+    u8 nsub;           ///< the number of trees nested under it
+} spade_frozen_value;
+
+/// where making a frozen copy of a table a step at a time with spade_prob_table_freeze_step() has gotten to
+/** The values of the top level tree being done are listed when it is
+    started, and copied a few at a time, in order of value, with all the
+    trees nested under them; once they are all copied they are put in
+    Eytzinger order.  Values added to the tree after it was started are
+    left for the next copy. */
+typedef struct {
+    int feature;               ///< the feature of the top level tree being copied; MAX_NUM_FEATURES if no copy is under way
+    spade_frozen_table *copy;  ///< the copy being made; its ntrees and nvals are the trees and values used so far
+    u32 trees_room;            ///< the number of trees there is room for in the copy
+    u32 vals_room;             ///< the number of values there is room for in the copy
+    spade_frozen_value *top;   ///< the values of the top level tree, those copied moved up to the start; NULL until it is started
+    u32 top_n;                 ///< the number of values listed in top
+    u32 top_next;              ///< the index in top of the next value listed to copy
+    u32 top_done;              ///< the number of values of the tree copied so far
+    u32 visited;               ///< the number of values copied so far in this copy
+    u32 last_visited;          ///< the number of values in the last complete copy
+} spade_freeze_cursor;
+
 
 void init_spade_prob_table(spade_prob_table *self,const char **featurenames,int recovering);
 spade_prob_table *new_spade_prob_table(const char **featurenames);
+spade_prob_table *new_spade_prob_table_like(spade_prob_table *other);
+void free_spade_prob_table(spade_prob_table *self);
+void free_spade_prob_table_mem(spade_prob_table *self);
+void spade_prob_table_set_tree_kind(spade_prob_table *self, u8 kind);
+void spade_prob_table_set_feature_domain(spade_prob_table *self, features f, valtype maxval);
+void spade_prob_table_keep_entropy(spade_prob_table *self);
+unsigned long spade_prob_table_mem_used(spade_prob_table *self);
+void spade_prob_table_clear_dirty(spade_prob_table *self);
 
 int spade_prob_table_is_empty(spade_prob_table *self);
 
@@ -59,6 +166,11 @@ void increment_2joint_count(spade_prob_table *self, features type1, valtype val1
 void increment_3joint_count(spade_prob_table *self, features type1, valtype val1, features type2, valtype val2, features type3, valtype val3, int skip);
 void increment_4joint_count(spade_prob_table *self, features type1, valtype val1, features type2, valtype val2, features type3, valtype val3, features type4, valtype val4, int skip);
 void increment_Njoint_count(spade_prob_table *self,int size,features type[],valtype val[],int skip);
+int spade_prob_table_merge(spade_prob_table *self, spade_prob_table *other, double weight);
+int spade_prob_table_subtract(spade_prob_table *self, spade_prob_table *other, double weight);
+int spade_prob_table_begin_load(spade_prob_table_loader *self, spade_prob_table *table);
+int spade_prob_table_load_value(spade_prob_table_loader *self, int depth, features type, valtype val, double count);
+void spade_prob_table_end_load(spade_prob_table_loader *self);
 
 double prob_simple(spade_prob_table *self, features type1, valtype val1);
 double prob_2joint(spade_prob_table *self, features type1, valtype val1, features type2, valtype val2);
@@ -74,7 +186,30 @@ double jointN_count(spade_prob_table *self,int size,features type[], valtype val
 
 double spade_prob_table_entropy(spade_prob_table *self, int size, features type[], valtype val[]);
 
+void spade_prob_table_query(spade_prob_table *self, int size, features type[], valtype val[], int condbase, int entropy_depth, spade_prob_query *res);
+double spade_prob_table_query_entropy(spade_prob_table *self, spade_prob_query *q);
+
+spade_frozen_table *spade_prob_table_freeze(spade_prob_table *self);
+void init_spade_freeze_cursor(spade_freeze_cursor *c);
+int spade_prob_table_start_freeze(spade_prob_table *self, spade_freeze_cursor *c);
+spade_frozen_table *spade_prob_table_freeze_step(spade_prob_table *self, spade_freeze_cursor *c, u32 budget);
+int spade_prob_table_freezing(spade_freeze_cursor *c);
+void spade_prob_table_abort_freeze(spade_freeze_cursor *c);
+void free_spade_frozen_table(spade_frozen_table *self);
+unsigned long spade_frozen_table_mem_used(spade_frozen_table *self);
+double frozen_jointN_count(spade_frozen_table *self, int size, features type[], valtype val[]);
+double frozen_prob_Njoint_Ncond(spade_frozen_table *self, int size, features type[], valtype val[], int condbase);
+double frozen_prob_Njoint_Ncond_plus_one(spade_frozen_table *self, int size, features type[], valtype val[], int condbase);
+void spade_frozen_table_query(spade_frozen_table *self, int size, features type[], valtype val[], int condbase, int entropy_depth, spade_prob_query *res);
+double spade_frozen_table_entropy(spade_frozen_table *self, int depth, features type[], valtype val[]);
+double spade_frozen_table_query_entropy(spade_frozen_table *self, spade_prob_query *q);
+
+void spade_prob_table_decay(spade_prob_table *self, double factor);
 void scale_and_prune_table(spade_prob_table *self, double factor, double threshold);
+void init_spade_prune_cursor(spade_prune_cursor *c);
+void spade_prob_table_start_prune(spade_prob_table *self, spade_prune_cursor *c, double threshold);
+int spade_prob_table_prune_step(spade_prob_table *self, spade_prune_cursor *c, u32 budget);
+int spade_prob_table_pruning(spade_prune_cursor *c);
 
 float feature_trees_stats(spade_prob_table *self, features f, float *amind, float *amaxd, float *aaved, float *awaved);
 
@@ -87,6 +222,8 @@ void write_all_entropies(spade_prob_table *self,FILE *f, featcomb c);
 
 void print_spade_prob_table(spade_prob_table *self);
 int sanity_check_spade_prob_table(spade_prob_table *self);
+int spade_prob_table_check_merge(spade_prob_table *self);
+int spade_prob_table_check_load(spade_prob_table *self);
 
 
 int spade_prob_table_checkpoint(statefile_ref *s,spade_prob_table *self);
@@ -23,63 +23,231 @@ warranty is expressed for this program.
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#ifndef SPADE_NO_MMAP
+#include <sys/mman.h>
+#endif
 #include "spade_prob_table_types.h"
 
-treeroot **ROOT_M;
-intnode **INT_M;
-leafnode **LEAF_M;
+static void grow_block_array(void ***arrptr, unsigned int *max, u32 **dirty, unsigned char block_bits, const char *what);
+static u32 *new_dirty_map(unsigned int blocks);
+
+/* the arena the tree accessor macros currently refer to */
+SPADE_THREAD_LOCAL spade_mem_arena *cur_arena= NULL;
 
-mindex root_freelist;
-mindex int_freelist;
-mindex leaf_freelist;
+/* the id the next arena created will get */
+static u32 next_arena_id= 1;
 
-unsigned char ROOT_BLOCK_BITS;
-unsigned char INT_BLOCK_BITS;
-unsigned char LEAF_BLOCK_BITS;
-unsigned int MAX_ROOT_BLOCKS;
-unsigned int MAX_INT_BLOCKS;
-unsigned int MAX_LEAF_BLOCKS;
+/* create a new, empty, arena */
+spade_mem_arena *new_spade_mem_arena() {
+    spade_mem_arena *new= (spade_mem_arena *)malloc(sizeof(spade_mem_arena));
+    if (new == NULL) return NULL;
+    init_spade_mem_arena(new);
+    allocate_mem_blocks(new);
+    return new;
+}
 
-static void reset_mem();
+/* initialize the arena to its defaults; no blocks are allocated */
+void init_spade_mem_arena(spade_mem_arena *a) {
+    int i;
+    a->root_block_bits= DEFAULT_ROOT_BLOCK_BITS;
+    a->int_block_bits= DEFAULT_INT_BLOCK_BITS;
+    a->leaf_block_bits= DEFAULT_LEAF_BLOCK_BITS;
+    a->bnode_block_bits= DEFAULT_BNODE_BLOCK_BITS;
+    a->dnode_block_bits= DEFAULT_DNODE_BLOCK_BITS;
+    a->max_root_blocks= DEFAULT_MAX_ROOT_BLOCKS;
+    a->max_int_blocks= DEFAULT_MAX_INT_BLOCKS;
+    a->max_leaf_blocks= DEFAULT_MAX_LEAF_BLOCKS;
+    a->max_bnode_blocks= DEFAULT_MAX_BNODE_BLOCKS;
+    a->max_dnode_blocks= DEFAULT_MAX_DNODE_BLOCKS;
 
-/* initialize the memory manager */
-void init_mem() {
-    static int spade_prob_table_mem_inited= 0;
-    reset_mem();
+    a->root_freelist=TNULL;
+    a->int_freelist=TNULL;
+    a->leaf_freelist=TNULL;
+    a->bnode_freelist=TNULL;
+    a->dnode_freelist=TNULL;
 
-    if (spade_prob_table_mem_inited) return; /* already inited */
-    spade_prob_table_mem_inited= 1;
+    a->root_m= NULL;
+    a->int_m= NULL;
+#ifdef SPADE_COMPACT_NODES
+    a->intc_m= NULL;
+#endif
+    a->leaf_m= NULL;
+    a->bnode_m= NULL;
+    a->dnode_m= NULL;
     
-    allocate_mem_blocks();
+    a->tree_kind= TREE_KIND_BINARY;
+    a->keep_clogc= 0;
+    for (i=0; i < MAX_NUM_FEATURES; i++) a->dense_levels[i]= 0;
+    a->decay= 1.0;
+    a->incr= 1.0;
+    a->mem_used= 0;
+    a->map_base= NULL;
+    a->map_len= 0;
+    a->id= next_arena_id++;
+    a->root_dirty= NULL;
+    a->int_dirty= NULL;
+    a->leaf_dirty= NULL;
+    a->bnode_dirty= NULL;
+    a->dnode_dirty= NULL;
+}
+
+/* give the arena the id it had when it was checkpointed */
+void spade_mem_arena_set_id(spade_mem_arena *a,u32 id) {
+    a->id= id;
+    if (id >= next_arena_id) next_arena_id= id+1;
 }
 
-static void reset_mem() {
-    ROOT_BLOCK_BITS= DEFAULT_ROOT_BLOCK_BITS;
-    INT_BLOCK_BITS= DEFAULT_INT_BLOCK_BITS;
-    LEAF_BLOCK_BITS= DEFAULT_LEAF_BLOCK_BITS;
-    MAX_ROOT_BLOCKS= DEFAULT_MAX_ROOT_BLOCKS;
-    MAX_INT_BLOCKS= DEFAULT_MAX_INT_BLOCKS;
-    MAX_LEAF_BLOCKS= DEFAULT_MAX_LEAF_BLOCKS;
+/* is the block at p one of the arena's own, rather than in a region mapped from a state file? */
+#define ARENA_OWNS_BLOCK(a,p) ((a)->map_base == NULL || (char *)(p) < (a)->map_base || (char *)(p) >= (a)->map_base+(a)->map_len)
 
-    root_freelist=TNULL;
-    int_freelist=TNULL;
-    leaf_freelist=TNULL;
+/* release the arena and all the nodes in it */
+void free_spade_mem_arena(spade_mem_arena *a) {
+    unsigned int i;
+    if (a == NULL) return;
+    if (cur_arena == a) cur_arena= NULL;
+    if (a->root_m != NULL) {
+        for (i=0; i < a->max_root_blocks && a->root_m[i] != NULL; i++) {
+            if (ARENA_OWNS_BLOCK(a,a->root_m[i])) free(a->root_m[i]);
+        }
+        free(a->root_m);
+    }
+    if (a->int_m != NULL) {
+        for (i=0; i < a->max_int_blocks && a->int_m[i] != NULL; i++) {
+            if (ARENA_OWNS_BLOCK(a,a->int_m[i])) free(a->int_m[i]);
+        }
+        free(a->int_m);
+    }
+#ifdef SPADE_COMPACT_NODES
+    if (a->intc_m != NULL) {
+        for (i=0; i < a->max_int_blocks && a->intc_m[i] != NULL; i++) {
+            if (ARENA_OWNS_BLOCK(a,a->intc_m[i])) free(a->intc_m[i]);
+        }
+        free(a->intc_m);
+    }
+#endif
+    if (a->leaf_m != NULL) {
+        for (i=0; i < a->max_leaf_blocks && a->leaf_m[i] != NULL; i++) {
+            if (ARENA_OWNS_BLOCK(a,a->leaf_m[i])) free(a->leaf_m[i]);
+        }
+        free(a->leaf_m);
+    }
+    if (a->bnode_m != NULL) {
+        for (i=0; i < a->max_bnode_blocks && a->bnode_m[i] != NULL; i++) {
+            if (ARENA_OWNS_BLOCK(a,a->bnode_m[i])) free(a->bnode_m[i]);
+        }
+        free(a->bnode_m);
+    }
+    if (a->dnode_m != NULL) {
+        for (i=0; i < a->max_dnode_blocks && a->dnode_m[i] != NULL; i++) {
+            if (ARENA_OWNS_BLOCK(a,a->dnode_m[i])) free(a->dnode_m[i]);
+        }
+        free(a->dnode_m);
+    }
+#ifndef SPADE_NO_MMAP
+    if (a->map_base != NULL) munmap(a->map_base,a->map_len);
+#endif
+    if (a->root_dirty != NULL) free(a->root_dirty);
+    if (a->int_dirty != NULL) free(a->int_dirty);
+    if (a->leaf_dirty != NULL) free(a->leaf_dirty);
+    if (a->bnode_dirty != NULL) free(a->bnode_dirty);
+    if (a->dnode_dirty != NULL) free(a->dnode_dirty);
+    free(a);
 }
 
-void allocate_mem_blocks() {
+void allocate_mem_blocks(spade_mem_arena *a) {
     unsigned int i;
 
-    ROOT_M=(treeroot **)malloc(sizeof(treeroot *)*MAX_ROOT_BLOCKS);
-    for (i=0; i < MAX_ROOT_BLOCKS; i++) ROOT_M[i]= NULL;
-    INT_M=  (intnode **)malloc(sizeof(intnode *)*MAX_INT_BLOCKS);
-    for (i=0; i < MAX_INT_BLOCKS; i++) INT_M[i]= NULL;
-    LEAF_M=(leafnode **)malloc(sizeof(leafnode *)*MAX_LEAF_BLOCKS);
-    for (i=0; i < MAX_LEAF_BLOCKS; i++) LEAF_M[i]= NULL;
+    a->root_m=(treeroot **)malloc(sizeof(treeroot *)*a->max_root_blocks);
+    for (i=0; i < a->max_root_blocks; i++) a->root_m[i]= NULL;
+    a->int_m=  (intnode **)malloc(sizeof(intnode *)*a->max_int_blocks);
+    for (i=0; i < a->max_int_blocks; i++) a->int_m[i]= NULL;
+#ifdef SPADE_COMPACT_NODES
+    a->intc_m=  (intnode_cold **)malloc(sizeof(intnode_cold *)*a->max_int_blocks);
+    for (i=0; i < a->max_int_blocks; i++) a->intc_m[i]= NULL;
+#endif
+    a->leaf_m=(leafnode **)malloc(sizeof(leafnode *)*a->max_leaf_blocks);
+    for (i=0; i < a->max_leaf_blocks; i++) a->leaf_m[i]= NULL;
+    a->bnode_m=(bnode **)malloc(sizeof(bnode *)*a->max_bnode_blocks);
+    for (i=0; i < a->max_bnode_blocks; i++) a->bnode_m[i]= NULL;
+    a->dnode_m=(dnode **)malloc(sizeof(dnode *)*a->max_dnode_blocks);
+    for (i=0; i < a->max_dnode_blocks; i++) a->dnode_m[i]= NULL;
+    spade_mem_arena_clear_dirty(a);
+}
+
+/* return a new dirty map, all clear, with room for the given number of blocks */
+static u32 *new_dirty_map(unsigned int blocks) {
+    u32 *map= (u32 *)calloc(DIRTY_MAP_WORDS(blocks),sizeof(u32));
+    if (map == NULL) {
+        fprintf(stderr,"Out of memory! in allocation of a dirty block map; exiting");
+        exit(2);
+    }
+    return map;
+}
+
+/* mark all the blocks of the arena as clean, as they are when just
+   checkpointed; this also sizes the dirty maps to the block arrays */
+void spade_mem_arena_clear_dirty(spade_mem_arena *a) {
+    if (a->root_dirty != NULL) free(a->root_dirty);
+    a->root_dirty= new_dirty_map(a->max_root_blocks);
+    if (a->int_dirty != NULL) free(a->int_dirty);
+    a->int_dirty= new_dirty_map(a->max_int_blocks);
+    if (a->leaf_dirty != NULL) free(a->leaf_dirty);
+    a->leaf_dirty= new_dirty_map(a->max_leaf_blocks);
+    if (a->bnode_dirty != NULL) free(a->bnode_dirty);
+    a->bnode_dirty= new_dirty_map(a->max_bnode_blocks);
+    if (a->dnode_dirty != NULL) free(a->dnode_dirty);
+    a->dnode_dirty= new_dirty_map(a->max_dnode_blocks);
+}
+
+/* make room for twice as many blocks in the block pointer array at arrptr, which has room for *max now,
+   and in its dirty map.  Node indices share a mindex with the tag bits of a dmindex, so the blocks
+   (of 2^block_bits nodes) stop short of DNODEMASK; a table that gets that big cannot go on */
+static void grow_block_array(void ***arrptr,unsigned int *max,u32 **dirty,unsigned char block_bits,const char *what) {
+    unsigned int limit= (unsigned int)(DNODEMASK >> block_bits);
+    unsigned int newmax= (2*(*max) < limit) ? 2*(*max) : limit;
+    unsigned int words= DIRTY_MAP_WORDS(*max),newwords= DIRTY_MAP_WORDS(newmax);
+    u32 *newdirty;
+    
+    if (newmax <= *max) {
+        fprintf(stderr,"Spade probability table has reached the limit of %u %s nodes; exiting",limit << block_bits,what);
+        exit(2);
+    }
+    if (!reallocate_ptr_array(arrptr,*max,newmax)
+        || (newdirty= (u32 *)realloc(*dirty,sizeof(u32)*newwords)) == NULL) {
+        fprintf(stderr,"Out of memory! in growing the %s block array; exiting",what);
+        exit(2);
+    }
+    memset(newdirty+words,0,sizeof(u32)*(newwords-words));
+    *dirty= newdirty;
+    *max= newmax;
+}
+
+/* set a->mem_used from the blocks the arena has and what is on its freelists */
+void spade_mem_arena_count_used(spade_mem_arena *a) {
+    unsigned long blocks,unused;
+    mindex i;
+    
+    for (blocks=0; blocks < a->max_root_blocks && a->root_m[blocks] != NULL; blocks++) {}
+    for (unused=0,i=a->root_freelist; i != TNULL; i=rfreenext(arena_tree(a,i))) unused++;
+    a->mem_used= (blocks*bits2blocksize(a->root_block_bits) - unused)*sizeof(treeroot);
+    for (blocks=0; blocks < a->max_int_blocks && a->int_m[blocks] != NULL; blocks++) {}
+    for (unused=0,i=a->int_freelist; i != TNULL; i=ifreenext(arena_intnode(a,i))) unused++;
+    a->mem_used+= (blocks*bits2blocksize(a->int_block_bits) - unused)*INTNODE_BYTES;
+    for (blocks=0; blocks < a->max_leaf_blocks && a->leaf_m[blocks] != NULL; blocks++) {}
+    for (unused=0,i=a->leaf_freelist; i != TNULL; i=lfreenext(arena_leafnode(a,i))) unused++;
+    a->mem_used+= (blocks*bits2blocksize(a->leaf_block_bits) - unused)*sizeof(leafnode);
+    for (blocks=0; blocks < a->max_bnode_blocks && a->bnode_m[blocks] != NULL; blocks++) {}
+    for (unused=0,i=a->bnode_freelist; i != TNULL; i=bfreenext(arena_bnode(a,i))) unused++;
+    a->mem_used+= (blocks*bits2blocksize(a->bnode_block_bits) - unused)*sizeof(bnode);
+    for (blocks=0; blocks < a->max_dnode_blocks && a->dnode_m[blocks] != NULL; blocks++) {}
+    for (unused=0,i=a->dnode_freelist; i != TNULL; i=dfreenext(arena_dnode(a,i))) unused++;
+    a->mem_used+= (blocks*bits2blocksize(a->dnode_block_bits) - unused)*sizeof(dnode);
 }
 
 int reallocate_ptr_array(void ***arrptr,int oldsize,int newsize) {
     unsigned int i;
-    void **arr= NULL;
+    void **arr= *arrptr;
 
     arr= (void **)realloc(arr,sizeof(void *)*newsize);
     if (arr == NULL) return 0;
@@ -88,25 +256,22 @@ int reallocate_ptr_array(void ***arrptr,int oldsize,int newsize) {
     return 1;
 }
 
-/* allocate a new treeroot node with the give feature type and return it */
+/* allocate a new treeroot node in the current arena with the give feature type and return it */
 mindex new_treeinfo(features type) {
     mindex root;
-    int i,p;
-    if (root_freelist == TNULL) { /* need to allocate a new block */
+    int i;
+    unsigned int p;
+    if (cur_arena->root_freelist == TNULL) { /* need to allocate a new block */
         /* find first unused block */
         for (p=0; p < MAX_ROOT_BLOCKS && (ROOT_M[p] != NULL); p++) {}
-        if (p == MAX_ROOT_BLOCKS) {
-            fprintf(stderr,"exhausted all %d blocks of %d treeroots; exiting; you might want to increase DEFAULT_MAX_ROOT_BLOCKS or DEFAULT_ROOT_BLOCK_BITS in params.h or wherever it is defined\n",MAX_ROOT_BLOCKS,ROOT_BLOCK_SIZE);
-            printf("next free root: %X; int: %X, leaf: %X\n",root_freelist,int_freelist,leaf_freelist);
-            exit(1);
-        }
+        if (p == MAX_ROOT_BLOCKS) grow_block_array((void ***)&ROOT_M,&MAX_ROOT_BLOCKS,&cur_arena->root_dirty,ROOT_BLOCK_BITS,"treeroot");
         ROOT_M[p]= (treeroot *)calloc(ROOT_BLOCK_SIZE,sizeof(treeroot));
         if (ROOT_M[p] == NULL) {
             fprintf(stderr,"Out of memory! in allocation of new treeroot block; exiting");
             exit(2);
         }
         /* add new slots to freelist */
-        root_freelist= root_index(p,0);
+        cur_arena->root_freelist= root_index(p,0);
         for (i=0; i < (ROOT_BLOCK_SIZE-1); i++) {
 #ifdef EXTRA_MARK_FREE
             ROOT_M[p][i].root= TNULL;
@@ -119,13 +284,15 @@ mindex new_treeinfo(features type) {
         rfreenext(ROOT_M[p][ROOT_BLOCK_SIZE-1])= TNULL;
     }
     /* give out the head and make its next the new head */
-    root= root_freelist;
-    root_freelist= rfreenext(tree(root_freelist));
+    root= cur_arena->root_freelist;
+    cur_arena->root_freelist= rfreenext(tree(cur_arena->root_freelist));
+    dirty_tree(root);
     treetype(root)= type;
     treeroot(root)= TNULL;
     treenext(root)= TNULL;
-    treeH(root)= -1;
-    treeH_wait(root)= 0;
+    treenvals(root)= 0;
+    treeclogc(root)= 0.0;
+    cur_arena->mem_used+= sizeof(treeroot);
     return root;
 }
 
@@ -134,49 +301,65 @@ void free_treeinfo(mindex f) {
 #ifdef EXTRA_MARK_FREE
     treeroot(f)= TNULL;
 #endif
+    cur_arena->mem_used-= sizeof(treeroot);
+    dirty_tree(f);
     /* add it to the start of the list */
-    rfreenext(tree(f))= root_freelist;
-    root_freelist= f;
+    rfreenext(tree(f))= cur_arena->root_freelist;
+    cur_arena->root_freelist= f;
 }
 
 
-/* allocate a new intnode node and return it */
+/* allocate a new intnode node in the current arena and return it */
 mindex new_int() {
     mindex res;
-    int i,p;
-    if (int_freelist == TNULL) { /* need to allocate a new block */
+    int i;
+    unsigned int p;
+    if (cur_arena->int_freelist == TNULL) { /* need to allocate a new block */
         /* find first unused block */
         for (p=0; p < MAX_INT_BLOCKS && (INT_M[p] != NULL); p++) {}
         if (p == MAX_INT_BLOCKS) {
-            fprintf(stderr,"exhausted all %d blocks of %d intnodes; exiting; you might want to increase DEFAULT_MAX_INT_BLOCKS or DEFAULT_INT_BLOCK_BITS in params.h or wherever it is defined\n",MAX_INT_BLOCKS,INT_BLOCK_SIZE);
-            printf("next free root: %X; int: %X, leaf: %X\n",root_freelist,int_freelist,leaf_freelist);
-            exit(1);
+#ifdef SPADE_COMPACT_NODES
+            if (!reallocate_ptr_array((void ***)&INTC_M,MAX_INT_BLOCKS,2*MAX_INT_BLOCKS)) {
+                fprintf(stderr,"Out of memory! in growing the intnode block array; exiting");
+                exit(2);
+            }
+#endif
+            grow_block_array((void ***)&INT_M,&MAX_INT_BLOCKS,&cur_arena->int_dirty,INT_BLOCK_BITS,"intnode");
         }
         INT_M[p]= (intnode *)calloc(INT_BLOCK_SIZE,sizeof(intnode));
+#ifdef SPADE_COMPACT_NODES
+        INTC_M[p]= (intnode_cold *)calloc(INT_BLOCK_SIZE,sizeof(intnode_cold));
+        if (INTC_M[p] == NULL) {
+            fprintf(stderr,"Out of memory! in allocation of new intnode block; exiting");
+            exit(2);
+        }
+#endif
         if (INT_M[p] == NULL) {
             fprintf(stderr,"Out of memory! in allocation of new intnode block; exiting");
             exit(2);
         }
         /* add new slots to freelist */
-        int_freelist= intnode_index(p,0);
+        cur_arena->int_freelist= intnode_index(p,0);
         for (i=0; i < (INT_BLOCK_SIZE-1); i++) {
 #ifdef EXTRA_MARK_FREE
-            INT_M[p][i].sum= -1;
+            intsum(intnode_index(p,i))= -1;
 #endif
             ifreenext(INT_M[p][i])= intnode_index(p,i+1);
         }
 #ifdef EXTRA_MARK_FREE
-        INT_M[p][INT_BLOCK_SIZE-1].sum= -1;
+        intsum(intnode_index(p,INT_BLOCK_SIZE-1))= -1;
 #endif
         ifreenext(INT_M[p][INT_BLOCK_SIZE-1])= TNULL;
     }
     /* give out the head and make its next the new head */
-    res= int_freelist;
-    int_freelist= ifreenext(intnode(int_freelist));
+    res= cur_arena->int_freelist;
+    cur_arena->int_freelist= ifreenext(intnode(cur_arena->int_freelist));
+    dirty_int(res);
     intleft(res)= intright(res)= TNULL;
     intsum(res)=0;
     intsortpt(res)= NOT_A_SORTPT;
     intwait(res)= 999;
+    cur_arena->mem_used+= INTNODE_BYTES;
     return res;
 }
 
@@ -185,30 +368,29 @@ void free_int(mindex f) {
 #ifdef EXTRA_MARK_FREE
     intsum(f)= -1;
 #endif
+    cur_arena->mem_used-= INTNODE_BYTES;
+    dirty_int(f);
     /* add it to the start of the list */
-    ifreenext(intnode(f))= int_freelist;
-    int_freelist= f;
+    ifreenext(intnode(f))= cur_arena->int_freelist;
+    cur_arena->int_freelist= f;
 }
 
-/* allocate a new leafnode node and return it */
+/* allocate a new leafnode node in the current arena and return it */
 mindex new_leaf(valtype val) {
     mindex res;
-    int i,p;
-    if (leaf_freelist == TNULL) { /* need to allocate a new block */
+    int i;
+    unsigned int p;
+    if (cur_arena->leaf_freelist == TNULL) { /* need to allocate a new block */
         /* find first unused block */
         for (p=0; p < MAX_LEAF_BLOCKS && (LEAF_M[p] != NULL); p++) {}
-        if (p == MAX_LEAF_BLOCKS) {
-            fprintf(stderr,"exhausted all %d blocks of %d leafnodes; exiting; you might want to increase DEFAULT_LEAF_ROOT_BLOCKS or DEFAULT_LEAF_BLOCK_BITS in params.h or wherever it is defined\n",MAX_LEAF_BLOCKS,LEAF_BLOCK_SIZE);
-            printf("next free root: %X; int: %X, leaf: %X\n",root_freelist,int_freelist,leaf_freelist);
-            exit(1);
-        }
+        if (p == MAX_LEAF_BLOCKS) grow_block_array((void ***)&LEAF_M,&MAX_LEAF_BLOCKS,&cur_arena->leaf_dirty,LEAF_BLOCK_BITS,"leafnode");
         LEAF_M[p]= (leafnode *)calloc(LEAF_BLOCK_SIZE,sizeof(leafnode));
         if (LEAF_M[p] == NULL) {
             fprintf(stderr,"Out of memory! in allocation of new leafnode block; exiting");
             exit(2);
         }
         /* add new slots to freelist */
-        leaf_freelist= leafnode_index(p,0);
+        cur_arena->leaf_freelist= leafnode_index(p,0);
         for (i=0; i < (LEAF_BLOCK_SIZE-1); i++) {
 #ifdef EXTRA_MARK_FREE
             LEAF_M[p][i].count= -1;
@@ -221,11 +403,13 @@ mindex new_leaf(valtype val) {
         lfreenext(LEAF_M[p][LEAF_BLOCK_SIZE-1])= TNULL;
     }
     /* give out the head and make its next the new head */
-    res= leaf_freelist;
-    leaf_freelist= lfreenext(leafnode(leaf_freelist));
+    res= cur_arena->leaf_freelist;
+    cur_arena->leaf_freelist= lfreenext(leafnode(cur_arena->leaf_freelist));
+    dirty_leaf(res);
     leafvalue(res)= val;
-    leafcount(res)= 1;
+    leafcount(res)= OBS_INCR; /* one observation */
     leafnexttree(res)= TNULL;
+    cur_arena->mem_used+= sizeof(leafnode);
     return res;
 }
 
@@ -234,9 +418,112 @@ void free_leaf(mindex f) {
 #ifdef EXTRA_MARK_FREE
     leafcount(f)= -1;
 #endif
+    cur_arena->mem_used-= sizeof(leafnode);
+    dirty_leaf(f);
+    /* add it to the start of the list */
+    lfreenext(leafnode(f))= cur_arena->leaf_freelist;
+    cur_arena->leaf_freelist= f;
+}
+
+/* allocate a new bnode node in the current arena and return it; it has no slots in use */
+mindex new_bnode() {
+    mindex res;
+    int i;
+    unsigned int p;
+    if (cur_arena->bnode_freelist == TNULL) { /* need to allocate a new block */
+        /* find first unused block */
+        for (p=0; p < MAX_BNODE_BLOCKS && (BNODE_M[p] != NULL); p++) {}
+        if (p == MAX_BNODE_BLOCKS) grow_block_array((void ***)&BNODE_M,&MAX_BNODE_BLOCKS,&cur_arena->bnode_dirty,BNODE_BLOCK_BITS,"bnode");
+        BNODE_M[p]= (bnode *)calloc(BNODE_BLOCK_SIZE,sizeof(bnode));
+        if (BNODE_M[p] == NULL) {
+            fprintf(stderr,"Out of memory! in allocation of new bnode block; exiting");
+            exit(2);
+        }
+        /* add new slots to freelist */
+        cur_arena->bnode_freelist= bnode_index(p,0);
+        for (i=0; i < (BNODE_BLOCK_SIZE-1); i++) {
+#ifdef EXTRA_MARK_FREE
+            BNODE_M[p][i].sum= -1;
+#endif
+            bfreenext(BNODE_M[p][i])= bnode_index(p,i+1);
+        }
+#ifdef EXTRA_MARK_FREE
+        BNODE_M[p][BNODE_BLOCK_SIZE-1].sum= -1;
+#endif
+        bfreenext(BNODE_M[p][BNODE_BLOCK_SIZE-1])= TNULL;
+    }
+    /* give out the head and make its next the new head */
+    res= cur_arena->bnode_freelist;
+    cur_arena->bnode_freelist= bfreenext(bnode(cur_arena->bnode_freelist));
+    dirty_bnode(res);
+    bnsum(res)= 0;
+    bnused(res)= 0;
+    cur_arena->mem_used+= sizeof(bnode);
+    return res;
+}
+
+/* free the bnode node given */
+void free_bnode(mindex f) {
+#ifdef EXTRA_MARK_FREE
+    bnsum(f)= -1;
+#endif
+    cur_arena->mem_used-= sizeof(bnode);
+    dirty_bnode(f);
+    /* add it to the start of the list */
+    bfreenext(bnode(f))= cur_arena->bnode_freelist;
+    cur_arena->bnode_freelist= f;
+}
+
+/* allocate a new dnode node in the current arena and return it; all its slots are TNULL */
+mindex new_dnode(u8 shift,valtype base) {
+    mindex res;
+    int i;
+    unsigned int p;
+    if (cur_arena->dnode_freelist == TNULL) { /* need to allocate a new block */
+        /* find first unused block */
+        for (p=0; p < MAX_DNODE_BLOCKS && (DNODE_M[p] != NULL); p++) {}
+        if (p == MAX_DNODE_BLOCKS) grow_block_array((void ***)&DNODE_M,&MAX_DNODE_BLOCKS,&cur_arena->dnode_dirty,DNODE_BLOCK_BITS,"dnode");
+        DNODE_M[p]= (dnode *)calloc(DNODE_BLOCK_SIZE,sizeof(dnode));
+        if (DNODE_M[p] == NULL) {
+            fprintf(stderr,"Out of memory! in allocation of new dnode block; exiting");
+            exit(2);
+        }
+        /* add new slots to freelist */
+        cur_arena->dnode_freelist= dnode_index(p,0);
+        for (i=0; i < (DNODE_BLOCK_SIZE-1); i++) {
+#ifdef EXTRA_MARK_FREE
+            DNODE_M[p][i].sum= -1;
+#endif
+            dfreenext(DNODE_M[p][i])= dnode_index(p,i+1);
+        }
+#ifdef EXTRA_MARK_FREE
+        DNODE_M[p][DNODE_BLOCK_SIZE-1].sum= -1;
+#endif
+        dfreenext(DNODE_M[p][DNODE_BLOCK_SIZE-1])= TNULL;
+    }
+    /* give out the head and make its next the new head */
+    res= cur_arena->dnode_freelist;
+    cur_arena->dnode_freelist= dfreenext(dnode(cur_arena->dnode_freelist));
+    dirty_dnode(res);
+    dnsum(res)= 0;
+    dnused(res)= 0;
+    dnshift(res)= shift;
+    dnbase(res)= base;
+    for (i=0; i < DNODE_SLOTS; i++) dnchild(res,i)= TNULL;
+    cur_arena->mem_used+= sizeof(dnode);
+    return res;
+}
+
+/* free the dnode node given */
+void free_dnode(mindex f) {
+#ifdef EXTRA_MARK_FREE
+    dnsum(f)= -1;
+#endif
+    cur_arena->mem_used-= sizeof(dnode);
+    dirty_dnode(f);
     /* add it to the start of the list */
-    lfreenext(leafnode(f))= leaf_freelist;
-    leaf_freelist= f;
+    dfreenext(dnode(f))= cur_arena->dnode_freelist;
+    cur_arena->dnode_freelist= f;
 }
 
 /* $Id: spade_prob_table_types.c,v 1.5 2002/12/19 22:37:10 jim Exp $ */
@@ -35,102 +35,310 @@ typedef u32 dmindex;
 /** \note right now, we assume all features can be contained in a u32 and can be sorted as unsigned ints; we may need to extend this someday */
 typedef u32 valtype;
 
+/* define SPADE_COMPACT_NODES to store the counts on leaves and interior nodes
+   as floats and to keep the traversal fields of interior nodes apart from
+   their sums; this takes about a quarter less memory for these nodes and
+   keeps more of a search path in cache, but a count is then only good to
+   about 7 significant digits */
+#ifdef SPADE_COMPACT_NODES
+typedef float count_t;   ///< the type of the (stored) counts on leaves and the sums on interior nodes
+#else
+typedef double count_t;  ///< the type of the (stored) counts on leaves and the sums on interior nodes
+#endif
+
+/* the stored counts are the actual counts divided by the decay not yet
+   applied to them (see spade_mem_arena), so they grow as that decay gets
+   smaller; spade_prob_table_decay() brings them up to date once it is
+   below MIN_LAZY_DECAY, which leaves a float count room for an actual
+   count of up to about 1e18 */
+#ifdef SPADE_COMPACT_NODES
+#define MIN_LAZY_DECAY 1e-20
+#else
+#define MIN_LAZY_DECAY 1e-100
+#endif
 
 /// a tree root
 typedef struct _treeroot {
     mindex next;      ///< the next tree root in a list
     dmindex root;     ///< root node of the tree, if top bit is 1, it is a leafnode, otherwise it is a interior node
     features type;    ///< the feature that is being represented in this tree
-    double entropy;   ///< the last calculated entropy in this tree; < 0 if it has not been calculated
-    u16 entropy_wait; ///< the number of additions to the tree to wait till recalculating the entropy; only valid if entropy >= 0
+    u32 nvals;        ///< the number of values (leaves) in the tree
+    double clogc;     ///< the sum over the leaves of count*ln(count), kept up to date so the entropy can be had without a walk
 } treeroot;
 
 /// an interior node in the tree
+/** With SPADE_COMPACT_NODES, this holds just what a search needs; the rest
+    is in the intnode_cold of the same index. */
 typedef struct _intnode {
-    double sum;     ///< the sum of the counts underneath this node in the tree
+#ifndef SPADE_COMPACT_NODES
+    count_t sum;    ///< the sum of the counts underneath this node in the tree
+#endif
     valtype sortpt; ///< the highest value on the left side of this node
     dmindex left;   ///< the left node; if top bit is 1, it is a leafnode
     dmindex right;  ///< the right node; if top bit is 1, it is a leafnode
+#ifndef SPADE_COMPACT_NODES
     u16 wait;       ///< the number of additions to the subtree to wait before checking for reblancing
+#endif
 } intnode;
 
+#ifdef SPADE_COMPACT_NODES
+/// the part of an interior node that is only needed when the node is updated
+typedef struct _intnode_cold {
+    count_t sum;    ///< the sum of the counts underneath this node in the tree
+    u16 wait;       ///< the number of additions to the subtree to wait before checking for reblancing
+} intnode_cold;
+#define INTNODE_BYTES (sizeof(intnode)+sizeof(intnode_cold)) ///< the memory taken by an interior node
+#else
+#define INTNODE_BYTES sizeof(intnode) ///< the memory taken by an interior node
+#endif
+
 /// a leaf node of the tree
 typedef struct _leafnode {
-    double count;    ///< the count on this node
+    count_t count;   ///< the count on this node
     valtype value;   ///< the value this node represents
     mindex nexttree; ///< the first in a linked list of trees anchored from this leaf node
 } leafnode;
 
+/// the number of slots in a wide node; this makes the sum and keys of a bnode fill one 64 byte cache line and its children another
+#define BNODE_FANOUT 14
+
+/// a wide interior node of the tree, holding up to BNODE_FANOUT sorted children
+/** Trees made of these are B-trees with all the leaves at the same depth.
+    The children of a bnode are either all leafnodes or all bnodes. */
+typedef struct _bnode {
+    double sum;                   ///< the sum of the counts underneath this node in the tree
+    valtype key[BNODE_FANOUT];    ///< the highest value underneath each slot, in increasing order
+    dmindex child[BNODE_FANOUT];  ///< the node in each slot; if top bit is 1, it is a leafnode, otherwise it is an (encoded) bnode
+    u16 used;                     ///< the number of slots in use
+} bnode;
+
+/// the number of slots in a dnode, one for each value of a byte
+#define DNODE_SLOTS 256
+
+/// a dense interior node of the tree, indexed directly by a byte of the value
+/** A tree of a feature with a small domain (see spade_prob_table_set_feature_domain())
+    becomes a dense tree once it has enough values.  For 8 bit values this is
+    a single dnode indexed by the value; for 16 bit values, it is a dnode indexed
+    by the high byte whose children are dnode pages indexed by the low byte.
+    The leaves hang directly off the slots. */
+typedef struct _dnode {
+    double sum;                  ///< the sum of the counts underneath this node in the tree
+    valtype base;                ///< the smallest value that could be underneath this node
+    u16 used;                    ///< the number of slots in use
+    u8 shift;                    ///< the slot for a value is its byte this many bits up
+    dmindex child[DNODE_SLOTS];  ///< the node in each slot, TNULL if none; a leafnode, or an (encoded) dnode page
+} dnode;
+
+/// the representations available for the trees in a spade_prob_table
+#define TREE_KIND_BINARY 0  ///< weight-balanced binary trees made of intnodes
+#define TREE_KIND_WIDE   1  ///< B-trees made of bnodes
+
 #define isleaf(node) (node & DMINDEXMASK)
 #define asleaf(leaf) (leaf | DMINDEXMASK)
 #define encleaf2mindex(node) (node ^ DMINDEXMASK)
+/* a bnode is denoted by the second highest bit being set in a dmindex (and not the highest) */
+#define isbnode(node) (((node) & (DMINDEXMASK|BNODEMASK)) == BNODEMASK)
+#define asbnode(b) ((b) | BNODEMASK)
+#define encbnode2mindex(node) ((node) ^ BNODEMASK)
+/* a dnode is denoted by the third highest bit being set in a dmindex (and neither above it) */
+#define isdnode(node) (((node) & (DMINDEXMASK|BNODEMASK|DNODEMASK)) == DNODEMASK)
+#define asdnode(d) ((d) | DNODEMASK)
+#define encdnode2mindex(node) ((node) ^ DNODEMASK)
 /* arg is a dmindex; if it denotes a leaf, return the count on that leaf
    otherwise return the sum on the interior node */ 
-#define count_or_sum(node) (isleaf(node) ? leafnode(encleaf2mindex(node)).count : intnode(node).sum)
+#define count_or_sum(node) (isleaf(node) ? (double)leafnode(encleaf2mindex(node)).count : (isbnode(node) ? bnode(encbnode2mindex(node)).sum : (isdnode(node) ? dnode(encdnode2mindex(node)).sum : (double)intsum(node))))
 #define eleafval(leaf) leafnode(encleaf2mindex(leaf)).value
-#define largestval(node) (isleaf(node) ? eleafval(node) : largest_val(node))
+#define largestval(node) (isleaf(node) ? eleafval(node) : (isbnode(node) ? bnlargest(encbnode2mindex(node)) : largest_val(node)))
 #define treetype(t) tree(t).type
 #define treeroot(t) tree(t).root
 #define treenext(t) tree(t).next
-#define treeH(t) tree(t).entropy
-#define treeH_wait(t) tree(t).entropy_wait
+#define treenvals(t) tree(t).nvals
+#define treeclogc(t) tree(t).clogc
 #define intleft(node) intnode(node).left
 #define intright(node) intnode(node).right
-#define intsum(node) intnode(node).sum
 #define intsortpt(node) intnode(node).sortpt
-#define intwait(node) intnode(node).wait
+#define intsum(node) arena_intsum(cur_arena,node)
+#define intwait(node) arena_intwait(cur_arena,node)
 #define leafcount(leaf) leafnode(leaf).count
 #define leafvalue(leaf) leafnode(leaf).value
 #define leafnexttree(leaf) leafnode(leaf).nexttree
+#define bnsum(node) bnode(node).sum
+#define bnkey(node,i) bnode(node).key[i]
+#define bnchild(node,i) bnode(node).child[i]
+#define bnused(node) bnode(node).used
+#define bnlargest(node) bnkey(node,bnused(node)-1)
+#define dnsum(node) dnode(node).sum
+#define dnbase(node) dnode(node).base
+#define dnused(node) dnode(node).used
+#define dnshift(node) dnode(node).shift
+#define dnchild(node,i) dnode(node).child[i]
+#define dnslot(node,val) (((val) >> dnshift(node)) & (DNODE_SLOTS-1)) ///< the slot of the dnode that val belongs in
+#define dnslottop(node,i) (dnbase(node) + ((((valtype)(i))+1) << dnshift(node)) - 1) ///< the largest value that could be under slot i
 
 
 /* defaults unless recovering from a checkpoint */
 #define DEFAULT_ROOT_BLOCK_BITS 10
 #define DEFAULT_INT_BLOCK_BITS 9
 #define DEFAULT_LEAF_BLOCK_BITS 10
+#define DEFAULT_BNODE_BLOCK_BITS 8
+#define DEFAULT_DNODE_BLOCK_BITS 4
 
-/* these number of blocks are used
-   unless file recovering from already uses more blocks */
+/* the number of blocks there is initially room for; this grows as needed */
 #define DEFAULT_MAX_ROOT_BLOCKS 4500
 #define DEFAULT_MAX_INT_BLOCKS 12000
 #define DEFAULT_MAX_LEAF_BLOCKS 9000
+#define DEFAULT_MAX_BNODE_BLOCKS 6000
+#define DEFAULT_MAX_DNODE_BLOCKS 4000
 
 #define bits2blocksize(b) (1 << b)
 
+/// a node memory arena; all the nodes of a spade_prob_table are allocated from the arena it owns
+/** The nodes are kept in blocks that are allocated as needed and that are
+    addressed through the block pointer arrays here; a mindex is a block
+    number followed by an offset in that block.  Since arenas share nothing,
+    any number of tables (and so spade instances) can exist side by side. */
+typedef struct _spade_mem_arena {
+    treeroot **root_m;           ///< the blocks of treeroots
+    intnode **int_m;             ///< the blocks of intnodes
+#ifdef SPADE_COMPACT_NODES
+    intnode_cold **intc_m;       ///< the blocks of the cold parts of the intnodes, parallel to int_m
+#endif
+    leafnode **leaf_m;           ///< the blocks of leafnodes
+    bnode **bnode_m;             ///< the blocks of bnodes
+    dnode **dnode_m;             ///< the blocks of dnodes
+    mindex root_freelist;        ///< the first free treeroot, TNULL if none
+    mindex int_freelist;         ///< the first free intnode, TNULL if none
+    mindex leaf_freelist;        ///< the first free leafnode, TNULL if none
+    mindex bnode_freelist;       ///< the first free bnode, TNULL if none
+    mindex dnode_freelist;       ///< the first free dnode, TNULL if none
+    unsigned char root_block_bits; ///< log2 of the number of treeroots in a block
+    unsigned char int_block_bits;  ///< log2 of the number of intnodes in a block
+    unsigned char leaf_block_bits; ///< log2 of the number of leafnodes in a block
+    unsigned char bnode_block_bits; ///< log2 of the number of bnodes in a block
+    unsigned char dnode_block_bits; ///< log2 of the number of dnodes in a block
+    unsigned int max_root_blocks;  ///< the size of the root_m array
+    unsigned int max_int_blocks;   ///< the size of the int_m array
+    unsigned int max_leaf_blocks;  ///< the size of the leaf_m array
+    unsigned int max_bnode_blocks; ///< the size of the bnode_m array
+    unsigned int max_dnode_blocks; ///< the size of the dnode_m array
+    u8 tree_kind;                  ///< the representation (TREE_KIND_*) to use for trees started from here on
+    u8 keep_clogc;                 ///< whether the trees keep their clogc up to date, so their entropy is quick to get
+    u8 dense_levels[MAX_NUM_FEATURES]; ///< for each feature, the number of dnode levels its trees may use (0, 1 or 2) once they have enough values
+    double decay;                  ///< the decay not yet applied to the stored counts; a stored count times this is the actual count
+    double incr;                   ///< 1/decay, the amount a new observation adds to the stored counts
+    unsigned long mem_used;        ///< the number of bytes taken by the nodes in use
+    char *map_base;                ///< if blocks were mapped from a state file, the start of the mapped region; NULL otherwise
+    unsigned long map_len;         ///< the length of the region at map_base
+    u32 id;                        ///< identifies the arena in a checkpoint and the delta checkpoints that follow it
+    u32 *root_dirty;               ///< a bit for each treeroot block, set if the block changed since the last checkpoint
+    u32 *int_dirty;                ///< a bit for each intnode block (and its cold part), set if the block changed since the last checkpoint
+    u32 *leaf_dirty;               ///< a bit for each leafnode block, set if the block changed since the last checkpoint
+    u32 *bnode_dirty;              ///< a bit for each bnode block, set if the block changed since the last checkpoint
+    u32 *dnode_dirty;              ///< a bit for each dnode block, set if the block changed since the last checkpoint
+} spade_mem_arena;
+
+/* the dirty block maps; each block's bit is set when something in it is
+   written, so a delta checkpoint need only contain those blocks.  Node
+   allocation and freeing mark the block; the tree code marks the nodes it
+   changes in place */
+#define DIRTY_MAP_WORDS(blocks) (((blocks)+31) >> 5) ///< the number of u32s in a dirty map for that many blocks
+#define MARK_BLOCK_DIRTY(map,b) ((map)[(b) >> 5] |= ((u32)1 << ((b) & 31)))
+#define BLOCK_IS_DIRTY(map,b) ((map)[(b) >> 5] & ((u32)1 << ((b) & 31)))
+
+/* arena-explicit node accessors */
+#define arena_tree(a,i) (a)->root_m[(i)>>(a)->root_block_bits][(i)&((1 << (a)->root_block_bits) -1)]
+#define arena_intnode(a,i) (a)->int_m[(i)>>(a)->int_block_bits][(i)&((1 << (a)->int_block_bits) -1)]
+#ifdef SPADE_COMPACT_NODES
+#define arena_intcold(a,i) (a)->intc_m[(i)>>(a)->int_block_bits][(i)&((1 << (a)->int_block_bits) -1)]
+#define arena_intsum(a,i) arena_intcold(a,i).sum
+#define arena_intwait(a,i) arena_intcold(a,i).wait
+#else
+#define arena_intsum(a,i) arena_intnode(a,i).sum
+#define arena_intwait(a,i) arena_intnode(a,i).wait
+#endif
+#define arena_leafnode(a,i) (a)->leaf_m[(i)>>(a)->leaf_block_bits][(i)&((1 << (a)->leaf_block_bits) -1)]
+#define arena_bnode(a,i) (a)->bnode_m[(i)>>(a)->bnode_block_bits][(i)&((1 << (a)->bnode_block_bits) -1)]
+#define arena_dnode(a,i) (a)->dnode_m[(i)>>(a)->dnode_block_bits][(i)&((1 << (a)->dnode_block_bits) -1)]
+
+/* the short forms used throughout the tree code refer to the current arena;
+   a table selects its arena with use_arena() on entry to its public functions */
+#define ROOT_M (cur_arena->root_m)
+#define INT_M (cur_arena->int_m)
+#ifdef SPADE_COMPACT_NODES
+#define INTC_M (cur_arena->intc_m)
+#endif
+#define LEAF_M (cur_arena->leaf_m)
+#define BNODE_M (cur_arena->bnode_m)
+#define DNODE_M (cur_arena->dnode_m)
+#define ROOT_BLOCK_BITS (cur_arena->root_block_bits)
+#define INT_BLOCK_BITS (cur_arena->int_block_bits)
+#define LEAF_BLOCK_BITS (cur_arena->leaf_block_bits)
+#define BNODE_BLOCK_BITS (cur_arena->bnode_block_bits)
+#define DNODE_BLOCK_BITS (cur_arena->dnode_block_bits)
+#define MAX_ROOT_BLOCKS (cur_arena->max_root_blocks)
+#define MAX_INT_BLOCKS (cur_arena->max_int_blocks)
+#define MAX_LEAF_BLOCKS (cur_arena->max_leaf_blocks)
+#define MAX_BNODE_BLOCKS (cur_arena->max_bnode_blocks)
+#define MAX_DNODE_BLOCKS (cur_arena->max_dnode_blocks)
+#define OBS_INCR (cur_arena->incr) ///< what one new observation adds to a stored count
+#define actual_count(c) ((c)*cur_arena->decay) ///< the actual count for the stored count c
+
 #define ROOT_BLOCK_SIZE bits2blocksize(ROOT_BLOCK_BITS)
 #define ROOT_BLOCK_MASK ((1 << ROOT_BLOCK_BITS) -1)
-#define tree(i) ROOT_M[i>>ROOT_BLOCK_BITS][i&ROOT_BLOCK_MASK]
+#define tree(i) arena_tree(cur_arena,i)
 #define root_index(p,i) ((p<<ROOT_BLOCK_BITS)+i)
 
 #define INT_BLOCK_SIZE bits2blocksize(INT_BLOCK_BITS)
 #define INT_BLOCK_MASK ((1 << INT_BLOCK_BITS) -1)
-#define intnode(i) INT_M[i>>INT_BLOCK_BITS][i&INT_BLOCK_MASK]
+#define intnode(i) arena_intnode(cur_arena,i)
 #define intnode_index(p,i) ((p<<INT_BLOCK_BITS)+i)
 
 #define LEAF_BLOCK_SIZE bits2blocksize(LEAF_BLOCK_BITS)
 #define LEAF_BLOCK_MASK ((1 << LEAF_BLOCK_BITS) -1)
-#define leafnode(i) LEAF_M[i>>LEAF_BLOCK_BITS][i&LEAF_BLOCK_MASK]
+#define leafnode(i) arena_leafnode(cur_arena,i)
 #define leafnode_index(p,i) ((p<<LEAF_BLOCK_BITS)+i)
 
+#define BNODE_BLOCK_SIZE bits2blocksize(BNODE_BLOCK_BITS)
+#define BNODE_BLOCK_MASK ((1 << BNODE_BLOCK_BITS) -1)
+#define bnode(i) arena_bnode(cur_arena,i)
+#define bnode_index(p,i) ((p<<BNODE_BLOCK_BITS)+i)
+
+#define DNODE_BLOCK_SIZE bits2blocksize(DNODE_BLOCK_BITS)
+#define DNODE_BLOCK_MASK ((1 << DNODE_BLOCK_BITS) -1)
+#define dnode(i) arena_dnode(cur_arena,i)
+#define dnode_index(p,i) ((p<<DNODE_BLOCK_BITS)+i)
+
+/* note that the given node in the current arena is about to be changed */
+#define dirty_tree(i) MARK_BLOCK_DIRTY(cur_arena->root_dirty,(i)>>ROOT_BLOCK_BITS)
+#define dirty_int(i) MARK_BLOCK_DIRTY(cur_arena->int_dirty,(i)>>INT_BLOCK_BITS)
+#define dirty_leaf(i) MARK_BLOCK_DIRTY(cur_arena->leaf_dirty,(i)>>LEAF_BLOCK_BITS)
+#define dirty_bnode(i) MARK_BLOCK_DIRTY(cur_arena->bnode_dirty,(i)>>BNODE_BLOCK_BITS)
+#define dirty_dnode(i) MARK_BLOCK_DIRTY(cur_arena->dnode_dirty,(i)>>DNODE_BLOCK_BITS)
+
 #define rfreenext(n) (n).next
 #define ifreenext(n) (n).left
 #define lfreenext(n) (n).nexttree
+#define bfreenext(n) (n).child[0]
+#define dfreenext(n) (n).child[0]
 
 /* something of valtype that cannot be a sortpt */
 #define NOT_A_SORTPT ((u32)MAX_U32)
 
 #define TNULL (mindex)-1
 #define DMINDEXMASK ((dmindex)(1 << (sizeof(dmindex)*8-1)))
+#define BNODEMASK ((dmindex)(1 << (sizeof(dmindex)*8-2)))
+#define DNODEMASK ((dmindex)(1 << (sizeof(dmindex)*8-3)))
 
-extern treeroot **ROOT_M;
-extern intnode **INT_M;
-extern leafnode **LEAF_M;
-extern mindex root_freelist;
-extern mindex int_freelist;
-extern mindex leaf_freelist;
+extern SPADE_THREAD_LOCAL spade_mem_arena *cur_arena;
+#define use_arena(a) (cur_arena= (a))
 
-void init_mem();
-void allocate_mem_blocks();
+spade_mem_arena *new_spade_mem_arena(void);
+void init_spade_mem_arena(spade_mem_arena *a);
+void free_spade_mem_arena(spade_mem_arena *a);
+void allocate_mem_blocks(spade_mem_arena *a);
+void spade_mem_arena_count_used(spade_mem_arena *a);
+void spade_mem_arena_clear_dirty(spade_mem_arena *a);
+void spade_mem_arena_set_id(spade_mem_arena *a,u32 id);
 int reallocate_ptr_array(void ***arrptr,int oldsize,int newsize);
 
 mindex new_treeinfo(features type);
@@ -139,13 +347,10 @@ mindex new_int();
 void free_int(mindex f);
 mindex new_leaf(valtype val);
 void free_leaf(mindex f);
-
-extern unsigned char ROOT_BLOCK_BITS;
-extern unsigned char INT_BLOCK_BITS;
-extern unsigned char LEAF_BLOCK_BITS;
-extern unsigned int MAX_ROOT_BLOCKS;
-extern unsigned int MAX_INT_BLOCKS;
-extern unsigned int MAX_LEAF_BLOCKS;
+mindex new_bnode();
+void free_bnode(mindex f);
+mindex new_dnode(u8 shift, valtype base);
+void free_dnode(mindex f);
 
 #endif // SPADE_PROB_TABLE_TYPES_H
 
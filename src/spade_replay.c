@@ -0,0 +1,1174 @@
+/*********************************************************************
+spade_replay.c, distributed as part of Spade v030125.1
+Author: James Hoagland, Silicon Defense (hoagland@SiliconDefense.com)
+copyright (c) 2002 by Silicon Defense (http://www.silicondefense.com/)
+Released under GNU General Public License, see the COPYING file included
+with the distribution or http://www.silicondefense.com/spice/ for details.
+
+Please send complaints, kudos, and especially improvements and bugfixes to
+hoagland@SiliconDefense.com.  As described in GNU General Public License, no
+warranty is expressed for this program.
+*********************************************************************/
+
+/* Internal version control: $Id$ */
+
+/*! \file spade_replay.c
+ * \brief
+ *  spade_replay.c is a standalone program that replays packet capture
+ *  files through netspade, without Snort
+ * \ingroup spade_replay
+ */
+
+/*! \addtogroup spade_replay Netspade packet capture replay
+ * \brief this group contains the standalone replay driver for netspade
+ *
+ * spade_replay reads classic pcap and pcapng files with its own parser,
+ * turns each IPv4 packet into spade_events the same way PreprocSpade in
+ * snort_spade.c does, and feeds them to netspade as fast as it can.  The
+ * reports netspade makes are printed, and the packet rate is reported at
+ * the end.  The Spade configuration can come from the "preprocessor spade"
+ * lines of a Snort configuration file.
+ * @{
+*/
+
+#include "netspade.h"
+#include "netspade_shards.h"
+#include "strtok.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+
+/// the magic number of a classic pcap file with microsecond timestamps
+#define PCAP_MAGIC          0xa1b2c3d4
+/// the magic number of a classic pcap file with nanosecond timestamps
+#define PCAP_NSEC_MAGIC     0xa1b23c4d
+/// the largest packet we accept in a capture file
+#define MAX_CAPLEN          262144
+
+/// pcapng section header block type
+#define PCAPNG_SHB          0x0A0D0D0A
+/// pcapng byte order magic, found in section header blocks
+#define PCAPNG_BYTE_ORDER   0x1A2B3C4D
+/// pcapng interface description block type
+#define PCAPNG_IDB          1
+/// (obsolete) pcapng packet block type
+#define PCAPNG_PB           2
+/// pcapng simple packet block type
+#define PCAPNG_SPB          3
+/// pcapng enhanced packet block type
+#define PCAPNG_EPB          6
+/// the pcapng interface description option giving the timestamp resolution
+#define PCAPNG_IF_TSRESOL   9
+/// the most interfaces we keep track of in a pcapng section
+#define MAX_IFACES          32
+
+/* the link layer types we know how to find an IPv4 header in */
+#define LINK_NULL           0
+#define LINK_EN10MB         1
+#define LINK_RAW_OLD1       12
+#define LINK_RAW_OLD2       14
+#define LINK_RAW            101
+#define LINK_LOOP           108
+#define LINK_LINUX_SLL      113
+#define LINK_IPV4           228
+#define LINK_LINUX_SLL2     276
+
+/* ICMP types whose messages enclose the IP header of the offending packet */
+#define ICMP_DEST_UNREACH   3
+#define ICMP_SOURCE_QUENCH  4
+#define ICMP_REDIRECT       5
+#define ICMP_TIME_EXCEEDED  11
+#define ICMP_PARAMETERPROB  12
+
+/// the most variables that can be defined in a configuration file
+#define MAX_CONF_VARS       64
+/// the longest (joined) configuration file line
+#define MAX_CONF_LINE       65536
+
+/// get a 16 bit big endian value
+#define GET16(p) ((u32)(((const u8 *)(p))[0] << 8) | ((const u8 *)(p))[1])
+/// get a 32 bit big endian value
+#define GET32(p) (((u32)((const u8 *)(p))[0] << 24) | ((u32)((const u8 *)(p))[1] << 16) \
+                  | ((u32)((const u8 *)(p))[2] << 8) | ((const u8 *)(p))[3])
+
+/// an open capture file
+typedef struct {
+    FILE *f; ///< the open file
+    const char *name; ///< the name of the file
+    int is_ng; ///< set if this is a pcapng file, rather than a classic pcap file
+    int shb_started; ///< set if the block type of the first pcapng section header block has been read
+    int swapped; ///< set if the file was written with the opposite byte order from big endian
+    int num_ifaces; ///< the number of interfaces described so far in this pcapng section
+    int linktype[MAX_IFACES]; ///< the link type of each interface; a classic pcap file has just one
+    double tsunit[MAX_IFACES]; ///< the length of a timestamp tick of each interface, in secs
+    u8 *buf; ///< buffer for the current record
+    u32 bufsize; ///< the allocated size of buf
+    double last_ts; ///< the timestamp of the last packet read, for packets without one
+} capfile;
+
+/// a packet read from a capture file
+typedef struct {
+    double ts; ///< when the packet was captured
+    int linktype; ///< the link type of the packet
+    const u8 *data; ///< the captured bytes of the packet
+    u32 caplen; ///< the number of bytes captured
+} cap_pkt;
+
+/// the "native" form of a spade_event we hand netspade
+typedef struct {
+    unsigned long frame; ///< the number of the packet in the replay, counting from 1
+    double ts; ///< when the packet was captured
+} replay_pkt;
+
+/// the headers found in an IPv4 packet, as Snort would decode them
+/** The fields mirror those of the Snort Packet struct that PreprocSpade
+    uses; a header pointer is NULL if Snort would not have decoded it */
+typedef struct {
+    const u8 *iph; ///< the IP header
+    const u8 *tcph; ///< the TCP header, if a whole one is present
+    const u8 *udph; ///< the UDP header, if a whole one is present
+    const u8 *icmph; ///< the ICMP header, if a whole one is present
+    u16 sp; ///< the TCP or UDP source port
+    u16 dp; ///< the TCP or UDP destination port
+    const u8 *orig_iph; ///< the IP header enclosed in an ICMP error message
+    const u8 *orig_tcph; ///< the start of the TCP header enclosed in an ICMP error message
+    const u8 *orig_udph; ///< the start of the UDP header enclosed in an ICMP error message
+    const u8 *orig_icmph; ///< the start of the ICMP header enclosed in an ICMP error message
+    u16 orig_sp; ///< the enclosed TCP or UDP source port
+    u16 orig_dp; ///< the enclosed TCP or UDP destination port
+    u8 orig_tcpflags; ///< the enclosed TCP flags, or 0 if they were not captured
+} decoded_pkt;
+
+/// a configuration file variable
+typedef struct {
+    char *name; ///< the name of the variable
+    char *value; ///< the value of the variable
+} conf_var;
+
+/// the settings and running totals of a replay
+typedef struct {
+    netspade *spade; ///< our instance of netspade
+    int verbose; ///< set if netspade status messages should be printed
+    int quiet; ///< set if reports should only be counted, not printed
+    int one_at_a_time; ///< set if events should be passed to netspade_new_pkt() one by one rather than in batches
+    int pipelined; ///< set if netspade should process the events in a pipeline of threads
+    int num_shards; ///< the number of netspades to share out the events between; 1 for just the one
+    int merge_freq; ///< how often (in secs of packet time) the tables of the shards are merged
+    int shard; ///< the shard being set up
+    netspade_shards shards; ///< the shards, if there are more than one
+    char *statefile; ///< the state file given on the command line, or NULL
+    char *logfile; ///< the log file given on the command line, or NULL
+    unsigned long pkts; ///< the number of packets read
+    unsigned long ip_pkts; ///< the number of those that were IPv4 packets
+    unsigned long events; ///< the number of spade_events given to netspade
+    unsigned long alerts; ///< the number of anomaly reports made
+    unsigned long adjusts; ///< the number of threshold adjustment reports made
+    replay_pkt cur; ///< the packet being replayed
+    spade_event batch[NETSPADE_BATCH_SIZE]; ///< the events waiting to be passed to netspade_new_pkts()
+    replay_pkt batch_pkts[NETSPADE_BATCH_SIZE]; ///< the native form of each event in batch
+    int batched; ///< the number of events in batch
+    conf_var vars[MAX_CONF_VARS]; ///< the configuration file variables
+    int num_vars; ///< the number of entries in vars
+} replay;
+
+static int capfile_open(capfile *cf, const char *name);
+static void capfile_close(capfile *cf);
+static int capfile_next(capfile *cf, cap_pkt *p);
+static int capfile_read_pcap(capfile *cf, cap_pkt *p);
+static int capfile_read_pcapng(capfile *cf, cap_pkt *p);
+static void capfile_read_idb(capfile *cf, const u8 *body, u32 len);
+static u8 *capfile_fill(capfile *cf, u32 len);
+static u32 capfile_get16(capfile *cf, const u8 *p);
+static u32 capfile_get32(capfile *cf, const u8 *p);
+static const u8 *link_to_ip(int linktype, const u8 *d, u32 len, u32 *iplen);
+static int decode_ip(const u8 *ip, u32 len, decoded_pkt *dp);
+static void decode_enclosed_ip(const u8 *ip, u32 len, decoded_pkt *dp);
+static void replay_ip_pkt(replay *r, const u8 *ip, u32 len, double ts);
+static void replay_event(replay *r, spade_event *pkt);
+static void replay_flush(replay *r);
+static int replay_file(replay *r, const char *name);
+static void replay_setup_spade(replay *r, char *args);
+static void replay_read_conf(replay *r, const char *name);
+static void replay_conf_line(replay *r, char *line, const char *name, int lineno);
+static char *replay_expand_vars(replay *r, const char *line);
+static void replay_report_anom(void *context, spade_report *rpt);
+static void replay_report_thresh_changed(void *context, char *id, char *mess, int using_corrscore);
+static void replay_msg_fn(spade_message_type msg_type, const char *msg);
+static void *replay_pkt_copy(void *native);
+static void replay_pkt_free(void *native);
+static char *ip_str(u32 ip, char *buf);
+static void usage(const char *prog);
+
+/// set if netspade status messages should be printed; replay_msg_fn has no context
+static int replay_verbose= 0;
+
+/// the most shards spade_replay -j runs
+#define MAX_REPLAY_SHARDS 64
+
+int main(int argc, char *argv[])
+{
+    replay r;
+    struct timeval start,end;
+    double secs;
+    char *conffile= NULL;
+    char *homenet= NULL;
+    char *detectors[64];
+    netspade *shards[MAX_REPLAY_SHARDS];
+    int num_detectors= 0;
+    int check_tables= 0,problems= 0;
+    int c,i;
+
+    memset(&r,0,sizeof(r));
+    r.num_shards= 1;
+    r.merge_freq= NETSPADE_SHARDS_MERGE_FREQ;
+    while ((c= getopt(argc,argv,"c:h:d:s:l:qv1tj:m:k")) != -1) {
+        switch (c) {
+        case 'c': conffile= optarg; break;
+        case 'h': homenet= optarg; break;
+        case 'd':
+            if (num_detectors == sizeof(detectors)/sizeof(detectors[0])) {
+                fprintf(stderr,"spade_replay: too many -d options\n");
+                exit(1);
+            }
+            detectors[num_detectors++]= optarg;
+            break;
+        case 's': r.statefile= optarg; break;
+        case 'l': r.logfile= optarg; break;
+        case 'q': r.quiet= 1; break;
+        case 'v': r.verbose= replay_verbose= 1; break;
+        case '1': r.one_at_a_time= 1; break;
+        case 't': r.pipelined= 1; break;
+        case 'j':
+            r.num_shards= atoi(optarg);
+            if (r.num_shards < 1 || r.num_shards > MAX_REPLAY_SHARDS) {
+                fprintf(stderr,"spade_replay: the number of shards must be from 1 to %d\n",MAX_REPLAY_SHARDS);
+                exit(1);
+            }
+            break;
+        case 'm': r.merge_freq= atoi(optarg); break;
+        case 'k': check_tables= 1; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (optind >= argc) usage(argv[0]);
+
+    /* each shard is set up the same way, from the top */
+    for (r.shard= 0; r.shard < r.num_shards; r.shard++) {
+        r.spade= NULL;
+        if (conffile != NULL) replay_read_conf(&r,conffile);
+        if (r.spade == NULL) replay_setup_spade(&r,"");
+        if (homenet != NULL) netspade_set_homenet_from_str(r.spade,homenet);
+        for (i= 0; i < num_detectors; i++) {
+            char *id= netspade_new_detector(r.spade,detectors[i]);
+            if (r.verbose && r.shard == 0) fprintf(stderr,"spade_replay: detector %s enabled with: %s\n",id,detectors[i]);
+        }
+        shards[r.shard]= r.spade;
+    }
+
+    if (r.num_shards > 1) {
+        if (!init_netspade_shards(&r.shards,shards,r.num_shards,r.merge_freq)) {
+            fprintf(stderr,"spade_replay: out of memory!\n");
+            exit(2);
+        }
+        netspade_shards_set_callbacks(&r.shards,&r,replay_report_anom,replay_report_thresh_changed,replay_pkt_copy,replay_pkt_free);
+        netspade_shards_start(&r.shards); /* if they cannot run in threads, they take turns in this one */
+    } else if (r.pipelined && !netspade_start_pipeline(r.spade)) {
+        exit(1);
+    }
+
+    gettimeofday(&start,NULL);
+    for (i= optind; i < argc; i++) {
+        if (!replay_file(&r,argv[i])) exit(1);
+    }
+    replay_flush(&r);
+    /* wait for the pipelines to get through the packets */
+    if (r.num_shards > 1)
+        netspade_shards_stop(&r.shards);
+    else
+        netspade_stop_pipeline(r.spade);
+    gettimeofday(&end,NULL);
+    secs= (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec)/1000000.0;
+
+    if (check_tables) {
+        for (i= 0; i < r.num_shards; i++) problems+= netspade_check_tables(shards[i]);
+        fprintf(stderr,"spade_replay: %d problems found checking the probability tables\n",problems);
+    }
+
+    /* this flushes the reports waiting on a response and writes the log and state */
+    if (r.num_shards > 1) {
+        if (r.verbose) fprintf(stderr,"spade_replay: the tables of the %d shards were merged %lu times\n",r.num_shards,r.shards.merges);
+        netspade_shards_cleanup(&r.shards);
+    } else {
+        netspade_cleanup(r.spade);
+    }
+    fflush(stdout);
+
+    fprintf(stderr,"spade_replay: %lu packets (%lu IPv4, %lu spade events) in %.3f secs",r.pkts,r.ip_pkts,r.events,secs);
+    if (secs > 0) fprintf(stderr,": %.0f packets/sec",r.pkts/secs);
+    fprintf(stderr,"\nspade_replay: %lu reports, %lu threshold adjustments\n",r.alerts,r.adjusts);
+    return problems ? 3 : 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,"usage: %s [-c snort.conf] [-h homenet] [-d detector-options]... [-s statefile]\n"
+                   "          [-l logfile] [-q] [-v] [-1] [-t] [-j shards] [-m secs] [-k] capture-file...\n",prog);
+    fprintf(stderr,"  -c  take the Spade configuration from the preprocessor spade lines of this file\n");
+    fprintf(stderr,"  -h  set the homenet, as on a spade-homenet line\n");
+    fprintf(stderr,"  -d  enable a detector, as on a spade-detect line; may be repeated\n");
+    fprintf(stderr,"  -s  recover from and checkpoint to this state file (default: none)\n");
+    fprintf(stderr,"  -l  write the Spade log to this file (default: -, standard output)\n");
+    fprintf(stderr,"  -q  just count the reports rather than printing them\n");
+    fprintf(stderr,"  -v  print Spade's status messages\n");
+    fprintf(stderr,"  -1  pass packets to Spade one at a time, rather than in batches\n");
+    fprintf(stderr,"  -t  have Spade process the packets in a pipeline of threads (needs a build\n"
+                   "      with SPADE_USE_THREADS)\n");
+    fprintf(stderr,"  -j  share out the packets by flow between this many instances of Spade, each\n"
+                   "      in threads of its own (with SPADE_USE_THREADS), which score against the\n"
+                   "      merged tables of them all; shard n > 0 adds .n to its state and log file\n"
+                   "      names, and only shard 0 writes its log to standard output\n");
+    fprintf(stderr,"  -m  merge the tables of the shards every this many seconds of packet time\n"
+                   "      (default: %d)\n",NETSPADE_SHARDS_MERGE_FREQ);
+    fprintf(stderr,"  -k  check the probability tables at the end for soundness and that they\n"
+                   "      come through merging and subtracting, and loading, intact; exits with 3\n"
+                   "      on a problem\n");
+    exit(1);
+}
+
+
+/*========================================================================*/
+/*========================== netspade set up =============================*/
+/*========================================================================*/
+
+/* set up netspade per the options of a "preprocessor spade:" line, with the
+   state and log files given on the command line taking precedence */
+static void replay_setup_spade(replay *r, char *argsstr)
+{
+    int prob_mode=3,checkpoint_freq=50000,recover,checkpoint_background= 0,checkpoint_deltas= 0,checkpoint_compress= 0;
+    double init_thresh= -1,memlimit_mb= 0;
+    char statefile[401]= "0";
+    char outfile[401]= "-";
+    int use_corrscore= 0;
+    char dest[11]= "alert";
+    char adjdest[11]= "\0";
+    char xsips[401]="",xdips[401]="",xsports[401]="",xdports[401]="";
+    void *args[16];
+
+    if (r->spade != NULL) {
+        fprintf(stderr,"spade_replay: Spade configured more than once, ignoring: %s\n",argsstr);
+        return;
+    }
+
+    /* same options as SpadeInit(); the dest options are accepted but unused */
+    args[0]= &init_thresh;
+    args[1]= &statefile;
+    args[2]= &outfile;
+    args[3]= &prob_mode;
+    args[4]= &checkpoint_freq;
+    args[5]= &use_corrscore;
+    args[6]= &dest;
+    args[7]= &adjdest;
+    args[8]= &xsips;
+    args[9]= &xdips;
+    args[10]= &xsports;
+    args[11]= &xdports;
+    args[12]= &memlimit_mb;
+    args[13]= &checkpoint_background;
+    args[14]= &checkpoint_deltas;
+    args[15]= &checkpoint_compress;
+    fill_args_space_sep(argsstr,"d:thresh;s400:statefile;s400:logfile;"
+            "i:probmode;i:cpfreq;b:-corrscore,corrscore;s10:dest;s10:adjdest;"
+            "s400:Xsips,Xsip,xsips;s400:Xdips,Xdip,xdips;"
+            "s400:Xsports,Xsport,xsports;s400:Xdports,Xdport,xdports;d:memlimit;"
+            "b:cpbackground;i:cpdeltas;b:cpcompress",args,replay_msg_fn);
+
+    if (r->statefile != NULL) {
+        strncpy(statefile,r->statefile,400);
+        statefile[400]= '\0';
+    }
+    if (r->logfile != NULL) {
+        strncpy(outfile,r->logfile,400);
+        outfile[400]= '\0';
+    }
+    if (r->shard > 0) { /* the other shards keep their own state and log */
+        if (strcmp(statefile,"0") && strcmp(statefile,"/dev/null") && strlen(statefile) < 390)
+            sprintf(statefile+strlen(statefile),".%d",r->shard);
+        if (!strcmp(outfile,"-"))
+            strcpy(outfile,"/dev/null");
+        else if (strlen(outfile) < 390)
+            sprintf(outfile+strlen(outfile),".%d",r->shard);
+    }
+
+    recover= strcmp(statefile,"0") && strcmp(statefile,"/dev/null");
+    if (recover) {
+        r->spade= new_netspade_from_statefile(statefile,replay_msg_fn,0,&recover);
+        if (r->verbose) fprintf(stderr,"spade_replay: %s Spade state from %s\n",recover ? "recovered" : "could not recover",statefile);
+        if (r->spade == NULL) {
+            fprintf(stderr,"spade_replay: out of memory!\n");
+            exit(2);
+        }
+        netspade_set_checkpointing(r->spade,statefile,checkpoint_freq);
+        if (checkpoint_background) netspade_set_background_checkpointing(r->spade,1);
+        if (checkpoint_deltas > 0) netspade_set_delta_checkpointing(r->spade,checkpoint_deltas);
+        if (checkpoint_compress) netspade_set_checkpoint_compression(r->spade,1);
+    } else {
+        r->spade= new_netspade(replay_msg_fn,0);
+        if (r->spade == NULL) {
+            fprintf(stderr,"spade_replay: out of memory!\n");
+            exit(2);
+        }
+    }
+
+    netspade_set_output_file(r->spade,outfile);
+    if (memlimit_mb > 0) netspade_set_memory_limit(r->spade,(unsigned long)(memlimit_mb*1024*1024));
+    netspade_set_callbacks(r->spade,r,replay_report_anom,replay_report_thresh_changed,replay_pkt_copy,replay_pkt_free);
+    netspade_add_rpt_excludes(r->spade,xsips,xdips,xsports,xdports);
+
+    if (prob_mode != 3 || init_thresh != -1 || use_corrscore) {
+        char init_detect_str[100];
+        /* backwards compatability mode, as in SpadeInit() */
+        if (prob_mode > 4 || prob_mode < 0) {
+            fprintf(stderr,"spade_replay: Spade probabity mode %d undefined, using #3 instead\n",prob_mode);
+            prob_mode= 3;
+        }
+        sprintf(init_detect_str,"id=default relscore=0  corrscore=0 thresh=%f probmode=%d corrscore=%d",
+                                                init_thresh,prob_mode,use_corrscore);
+        netspade_new_detector(r->spade,init_detect_str);
+    }
+}
+
+/* read the Spade configuration from the "preprocessor spade..." lines of a
+   Snort configuration file; other lines, except "var" lines, are ignored */
+static void replay_read_conf(replay *r, const char *name)
+{
+    FILE *f= fopen(name,"r");
+    static char line[MAX_CONF_LINE];
+    int len= 0,lineno= 0,startline= 1;
+
+    if (f == NULL) {
+        fprintf(stderr,"spade_replay: could not open %s\n",name);
+        exit(1);
+    }
+    while (fgets(line+len,MAX_CONF_LINE-len,f) != NULL) {
+        lineno++;
+        len= strlen(line);
+        if (len == MAX_CONF_LINE-1 && line[len-1] != '\n' && !feof(f)) {
+            fprintf(stderr,"spade_replay: line too long: %s(%d)\n",name,lineno);
+            exit(1);
+        }
+        while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r')) line[--len]= '\0';
+        if (len > 0 && line[len-1] == '\\' && len < MAX_CONF_LINE-1) { /* continued on the next line */
+            line[--len]= '\0';
+            continue;
+        }
+        replay_conf_line(r,line,name,startline);
+        len= 0;
+        startline= lineno+1;
+    }
+    if (len > 0) replay_conf_line(r,line,name,startline);
+    fclose(f);
+}
+
+static void replay_conf_line(replay *r, char *line, const char *name, int lineno)
+{
+    char *p= line,*kw,*args,*expanded;
+
+    while (*p == ' ' || *p == '\t') p++;
+    if (*p == '#' || *p == ';' || *p == '\0') return;
+
+    if (!strncmp(p,"var",3) && (p[3] == ' ' || p[3] == '\t')) {
+        char *varname,*value;
+        p+= 3;
+        while (*p == ' ' || *p == '\t') p++;
+        varname= p;
+        while (*p != '\0' && *p != ' ' && *p != '\t') p++;
+        if (*p != '\0') *p++= '\0';
+        while (*p == ' ' || *p == '\t') p++;
+        if (*varname == '\0') return;
+        if (r->num_vars == MAX_CONF_VARS) {
+            fprintf(stderr,"spade_replay: too many variables, ignoring %s: %s(%d)\n",varname,name,lineno);
+            return;
+        }
+        value= replay_expand_vars(r,p);
+        r->vars[r->num_vars].name= strdup(varname);
+        r->vars[r->num_vars].value= value;
+        if (r->vars[r->num_vars].name == NULL) {
+            fprintf(stderr,"spade_replay: out of memory!\n");
+            exit(2);
+        }
+        r->num_vars++;
+        return;
+    }
+
+    if (strncmp(p,"preprocessor",12) || (p[12] != ' ' && p[12] != '\t')) return;
+    p+= 12;
+    while (*p == ' ' || *p == '\t') p++;
+    kw= p;
+    while (*p != '\0' && *p != ':' && *p != ' ' && *p != '\t') p++;
+    if (*p != ':') {
+        while (*p == ' ' || *p == '\t') *p++= '\0';
+        if (*p != ':') return;
+    }
+    *p++= '\0';
+    if (strncmp(kw,"spade",5)) return;
+
+    expanded= replay_expand_vars(r,p);
+    args= expanded;
+    while (*args == ' ' || *args == '\t') args++;
+
+    if (!strcmp(kw,"spade")) {
+        replay_setup_spade(r,args);
+    } else {
+        if (r->spade == NULL) replay_setup_spade(r,"");
+        if (!strcmp(kw,"spade-homenet")) {
+            netspade_set_homenet_from_str(r->spade,args);
+        } else if (!strcmp(kw,"spade-detect")) {
+            netspade_new_detector(r->spade,args);
+        } else if (!strcmp(kw,"spade-stats")) {
+            netspade_set_output_stats_from_str(r->spade,args);
+        } else if (!strcmp(kw,"spade-threshlearn") || !strcmp(kw,"spade-threshadvise")) {
+            netspade_setup_detector_advise_from_str(r->spade,args);
+        } else if (!strcmp(kw,"spade-adapt")) {
+            netspade_setup_detector_adapt_from_str(r->spade,1,args);
+        } else if (!strcmp(kw,"spade-adapt2")) {
+            netspade_setup_detector_adapt_from_str(r->spade,2,args);
+        } else if (!strcmp(kw,"spade-adapt3")) {
+            netspade_setup_detector_adapt_from_str(r->spade,3,args);
+        } else if (!strcmp(kw,"spade-survey")) {
+            netspade_setup_detector_survey_from_str(r->spade,args);
+        } else {
+            fprintf(stderr,"spade_replay: unknown preprocessor %s, ignoring: %s(%d)\n",kw,name,lineno);
+        }
+    }
+    free(expanded);
+}
+
+/* return a malloc'd copy of line with $name and $(name) replaced by the
+   value of that variable */
+static char *replay_expand_vars(replay *r, const char *line)
+{
+    char *out= (char *)malloc(MAX_CONF_LINE);
+    int len= 0;
+
+    if (out == NULL) {
+        fprintf(stderr,"spade_replay: out of memory!\n");
+        exit(2);
+    }
+    while (*line != '\0' && len < MAX_CONF_LINE-1) {
+        if (*line == '$') {
+            const char *start= line+1,*stop;
+            int paren= (*start == '('),n,i;
+            if (paren) start++;
+            for (stop= start; *stop == '_' || (*stop >= 'A' && *stop <= 'Z')
+                    || (*stop >= 'a' && *stop <= 'z') || (*stop >= '0' && *stop <= '9'); stop++);
+            n= stop - start;
+            for (i= r->num_vars-1; i >= 0; i--) {
+                if ((int)strlen(r->vars[i].name) == n && !strncmp(r->vars[i].name,start,n)) break;
+            }
+            if (n > 0 && i >= 0 && (!paren || *stop == ')')) {
+                const char *v= r->vars[i].value;
+                while (*v != '\0' && len < MAX_CONF_LINE-1) out[len++]= *v++;
+                line= stop + paren;
+                continue;
+            }
+        }
+        out[len++]= *line++;
+    }
+    out[len]= '\0';
+    return out;
+}
+
+
+/*========================================================================*/
+/*============================ replaying =================================*/
+/*========================================================================*/
+
+static int replay_file(replay *r, const char *name)
+{
+    capfile cf;
+    cap_pkt p;
+    int res;
+
+    if (!capfile_open(&cf,name)) return 0;
+    while ((res= capfile_next(&cf,&p)) > 0) {
+        const u8 *ip;
+        u32 iplen;
+
+        r->pkts++;
+        ip= link_to_ip(p.linktype,p.data,p.caplen,&iplen);
+        if (ip != NULL) {
+            r->ip_pkts++;
+            r->cur.frame= r->pkts;
+            r->cur.ts= p.ts;
+            replay_ip_pkt(r,ip,iplen,p.ts);
+        }
+    }
+    capfile_close(&cf);
+    return res == 0;
+}
+
+/* pass the IPv4 packet to netspade; this follows PreprocSpade() */
+static void replay_ip_pkt(replay *r, const u8 *ip, u32 len, double ts)
+{
+    spade_event pkt;
+    decoded_pkt p;
+
+    if (!decode_ip(ip,len,&p)) return; /* netspade only looks at IP packets for now */
+
+    pkt.time= (time_t)ts;
+
+    pkt.origin= PKTORIG_TOP;
+    pkt.fldval[IPPROTO]= p.iph[9];
+
+    switch (pkt.fldval[IPPROTO]) { /* protocol-specific processing */
+    case IPPROTO_TCP:
+        if (p.tcph == NULL) return;
+        pkt.fldval[TCPFLAGS]= p.tcph[13];
+        break;
+    case IPPROTO_UDP:
+        if (p.udph == NULL) return;
+        break;
+    case IPPROTO_ICMP:
+        if (p.icmph == NULL) return;
+        pkt.fldval[ICMPTYPE]= p.icmph[0];
+        pkt.fldval[ICMPTYPECODE]= (p.icmph[0] << 8) | p.icmph[1];
+        break;
+    default:;
+    }
+
+    pkt.fldval[SIP]= GET32(p.iph+12);
+    pkt.fldval[DIP]= GET32(p.iph+16);
+    pkt.fldval[SPORT]= p.sp;
+    pkt.fldval[DPORT]= p.dp;
+
+    replay_event(r,&pkt);
+
+    if ((p.orig_iph != NULL) && (p.icmph != NULL) && (p.icmph[0] == ICMP_DEST_UNREACH)) {
+        pkt.origin= PKTORIG_UNRCH;
+
+        pkt.fldval[IPPROTO]= p.orig_iph[9];
+
+        switch (pkt.fldval[IPPROTO]) { /* protocol-specific processing */
+        case IPPROTO_TCP:
+            if (p.orig_tcph == NULL) return;
+            pkt.fldval[TCPFLAGS]= p.orig_tcpflags;
+            break;
+        case IPPROTO_UDP:
+            if (p.orig_udph == NULL) return;
+            break;
+        case IPPROTO_ICMP:
+            if (p.orig_icmph == NULL) return;
+            break;
+        default:;
+        }
+
+        pkt.fldval[SIP]= GET32(p.orig_iph+12);
+        pkt.fldval[DIP]= GET32(p.orig_iph+16);
+        pkt.fldval[SPORT]= p.orig_sp;
+        pkt.fldval[DPORT]= p.orig_dp;
+
+        replay_event(r,&pkt);
+    }
+}
+
+/* hand an event to netspade, in batches unless one_at_a_time is set */
+static void replay_event(replay *r, spade_event *pkt)
+{
+    r->events++;
+    if (r->one_at_a_time) {
+        pkt->native= &r->cur;
+        if (r->num_shards > 1)
+            netspade_shards_new_pkt(&r->shards,pkt);
+        else
+            netspade_new_pkt(r->spade,pkt);
+        return;
+    }
+    r->batch[r->batched]= *pkt;
+    r->batch_pkts[r->batched]= r->cur;
+    r->batch[r->batched].native= &r->batch_pkts[r->batched];
+    if (++r->batched == NETSPADE_BATCH_SIZE) replay_flush(r);
+}
+
+static void replay_flush(replay *r)
+{
+    if (r->batched > 0) {
+        if (r->num_shards > 1)
+            netspade_shards_new_pkts(&r->shards,r->batch,r->batched);
+        else
+            netspade_new_pkts(r->spade,r->batch,r->batched);
+    }
+    r->batched= 0;
+}
+
+/* find the headers in an IPv4 packet the way Snort's DecodeIP() would;
+   returns 0 if Snort would not consider it an IP packet */
+static int decode_ip(const u8 *ip, u32 len, decoded_pkt *dp)
+{
+    u32 ip_len,hlen,frag_off;
+    const u8 *payload;
+
+    memset(dp,0,sizeof(decoded_pkt));
+    if (len < 20 || (ip[0] >> 4) != 4) return 0;
+    hlen= (ip[0] & 0x0F) << 2;
+    ip_len= GET16(ip+2);
+    if (ip_len > len) ip_len= len; /* truncated by the capture */
+    if (hlen < 20 || hlen > ip_len) return 0;
+    dp->iph= ip;
+
+    /* like Snort without fragment reassembly, don't look past the IP header of fragments */
+    frag_off= GET16(ip+6) & 0x3FFF;
+    if (frag_off) return 1;
+
+    payload= ip + hlen;
+    len= ip_len - hlen;
+    switch (ip[9]) {
+    case IPPROTO_TCP:
+        if (len >= 20 && (payload[12] >> 4) >= 5 && (u32)((payload[12] >> 4) << 2) <= len) {
+            dp->tcph= payload;
+            dp->sp= GET16(payload);
+            dp->dp= GET16(payload+2);
+        }
+        break;
+    case IPPROTO_UDP:
+        if (len >= 8) {
+            dp->udph= payload;
+            dp->sp= GET16(payload);
+            dp->dp= GET16(payload+2);
+        }
+        break;
+    case IPPROTO_ICMP:
+        if (len >= 4) {
+            dp->icmph= payload;
+            switch (payload[0]) {
+            case ICMP_DEST_UNREACH:
+            case ICMP_SOURCE_QUENCH:
+            case ICMP_REDIRECT:
+            case ICMP_TIME_EXCEEDED:
+            case ICMP_PARAMETERPROB:
+                /* the offending datagram follows the 4 unused bytes */
+                if (len > 8) decode_enclosed_ip(payload+8,len-8,dp);
+                break;
+            default:;
+            }
+        }
+        break;
+    default:;
+    }
+    return 1;
+}
+
+/* find the headers in the IP datagram enclosed in an ICMP error message, the
+   way Snort's DecodeIPOnly() would; usually only the first 8 bytes of its
+   payload are present, which is enough for the ports but not the TCP flags */
+static void decode_enclosed_ip(const u8 *ip, u32 len, decoded_pkt *dp)
+{
+    u32 hlen;
+    const u8 *payload;
+
+    if (len < 20 || (ip[0] >> 4) != 4) return;
+    hlen= (ip[0] & 0x0F) << 2;
+    if (hlen < 20 || hlen > len) return;
+    dp->orig_iph= ip;
+    if (GET16(ip+6) & 0x1FFF) return; /* no transport header in a later fragment */
+
+    payload= ip + hlen;
+    len-= hlen;
+    if (len < 4) return;
+    switch (ip[9]) {
+    case IPPROTO_TCP:
+        dp->orig_tcph= payload;
+        dp->orig_sp= GET16(payload);
+        dp->orig_dp= GET16(payload+2);
+        if (len >= 14) dp->orig_tcpflags= payload[13];
+        break;
+    case IPPROTO_UDP:
+        dp->orig_udph= payload;
+        dp->orig_sp= GET16(payload);
+        dp->orig_dp= GET16(payload+2);
+        break;
+    case IPPROTO_ICMP:
+        dp->orig_icmph= payload;
+        break;
+    default:;
+    }
+}
+
+/* return where the IPv4 header is in a link layer frame, or NULL if it is
+   not an IPv4 packet */
+static const u8 *link_to_ip(int linktype, const u8 *d, u32 len, u32 *iplen)
+{
+    u32 off,type;
+
+    switch (linktype) {
+    case LINK_EN10MB:
+        if (len < 14) return NULL;
+        type= GET16(d+12);
+        off= 14;
+        while ((type == 0x8100 || type == 0x88A8 || type == 0x9100) && len >= off+4) { /* VLAN tags */
+            type= GET16(d+off+2);
+            off+= 4;
+        }
+        if (type != 0x0800) return NULL;
+        break;
+    case LINK_NULL:
+    case LINK_LOOP:
+        /* the address family, in the byte order of the capturing host for LINK_NULL */
+        if (len < 4) return NULL;
+        type= GET32(d);
+        if (type != 2 && type != 0x02000000) return NULL;
+        off= 4;
+        break;
+    case LINK_RAW:
+    case LINK_RAW_OLD1:
+    case LINK_RAW_OLD2:
+    case LINK_IPV4:
+        if (len < 1 || (d[0] >> 4) != 4) return NULL;
+        off= 0;
+        break;
+    case LINK_LINUX_SLL:
+        if (len < 16 || GET16(d+14) != 0x0800) return NULL;
+        off= 16;
+        break;
+    case LINK_LINUX_SLL2:
+        if (len < 20 || GET16(d) != 0x0800) return NULL;
+        off= 20;
+        break;
+    default:
+        return NULL;
+    }
+    if (len <= off) return NULL;
+    *iplen= len - off;
+    return d + off;
+}
+
+
+/*========================================================================*/
+/*======================== capture file reading ==========================*/
+/*========================================================================*/
+
+/* open a capture file and read its header; returns 0 on failure */
+static int capfile_open(capfile *cf, const char *name)
+{
+    u8 hdr[24];
+    u32 magic;
+
+    memset(cf,0,sizeof(capfile));
+    cf->name= name;
+    cf->f= strcmp(name,"-") ? fopen(name,"rb") : stdin;
+    if (cf->f == NULL) {
+        fprintf(stderr,"spade_replay: could not open %s\n",name);
+        return 0;
+    }
+    if (fread(hdr,1,4,cf->f) != 4) {
+        fprintf(stderr,"spade_replay: %s is empty or unreadable\n",name);
+        capfile_close(cf);
+        return 0;
+    }
+    magic= GET32(hdr);
+    if (magic == PCAPNG_SHB) {
+        cf->is_ng= 1;
+        cf->shb_started= 1;
+        return 1; /* the rest of the section header block is read by capfile_read_pcapng() */
+    }
+
+    if (magic == PCAP_MAGIC || magic == PCAP_NSEC_MAGIC) {
+        cf->swapped= 0;
+    } else {
+        cf->swapped= 1;
+        magic= capfile_get32(cf,hdr);
+        if (magic != PCAP_MAGIC && magic != PCAP_NSEC_MAGIC) {
+            fprintf(stderr,"spade_replay: %s is not a pcap or pcapng file\n",name);
+            capfile_close(cf);
+            return 0;
+        }
+    }
+    if (fread(hdr+4,1,20,cf->f) != 20) {
+        fprintf(stderr,"spade_replay: %s: truncated file header\n",name);
+        capfile_close(cf);
+        return 0;
+    }
+    cf->num_ifaces= 1;
+    cf->linktype[0]= capfile_get32(cf,hdr+20) & 0xFFFF;
+    cf->tsunit[0]= (magic == PCAP_NSEC_MAGIC) ? 1e-9 : 1e-6;
+    return 1;
+}
+
+static void capfile_close(capfile *cf)
+{
+    if (cf->f != NULL && cf->f != stdin) fclose(cf->f);
+    cf->f= NULL;
+    free(cf->buf);
+    cf->buf= NULL;
+}
+
+/* read the next packet; returns 1 if there is one, 0 at the end of the file,
+   and -1 if the file is corrupt */
+static int capfile_next(capfile *cf, cap_pkt *p)
+{
+    return cf->is_ng ? capfile_read_pcapng(cf,p) : capfile_read_pcap(cf,p);
+}
+
+static int capfile_read_pcap(capfile *cf, cap_pkt *p)
+{
+    u8 rec[16];
+    u32 caplen;
+    size_t n= fread(rec,1,16,cf->f);
+
+    if (n == 0) return 0;
+    if (n != 16) {
+        fprintf(stderr,"spade_replay: %s: truncated packet header\n",cf->name);
+        return -1;
+    }
+    caplen= capfile_get32(cf,rec+8);
+    if (caplen > MAX_CAPLEN) {
+        fprintf(stderr,"spade_replay: %s: bad packet length %lu\n",cf->name,(unsigned long)caplen);
+        return -1;
+    }
+    p->data= capfile_fill(cf,caplen);
+    if (p->data == NULL) {
+        fprintf(stderr,"spade_replay: %s: truncated packet\n",cf->name);
+        return -1;
+    }
+    p->ts= capfile_get32(cf,rec) + capfile_get32(cf,rec+4)*cf->tsunit[0];
+    p->linktype= cf->linktype[0];
+    p->caplen= caplen;
+    return 1;
+}
+
+static int capfile_read_pcapng(capfile *cf, cap_pkt *p)
+{
+    u8 hdr[8];
+    u32 type,blocklen,iface,caplen;
+    const u8 *body;
+    size_t n;
+
+    for (;;) {
+        if (cf->shb_started) {
+            /* capfile_open() consumed the block type of the first section header block */
+            cf->shb_started= 0;
+            type= PCAPNG_SHB;
+            n= fread(hdr+4,1,4,cf->f) + 4;
+        } else {
+            n= fread(hdr,1,8,cf->f);
+            if (n == 0) return 0;
+            type= capfile_get32(cf,hdr);
+        }
+        if (n != 8) {
+            fprintf(stderr,"spade_replay: %s: truncated block header\n",cf->name);
+            return -1;
+        }
+
+        if (type == PCAPNG_SHB) {
+            /* the byte order magic tells us how to read the length of this block and everything in the section */
+            u8 bom[4];
+            if (fread(bom,1,4,cf->f) != 4) {
+                fprintf(stderr,"spade_replay: %s: truncated section header\n",cf->name);
+                return -1;
+            }
+            if (GET32(bom) == PCAPNG_BYTE_ORDER) {
+                cf->swapped= 0;
+            } else {
+                cf->swapped= 1;
+                if (capfile_get32(cf,bom) != PCAPNG_BYTE_ORDER) {
+                    fprintf(stderr,"spade_replay: %s: bad section header byte order\n",cf->name);
+                    return -1;
+                }
+            }
+            cf->num_ifaces= 0;
+            blocklen= capfile_get32(cf,hdr+4);
+            if (blocklen < 28 || (blocklen & 3) || blocklen > MAX_CAPLEN+1024
+                    || capfile_fill(cf,blocklen-12) == NULL) {
+                fprintf(stderr,"spade_replay: %s: bad section header\n",cf->name);
+                return -1;
+            }
+            continue;
+        }
+
+        blocklen= capfile_get32(cf,hdr+4);
+        if (blocklen < 12 || (blocklen & 3) || blocklen > MAX_CAPLEN+1024) {
+            fprintf(stderr,"spade_replay: %s: bad block length %lu\n",cf->name,(unsigned long)blocklen);
+            return -1;
+        }
+        body= capfile_fill(cf,blocklen-8);
+        if (body == NULL) {
+            fprintf(stderr,"spade_replay: %s: truncated block\n",cf->name);
+            return -1;
+        }
+        blocklen-= 12; /* now the length of the body */
+
+        switch (type) {
+        case PCAPNG_IDB:
+            capfile_read_idb(cf,body,blocklen);
+            continue;
+        case PCAPNG_EPB:
+            if (blocklen < 20) break;
+            iface= capfile_get32(cf,body);
+            caplen= capfile_get32(cf,body+12);
+            if (caplen > blocklen-20 || iface >= (u32)cf->num_ifaces) break;
+            p->ts= ((double)capfile_get32(cf,body+4)*4294967296.0 + capfile_get32(cf,body+8)) * cf->tsunit[iface];
+            p->data= body+20;
+            p->caplen= caplen;
+            p->linktype= cf->linktype[iface];
+            cf->last_ts= p->ts;
+            return 1;
+        case PCAPNG_PB:
+            if (blocklen < 20) break;
+            iface= capfile_get16(cf,body);
+            caplen= capfile_get32(cf,body+12);
+            if (caplen > blocklen-20 || iface >= (u32)cf->num_ifaces) break;
+            p->ts= ((double)capfile_get32(cf,body+4)*4294967296.0 + capfile_get32(cf,body+8)) * cf->tsunit[iface];
+            p->data= body+20;
+            p->caplen= caplen;
+            p->linktype= cf->linktype[iface];
+            cf->last_ts= p->ts;
+            return 1;
+        case PCAPNG_SPB:
+            /* no timestamp; treat it as arriving with the last packet */
+            if (blocklen < 4 || cf->num_ifaces == 0) break;
+            caplen= capfile_get32(cf,body);
+            if (caplen > blocklen-4) caplen= blocklen-4;
+            p->ts= cf->last_ts;
+            p->data= body+4;
+            p->caplen= caplen;
+            p->linktype= cf->linktype[0];
+            return 1;
+        default:
+            continue; /* a block we have no use for */
+        }
+        fprintf(stderr,"spade_replay: %s: bad packet block\n",cf->name);
+        return -1;
+    }
+}
+
+/* note the link type and timestamp resolution of a pcapng interface */
+static void capfile_read_idb(capfile *cf, const u8 *body, u32 len)
+{
+    int i= cf->num_ifaces;
+    u32 off;
+
+    if (len < 8 || i == MAX_IFACES) return;
+    cf->linktype[i]= capfile_get16(cf,body);
+    cf->tsunit[i]= 1e-6;
+    for (off= 8; off+4 <= len; ) {
+        u32 code= capfile_get16(cf,body+off);
+        u32 optlen= capfile_get16(cf,body+off+2);
+        if (code == 0 || off+4+optlen > len) break;
+        if (code == PCAPNG_IF_TSRESOL && optlen >= 1) {
+            u8 res= body[off+4];
+            double unit= 1;
+            int j;
+            for (j= res & 0x7F; j > 0; j--) unit/= (res & 0x80) ? 2 : 10;
+            cf->tsunit[i]= unit;
+        }
+        off+= 4 + ((optlen+3) & ~3);
+    }
+    cf->num_ifaces++;
+}
+
+/* read the next len bytes of the file into our buffer and return it, or NULL
+   if the file ends first */
+static u8 *capfile_fill(capfile *cf, u32 len)
+{
+    if (len > cf->bufsize) {
+        u8 *newbuf= (u8 *)realloc(cf->buf,len);
+        if (newbuf == NULL) {
+            fprintf(stderr,"spade_replay: out of memory!\n");
+            exit(2);
+        }
+        cf->buf= newbuf;
+        cf->bufsize= len;
+    }
+    if (len > 0 && fread(cf->buf,1,len,cf->f) != len) return NULL;
+    return cf->buf;
+}
+
+static u32 capfile_get16(capfile *cf, const u8 *p)
+{
+    return cf->swapped ? (u32)(p[1] << 8) | p[0] : GET16(p);
+}
+
+static u32 capfile_get32(capfile *cf, const u8 *p)
+{
+    return cf->swapped ? ((u32)p[3] << 24) | ((u32)p[2] << 16) | ((u32)p[1] << 8) | p[0] : GET32(p);
+}
+
+
+/*========================================================================*/
+/*========================= netspade callbacks ===========================*/
+/*========================================================================*/
+
+/* our netspade callback for when there is something anomalous to report */
+static void replay_report_anom(void *context, spade_report *rpt)
+{
+    replay *r= (replay *)context;
+    spade_event *pkt= rpt->pkt;
+    replay_pkt *rp= (replay_pkt *)pkt->native;
+    char sip[16],dip[16];
+
+    r->alerts++;
+    if (r->quiet) return;
+    printf("%.6f #%lu Spade: %s: %s: %.4f  %s:%lu -> %s:%lu proto %lu\n",
+        rp->ts,rp->frame,rpt->detect_type_str,rpt->scope_str,spade_report_mainscore(rpt),
+        ip_str(pkt->fldval[SIP],sip),(unsigned long)pkt->fldval[SPORT],
+        ip_str(pkt->fldval[DIP],dip),(unsigned long)pkt->fldval[DPORT],
+        (unsigned long)pkt->fldval[IPPROTO]);
+}
+
+/* our netspade callback for when there the threshold is adjusted */
+static void replay_report_thresh_changed(void *context, char *id, char *mess, int using_corrscore)
+{
+    replay *r= (replay *)context;
+
+    r->adjusts++;
+    if (r->quiet) return;
+    printf("Spade: id=%s: %s\n",id,mess);
+}
+
+static void replay_msg_fn(spade_message_type msg_type, const char *msg)
+{
+    /* messages about the configuration may not end in a newline */
+    const char *nl= (msg[0] != '\0' && msg[strlen(msg)-1] == '\n') ? "" : "\n";
+
+    switch (msg_type) {
+    case SPADE_MSG_TYPE_FATAL:
+        fprintf(stderr,"spade_replay: %s%s",msg,nl);
+        exit(1);
+    case SPADE_MSG_TYPE_WARNING:
+        fprintf(stderr,"spade_replay: %s%s",msg,nl);
+        break;
+    default:
+        if (replay_verbose) fprintf(stderr,"spade_replay: %s%s",msg,nl);
+        break;
+    }
+}
+
+/* netspade holds on to some packets while it waits to see a response */
+static void *replay_pkt_copy(void *native)
+{
+    replay_pkt *copy= (replay_pkt *)malloc(sizeof(replay_pkt));
+    if (copy == NULL) {
+        fprintf(stderr,"spade_replay: out of memory!\n");
+        exit(2);
+    }
+    *copy= *(replay_pkt *)native;
+    return copy;
+}
+
+static void replay_pkt_free(void *native)
+{
+    free(native);
+}
+
+static char *ip_str(u32 ip, char *buf)
+{
+    sprintf(buf,"%lu.%lu.%lu.%lu",(unsigned long)(ip >> 24),(unsigned long)((ip >> 16) & 0xFF),
+            (unsigned long)((ip >> 8) & 0xFF),(unsigned long)(ip & 0xFF));
+    return buf;
+}
+
+/*@}*/
+
+/* $Id$ */
@@ -27,7 +27,7 @@ warranty is expressed for this program.
 */
 
 /* creation and recycling routines for spade_report's */
-spade_report *spade_report_freelist=NULL;
+SPADE_THREAD_LOCAL spade_report *spade_report_freelist=NULL;
 
 spade_report *new_spade_report(spade_event *pkt,score_info *score, int detect_type, char *detectorid,const char *detect_type_str,char *scope_str,spade_pkt_stats *stream_stats,port_status_t port_status) {
     spade_report *new;
@@ -65,6 +65,15 @@ void free_spade_reports(spade_report *start) {
     spade_report_freelist= start;
 }
 
+/* return the spade_reports on this thread's free list to the system */
+void free_spade_report_freelist(void) {
+    spade_report *next;
+    for (; spade_report_freelist != NULL; spade_report_freelist= next) {
+        next= spade_report_freelist->next;
+        free(spade_report_freelist);
+    }
+}
+
 void port_status_set_file_print(port_status_set_t set,FILE *f) {
     int first= 1;
     int i;
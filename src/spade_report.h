@@ -141,6 +141,7 @@ typedef struct _spade_report {
 spade_report *new_spade_report(spade_event *pkt,score_info *score, int detect_type, char *detectorid,const char *detect_type_str,char *scope_str,spade_pkt_stats *stream_stats,port_status_t port_status);
 void free_spade_report(spade_report *rpt);
 void free_spade_reports(spade_report *rpt);
+void free_spade_report_freelist(void);
 
 #define spade_report_mainscore(rpt) (rpt != NULL ? score_info_mainscore(rpt->score) : NO_SCORE)
 #define spade_report_relscore(rpt) (rpt != NULL ? score_info_relscore(rpt->score) : NO_SCORE)
@@ -0,0 +1,105 @@
+/*********************************************************************
+spade_ring.c, distributed as part of Spade v030125.1
+Author: James Hoagland, Silicon Defense (hoagland@SiliconDefense.com)
+copyright (c) 2002 by Silicon Defense (http://www.silicondefense.com/)
+Released under GNU General Public License, see the COPYING file included
+with the distribution or http://www.silicondefense.com/spice/ for details.
+
+Please send complaints, kudos, and especially improvements and bugfixes to
+hoagland@SiliconDefense.com.  As described in GNU General Public License, no
+warranty is expressed for this program.
+*********************************************************************/
+
+/*! \file spade_ring.c
+ * \brief
+ *  contains the routines for spade_ring, a bounded queue that passes
+ *  items from one thread to another without locks
+ * \ingroup libspade_util
+ */
+
+/*! \addtogroup libspade_util
+    @{
+*/
+
+#include <stdlib.h>
+#include <sched.h>
+#include <unistd.h>
+#include "spade_ring.h"
+
+/* the count published by the other end is read with acquire semantics, so
+   the item contents written before it are seen, and our own count is
+   written with release semantics, so the other end sees what we did with
+   the slot first */
+#define RING_LOAD(var) __atomic_load_n(&(var),__ATOMIC_ACQUIRE)
+#define RING_STORE(var,val) __atomic_store_n(&(var),(val),__ATOMIC_RELEASE)
+
+static void spade_ring_wait(int *waits);
+
+/* set up a ring with room for nslots items of slot_size bytes; nslots is
+   rounded up to a power of 2.  Returns 0 if out of memory */
+int init_spade_ring(spade_ring *self,u32 nslots,size_t slot_size) {
+    u32 n= 1;
+    while (n < nslots) n<<= 1;
+
+    self->slots= (char *)malloc(n*slot_size);
+    if (self->slots == NULL) return 0;
+    self->slot_size= slot_size;
+    self->mask= n-1;
+    self->head= 0;
+    self->tail_seen= 0;
+    self->tail= 0;
+    self->head_seen= 0;
+    return 1;
+}
+
+void spade_ring_cleanup(spade_ring *self) {
+    free(self->slots);
+    self->slots= NULL;
+}
+
+/* (producer) return the slot for the next item, waiting until there is one free */
+void *spade_ring_claim(spade_ring *self) {
+    int waits= 0;
+    while (self->head - self->tail_seen > self->mask) {
+        self->tail_seen= RING_LOAD(self->tail);
+        if (self->head - self->tail_seen > self->mask) spade_ring_wait(&waits);
+    }
+    return self->slots + (self->head & self->mask)*self->slot_size;
+}
+
+/* (producer) pass on the item filled in the slot from spade_ring_claim() */
+void spade_ring_publish(spade_ring *self) {
+    RING_STORE(self->head,self->head+1);
+}
+
+/* (consumer) return the oldest item, waiting until there is one */
+void *spade_ring_next(spade_ring *self) {
+    int waits= 0;
+    while (self->head_seen == self->tail) {
+        self->head_seen= RING_LOAD(self->head);
+        if (self->head_seen == self->tail) spade_ring_wait(&waits);
+    }
+    return self->slots + (self->tail & self->mask)*self->slot_size;
+}
+
+/* (consumer) be done with the item from spade_ring_next(), freeing its slot */
+void spade_ring_consume(spade_ring *self) {
+    RING_STORE(self->tail,self->tail+1);
+}
+
+/* wait a little for the other end of a ring; the first few times we just
+   spin, then we give up the processor, and after that we sleep, so an
+   idle ring does not keep a processor busy */
+static void spade_ring_wait(int *waits) {
+    (*waits)++;
+    if (*waits < 64) return;
+    if (*waits < 256) {
+        sched_yield();
+    } else {
+        usleep(50);
+    }
+}
+
+/*@}*/
+
+/* $Id$ */
@@ -0,0 +1,62 @@
+/*********************************************************************
+spade_ring.h, distributed as part of Spade v030125.1
+Author: James Hoagland, Silicon Defense (hoagland@SiliconDefense.com)
+copyright (c) 2002 by Silicon Defense (http://www.silicondefense.com/)
+Released under GNU General Public License, see the COPYING file included
+with the distribution or http://www.silicondefense.com/spice/ for details.
+
+Please send complaints, kudos, and especially improvements and bugfixes to
+hoagland@SiliconDefense.com.  As described in GNU General Public License, no
+warranty is expressed for this program.
+*********************************************************************/
+
+#ifndef SPADE_RING_H
+#define SPADE_RING_H
+
+/*! \file spade_ring.h
+ * \brief
+ *  spade_ring.h is the header file for spade_ring.c
+ * \ingroup libspade_util
+ */
+
+/*! \addtogroup libspade_util
+    @{
+*/
+
+#include "spade_features.h"
+#include <stddef.h>
+
+/// the size we assume a cache line is, to keep the two ends of a spade_ring apart
+#define SPADE_RING_LINE 64
+
+/// a bounded queue of fixed size items, passed from one thread to one other without locking
+/** The producer fills a slot got from spade_ring_claim() and hands it
+    over with spade_ring_publish(); the consumer gets the oldest item with
+    spade_ring_next() and gives its slot back with spade_ring_consume().
+    Each call that needs a slot or an item waits for one. */
+typedef struct {
+    char *slots; ///< the storage for the items
+    size_t slot_size; ///< the size of each item
+    u32 mask; ///< the number of slots less one; the number of slots is a power of 2
+
+    char pad0[SPADE_RING_LINE];
+    u32 head; ///< the count of items published; only the producer writes this
+    u32 tail_seen; ///< the producer's last look at tail
+    char pad1[SPADE_RING_LINE];
+    u32 tail; ///< the count of items consumed; only the consumer writes this
+    u32 head_seen; ///< the consumer's last look at head
+    char pad2[SPADE_RING_LINE];
+} spade_ring;
+
+int init_spade_ring(spade_ring *self, u32 nslots, size_t slot_size);
+void spade_ring_cleanup(spade_ring *self);
+
+void *spade_ring_claim(spade_ring *self);
+void spade_ring_publish(spade_ring *self);
+void *spade_ring_next(spade_ring *self);
+void spade_ring_consume(spade_ring *self);
+
+/*@}*/
+#endif  /* ! SPADE_RING_H */
+
+/* $Id$ */
@@ -25,12 +25,40 @@ warranty is expressed for this program.
 #include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#ifndef SPADE_NO_MMAP
+#include <sys/mman.h>
+#endif
+#ifdef SPADE_USE_ZLIB
+#include <zlib.h>
+#endif
 
 #include "spade_features.h"
 #include "spade_prob_table_types.h"
 #include "spade_state.h"
 
-#define CUR_FVERS 5
+#include <string.h>
+
+#define CUR_FVERS 9
+/* format version 6 moved the node arena from the file header to each table */
+#define FIRST_PER_TABLE_ARENA_FVERS 6
+/* format version 7 put the header of each arena before its node blocks and
+   started each block on a page boundary, so the blocks can be mapped in place */
+#define FIRST_PAGED_ARENA_FVERS 7
+/* format version 8 gave each checkpoint a stamp and each arena an id, so
+   that delta checkpoints can say which checkpoint and arenas they follow on */
+#define FIRST_STAMPED_FVERS 8
+/* format version 9 let the node blocks of an arena be stored compressed */
+#define FIRST_ENCODED_FVERS 9
+
+/// round off up to the next multiple of align
+#define ALIGN_UP(off,align) ((((off)+(align)-1)/(align))*(align))
+
+/// the most bytes the built-in codec can take to encode a block of that many bytes
+#define PACKED_BOUND(bytes) (((bytes)/4)*5+8)
 
 /// treeroot structure used in file checkpoint version 4 and earlier
 typedef struct {
@@ -39,23 +67,140 @@ typedef struct {
     features type;///< the feature that is being represented in this tree
 } upto_v4_treeroot;
 
+/// treeroot structure used in file checkpoint version 5
+typedef struct {
+    mindex next;      ///< the next tree root in a list
+    dmindex root;     ///< root node of the tree, if top bit is 1, it is a leafnode, otherwise it is a interior node
+    features type;    ///< the feature that is being represented in this tree
+    double entropy;   ///< the last calculated entropy in this tree; < 0 if it has not been calculated
+    u16 entropy_wait; ///< the number of additions to the tree to wait till recalculating the entropy
+} v5_treeroot;
+
+/* the layouts of the count bearing nodes; a version 6 file records which of these its arenas use */
+#define NODE_LAYOUT_FULL    0 ///< intnodes and leafnodes as in builds without SPADE_COMPACT_NODES, and in all files before version 6
+#define NODE_LAYOUT_COMPACT 1 ///< intnodes and leafnodes as in builds with SPADE_COMPACT_NODES
+#ifdef SPADE_COMPACT_NODES
+#define NATIVE_NODE_LAYOUT NODE_LAYOUT_COMPACT
+
+/// intnode structure in the full layout
+typedef struct {
+    double sum;
+    valtype sortpt;
+    dmindex left;
+    dmindex right;
+    u16 wait;
+} full_intnode;
+
+/// leafnode structure in the full layout
+typedef struct {
+    double count;
+    valtype value;
+    mindex nexttree;
+} full_leafnode;
+
+#define FOREIGN_INTNODE_BYTES sizeof(full_intnode) ///< the file space taken by an intnode in the other layout
+#define FOREIGN_LEAFNODE_BYTES sizeof(full_leafnode) ///< the file space taken by a leafnode in the other layout
+#else
+#define NATIVE_NODE_LAYOUT NODE_LAYOUT_FULL
+
+/// the part of an intnode needed for searching, in the compact layout
+typedef struct {
+    valtype sortpt;
+    dmindex left;
+    dmindex right;
+} compact_intnode;
+
+/// the rest of an intnode, in the compact layout
+typedef struct {
+    float sum;
+    u16 wait;
+} compact_intnode_cold;
+
+/// leafnode structure in the compact layout
+typedef struct {
+    float count;
+    valtype value;
+    mindex nexttree;
+} compact_leafnode;
+
+#define FOREIGN_INTNODE_BYTES (sizeof(compact_intnode)+sizeof(compact_intnode_cold)) ///< the file space taken by an intnode in the other layout
+#define FOREIGN_LEAFNODE_BYTES sizeof(compact_leafnode) ///< the file space taken by a leafnode in the other layout
+#endif
+
+static int recover_int_block(statefile_ref *s, spade_mem_arena *a, unsigned int b, u8 layout);
+static int recover_leaf_block(statefile_ref *s, spade_mem_arena *a, unsigned int b, u8 layout);
+static int recover_paged_mem_arena(statefile_ref *s, spade_mem_arena *a, u8 layout, u32 align);
+#ifdef SPADE_COMPACT_NODES
+static int peek_unpaged_decay(statefile_ref *s, u8 layout, double *decay);
+static void apply_translated_decay(spade_mem_arena *a);
+#endif
+static int recover_delta_mem_arena(statefile_ref *s, spade_mem_arena **ap);
+static int recover_paged_block(statefile_ref *s, long off, void **block, size_t size, size_t n);
+static int patch_blocks(statefile_ref *s, void **blocks, size_t size, void **cold, size_t coldsize, u32 nblocks, size_t n, u32 align);
+static int read_block_encoding(statefile_ref *s);
+static int checkpoint_blocks(statefile_ref *s, void **blocks, size_t size, void **cold, size_t coldsize, u32 *dirty, u32 nblocks, size_t n, u32 align);
+static size_t block_fwrite(void *ptr, size_t size, size_t n, statefile_ref *s);
+static size_t block_fread(void *ptr, size_t size, size_t n, statefile_ref *s);
+static int ensure_codebuf(statefile_ref *s, unsigned long size);
+static unsigned long pack_words(unsigned char *src, unsigned long bytes, size_t stride, unsigned char *dst);
+static int unpack_words(unsigned char *src, unsigned long len, unsigned char *dst, unsigned long bytes, size_t stride);
+static void pad_to_alignment(statefile_ref *s, u32 align);
+static u32 file_page_size(void);
+
 
+/* start writing a full checkpoint to filename */
 statefile_ref *spade_state_begin_checkpointing(char *filename,char *appname,u8 app_cur_fvers) {
+    return spade_state_begin_stamped_checkpointing(filename,appname,app_cur_fvers,spade_state_new_stamp(),0);
+}
+
+/* start writing a checkpoint with the given stamp to filename; if
+   prev_stamp is not 0, this is a delta checkpoint, which has only the node
+   blocks changed since the checkpoint with that stamp */
+statefile_ref *spade_state_begin_stamped_checkpointing(char *filename,char *appname,u8 app_cur_fvers,u32 stamp,u32 prev_stamp) {
     statefile_ref *s= (statefile_ref *)malloc(sizeof(statefile_ref));
     char v='v';
     u8 fvers= CUR_FVERS,uc;
     double d= 1234.56789;
     u32 l= 0x01020304;
-    u32 i,blocks_used;
     u8 numfeat= MAX_NUM_FEATURES;
+    struct stat st;
+
+    if (s == NULL) return NULL;
+    s->filename= NULL;
+    s->tmpname= NULL;
+    s->legacy_arena= NULL;
+    s->stamp= stamp;
+    s->prev_stamp= prev_stamp;
+    s->prior_arenas= NULL;
+    s->num_prior_arenas= 0;
+    s->encoding= SPADE_STATE_ENC_RAW;
+    s->codebuf= NULL;
+    s->codebuf_size= 0;
+    /* a regular file is written under a temporary name and then renamed, so
+       that the file is never seen half written and so that the blocks of a
+       run recovered from it, which may be mapped from it, stay intact */
+    if (stat(filename,&st) != 0 || S_ISREG(st.st_mode)) {
+        s->filename= strdup(filename);
+        s->tmpname= (char *)malloc(strlen(filename)+5);
+        if (s->filename == NULL || s->tmpname == NULL) {
+            free(s->filename);
+            free(s->tmpname);
+            free(s);
+            return NULL;
+        }
+        sprintf(s->tmpname,"%s.tmp",filename);
+    }
 
     errno=0;
-    s->f= fopen(filename,"wb");
+    s->f= fopen(s->tmpname != NULL ? s->tmpname : filename,"wb");
     if (errno) {
-        perror(filename);
+        perror(s->tmpname != NULL ? s->tmpname : filename);
+        free(s->filename);
+        free(s->tmpname);
         free(s);
         return NULL;
     }
+    s->fvers= fvers;
 
     fwrite(&v,sizeof(v),1,s->f);
     fwrite(&fvers,1,1,s->f);
@@ -75,42 +220,61 @@ statefile_ref *spade_state_begin_checkpointing(char *filename,char *appname,u8 a
     fwrite(&d,sizeof(d),1,s->f);
 
     fwrite(&numfeat,sizeof(numfeat),1,s->f);
+    fwrite(&stamp,sizeof(stamp),1,s->f);
+    fwrite(&prev_stamp,sizeof(prev_stamp),1,s->f);
 
-    /* write out tree library state */
-        /* treeroot type state */
-    fwrite(&ROOT_BLOCK_BITS,sizeof(ROOT_BLOCK_BITS),1,s->f);
-    for (blocks_used= 0; ROOT_M[blocks_used] != NULL; blocks_used++) {}
-    fwrite(&blocks_used,sizeof(blocks_used),1,s->f);
-    for (i= 0; i < blocks_used; i++) {
-        fwrite(ROOT_M[i],sizeof(treeroot),ROOT_BLOCK_SIZE,s->f);
-    }
-    fwrite(&root_freelist,sizeof(root_freelist),1,s->f);
-
-        /* intnode type state */
-    fwrite(&INT_BLOCK_BITS,sizeof(INT_BLOCK_BITS),1,s->f);
-    for (blocks_used= 0; INT_M[blocks_used] != NULL; blocks_used++) {}
-    fwrite(&blocks_used,sizeof(blocks_used),1,s->f);
-    for (i= 0; i < blocks_used; i++) {
-        fwrite(INT_M[i],sizeof(intnode),INT_BLOCK_SIZE,s->f);
-    }
-    fwrite(&int_freelist,sizeof(int_freelist),1,s->f);
+    return s;
+}
 
-        /* leafnode type state */
-    fwrite(&LEAF_BLOCK_BITS,sizeof(LEAF_BLOCK_BITS),1,s->f);
-    for (blocks_used= 0; LEAF_M[blocks_used] != NULL; blocks_used++) {}
-    fwrite(&blocks_used,sizeof(blocks_used),1,s->f);
-    for (i= 0; i < blocks_used; i++) {
-        fwrite(LEAF_M[i],sizeof(leafnode),LEAF_BLOCK_SIZE,s->f);
-    }
-    fwrite(&leaf_freelist,sizeof(leaf_freelist),1,s->f);
+/* return a new (nonzero) stamp to identify a checkpoint by */
+u32 spade_state_new_stamp() {
+    static SPADE_THREAD_LOCAL u32 made= 0;
+    struct timeval tv;
+    u32 stamp;
+    gettimeofday(&tv,NULL);
+    stamp= ((u32)tv.tv_sec*2654435761U) ^ ((u32)tv.tv_usec << 12) ^ ((u32)getpid() << 22) ^ ++made;
+    return stamp ? stamp : 1;
+}
 
-    return s;
+/* have the node blocks of the arenas checkpointed from here on stored in
+   the given encoding; SPADE_STATE_ENC_RAW (the default) lets them be mapped
+   on recovery, while the others make the file smaller */
+void spade_state_set_encoding(statefile_ref *s,u8 encoding) {
+    s->encoding= encoding;
 }
 
 int spade_state_end_checkpointing(statefile_ref *s) {
+    int res= 1;
+    if (fclose(s->f) != 0) {
+        perror(s->tmpname != NULL ? s->tmpname : "Spade state file");
+        res= 0;
+    }
+    if (s->tmpname != NULL) {
+        if (res && rename(s->tmpname,s->filename) != 0) {
+            perror(s->filename);
+            res= 0;
+        }
+        if (!res) remove(s->tmpname);
+        free(s->tmpname);
+        free(s->filename);
+    }
+    free(s->codebuf);
+    free(s);
+    return res;
+}
+
+/* give up on the checkpoint being written, after a failure part way through;
+   the file written under a temporary name is removed, so the last good
+   checkpoint stays in place */
+void spade_state_abort_checkpointing(statefile_ref *s) {
     fclose(s->f);
+    if (s->tmpname != NULL) {
+        remove(s->tmpname);
+        free(s->tmpname);
+        free(s->filename);
+    }
+    free(s->codebuf);
     free(s);
-    return 1;
 }
 
 int spade_state_checkpoint_str(statefile_ref *s,char *str) {
@@ -157,6 +321,244 @@ int spade_state_end_section(statefile_ref *s) {
     return 1;
 }
 
+/* the format version 8 layout of an arena is its header, with the block
+   size, number of blocks, and freelist of each kind of node, followed by the
+   blocks; each block starts and ends on a multiple of the page size the
+   header records.  In a delta checkpoint, the blocks of each kind are only
+   those marked dirty, preceded by a list of their indices.  If the header
+   gives an encoding other than SPADE_STATE_ENC_RAW, each block (and its
+   cold part) is instead an encoded frame, with no padding */
+int spade_state_checkpoint_mem_arena(statefile_ref *s,spade_mem_arena *a) {
+    u32 align= file_page_size();
+    u32 root_blocks,int_blocks,leaf_blocks,bnode_blocks,dnode_blocks;
+    u8 layout= NATIVE_NODE_LAYOUT;
+    double mem_used= a->mem_used;
+    
+    for (root_blocks= 0; root_blocks < a->max_root_blocks && a->root_m[root_blocks] != NULL; root_blocks++) {}
+    for (int_blocks= 0; int_blocks < a->max_int_blocks && a->int_m[int_blocks] != NULL; int_blocks++) {}
+    for (leaf_blocks= 0; leaf_blocks < a->max_leaf_blocks && a->leaf_m[leaf_blocks] != NULL; leaf_blocks++) {}
+    for (bnode_blocks= 0; bnode_blocks < a->max_bnode_blocks && a->bnode_m[bnode_blocks] != NULL; bnode_blocks++) {}
+    for (dnode_blocks= 0; dnode_blocks < a->max_dnode_blocks && a->dnode_m[dnode_blocks] != NULL; dnode_blocks++) {}
+
+    fwrite(&layout,sizeof(layout),1,s->f);
+    fwrite(&a->keep_clogc,sizeof(a->keep_clogc),1,s->f); /* whether the clogc of the trees are current */
+    fwrite(&align,sizeof(align),1,s->f);
+    fwrite(&a->id,sizeof(a->id),1,s->f);
+    fwrite(&s->encoding,sizeof(s->encoding),1,s->f);
+    
+    fwrite(&a->root_block_bits,sizeof(a->root_block_bits),1,s->f);
+    fwrite(&root_blocks,sizeof(root_blocks),1,s->f);
+    fwrite(&a->root_freelist,sizeof(a->root_freelist),1,s->f);
+    fwrite(&a->int_block_bits,sizeof(a->int_block_bits),1,s->f);
+    fwrite(&int_blocks,sizeof(int_blocks),1,s->f);
+    fwrite(&a->int_freelist,sizeof(a->int_freelist),1,s->f);
+    fwrite(&a->leaf_block_bits,sizeof(a->leaf_block_bits),1,s->f);
+    fwrite(&leaf_blocks,sizeof(leaf_blocks),1,s->f);
+    fwrite(&a->leaf_freelist,sizeof(a->leaf_freelist),1,s->f);
+    fwrite(&a->bnode_block_bits,sizeof(a->bnode_block_bits),1,s->f);
+    fwrite(&bnode_blocks,sizeof(bnode_blocks),1,s->f);
+    fwrite(&a->bnode_freelist,sizeof(a->bnode_freelist),1,s->f);
+    fwrite(&a->dnode_block_bits,sizeof(a->dnode_block_bits),1,s->f);
+    fwrite(&dnode_blocks,sizeof(dnode_blocks),1,s->f);
+    fwrite(&a->dnode_freelist,sizeof(a->dnode_freelist),1,s->f);
+    fwrite(&a->decay,sizeof(a->decay),1,s->f);
+    fwrite(&mem_used,sizeof(mem_used),1,s->f);
+
+    return checkpoint_blocks(s,(void **)a->root_m,sizeof(treeroot),NULL,0,a->root_dirty,root_blocks,bits2blocksize(a->root_block_bits),align)
+#ifdef SPADE_COMPACT_NODES
+        && checkpoint_blocks(s,(void **)a->int_m,sizeof(intnode),(void **)a->intc_m,sizeof(intnode_cold),a->int_dirty,int_blocks,bits2blocksize(a->int_block_bits),align)
+#else
+        && checkpoint_blocks(s,(void **)a->int_m,sizeof(intnode),NULL,0,a->int_dirty,int_blocks,bits2blocksize(a->int_block_bits),align)
+#endif
+        && checkpoint_blocks(s,(void **)a->leaf_m,sizeof(leafnode),NULL,0,a->leaf_dirty,leaf_blocks,bits2blocksize(a->leaf_block_bits),align)
+        && checkpoint_blocks(s,(void **)a->bnode_m,sizeof(bnode),NULL,0,a->bnode_dirty,bnode_blocks,bits2blocksize(a->bnode_block_bits),align)
+        && checkpoint_blocks(s,(void **)a->dnode_m,sizeof(dnode),NULL,0,a->dnode_dirty,dnode_blocks,bits2blocksize(a->dnode_block_bits),align);
+}
+
+/* write nblocks blocks of n nodes of the given size each, each followed by
+   its cold part (of n coldsize parts) if cold is not NULL and padded to
+   align; for a delta checkpoint, write only those marked in the dirty map,
+   after a list of which those are.  Returns 0 if a block could not be
+   written (out of memory to encode it in, or a short write) */
+static int checkpoint_blocks(statefile_ref *s,void **blocks,size_t size,void **cold,size_t coldsize,u32 *dirty,u32 nblocks,size_t n,u32 align) {
+    u32 i,count;
+    int delta= (s->prev_stamp != 0);
+    
+    if (delta) {
+        for (i= 0,count= 0; i < nblocks; i++) if (BLOCK_IS_DIRTY(dirty,i)) count++;
+        fwrite(&count,sizeof(count),1,s->f);
+        for (i= 0; i < nblocks; i++) if (BLOCK_IS_DIRTY(dirty,i)) fwrite(&i,sizeof(i),1,s->f);
+    }
+    if (s->encoding == SPADE_STATE_ENC_RAW) pad_to_alignment(s,align);
+    for (i= 0; i < nblocks; i++) {
+        if (delta && !BLOCK_IS_DIRTY(dirty,i)) continue;
+        if (block_fwrite(blocks[i],size,n,s) != n) return 0;
+        if (cold != NULL && block_fwrite(cold[i],coldsize,n,s) != n) return 0;
+        if (s->encoding == SPADE_STATE_ENC_RAW) pad_to_alignment(s,align);
+    }
+    return 1;
+}
+
+/* write the n nodes of the given size at ptr, as is or, if the arena's
+   blocks are encoded, as a frame: the length of the encoded nodes followed by
+   them.  Returns n on success, like fwrite() */
+static size_t block_fwrite(void *ptr,size_t size,size_t n,statefile_ref *s) {
+    unsigned long bytes= size*n,len;
+    u32 framelen;
+    
+    if (s->encoding == SPADE_STATE_ENC_RAW) return fwrite(ptr,size,n,s->f);
+#ifdef SPADE_USE_ZLIB
+    if (s->encoding == SPADE_STATE_ENC_ZLIB) {
+        uLongf zlen= compressBound(bytes);
+        if (!ensure_codebuf(s,zlen)) return 0;
+        if (compress2(s->codebuf,&zlen,(Bytef *)ptr,bytes,Z_BEST_SPEED) != Z_OK) return 0;
+        len= zlen;
+    } else
+#endif
+    {
+        if (!ensure_codebuf(s,PACKED_BOUND(bytes))) return 0;
+        len= pack_words((unsigned char *)ptr,bytes,size,s->codebuf);
+    }
+    framelen= len;
+    if (fwrite(&framelen,sizeof(framelen),1,s->f) != 1) return 0;
+    return fwrite(s->codebuf,1,len,s->f) == len ? n : 0;
+}
+
+/* read n nodes of the given size into ptr, from the file as is or, if the
+   arena's blocks are encoded, from the next frame, which must decode to
+   exactly that.  Returns n on success, like fread() */
+static size_t block_fread(void *ptr,size_t size,size_t n,statefile_ref *s) {
+    unsigned long bytes= size*n;
+    u32 framelen;
+    
+    if (s->encoding == SPADE_STATE_ENC_RAW) return fread(ptr,size,n,s->f);
+    if (fread(&framelen,sizeof(framelen),1,s->f) != 1) return 0;
+    if (framelen > PACKED_BOUND(bytes)+bytes/8+64) return 0; /* longer than any encoding of it */
+    if (!ensure_codebuf(s,framelen)) return 0;
+    if (fread(s->codebuf,1,framelen,s->f) != framelen) return 0;
+#ifdef SPADE_USE_ZLIB
+    if (s->encoding == SPADE_STATE_ENC_ZLIB) {
+        uLongf zlen= bytes;
+        if (uncompress((Bytef *)ptr,&zlen,s->codebuf,framelen) != Z_OK || zlen != bytes) return 0;
+        return n;
+    }
+#endif
+    return unpack_words(s->codebuf,framelen,(unsigned char *)ptr,bytes,size) ? n : 0;
+}
+
+/* make the buffer for encoded blocks at least size bytes; returns 0 if out of memory */
+static int ensure_codebuf(statefile_ref *s,unsigned long size) {
+    unsigned char *buf;
+    if (size <= s->codebuf_size) return 1;
+    buf= (unsigned char *)realloc(s->codebuf,size);
+    if (buf == NULL) return 0;
+    s->codebuf= buf;
+    s->codebuf_size= size;
+    return 1;
+}
+
+/* the built-in codec (SPADE_STATE_ENC_PACKED) takes a block as 32 bit
+   words and stores, for each, the difference from the word one node before
+   it as a zigzag varint (7 bits a byte, low bits first, the top bit set if
+   more follow).  A run of words that are the same as one node before is
+   stored as a 0 byte and then the length of the run as a varint.  Nodes next
+   to each other tend to have close indices, values, and counts, and the
+   nodes not yet used in a block are all alike, so this takes much less room
+   than the block does.  Any bytes past the last whole word are stored as is */
+
+/* encode a block of bytes at src, made of nodes of stride bytes, into dst, which must have room for PACKED_BOUND(bytes); returns the length of the encoding */
+static unsigned long pack_words(unsigned char *src,unsigned long bytes,size_t stride,unsigned char *dst) {
+    unsigned long i,nwords= bytes/4,back= stride/4,run= 0,len= 0;
+    u32 w,prev,zz;
+    
+    if (back == 0) back= 1;
+    for (i= 0; i < nwords; i++) {
+        memcpy(&w,src+4*i,4);
+        if (i >= back) memcpy(&prev,src+4*(i-back),4);
+        else prev= 0;
+        w-= prev;
+        zz= (w << 1) ^ (0-(w >> 31));
+        if (zz == 0) {
+            run++;
+            continue;
+        }
+        if (run) {
+            dst[len++]= 0;
+            for (; run >= 0x80; run >>= 7) dst[len++]= (unsigned char)(run | 0x80);
+            dst[len++]= (unsigned char)run;
+            run= 0;
+        }
+        for (; zz >= 0x80; zz >>= 7) dst[len++]= (unsigned char)(zz | 0x80);
+        dst[len++]= (unsigned char)zz;
+    }
+    if (run) {
+        dst[len++]= 0;
+        for (; run >= 0x80; run >>= 7) dst[len++]= (unsigned char)(run | 0x80);
+        dst[len++]= (unsigned char)run;
+    }
+    memcpy(dst+len,src+4*nwords,bytes-4*nwords);
+    return len+bytes-4*nwords;
+}
+
+/// read a varint at src[pos] (with len bytes in src) into var, advancing pos; returns 0 from the enclosing function if it is cut off or too long
+#define VARINT_READ(var) { \
+        int shift; \
+        (var)= 0; \
+        for (shift= 0; ; shift+= 7) { \
+            if (pos >= len || shift > 28) return 0; \
+            (var)|= (u32)(src[pos] & 0x7f) << shift; \
+            if (!(src[pos++] & 0x80)) break; \
+        } \
+    }
+
+/* decode the len bytes at src, as made by pack_words() from nodes of stride bytes, into the bytes bytes at dst; returns 0 if it does not decode to exactly that */
+static int unpack_words(unsigned char *src,unsigned long len,unsigned char *dst,unsigned long bytes,size_t stride) {
+    unsigned long i,nwords= bytes/4,back= stride/4,pos= 0;
+    u32 w,prev,zz,run;
+    
+    if (back == 0) back= 1;
+    for (i= 0; i < nwords; ) {
+        VARINT_READ(zz);
+        if (zz == 0) { /* a run of words the same as one node back */
+            VARINT_READ(run);
+            if (run == 0 || run > nwords-i) return 0;
+            for (; run > 0; run--,i++) {
+                if (i >= back) memcpy(dst+4*i,dst+4*(i-back),4);
+                else memset(dst+4*i,0,4);
+            }
+        } else {
+            w= (zz >> 1) ^ (0-(zz & 1));
+            if (i >= back) {
+                memcpy(&prev,dst+4*(i-back),4);
+                w+= prev;
+            }
+            memcpy(dst+4*i,&w,4);
+            i++;
+        }
+    }
+    if (len-pos != bytes-4*nwords) return 0;
+    memcpy(dst+4*nwords,src+pos,bytes-4*nwords);
+    return 1;
+}
+
+/* write zeros to the file up to the next multiple of align bytes */
+static void pad_to_alignment(statefile_ref *s,u32 align) {
+    static const char zeros[256]= {0};
+    long pos= ftell(s->f);
+    unsigned long pad,n;
+    if (pos < 0) return; /* not a regular file; no use in padding */
+    for (pad= ALIGN_UP(pos,align)-pos; pad > 0; pad-= n) {
+        n= pad > sizeof(zeros) ? sizeof(zeros) : pad;
+        fwrite(zeros,1,n,s->f);
+    }
+}
+
+/* the alignment to give node blocks in the file; this is the page size, but at least 4096 */
+static u32 file_page_size() {
+    long pagesize= sysconf(_SC_PAGESIZE);
+    return pagesize < 4096 ? 4096 : (u32)pagesize;
+}
+
 #define PREMATURE_END_CHECK(count,minsize) if (count < minsize) { \
         fprintf(stderr,"Premature end in Spade recovery file %s; not recovering from it\n",filename); \
         fclose(s->f); \
@@ -171,18 +573,648 @@ int spade_state_end_section(statefile_ref *s) {
     }
 
 
+#define ARENA_PREMATURE_END_CHECK(count,minsize) if (count < minsize) { \
+        fprintf(stderr,"Premature end in Spade recovery file %s; not recovering from it\n",s->filename); \
+        return 0; \
+    }
+
+#define ARENA_CORRUPT_FILE_CHECK(testres,whatwentwrong) \
+    if (testres) { \
+        fprintf(stderr,"Corrupt Spade recovery file %s: %s; not recovering from it\n",s->filename,whatwentwrong); \
+        return 0; \
+    }
+
+/* read the state of a node arena from the file into the given, freshly
+   created, arena; returns 0 on failure */
+static int recover_mem_arena(statefile_ref *s,spade_mem_arena *a) {
+    unsigned int i,blocks_used;
+    int count;
+    u8 layout= NODE_LAYOUT_FULL;
+    u32 align,id;
+
+    if (s->fvers >= FIRST_PER_TABLE_ARENA_FVERS) {
+        count= fread(&layout,sizeof(layout),1,s->f);
+        ARENA_PREMATURE_END_CHECK(count,1);
+        ARENA_CORRUPT_FILE_CHECK(layout != NODE_LAYOUT_FULL && layout != NODE_LAYOUT_COMPACT,"stored node layout is not known");
+        if (s->fvers >= FIRST_PAGED_ARENA_FVERS) {
+            count= fread(&a->keep_clogc,sizeof(a->keep_clogc),1,s->f);
+            if (count == 1) count= fread(&align,sizeof(align),1,s->f);
+            if (count == 1 && s->fvers >= FIRST_STAMPED_FVERS) {
+                count= fread(&id,sizeof(id),1,s->f);
+                if (count == 1) spade_mem_arena_set_id(a,id);
+            }
+            ARENA_PREMATURE_END_CHECK(count,1);
+            if (!read_block_encoding(s)) return 0;
+            if (!recover_paged_mem_arena(s,a,layout,align)) return 0;
+#ifdef SPADE_COMPACT_NODES
+            if (layout != NATIVE_NODE_LAYOUT) apply_translated_decay(a);
+#endif
+            return 1;
+        }
+#ifdef SPADE_COMPACT_NODES
+        /* the counts are scaled by the decay as they are translated, and it comes after them here */
+        if (layout != NATIVE_NODE_LAYOUT && !peek_unpaged_decay(s,layout,&a->decay)) return 0;
+#endif
+    }
+
+    count= fread(&a->root_block_bits,sizeof(a->root_block_bits),1,s->f);
+    ARENA_PREMATURE_END_CHECK(count,1);
+    ARENA_CORRUPT_FILE_CHECK(a->root_block_bits < 3,"stored ROOT_BLOCK_BITS is too small");
+    
+    /* use the max block size for this run unless there is more stored in the file */
+    count= fread(&blocks_used,sizeof(blocks_used),1,s->f);
+    ARENA_PREMATURE_END_CHECK(count,1);
+    if (blocks_used > a->max_root_blocks) {
+        if (!reallocate_ptr_array((void ***)&a->root_m,a->max_root_blocks,blocks_used)) return 0;
+        a->max_root_blocks= blocks_used;
+    }
+    
+    if (s->fvers >= FIRST_PER_TABLE_ARENA_FVERS) { // can read block of treeroots directly
+        for (i= 0; i < blocks_used; i++) {
+            a->root_m[i]= (treeroot *)malloc(sizeof(treeroot)*bits2blocksize(a->root_block_bits));
+            count= fread(a->root_m[i],sizeof(treeroot),bits2blocksize(a->root_block_bits),s->f);
+            ARENA_PREMATURE_END_CHECK(count,bits2blocksize(a->root_block_bits));
+        }
+    } else if (s->fvers == 5) { // need to translate treeroot struct from v5_treeroot to treeroot
+        int j;
+        v5_treeroot *origblock= (v5_treeroot *)malloc(sizeof(v5_treeroot)*bits2blocksize(a->root_block_bits));
+        for (i= 0; i < blocks_used; i++) {
+            a->root_m[i]= (treeroot *)malloc(sizeof(treeroot)*bits2blocksize(a->root_block_bits));
+            count= fread(origblock,sizeof(v5_treeroot),bits2blocksize(a->root_block_bits),s->f);
+            ARENA_PREMATURE_END_CHECK(count,bits2blocksize(a->root_block_bits));
+            for (j=0; j < bits2blocksize(a->root_block_bits); j++) {
+                a->root_m[i][j].next= origblock[j].next;
+                a->root_m[i][j].root= origblock[j].root;
+                a->root_m[i][j].type= origblock[j].type;
+                a->root_m[i][j].nvals= 0; /* these are recalculated as the trees are copied out */
+                a->root_m[i][j].clogc= 0.0;
+            }
+        }
+        free(origblock);
+    } else { // need to translate treeroot struct from treeroot_orig to treeroot
+        int j;
+        upto_v4_treeroot *origblock= (upto_v4_treeroot *)malloc(sizeof(upto_v4_treeroot)*bits2blocksize(a->root_block_bits));
+        for (i= 0; i < blocks_used; i++) {
+            a->root_m[i]= (treeroot *)malloc(sizeof(treeroot)*bits2blocksize(a->root_block_bits));
+            count= fread(origblock,sizeof(upto_v4_treeroot),bits2blocksize(a->root_block_bits),s->f);
+            ARENA_PREMATURE_END_CHECK(count,bits2blocksize(a->root_block_bits));
+            for (j=0; j < bits2blocksize(a->root_block_bits); j++) {
+                // look at original structure and initialize new from it
+                a->root_m[i][j].next= origblock[j].next;
+                a->root_m[i][j].root= origblock[j].root;
+                a->root_m[i][j].type= origblock[j].type;
+                a->root_m[i][j].nvals= 0; /* these are recalculated as the trees are copied out */
+                a->root_m[i][j].clogc= 0.0;
+            }
+        }
+        free(origblock);
+    }
+
+    count= fread(&a->root_freelist,sizeof(a->root_freelist),1,s->f);
+    ARENA_PREMATURE_END_CHECK(count,1);
+    
+    
+    count= fread(&a->int_block_bits,sizeof(a->int_block_bits),1,s->f);
+    ARENA_PREMATURE_END_CHECK(count,1);
+    ARENA_CORRUPT_FILE_CHECK(a->int_block_bits < 3,"stored INT_BLOCK_BITS is too small");
+    
+    /* use the max block size for this run unless there is more stored in the file */
+    count= fread(&blocks_used,sizeof(blocks_used),1,s->f);
+    ARENA_PREMATURE_END_CHECK(count,1);
+    if (blocks_used > a->max_int_blocks) {
+        if (!reallocate_ptr_array((void ***)&a->int_m,a->max_int_blocks,blocks_used)) return 0;
+#ifdef SPADE_COMPACT_NODES
+        if (!reallocate_ptr_array((void ***)&a->intc_m,a->max_int_blocks,blocks_used)) return 0;
+#endif
+        a->max_int_blocks= blocks_used;
+    }
+    
+    for (i= 0; i < blocks_used; i++) {
+        if (!recover_int_block(s,a,i,layout)) return 0;
+    }
+
+    count= fread(&a->int_freelist,sizeof(a->int_freelist),1,s->f);
+    ARENA_PREMATURE_END_CHECK(count,1);
+    
+    
+    count= fread(&a->leaf_block_bits,sizeof(a->leaf_block_bits),1,s->f);
+    ARENA_PREMATURE_END_CHECK(count,1);
+    ARENA_CORRUPT_FILE_CHECK(a->leaf_block_bits < 3,"stored LEAF_BLOCK_BITS is too small");
+    
+    /* use the max block size for this run unless there is more stored in the file */
+    count= fread(&blocks_used,sizeof(blocks_used),1,s->f);
+    ARENA_PREMATURE_END_CHECK(count,1);
+    if (blocks_used > a->max_leaf_blocks) {
+        if (!reallocate_ptr_array((void ***)&a->leaf_m,a->max_leaf_blocks,blocks_used)) return 0;
+        a->max_leaf_blocks= blocks_used;
+    }
+    
+    for (i= 0; i < blocks_used; i++) {
+        if (!recover_leaf_block(s,a,i,layout)) return 0;
+    }
+    
+    count= fread(&a->leaf_freelist,sizeof(a->leaf_freelist),1,s->f);
+    ARENA_PREMATURE_END_CHECK(count,1);
+    
+    if (s->fvers < FIRST_PER_TABLE_ARENA_FVERS) return 1; /* bnodes came along with per-table arenas */
+    
+    count= fread(&a->bnode_block_bits,sizeof(a->bnode_block_bits),1,s->f);
+    ARENA_PREMATURE_END_CHECK(count,1);
+    ARENA_CORRUPT_FILE_CHECK(a->bnode_block_bits < 3,"stored BNODE_BLOCK_BITS is too small");
+    
+    /* use the max block size for this run unless there is more stored in the file */
+    count= fread(&blocks_used,sizeof(blocks_used),1,s->f);
+    ARENA_PREMATURE_END_CHECK(count,1);
+    if (blocks_used > a->max_bnode_blocks) {
+        if (!reallocate_ptr_array((void ***)&a->bnode_m,a->max_bnode_blocks,blocks_used)) return 0;
+        a->max_bnode_blocks= blocks_used;
+    }
+    
+    for (i= 0; i < blocks_used; i++) {
+        a->bnode_m[i]= (bnode *)malloc(sizeof(bnode)*bits2blocksize(a->bnode_block_bits));
+        count= fread(a->bnode_m[i],sizeof(bnode),bits2blocksize(a->bnode_block_bits),s->f);
+        ARENA_PREMATURE_END_CHECK(count,bits2blocksize(a->bnode_block_bits));
+    }
+    
+    count= fread(&a->bnode_freelist,sizeof(a->bnode_freelist),1,s->f);
+    ARENA_PREMATURE_END_CHECK(count,1);
+    
+    count= fread(&a->dnode_block_bits,sizeof(a->dnode_block_bits),1,s->f);
+    ARENA_PREMATURE_END_CHECK(count,1);
+    ARENA_CORRUPT_FILE_CHECK(a->dnode_block_bits < 1,"stored DNODE_BLOCK_BITS is too small");
+    
+    /* use the max block size for this run unless there is more stored in the file */
+    count= fread(&blocks_used,sizeof(blocks_used),1,s->f);
+    ARENA_PREMATURE_END_CHECK(count,1);
+    if (blocks_used > a->max_dnode_blocks) {
+        if (!reallocate_ptr_array((void ***)&a->dnode_m,a->max_dnode_blocks,blocks_used)) return 0;
+        a->max_dnode_blocks= blocks_used;
+    }
+    
+    for (i= 0; i < blocks_used; i++) {
+        a->dnode_m[i]= (dnode *)malloc(sizeof(dnode)*bits2blocksize(a->dnode_block_bits));
+        count= fread(a->dnode_m[i],sizeof(dnode),bits2blocksize(a->dnode_block_bits),s->f);
+        ARENA_PREMATURE_END_CHECK(count,bits2blocksize(a->dnode_block_bits));
+    }
+    
+    count= fread(&a->dnode_freelist,sizeof(a->dnode_freelist),1,s->f);
+    ARENA_PREMATURE_END_CHECK(count,1);
+    
+    count= fread(&a->decay,sizeof(a->decay),1,s->f);
+    ARENA_PREMATURE_END_CHECK(count,1);
+    ARENA_CORRUPT_FILE_CHECK(a->decay <= 0.0 || a->decay > 1.0,"stored decay is not in (0,1]");
+    a->incr= 1/a->decay;
+#ifdef SPADE_COMPACT_NODES
+    if (layout != NATIVE_NODE_LAYOUT) apply_translated_decay(a);
+#endif
+    
+    spade_mem_arena_count_used(a);
+    return 1;
+}
+
+#ifdef SPADE_COMPACT_NODES
+/* read into *decay the decay stored after the blocks of a format version 6
+   arena, whose blocks (in the given layout) start where the file is; the
+   file is left where it was.  Returns 0 on failure */
+static int peek_unpaged_decay(statefile_ref *s,u8 layout,double *decay) {
+    size_t node_bytes[5];
+    unsigned char bits;
+    unsigned int blocks_used;
+    long start= ftell(s->f);
+    int k,count;
+
+    ARENA_CORRUPT_FILE_CHECK(start < 0,"cannot tell the position in it");
+    node_bytes[0]= sizeof(treeroot);
+    node_bytes[1]= (layout == NATIVE_NODE_LAYOUT) ? INTNODE_BYTES : FOREIGN_INTNODE_BYTES;
+    node_bytes[2]= (layout == NATIVE_NODE_LAYOUT) ? sizeof(leafnode) : FOREIGN_LEAFNODE_BYTES;
+    node_bytes[3]= sizeof(bnode);
+    node_bytes[4]= sizeof(dnode);
+    /* each kind of node has its block bits, number of blocks, blocks and free list */
+    for (k= 0; k < 5; k++) {
+        count= fread(&bits,sizeof(bits),1,s->f);
+        if (count == 1) count= fread(&blocks_used,sizeof(blocks_used),1,s->f);
+        ARENA_PREMATURE_END_CHECK(count,1);
+        ARENA_CORRUPT_FILE_CHECK(bits > 24,"stored block bits are too large");
+        ARENA_CORRUPT_FILE_CHECK(fseek(s->f,(long)(blocks_used*node_bytes[k]*bits2blocksize(bits)+sizeof(mindex)),SEEK_CUR) != 0,"cannot seek past the blocks");
+    }
+    count= fread(decay,sizeof(*decay),1,s->f);
+    ARENA_PREMATURE_END_CHECK(count,1);
+    ARENA_CORRUPT_FILE_CHECK(*decay <= 0.0 || *decay > 1.0,"stored decay is not in (0,1]");
+    ARENA_CORRUPT_FILE_CHECK(fseek(s->f,start,SEEK_SET) != 0,"cannot seek back to the blocks");
+    return 1;
+}
+
+/* finish recovering an arena whose leaves and intnodes were translated from
+   the full layout, which were scaled by the decay as they were (the stored
+   counts of a full layout table can be far beyond the range of a float);
+   apply it to the sums on the other nodes too, so that none is pending.
+   The clogc of the trees is then out of date, so is left to be worked out
+   again */
+static void apply_translated_decay(spade_mem_arena *a) {
+    unsigned int b,j;
+    for (b= 0; b < a->max_bnode_blocks && a->bnode_m[b] != NULL; b++) {
+        for (j= 0; j < (unsigned int)bits2blocksize(a->bnode_block_bits); j++) a->bnode_m[b][j].sum*= a->decay;
+    }
+    for (b= 0; b < a->max_dnode_blocks && a->dnode_m[b] != NULL; b++) {
+        for (j= 0; j < (unsigned int)bits2blocksize(a->dnode_block_bits); j++) a->dnode_m[b][j].sum*= a->decay;
+    }
+    a->decay= a->incr= 1.0;
+    a->keep_clogc= 0;
+}
+#endif
+
+#define PAGED_HEADER_READ(var) \
+    count= fread(&(var),sizeof(var),1,s->f); \
+    ARENA_PREMATURE_END_CHECK(count,1);
+
+/* read the block bits of a kind of node into field; an arena being brought up to date by a delta checkpoint must keep its block sizes */
+#define BLOCK_BITS_READ(field,firstblock) \
+    PAGED_HEADER_READ(bits); \
+    ARENA_CORRUPT_FILE_CHECK((firstblock) != NULL && bits != (field),"block size differs from the checkpoint before it"); \
+    (field)= bits;
+
+/* make room for blocks_used blocks in the block pointer array at arrptr, which has room for *max now; returns 0 on failure */
+#define ENSURE_BLOCK_ROOM(arrptr,max,blocks_used) \
+    if ((blocks_used) > (max)) { \
+        if (!reallocate_ptr_array((void ***)&(arrptr),(max),(blocks_used))) return 0; \
+        (max)= (blocks_used); \
+    }
+
+/* read the rest of the state of a node arena stored in the format version
+   7 layout (after its layout, keep_clogc, block alignment, id, and block
+   encoding) into the
+   given, freshly created, arena; the blocks are mapped copy-on-write from the
+   file where possible, so that they are only read in as they are used, and
+   are read in otherwise.  For a delta checkpoint, the arena is instead the one
+   being brought up to date, and the blocks in the file are read into it in
+   place.  Returns 0 on failure */
+static int recover_paged_mem_arena(statefile_ref *s,spade_mem_arena *a,u8 layout,u32 align) {
+    unsigned int i;
+    int count;
+    u8 bits;
+    u32 root_blocks,int_blocks,leaf_blocks,bnode_blocks,dnode_blocks;
+    unsigned long root_bytes,int_bytes,leaf_bytes,bnode_bytes,dnode_bytes,off;
+    double mem_used;
+    long start;
+    struct stat st;
+
+    ARENA_CORRUPT_FILE_CHECK(align == 0,"stored block alignment is 0");
+    BLOCK_BITS_READ(a->root_block_bits,a->root_m[0]);
+    PAGED_HEADER_READ(root_blocks);
+    PAGED_HEADER_READ(a->root_freelist);
+    ARENA_CORRUPT_FILE_CHECK(a->root_block_bits < 3,"stored ROOT_BLOCK_BITS is too small");
+    BLOCK_BITS_READ(a->int_block_bits,a->int_m[0]);
+    PAGED_HEADER_READ(int_blocks);
+    PAGED_HEADER_READ(a->int_freelist);
+    ARENA_CORRUPT_FILE_CHECK(a->int_block_bits < 3,"stored INT_BLOCK_BITS is too small");
+    BLOCK_BITS_READ(a->leaf_block_bits,a->leaf_m[0]);
+    PAGED_HEADER_READ(leaf_blocks);
+    PAGED_HEADER_READ(a->leaf_freelist);
+    ARENA_CORRUPT_FILE_CHECK(a->leaf_block_bits < 3,"stored LEAF_BLOCK_BITS is too small");
+    BLOCK_BITS_READ(a->bnode_block_bits,a->bnode_m[0]);
+    PAGED_HEADER_READ(bnode_blocks);
+    PAGED_HEADER_READ(a->bnode_freelist);
+    ARENA_CORRUPT_FILE_CHECK(a->bnode_block_bits < 3,"stored BNODE_BLOCK_BITS is too small");
+    BLOCK_BITS_READ(a->dnode_block_bits,a->dnode_m[0]);
+    PAGED_HEADER_READ(dnode_blocks);
+    PAGED_HEADER_READ(a->dnode_freelist);
+    ARENA_CORRUPT_FILE_CHECK(a->dnode_block_bits < 1,"stored DNODE_BLOCK_BITS is too small");
+    PAGED_HEADER_READ(a->decay);
+    ARENA_CORRUPT_FILE_CHECK(a->decay <= 0.0 || a->decay > 1.0,"stored decay is not in (0,1]");
+    a->incr= 1/a->decay;
+    PAGED_HEADER_READ(mem_used);
+    a->mem_used= (unsigned long)mem_used;
+
+    /* use the max number of blocks for this run unless there is more stored in the file */
+    ENSURE_BLOCK_ROOM(a->root_m,a->max_root_blocks,root_blocks);
+#ifdef SPADE_COMPACT_NODES
+    if (int_blocks > a->max_int_blocks) {
+        if (!reallocate_ptr_array((void ***)&a->intc_m,a->max_int_blocks,int_blocks)) return 0;
+    }
+#endif
+    ENSURE_BLOCK_ROOM(a->int_m,a->max_int_blocks,int_blocks);
+    ENSURE_BLOCK_ROOM(a->leaf_m,a->max_leaf_blocks,leaf_blocks);
+    ENSURE_BLOCK_ROOM(a->bnode_m,a->max_bnode_blocks,bnode_blocks);
+    ENSURE_BLOCK_ROOM(a->dnode_m,a->max_dnode_blocks,dnode_blocks);
+
+    if (s->prev_stamp != 0) { /* a delta checkpoint; patch in the blocks that changed */
+        ARENA_CORRUPT_FILE_CHECK(layout != NATIVE_NODE_LAYOUT,"it is a delta checkpoint with the other node layout");
+        return patch_blocks(s,(void **)a->root_m,sizeof(treeroot),NULL,0,root_blocks,bits2blocksize(a->root_block_bits),align)
+#ifdef SPADE_COMPACT_NODES
+            && patch_blocks(s,(void **)a->int_m,sizeof(intnode),(void **)a->intc_m,sizeof(intnode_cold),int_blocks,bits2blocksize(a->int_block_bits),align)
+#else
+            && patch_blocks(s,(void **)a->int_m,sizeof(intnode),NULL,0,int_blocks,bits2blocksize(a->int_block_bits),align)
+#endif
+            && patch_blocks(s,(void **)a->leaf_m,sizeof(leafnode),NULL,0,leaf_blocks,bits2blocksize(a->leaf_block_bits),align)
+            && patch_blocks(s,(void **)a->bnode_m,sizeof(bnode),NULL,0,bnode_blocks,bits2blocksize(a->bnode_block_bits),align)
+            && patch_blocks(s,(void **)a->dnode_m,sizeof(dnode),NULL,0,dnode_blocks,bits2blocksize(a->dnode_block_bits),align);
+    }
+    
+    if (s->encoding != SPADE_STATE_ENC_RAW) { /* the blocks are encoded frames one after the other, so must be read in turn */
+        for (i= 0; i < root_blocks; i++) {
+            if (!recover_paged_block(s,-1,(void **)&a->root_m[i],sizeof(treeroot),bits2blocksize(a->root_block_bits))) return 0;
+        }
+        for (i= 0; i < int_blocks; i++) {
+            if (!recover_int_block(s,a,i,layout)) return 0;
+        }
+        for (i= 0; i < leaf_blocks; i++) {
+            if (!recover_leaf_block(s,a,i,layout)) return 0;
+        }
+        for (i= 0; i < bnode_blocks; i++) {
+            if (!recover_paged_block(s,-1,(void **)&a->bnode_m[i],sizeof(bnode),bits2blocksize(a->bnode_block_bits))) return 0;
+        }
+        for (i= 0; i < dnode_blocks; i++) {
+            if (!recover_paged_block(s,-1,(void **)&a->dnode_m[i],sizeof(dnode),bits2blocksize(a->dnode_block_bits))) return 0;
+        }
+        return 1;
+    }
+
+    /* the file space each block takes */
+    root_bytes= ALIGN_UP(sizeof(treeroot)*bits2blocksize(a->root_block_bits),align);
+    int_bytes= ALIGN_UP((layout == NATIVE_NODE_LAYOUT ? INTNODE_BYTES : FOREIGN_INTNODE_BYTES)*bits2blocksize(a->int_block_bits),align);
+    leaf_bytes= ALIGN_UP((layout == NATIVE_NODE_LAYOUT ? sizeof(leafnode) : FOREIGN_LEAFNODE_BYTES)*bits2blocksize(a->leaf_block_bits),align);
+    bnode_bytes= ALIGN_UP(sizeof(bnode)*bits2blocksize(a->bnode_block_bits),align);
+    dnode_bytes= ALIGN_UP(sizeof(dnode)*bits2blocksize(a->dnode_block_bits),align);
+
+    start= ftell(s->f);
+    ARENA_CORRUPT_FILE_CHECK(start < 0,"cannot tell the position in it");
+    start= ALIGN_UP(start,align);
+    a->map_len= root_blocks*root_bytes + int_blocks*int_bytes + leaf_blocks*leaf_bytes + bnode_blocks*bnode_bytes + dnode_blocks*dnode_bytes;
+    /* a mapping past the end of the file would only fail once used, so check now */
+    ARENA_CORRUPT_FILE_CHECK(fstat(fileno(s->f),&st) != 0,"cannot get its size");
+    ARENA_PREMATURE_END_CHECK((unsigned long)st.st_size,start+a->map_len);
+#ifndef SPADE_NO_MMAP
+    if (layout == NATIVE_NODE_LAYOUT && a->map_len > 0 && align % sysconf(_SC_PAGESIZE) == 0) {
+        void *base= mmap(NULL,a->map_len,PROT_READ|PROT_WRITE,MAP_PRIVATE,fileno(s->f),start);
+        if (base != MAP_FAILED) {
+            a->map_base= (char *)base;
+#ifdef MADV_WILLNEED
+            madvise(base,a->map_len,MADV_WILLNEED); /* start reading it in */
+#endif
+        }
+    }
+#endif
+    
+    off= start;
+    for (i= 0; i < root_blocks; i++,off+= root_bytes) {
+        if (a->map_base != NULL) {
+            a->root_m[i]= (treeroot *)(a->map_base+(off-start));
+        } else if (!recover_paged_block(s,off,(void **)&a->root_m[i],sizeof(treeroot),bits2blocksize(a->root_block_bits))) {
+            return 0;
+        }
+    }
+    for (i= 0; i < int_blocks; i++,off+= int_bytes) {
+        if (a->map_base != NULL) {
+            a->int_m[i]= (intnode *)(a->map_base+(off-start));
+#ifdef SPADE_COMPACT_NODES
+            a->intc_m[i]= (intnode_cold *)(a->map_base+(off-start)+sizeof(intnode)*bits2blocksize(a->int_block_bits));
+#endif
+        } else {
+            ARENA_CORRUPT_FILE_CHECK(fseek(s->f,off,SEEK_SET) != 0,"cannot seek to a block");
+            if (!recover_int_block(s,a,i,layout)) return 0;
+        }
+    }
+    for (i= 0; i < leaf_blocks; i++,off+= leaf_bytes) {
+        if (a->map_base != NULL) {
+            a->leaf_m[i]= (leafnode *)(a->map_base+(off-start));
+        } else {
+            ARENA_CORRUPT_FILE_CHECK(fseek(s->f,off,SEEK_SET) != 0,"cannot seek to a block");
+            if (!recover_leaf_block(s,a,i,layout)) return 0;
+        }
+    }
+    for (i= 0; i < bnode_blocks; i++,off+= bnode_bytes) {
+        if (a->map_base != NULL) {
+            a->bnode_m[i]= (bnode *)(a->map_base+(off-start));
+        } else if (!recover_paged_block(s,off,(void **)&a->bnode_m[i],sizeof(bnode),bits2blocksize(a->bnode_block_bits))) {
+            return 0;
+        }
+    }
+    for (i= 0; i < dnode_blocks; i++,off+= dnode_bytes) {
+        if (a->map_base != NULL) {
+            a->dnode_m[i]= (dnode *)(a->map_base+(off-start));
+        } else if (!recover_paged_block(s,off,(void **)&a->dnode_m[i],sizeof(dnode),bits2blocksize(a->dnode_block_bits))) {
+            return 0;
+        }
+    }
+    if (a->map_base == NULL) a->map_len= 0;
+
+    ARENA_CORRUPT_FILE_CHECK(fseek(s->f,off,SEEK_SET) != 0,"cannot seek past the blocks");
+    return 1;
+}
+
+/* read the blocks, of n nodes of the given size each, of one kind of node
+   in a delta checkpoint, which are those in the list before them, into place
+   in blocks, allocating any that are new; each is followed in the file by its
+   cold part (of n coldsize parts), which goes in cold, if cold is not NULL.
+   The rest of the nblocks blocks must already be there from the checkpoint
+   before.  Returns 0 on failure */
+static int patch_blocks(statefile_ref *s,void **blocks,size_t size,void **cold,size_t coldsize,u32 nblocks,size_t n,u32 align) {
+    u32 i,nlisted,*list;
+    long off= -1; /* encoded blocks are read in turn */
+    size_t count;
+    
+    count= fread(&nlisted,sizeof(nlisted),1,s->f);
+    ARENA_PREMATURE_END_CHECK(count,1);
+    ARENA_CORRUPT_FILE_CHECK(nlisted > nblocks,"it lists more changed blocks than there are");
+    list= (u32 *)malloc(sizeof(u32)*(nlisted+1));
+    if (list == NULL) return 0;
+    count= fread(list,sizeof(u32),nlisted,s->f);
+    if (count < nlisted) free(list);
+    ARENA_PREMATURE_END_CHECK(count,nlisted);
+    for (i= 0; i < nlisted && list[i] < nblocks; i++) {}
+    if (i < nlisted) free(list);
+    ARENA_CORRUPT_FILE_CHECK(i < nlisted,"a changed block is out of range");
+    if (s->encoding == SPADE_STATE_ENC_RAW) off= ALIGN_UP(ftell(s->f),align);
+    for (i= 0; i < nlisted; i++) {
+        if (!recover_paged_block(s,off,&blocks[list[i]],size,n)
+            || (cold != NULL && !recover_paged_block(s,off < 0 ? off : off+(long)(size*n),&cold[list[i]],coldsize,n))) {
+            free(list);
+            return 0;
+        }
+        if (off >= 0) off+= ALIGN_UP(size*n+coldsize*n,align);
+    }
+    free(list);
+    for (i= 0; i < nblocks; i++) {
+        ARENA_CORRUPT_FILE_CHECK(blocks[i] == NULL,"a block is in neither it nor the checkpoint before it");
+    }
+    if (off >= 0) ARENA_CORRUPT_FILE_CHECK(fseek(s->f,off,SEEK_SET) != 0,"cannot seek past the blocks");
+    return 1;
+}
+
+/* read the n nodes of the given size that make a block from off in the file
+   (or where the file is, if off is negative) into block, allocating it first
+   unless it is already there; returns 0 on failure */
+static int recover_paged_block(statefile_ref *s,long off,void **block,size_t size,size_t n) {
+    size_t count;
+    if (off >= 0) ARENA_CORRUPT_FILE_CHECK(fseek(s->f,off,SEEK_SET) != 0,"cannot seek to a block");
+    if (*block == NULL) *block= malloc(size*n);
+    if (*block == NULL) return 0;
+    count= block_fread(*block,size,n,s);
+    ARENA_PREMATURE_END_CHECK(count,n);
+    return 1;
+}
+
+/* read the encoding of the node blocks of an arena, which files before
+   version 9 do not have, into s->encoding; returns 0 on failure */
+static int read_block_encoding(statefile_ref *s) {
+    int count;
+    s->encoding= SPADE_STATE_ENC_RAW;
+    if (s->fvers < FIRST_ENCODED_FVERS) return 1;
+    count= fread(&s->encoding,sizeof(s->encoding),1,s->f);
+    ARENA_PREMATURE_END_CHECK(count,1);
+    ARENA_CORRUPT_FILE_CHECK(s->encoding > SPADE_STATE_ENC_ZLIB,"stored block encoding is not known");
+#ifndef SPADE_USE_ZLIB
+    if (s->encoding == SPADE_STATE_ENC_ZLIB) {
+        fprintf(stderr,"Spade recovery file %s is compressed with zlib, which this build of Spade is without (see SPADE_USE_ZLIB); not recovering from it\n",s->filename);
+        return 0;
+    }
+#endif
+    return 1;
+}
+
+/* read block b of the arena's intnodes, stored in the given layout, from the file; returns 0 on failure */
+static int recover_int_block(statefile_ref *s,spade_mem_arena *a,unsigned int b,u8 layout) {
+    int j,count,n= bits2blocksize(a->int_block_bits);
+    
+    a->int_m[b]= (intnode *)malloc(sizeof(intnode)*n);
+#ifdef SPADE_COMPACT_NODES
+    a->intc_m[b]= (intnode_cold *)malloc(sizeof(intnode_cold)*n);
+#endif
+    if (layout == NATIVE_NODE_LAYOUT) { /* can read the block directly */
+        count= block_fread(a->int_m[b],sizeof(intnode),n,s);
+        ARENA_PREMATURE_END_CHECK(count,n);
+#ifdef SPADE_COMPACT_NODES
+        count= block_fread(a->intc_m[b],sizeof(intnode_cold),n,s);
+        ARENA_PREMATURE_END_CHECK(count,n);
+#endif
+    } else { /* need to translate from the other layout */
+#ifdef SPADE_COMPACT_NODES
+        full_intnode *origblock= (full_intnode *)malloc(sizeof(full_intnode)*n);
+        count= block_fread(origblock,sizeof(full_intnode),n,s);
+        if (count < n) free(origblock);
+        ARENA_PREMATURE_END_CHECK(count,n);
+        for (j=0; j < n; j++) {
+            a->int_m[b][j].sortpt= origblock[j].sortpt;
+            a->int_m[b][j].left= origblock[j].left;
+            a->int_m[b][j].right= origblock[j].right;
+            a->intc_m[b][j].sum= (count_t)(origblock[j].sum*a->decay); /* see apply_translated_decay() */
+            a->intc_m[b][j].wait= origblock[j].wait;
+        }
+        free(origblock);
+#else
+        compact_intnode *origblock= (compact_intnode *)malloc(sizeof(compact_intnode)*n);
+        compact_intnode_cold *origcold= (compact_intnode_cold *)malloc(sizeof(compact_intnode_cold)*n);
+        count= block_fread(origblock,sizeof(compact_intnode),n,s);
+        if (count == n) count= block_fread(origcold,sizeof(compact_intnode_cold),n,s);
+        if (count < n) {
+            free(origblock);
+            free(origcold);
+        }
+        ARENA_PREMATURE_END_CHECK(count,n);
+        for (j=0; j < n; j++) {
+            a->int_m[b][j].sortpt= origblock[j].sortpt;
+            a->int_m[b][j].left= origblock[j].left;
+            a->int_m[b][j].right= origblock[j].right;
+            a->int_m[b][j].sum= origcold[j].sum;
+            a->int_m[b][j].wait= origcold[j].wait;
+        }
+        free(origblock);
+        free(origcold);
+#endif
+    }
+    return 1;
+}
+
+/* read block b of the arena's leafnodes, stored in the given layout, from the file; returns 0 on failure */
+static int recover_leaf_block(statefile_ref *s,spade_mem_arena *a,unsigned int b,u8 layout) {
+    int j,count,n= bits2blocksize(a->leaf_block_bits);
+    
+    a->leaf_m[b]= (leafnode *)malloc(sizeof(leafnode)*n);
+    if (layout == NATIVE_NODE_LAYOUT) { /* can read the block directly */
+        count= block_fread(a->leaf_m[b],sizeof(leafnode),n,s);
+        ARENA_PREMATURE_END_CHECK(count,n);
+    } else { /* need to translate from the other layout */
+#ifdef SPADE_COMPACT_NODES
+        full_leafnode *origblock= (full_leafnode *)malloc(sizeof(full_leafnode)*n);
+        count= block_fread(origblock,sizeof(full_leafnode),n,s);
+#else
+        compact_leafnode *origblock= (compact_leafnode *)malloc(sizeof(compact_leafnode)*n);
+        count= block_fread(origblock,sizeof(compact_leafnode),n,s);
+#endif
+        if (count < n) free(origblock);
+        ARENA_PREMATURE_END_CHECK(count,n);
+        for (j=0; j < n; j++) {
+#ifdef SPADE_COMPACT_NODES
+            a->leaf_m[b][j].count= (count_t)(origblock[j].count*a->decay); /* see apply_translated_decay() */
+#else
+            a->leaf_m[b][j].count= (count_t)origblock[j].count;
+#endif
+            a->leaf_m[b][j].value= origblock[j].value;
+            a->leaf_m[b][j].nexttree= origblock[j].nexttree;
+        }
+        free(origblock);
+    }
+    return 1;
+}
+
+/* read an arena of a delta checkpoint; this brings the arena among
+   s->prior_arenas with the same id up to date and takes it over, or if there
+   is none, is an arena created since the checkpoint before, which is wholly
+   in the file.  The arena is returned in *ap, even on failure (returning 0) */
+static int recover_delta_mem_arena(statefile_ref *s,spade_mem_arena **ap) {
+    spade_mem_arena *a= NULL;
+    u8 layout,keep_clogc;
+    u32 align,id;
+    int i,count;
+    
+    PAGED_HEADER_READ(layout);
+    PAGED_HEADER_READ(keep_clogc);
+    PAGED_HEADER_READ(align);
+    PAGED_HEADER_READ(id);
+    if (!read_block_encoding(s)) return 0;
+    for (i= 0; i < s->num_prior_arenas && a == NULL; i++) {
+        if (s->prior_arenas[i] != NULL && s->prior_arenas[i]->id == id) {
+            a= s->prior_arenas[i];
+            s->prior_arenas[i]= NULL;
+        }
+    }
+    if (a == NULL) {
+        a= new_spade_mem_arena();
+        if (a == NULL) return 0;
+        spade_mem_arena_set_id(a,id);
+    }
+    *ap= a;
+    a->keep_clogc= keep_clogc;
+    return recover_paged_mem_arena(s,a,layout,align);
+}
+
+spade_mem_arena *spade_state_recover_mem_arena(statefile_ref *s) {
+    spade_mem_arena *a= NULL;
+    int ok;
+    if (s->prev_stamp != 0) {
+        ok= recover_delta_mem_arena(s,&a);
+    } else {
+        a= new_spade_mem_arena();
+        if (a == NULL) return NULL;
+        ok= recover_mem_arena(s,a);
+    }
+    if (!ok) {
+        free_spade_mem_arena(a);
+        return NULL;
+    }
+    spade_mem_arena_clear_dirty(a); /* it is as in the file now */
+    return a;
+}
+
 statefile_ref *spade_state_begin_recovery(char *filename,int min_app_fvers,char **appname,u8 *file_app_fvers) {
     statefile_ref *s= (statefile_ref *)malloc(sizeof(statefile_ref));
     unsigned char uc,fvers;
     char v;
-    unsigned int i,blocks_used;
     int count;
     u8 numfeat;
     double d;
     u32 l;
     
-    init_mem();
-    
     if (s == NULL) return NULL;
     
     errno=0;
@@ -264,94 +1296,38 @@ statefile_ref *spade_state_begin_recovery(char *filename,int min_app_fvers,char
         return NULL;
     }
 
-    count= fread(&ROOT_BLOCK_BITS,sizeof(ROOT_BLOCK_BITS),1,s->f);
-    PREMATURE_END_CHECK(count,1);
-    CORRUPT_FILE_CHECK(ROOT_BLOCK_BITS < 3,"stored ROOT_BLOCK_BITS is too small");
-    
-    /* use the max block size for this run unless there is more stored in the file */
-    count= fread(&blocks_used,sizeof(blocks_used),1,s->f);
-    PREMATURE_END_CHECK(count,1);
-    if (blocks_used > DEFAULT_MAX_ROOT_BLOCKS) {
-        reallocate_ptr_array((void ***)&ROOT_M,DEFAULT_MAX_ROOT_BLOCKS,blocks_used);
-        MAX_ROOT_BLOCKS= blocks_used;
-    }
-    
-    if (fvers >= 5) { // can read block of treeroots directly
-        for (i= 0; i < blocks_used; i++) {
-            ROOT_M[i]= (treeroot *)malloc(sizeof(treeroot)*ROOT_BLOCK_SIZE);
-            count= fread(ROOT_M[i],sizeof(treeroot),ROOT_BLOCK_SIZE,s->f);
-            PREMATURE_END_CHECK(count,ROOT_BLOCK_SIZE);
-        }
-    } else { // need to translate treeroot struct from treeroot_orig to treeroot
-        int j;
-        upto_v4_treeroot *origblock= (upto_v4_treeroot *)malloc(sizeof(upto_v4_treeroot)*ROOT_BLOCK_SIZE);
-        for (i= 0; i < blocks_used; i++) {
-            ROOT_M[i]= (treeroot *)malloc(sizeof(treeroot)*ROOT_BLOCK_SIZE);
-            count= fread(origblock,sizeof(upto_v4_treeroot),ROOT_BLOCK_SIZE,s->f);
-            PREMATURE_END_CHECK(count,ROOT_BLOCK_SIZE);
-            for (j=0; j < ROOT_BLOCK_SIZE; j++) {
-                // look at original structure and initialize new from it
-                ROOT_M[i][j].next= origblock[j].next;
-                ROOT_M[i][j].root= origblock[j].root;
-                ROOT_M[i][j].type= origblock[j].type;
-                ROOT_M[i][j].entropy= -1;
-            }
-        }
-        free(origblock);
-    }
-
-    count= fread(&root_freelist,sizeof(root_freelist),1,s->f);
-    PREMATURE_END_CHECK(count,1);
-    
-    
-    count= fread(&INT_BLOCK_BITS,sizeof(INT_BLOCK_BITS),1,s->f);
-    PREMATURE_END_CHECK(count,1);
-    CORRUPT_FILE_CHECK(INT_BLOCK_BITS < 3,"stored INT_BLOCK_BITS is too small");
-    
-    /* use the max block size for this run unless there is more stored in the file */
-    count= fread(&blocks_used,sizeof(blocks_used),1,s->f);
-    PREMATURE_END_CHECK(count,1);
-    if (blocks_used > DEFAULT_MAX_INT_BLOCKS) {
-        reallocate_ptr_array((void ***)&INT_M,DEFAULT_MAX_INT_BLOCKS,blocks_used);
-        MAX_INT_BLOCKS= blocks_used;
-    }
-    
-    for (i= 0; i < blocks_used; i++) {
-        INT_M[i]= (intnode *)malloc(sizeof(intnode)*INT_BLOCK_SIZE);
-        count= fread(INT_M[i],sizeof(intnode),INT_BLOCK_SIZE,s->f);
-        PREMATURE_END_CHECK(count,INT_BLOCK_SIZE);
+    s->stamp= s->prev_stamp= 0;
+    if (fvers >= FIRST_STAMPED_FVERS) {
+        count= fread(&s->stamp,sizeof(s->stamp),1,s->f);
+        if (count == 1) count= fread(&s->prev_stamp,sizeof(s->prev_stamp),1,s->f);
+        PREMATURE_END_CHECK(count,1);
     }
 
-    count= fread(&int_freelist,sizeof(int_freelist),1,s->f);
-    PREMATURE_END_CHECK(count,1);
-    
-    
-    count= fread(&LEAF_BLOCK_BITS,sizeof(LEAF_BLOCK_BITS),1,s->f);
-    PREMATURE_END_CHECK(count,1);
-    CORRUPT_FILE_CHECK(LEAF_BLOCK_BITS < 3,"stored LEAF_BLOCK_BITS is too small");
-    
-    /* use the max block size for this run unless there is more stored in the file */
-    count= fread(&blocks_used,sizeof(blocks_used),1,s->f);
-    PREMATURE_END_CHECK(count,1);
-    if (blocks_used > DEFAULT_MAX_LEAF_BLOCKS) {
-        reallocate_ptr_array((void ***)LEAF_M,DEFAULT_MAX_LEAF_BLOCKS,blocks_used);
-        MAX_LEAF_BLOCKS= blocks_used;
-    }
-    
-    for (i= 0; i < blocks_used; i++) {
-        LEAF_M[i]= (leafnode *)malloc(sizeof(leafnode)*LEAF_BLOCK_SIZE);
-        count= fread(LEAF_M[i],sizeof(leafnode),LEAF_BLOCK_SIZE,s->f);
-        PREMATURE_END_CHECK(count,LEAF_BLOCK_SIZE);
+    s->fvers= fvers;
+    s->filename= strdup(filename);
+    s->tmpname= NULL;
+    s->legacy_arena= NULL;
+    s->prior_arenas= NULL;
+    s->num_prior_arenas= 0;
+    s->encoding= SPADE_STATE_ENC_RAW;
+    s->codebuf= NULL;
+    s->codebuf_size= 0;
+    if (fvers < FIRST_PER_TABLE_ARENA_FVERS) { /* all tables share the arena stored here */
+        s->legacy_arena= new_spade_mem_arena();
+        if (s->legacy_arena == NULL || !recover_mem_arena(s,s->legacy_arena)) {
+            fclose(s->f);
+            return NULL;
+        }
     }
     
-    count= fread(&leaf_freelist,sizeof(leaf_freelist),1,s->f);
-    PREMATURE_END_CHECK(count,1);
-    
     return s;
 }
 
 int spade_state_end_recovery(statefile_ref *s) {
     fclose(s->f);
+    if (s->legacy_arena != NULL) free_spade_mem_arena(s->legacy_arena);
+    free(s->filename);
+    free(s->codebuf);
     free(s);
     return 1;
 }
@@ -23,17 +23,45 @@ warranty is expressed for this program.
     @{
 */
 
+#include "spade_prob_table_types.h"
+
 #include <stdio.h>
 #include <time.h>
 
+/* the encodings the node blocks of an arena can be stored in */
+#define SPADE_STATE_ENC_RAW    0 ///< as they are in memory, each starting on a page boundary so it can be mapped
+#define SPADE_STATE_ENC_PACKED 1 ///< packed by the built-in codec, which stores the difference of each word from the same word of the node before
+#define SPADE_STATE_ENC_ZLIB   2 ///< compressed with zlib; only recoverable by a build with SPADE_USE_ZLIB
+/// the encoding used when compressed checkpoints are wanted
+#ifdef SPADE_USE_ZLIB
+#define SPADE_STATE_ENC_COMPRESSED SPADE_STATE_ENC_ZLIB
+#else
+#define SPADE_STATE_ENC_COMPRESSED SPADE_STATE_ENC_PACKED
+#endif
+
 /// a handle for ths user on a currently active state recovery file
 typedef struct {
     FILE *f; ///< the file pointer
+    u8 fvers; ///< the format version of the file
+    char *filename; ///< the name of the file; when checkpointing, only set if the file is being written under a temporary name
+    char *tmpname; ///< when checkpointing, the temporary name the file is written under and which is renamed to filename at the end; NULL if writing to filename directly
+    spade_mem_arena *legacy_arena; ///< when recovering from a file that predates per-table arenas, the single arena it contains; NULL otherwise
+    u32 stamp; ///< identifies the checkpoint in the file; 0 if the file predates these
+    u32 prev_stamp; ///< for a delta checkpoint, which has only what changed since the checkpoint before it, the stamp of that checkpoint; 0 otherwise
+    spade_mem_arena **prior_arenas; ///< when recovering a delta checkpoint, the arenas it brings up to date; each is set to NULL as it is taken over
+    int num_prior_arenas; ///< the number of entries in prior_arenas
+    u8 encoding; ///< the encoding (SPADE_STATE_ENC_*) of the node blocks of the arena being written or read
+    unsigned char *codebuf; ///< a buffer for encoded node blocks; NULL if there has been no need for one
+    unsigned long codebuf_size; ///< the size of codebuf
 } statefile_ref;
 
 
 statefile_ref *spade_state_begin_checkpointing(char *filename, char *appname, u8 app_cur_fvers);
+statefile_ref *spade_state_begin_stamped_checkpointing(char *filename, char *appname, u8 app_cur_fvers, u32 stamp, u32 prev_stamp);
+u32 spade_state_new_stamp(void);
+void spade_state_set_encoding(statefile_ref *s, u8 encoding);
 int spade_state_end_checkpointing(statefile_ref *s);
+void spade_state_abort_checkpointing(statefile_ref *s);
 int spade_state_checkpoint_str(statefile_ref *s, char *str);
 int spade_state_checkpoint_arr(statefile_ref *s, void *arr, int len, int elsize);
 int spade_state_checkpoint_str_arr(statefile_ref *s, char **arr, int len);
@@ -42,6 +70,7 @@ int spade_state_checkpoint_u8(statefile_ref *s, u8 val);
 int spade_state_checkpoint_time_t(statefile_ref *s, time_t val);
 int spade_state_checkpoint_double(statefile_ref *s,double val);
 int spade_state_end_section(statefile_ref *s);
+int spade_state_checkpoint_mem_arena(statefile_ref *s, spade_mem_arena *a);
 
 statefile_ref *spade_state_begin_recovery(char *filename, int min_app_fvers, char **appname, u8 *file_app_fvers);
 int spade_state_end_recovery(statefile_ref *s);
@@ -54,6 +83,7 @@ int spade_state_recover_time_t(statefile_ref *s, time_t *val);
 int spade_state_recover_double(statefile_ref *s, double *val);
 int spade_state_recover_str(statefile_ref *s, char **str);
 int spade_state_recover_str_to_buff(statefile_ref *s, char *buff, int maxlen);
+spade_mem_arena *spade_state_recover_mem_arena(statefile_ref *s);
 
 #endif // SPADE_STATE_H
 